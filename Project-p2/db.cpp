@@ -5,34 +5,316 @@
 #include "db.h"
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <sys/types.h>
+#include <time.h>
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 #if defined(_WIN32) || defined(_WIN64)
 #define strcasecmp _stricmp
 #endif
 
-/* Globals to store output column ordering/widths for JOIN printing */
-static int join_out_count = 0;
-static int join_out_widths[MAX_NUM_COL * 2];
-static int join_out_types[MAX_NUM_COL * 2];
-static char join_out_names[MAX_NUM_COL * 2][MAX_IDENT_LEN + 8];
+/* Row cap per table (the project limit is MAX_ROWS); db_bench raises it */
+static int g_max_rows = MAX_ROWS;
+
+/* Echo the token list of each statement (the command line does) */
+static bool g_trace_tokens = true;
+
+/* SELECT result format, and where results go (NULL means stdout) */
+static int g_output_mode = OUT_TABLE;
+static FILE *g_result_fp = NULL;
+
+/* Globals for EXPLAIN / EXPLAIN ANALYZE, set up by do_semantic() */
+static int g_explain = EXPLAIN_OFF;
+static plan_node g_plan[MAX_PLAN_NODES];
+static int g_plan_count = 0;
+
+static long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Add an operator to the plan being explained.  Returns the node index,
+   or -1 when no EXPLAIN is active so callers can pass it around freely. */
+static int plan_add(const char *op_name, int depth, const char *fmt, ...) {
+  if (g_explain == EXPLAIN_OFF || g_plan_count >= MAX_PLAN_NODES)
+    return -1;
+
+  plan_node *node = &g_plan[g_plan_count];
+  memset(node, 0, sizeof(*node));
+  strncpy(node->op_name, op_name, sizeof(node->op_name) - 1);
+  node->depth = depth;
+  node->last_page = -1;
+
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(node->detail, sizeof(node->detail), fmt, args);
+  va_end(args);
+  return g_plan_count++;
+}
+
+/* Append to a plan detail string, stopping quietly once it is full */
+static void detail_append(char *detail, int size, int *used, const char *fmt, ...) {
+  if (*used >= size - 1)
+    return;
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(detail + *used, size - *used, fmt, args);
+  va_end(args);
+  if (n > 0)
+    *used = (*used + n < size) ? *used + n : size - 1;
+}
+
+/* Start of a timed section; 0 when not analyzing */
+static inline long long plan_clock() {
+  return (g_explain == EXPLAIN_ANALYZE) ? now_ns() : 0;
+}
+
+/* Charge the time since *mark to a node and restart the mark */
+static inline void plan_charge(int node, long long *mark) {
+  if (node < 0 || g_explain != EXPLAIN_ANALYZE)
+    return;
+  long long now = now_ns();
+  g_plan[node].time_ns += now - *mark;
+  *mark = now;
+}
+
+static inline void plan_rows(int node, long long rows_in, long long rows_out) {
+  if (node < 0)
+    return;
+  g_plan[node].rows_in += rows_in;
+  g_plan[node].rows_out += rows_out;
+}
+
+/* Hot-path counters for SHOW STATS.  Every thread bumps its own block
+   (no locking on the hot path); the blocks stay on g_stats_list for the
+   life of the process so readers can add them all up. */
+static __thread db_stats *t_stats = NULL;
+static db_stats *g_stats_list = NULL;
+static pthread_mutex_t g_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static db_stats *my_stats() {
+  if (t_stats == NULL) {
+    t_stats = (db_stats *)calloc(1, sizeof(db_stats));
+    pthread_mutex_lock(&g_stats_lock);
+    t_stats->next = g_stats_list;
+    g_stats_list = t_stats;
+    pthread_mutex_unlock(&g_stats_lock);
+  }
+  return t_stats;
+}
+
+#define STAT_ADD(field, n) (my_stats()->field += (n))
+
+/* Sum of the counters of all threads */
+static void db_stats_total(db_stats *total) {
+  memset(total, 0, sizeof(*total));
+  pthread_mutex_lock(&g_stats_lock);
+  for (db_stats *s = g_stats_list; s != NULL; s = s->next) {
+    total->rows_scanned += s->rows_scanned;
+    total->rows_returned += s->rows_returned;
+    total->records_written += s->records_written;
+    total->fseek_calls += s->fseek_calls;
+    total->fread_calls += s->fread_calls;
+    total->fwrite_calls += s->fwrite_calls;
+    total->bytes_read += s->bytes_read;
+    total->bytes_written += s->bytes_written;
+    total->header_writes += s->header_writes;
+    total->catalog_rewrites += s->catalog_rewrites;
+    total->allocations += s->allocations;
+    total->aio_reads += s->aio_reads;
+    total->aio_writes += s->aio_writes;
+    total->aio_waits += s->aio_waits;
+    total->direct_ios += s->direct_ios;
+    total->qcache_hits += s->qcache_hits;
+    total->qcache_misses += s->qcache_misses;
+    total->qcache_evictions += s->qcache_evictions;
+    total->bloom_probes += s->bloom_probes;
+    total->bloom_passed += s->bloom_passed;
+    total->join_blocks += s->join_blocks;
+    total->join_inner_rows += s->join_inner_rows;
+    total->join_partitions += s->join_partitions;
+    total->sort_runs += s->sort_runs;
+    total->dml_ranges += s->dml_ranges;
+    total->tasks_run += s->tasks_run;
+    total->tasks_stolen += s->tasks_stolen;
+    total->morsels += s->morsels;
+    total->join_switches += s->join_switches;
+    total->join_swaps += s->join_swaps;
+    for (int i = 0; i < NUM_STATEMENT_TYPES; i++) {
+      total->stmt_count[i] += s->stmt_count[i];
+      total->stmt_time_ns[i] += s->stmt_time_ns[i];
+    }
+  }
+  pthread_mutex_unlock(&g_stats_lock);
+}
+
+/* Print the summed counters as a two column report */
+static void print_stats(FILE *out) {
+  static const char *stmt_names[NUM_STATEMENT_TYPES] = {
+      "create_table", "drop_table", "list_table", "list_schema", "insert",
+      "delete",       "update",     "select",     "select_star", "show_stats",
+      "create_view",  "refresh_view"};
+  db_stats total;
+  db_stats_total(&total);
+
+  fprintf(out, "%-28s %15s\n", "Statistic", "Value");
+  fprintf(out, "---------------------------- ---------------\n");
+  fprintf(out, "%-28s %15lld\n", "rows_scanned", total.rows_scanned);
+  fprintf(out, "%-28s %15lld\n", "rows_returned", total.rows_returned);
+  fprintf(out, "%-28s %15lld\n", "records_written", total.records_written);
+  fprintf(out, "%-28s %15lld\n", "fseek_calls", total.fseek_calls);
+  fprintf(out, "%-28s %15lld\n", "fread_calls", total.fread_calls);
+  fprintf(out, "%-28s %15lld\n", "fwrite_calls", total.fwrite_calls);
+  fprintf(out, "%-28s %15lld\n", "bytes_read", total.bytes_read);
+  fprintf(out, "%-28s %15lld\n", "bytes_written", total.bytes_written);
+  fprintf(out, "%-28s %15lld\n", "header_writes", total.header_writes);
+  fprintf(out, "%-28s %15lld\n", "catalog_rewrites", total.catalog_rewrites);
+  fprintf(out, "%-28s %15lld\n", "allocations", total.allocations);
+  fprintf(out, "%-28s %15lld\n", "aio_reads", total.aio_reads);
+  fprintf(out, "%-28s %15lld\n", "aio_writes", total.aio_writes);
+  fprintf(out, "%-28s %15lld\n", "aio_waits", total.aio_waits);
+  fprintf(out, "%-28s %15lld\n", "direct_ios", total.direct_ios);
+  fprintf(out, "%-28s %15lld\n", "qcache_hits", total.qcache_hits);
+  fprintf(out, "%-28s %15lld\n", "qcache_misses", total.qcache_misses);
+  fprintf(out, "%-28s %15lld\n", "qcache_evictions", total.qcache_evictions);
+  fprintf(out, "%-28s %15lld\n", "bloom_probes", total.bloom_probes);
+  fprintf(out, "%-28s %15lld\n", "bloom_passed", total.bloom_passed);
+  if (total.bloom_probes > 0)
+    fprintf(out, "%-28s %15lld\n", "bloom_pass_pct",
+            total.bloom_passed * 100 / total.bloom_probes);
+  fprintf(out, "%-28s %15lld\n", "join_blocks", total.join_blocks);
+  fprintf(out, "%-28s %15lld\n", "join_inner_rows", total.join_inner_rows);
+  fprintf(out, "%-28s %15lld\n", "join_partitions", total.join_partitions);
+  fprintf(out, "%-28s %15lld\n", "sort_runs", total.sort_runs);
+  fprintf(out, "%-28s %15lld\n", "dml_ranges", total.dml_ranges);
+  fprintf(out, "%-28s %15lld\n", "tasks_run", total.tasks_run);
+  fprintf(out, "%-28s %15lld\n", "tasks_stolen", total.tasks_stolen);
+  fprintf(out, "%-28s %15lld\n", "morsels", total.morsels);
+  fprintf(out, "%-28s %15lld\n", "join_switches", total.join_switches);
+  fprintf(out, "%-28s %15lld\n", "join_swaps", total.join_swaps);
+  for (int i = 0; i < NUM_STATEMENT_TYPES; i++) {
+    if (total.stmt_count[i] == 0)
+      continue;
+    char name[40];
+    snprintf(name, sizeof(name), "%s.count", stmt_names[i]);
+    fprintf(out, "%-28s %15lld\n", name, total.stmt_count[i]);
+    snprintf(name, sizeof(name), "%s.time_us", stmt_names[i]);
+    fprintf(out, "%-28s %15lld\n", name, total.stmt_time_ns[i] / 1000);
+  }
+}
+
+/* atexit() hook for DB_STATS=1 - dump the counters to stderr */
+static void dump_stats_at_exit() {
+  fprintf(stderr, "\n");
+  print_stats(stderr);
+}
+
+/* Counted stdio wrappers - all table and catalog I/O goes through these */
+static int db_fseek(FILE *file_ptr, long offset, int whence) {
+  STAT_ADD(fseek_calls, 1);
+  return fseek(file_ptr, offset, whence);
+}
+
+static size_t db_fread(void *buf, size_t size, size_t count, FILE *file_ptr) {
+  size_t n = fread(buf, size, count, file_ptr);
+  STAT_ADD(fread_calls, 1);
+  STAT_ADD(bytes_read, (long long)(n * size));
+  return n;
+}
+
+static size_t db_fwrite(const void *buf, size_t size, size_t count,
+                        FILE *file_ptr) {
+  size_t n = fwrite(buf, size, count, file_ptr);
+  STAT_ADD(fwrite_calls, 1);
+  STAT_ADD(bytes_written, (long long)(n * size));
+  return n;
+}
+
+/* malloc() that is counted, and charged to a plan node under EXPLAIN */
+static void *db_malloc(size_t size, int node) {
+  STAT_ADD(allocations, 1);
+  if (node >= 0)
+    g_plan[node].allocs++;
+  return malloc(size);
+}
+
+static void *db_calloc(size_t count, size_t size, int node) {
+  STAT_ADD(allocations, 1);
+  if (node >= 0)
+    g_plan[node].allocs++;
+  return calloc(count, size);
+}
+
+/* For buffers that O_DIRECT may transfer into or out of */
+static void *db_malloc_aligned(size_t size, int node) {
+  void *ptr = NULL;
+  STAT_ADD(allocations, 1);
+  if (node >= 0)
+    g_plan[node].allocs++;
+  return (posix_memalign(&ptr, DIRECT_IO_ALIGN, size) == 0) ? ptr : NULL;
+}
+
+static void *db_realloc(void *ptr, size_t size, int node) {
+  STAT_ADD(allocations, 1);
+  if (node >= 0)
+    g_plan[node].allocs++;
+  return realloc(ptr, size);
+}
+
+static void print_plan() {
+  printf("\nQuery Plan\n");
+  printf("*****************\n");
+  for (int i = 0; i < g_plan_count; i++) {
+    plan_node *node = &g_plan[i];
+    printf("%*s%s%s [%s]", node->depth * 2, "", (node->depth > 0) ? "-> " : "",
+           node->op_name, node->detail);
+    if (g_explain == EXPLAIN_ANALYZE) {
+      printf("  (rows in=%lld out=%lld, time=%.3f ms, pages=%lld, bytes=%lld, "
+             "allocs=%lld)",
+             node->rows_in, node->rows_out, node->time_ns / 1000000.0,
+             node->pages_read, node->bytes_read, node->allocs);
+    }
+    printf("\n");
+  }
+  printf("****** End ******\n");
+}
+
+/* While a materialized view is maintained, its base table resolves to the
+   delta file <name>.mvd, so the view's own SELECT runs over just the
+   changed rows (see mv_apply_delta). */
+static const char *g_tab_redirect = NULL;
+
+static void tab_file_name(char *filename, size_t size, const char *table_name) {
+  bool delta = g_tab_redirect && (strcasecmp(table_name, g_tab_redirect) == 0);
+  snprintf(filename, size, delta ? "%s.mvd" : "%s.tab", table_name);
+}
 
 static int open_tab_rw(const char *table_name, FILE **file_ptr,
                        table_file_header *header) {
   char filename[MAX_IDENT_LEN + 5] = {0};
-  snprintf(filename, sizeof(filename), "%s.tab", table_name);
+  tab_file_name(filename, sizeof(filename), table_name);
 
   *file_ptr = fopen(filename, "rb+"); // read/write binary
   if (!*file_ptr)
     return FILE_OPEN_ERROR;
 
-  fseek(*file_ptr, 0, SEEK_SET);
-  if (fread(header, sizeof(*header), 1, *file_ptr) != 1) {
+  db_fseek(*file_ptr, 0, SEEK_SET);
+  if (db_fread(header, sizeof(*header), 1, *file_ptr) != 1) {
     fclose(*file_ptr);
     *file_ptr = NULL;
     return FILE_OPEN_ERROR;
@@ -44,12 +326,15 @@ static int write_header(FILE *file_ptr, const table_file_header *header_in) {
   table_file_header on_disk_header = *header_in;
   on_disk_header.tpd_ptr = 0; // zero when writing
 
-  /* Recompute on-disk file_size to reflect actual number of records */
-  on_disk_header.file_size =
-      on_disk_header.record_offset + on_disk_header.record_size * on_disk_header.num_records;
+  /* Recompute on-disk file_size to reflect actual number of records.
+     Slotted tables track their size in pages (see tab_write_header). */
+  if (!(on_disk_header.file_header_flag & TAB_FLAG_SLOTTED))
+    on_disk_header.file_size =
+        on_disk_header.record_offset + on_disk_header.record_size * on_disk_header.num_records;
 
-  fseek(file_ptr, 0, SEEK_SET);
-  if (fwrite(&on_disk_header, sizeof(on_disk_header), 1, file_ptr) != 1)
+  STAT_ADD(header_writes, 1);
+  db_fseek(file_ptr, 0, SEEK_SET);
+  if (db_fwrite(&on_disk_header, sizeof(on_disk_header), 1, file_ptr) != 1)
     return FILE_WRITE_ERROR;
   fflush(file_ptr);
   return 0;
@@ -73,837 +358,3957 @@ static int compute_record_size_from_tpd(const tpd_entry *table_descriptor) {
   return round_to_multiple_of_4(record_size);
 }
 
-static int create_table_data_file(const tpd_entry *table_descriptor) {
-  char filename[MAX_IDENT_LEN + 5] = {0};
-  snprintf(filename, sizeof(filename), "%s.tab", table_descriptor->table_name);
-
-  int record_size = compute_record_size_from_tpd(table_descriptor);
-
-  table_file_header header = {0};
-  header.record_size = record_size;
-  header.num_records = 0;
-  header.record_offset = sizeof(table_file_header);
-  /* Initially only write the header; do not pre-allocate space for MAX_ROWS */
-  header.file_size = header.record_offset;
-  header.file_header_flag = 0;
-  header.tpd_ptr = 0; // zero on disk
+/*************************************************************
+        Page compression - byte-oriented LZ77 codec
+ *************************************************************/
 
-  /* Write only the header to create a small initial file. File will grow as
-   * records are inserted. */
-  FILE *file_handle = fopen(filename, "wb");
-  if (!file_handle)
-    return FILE_OPEN_ERROR;
-  if (fwrite(&header, sizeof(header), 1, file_handle) != 1) {
-    fclose(file_handle);
-    return FILE_WRITE_ERROR;
+/* Each sequence is a token byte (literal count << 4 | match length - 4),
+   the literals, and a 2-byte match offset.  Counts of 15 or more continue
+   in extra bytes of 255 ending with one below 255.  The last sequence has
+   literals only.  Zero padding and repeated values turn into long matches. */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+static inline int lz_put_count(unsigned char *dst, int op, int cap, int count) {
+  for (; count >= 255; count -= 255) {
+    if (op >= cap)
+      return -1;
+    dst[op++] = 255;
   }
-  fflush(file_handle);
-  fclose(file_handle);
-  return 0;
+  if (op >= cap)
+    return -1;
+  dst[op++] = (unsigned char)count;
+  return op;
 }
 
-static int drop_table_data_file(const char *table_name) {
-  char fname[MAX_IDENT_LEN + 5] = {0};
-  snprintf(fname, sizeof(fname), "%s.tab", table_name);
-  if (remove(fname) == 0)
-    return 0;
-  if (errno == ENOENT)
-    return 0;
-  return FILE_OPEN_ERROR;
+static int lz_put_sequence(unsigned char *dst, int op, int cap,
+                           const unsigned char *lit, int lit_len,
+                           int offset, int match_len) {
+  int ml = (match_len > 0) ? match_len - LZ_MIN_MATCH : 0;
+  if (op >= cap)
+    return -1;
+  dst[op++] = (unsigned char)(((lit_len < 15 ? lit_len : 15) << 4) |
+                              (ml < 15 ? ml : 15));
+  if ((lit_len >= 15) && ((op = lz_put_count(dst, op, cap, lit_len - 15)) < 0))
+    return -1;
+  if (op + lit_len > cap)
+    return -1;
+  memcpy(dst + op, lit, lit_len);
+  op += lit_len;
+  if (match_len > 0) {
+    if (op + 2 > cap)
+      return -1;
+    dst[op++] = (unsigned char)(offset & 0xff);
+    dst[op++] = (unsigned char)(offset >> 8);
+    if ((ml >= 15) && ((op = lz_put_count(dst, op, cap, ml - 15)) < 0))
+      return -1;
+  }
+  return op;
 }
 
-/* Extract a field value from a row buffer at the specified column index */
-static void extract_field_at_column(unsigned char *row_buffer,
-                                    cd_entry *columns, int col_index,
-                                    unsigned char *str_value, int *int_value,
-                                    unsigned char *length) {
-  int offset = 0;
-
-  // Calculate offset to the target column
-  for (int i = 0; i < col_index; i++) {
-    offset += 1 + ((columns[i].col_type == T_INT) ? 4 : columns[i].col_len);
+/* Returns the compressed length, or 0 when the output would not be
+   smaller than cap */
+static int lz_compress(const unsigned char *src, int src_len,
+                       unsigned char *dst, int cap) {
+  int table[1 << LZ_HASH_BITS];
+  int ip = 0, anchor = 0, op = 0;
+  memset(table, -1, sizeof(table));
+
+  while (ip + LZ_MIN_MATCH <= src_len) {
+    uint32_t v;
+    memcpy(&v, src + ip, 4);
+    int h = (int)((v * 2654435761u) >> (32 - LZ_HASH_BITS));
+    int cand = table[h];
+    table[h] = ip;
+    if ((cand < 0) || (ip - cand > 0xffff) ||
+        (memcmp(src + cand, src + ip, LZ_MIN_MATCH) != 0)) {
+      ip++;
+      continue;
+    }
+    int len = LZ_MIN_MATCH;
+    while ((ip + len < src_len) && (src[cand + len] == src[ip + len]))
+      len++;
+    op = lz_put_sequence(dst, op, cap, src + anchor, ip - anchor, ip - cand, len);
+    if (op < 0)
+      return 0;
+    ip += len;
+    anchor = ip;
   }
+  op = lz_put_sequence(dst, op, cap, src + anchor, src_len - anchor, 0, 0);
+  return (op < 0) ? 0 : op;
+}
 
-  // Read length byte
-  *length = row_buffer[offset++];
-
-  // Read the actual value
-  if (columns[col_index].col_type == T_INT) {
-    if (*length > 0) {
-      memcpy(int_value, row_buffer + offset, 4);
-    } else {
-      *int_value = 0; // NULL
+/* Returns the decompressed length, or -1 on a malformed frame */
+static int lz_decompress(const unsigned char *src, int src_len,
+                         unsigned char *dst, int cap) {
+  int ip = 0, op = 0;
+  while (ip < src_len) {
+    int token = src[ip++];
+    int lit_len = token >> 4, ml = token & 15;
+    if (lit_len == 15) {
+      int b;
+      do {
+        if (ip >= src_len)
+          return -1;
+        lit_len += (b = src[ip++]);
+      } while (b == 255);
     }
-  } else {
-    if (*length > 0) {
-      memcpy(str_value, row_buffer + offset, *length);
+    if ((ip + lit_len > src_len) || (op + lit_len > cap))
+      return -1;
+    memcpy(dst + op, src + ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+    if (ip == src_len)
+      break; // last sequence
+
+    if (ip + 2 > src_len)
+      return -1;
+    int offset = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+    if (ml == 15) {
+      int b;
+      do {
+        if (ip >= src_len)
+          return -1;
+        ml += (b = src[ip++]);
+      } while (b == 255);
     }
+    ml += LZ_MIN_MATCH;
+    if ((offset == 0) || (offset > op) || (op + ml > cap))
+      return -1;
+    /* Byte by byte: the match may overlap its own output */
+    for (int i = 0; i < ml; i++, op++)
+      dst[op] = dst[op - offset];
   }
+  return op;
 }
 
-/* Compare two field values for equality */
-static bool are_fields_equal(cd_entry *col, unsigned char len1, void *val1,
-                             unsigned char len2, void *val2) {
-  // Both NULL
-  if (len1 == 0 && len2 == 0)
-    return true;
-
-  // One NULL, one not
-  if (len1 == 0 || len2 == 0)
-    return false;
+/*************************************************************
+        Asynchronous I/O - io_uring with a thread-pool fallback
+ *************************************************************/
 
-  // Compare based on type
-  if (col->col_type == T_INT) {
-    return *(int32_t *)val1 == *(int32_t *)val2;
-  } else {
-    return (len1 == len2) && (memcmp(val1, val2, len1) == 0);
+static int g_aio_engine = -1;  // aio_engine, chosen on first use
+static pthread_mutex_t g_aio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_aio_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_aio_done = PTHREAD_COND_INITIALIZER;
+static aio_req *g_aio_head = NULL, *g_aio_tail = NULL;  // thread pool queue
+
+/* Move the whole request with pread/pwrite; returns bytes or -errno.
+   A read stops early at end of file. */
+static int aio_transfer(aio_req *req) {
+  int total = 0;
+  while (total < req->len) {
+    ssize_t n = req->write
+                    ? pwrite(req->fd, req->buf + total, req->len - total, req->offset + total)
+                    : pread(req->fd, req->buf + total, req->len - total, req->offset + total);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+    if (n == 0)
+      break;
+    total += n;
   }
+  return total;
 }
 
-/**
- * Print a single field value
- */
-static void print_field(cd_entry *col, unsigned char length, void *value) {
-  if (length == 0) {
-    printf("NULL");
-  } else if (col->col_type == T_INT) {
-    printf("%d", *(int32_t *)value);
-  } else {
-    /* Print strings without surrounding quotes */
-    printf("%.*s", (int)length, (char *)value);
+static void *aio_worker(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&g_aio_lock);
+  while (true) {
+    while (g_aio_head == NULL)
+      pthread_cond_wait(&g_aio_work, &g_aio_lock);
+    aio_req *req = g_aio_head;
+    if ((g_aio_head = req->next) == NULL)
+      g_aio_tail = NULL;
+    pthread_mutex_unlock(&g_aio_lock);
+    int result = aio_transfer(req);
+    pthread_mutex_lock(&g_aio_lock);
+    req->result = result;
+    req->done = true;
+    pthread_cond_broadcast(&g_aio_done);
   }
+  return NULL;
 }
 
-/**
- * Find common columns between two tables for NATURAL JOIN
- */
-static int find_common_columns(tpd_entry *tpd1, tpd_entry *tpd2, int *col_map1,
-                               int *col_map2) {
-  cd_entry *cols1 = (cd_entry *)((char *)tpd1 + tpd1->cd_offset);
-  cd_entry *cols2 = (cd_entry *)((char *)tpd2 + tpd2->cd_offset);
-  int num_common = 0;
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+/* The submission and completion rings, mapped from the kernel */
+static struct {
+  int fd;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned entries;
+  unsigned inflight;
+} g_ring;
+
+/* Ask the kernel whether it knows IORING_OP_READ and IORING_OP_WRITE.
+   Kernels too old for the probe are too old for those ops as well. */
+static bool ring_has_read_write(int fd) {
+#ifdef IO_URING_OP_SUPPORTED
+  const unsigned num_ops = 256;
+  size_t size = sizeof(struct io_uring_probe) + num_ops * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+  if (!probe)
+    return false;
+  bool ok = false;
+  if ((syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, num_ops) == 0) &&
+      (probe->ops_len > IORING_OP_WRITE) && (probe->ops_len > IORING_OP_READ))
+    ok = (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+         (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  return ok;
+#else
+  (void)fd;
+  return false;
+#endif
+}
 
-  for (int i = 0; i < tpd1->num_columns; i++) {
-    for (int j = 0; j < tpd2->num_columns; j++) {
-      if (strcmp(cols1[i].col_name, cols2[j].col_name) == 0) {
-        col_map1[num_common] = i;
-        col_map2[num_common] = j;
-        num_common++;
-        break;
-      }
-    }
+static bool ring_setup() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = (int)syscall(__NR_io_uring_setup, AIO_QUEUE_DEPTH, &params);
+  if (fd < 0)
+    return false;
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single && cq_size > sq_size)
+    sq_size = cq_size;
+  unsigned char *sq = (unsigned char *)mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  unsigned char *cq = single ? sq
+                             : (unsigned char *)mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                                                     MAP_SHARED | MAP_POPULATE, fd,
+                                                     IORING_OFF_CQ_RING);
+  void *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                    IORING_OFF_SQES);
+  if ((sq == MAP_FAILED) || (cq == MAP_FAILED) || (sqes == MAP_FAILED)) {
+    close(fd);
+    return false;
+  }
+  if (!ring_has_read_write(fd)) {
+    /* Before 5.6 every READ/WRITE would come back -EINVAL */
+    munmap(sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+    if (!single)
+      munmap(cq, cq_size);
+    munmap(sq, sq_size);
+    close(fd);
+    return false;
   }
 
-  return num_common;
+  g_ring.fd = fd;
+  g_ring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  g_ring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  g_ring.sq_array = (unsigned *)(sq + params.sq_off.array);
+  g_ring.cq_head = (unsigned *)(cq + params.cq_off.head);
+  g_ring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  g_ring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  g_ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  g_ring.sqes = (struct io_uring_sqe *)sqes;
+  g_ring.entries = params.sq_entries;
+  g_ring.inflight = 0;
+  return true;
 }
 
-/**
- * Print the header row for NATURAL JOIN result
- * Format: common columns | remaining table1 columns | remaining table2 columns
- */
-static void print_join_header(tpd_entry *tpd1, tpd_entry *tpd2,
-                              int *common_map1, int *common_map2,
-                              int num_common) {
-  cd_entry *cols1 = (cd_entry *)((char *)tpd1 + tpd1->cd_offset);
-  cd_entry *cols2 = (cd_entry *)((char *)tpd2 + tpd2->cd_offset);
-  bool first = true;
-
-  /* We'll build an ordered list of output columns and compute widths */
-  int out_col_count = 0;
-  static int out_col_widths[MAX_NUM_COL * 2];
-  static int out_col_types[MAX_NUM_COL * 2];
-  static char out_col_names[MAX_NUM_COL * 2][MAX_IDENT_LEN + 8];
-
-  // helper to add a column to output list
-  auto add_out_col = [&](const char *name, int col_type, int col_len) {
-    strncpy(out_col_names[out_col_count], name, sizeof(out_col_names[0]) - 1);
-    out_col_names[out_col_count][sizeof(out_col_names[0]) - 1] = '\0';
-    out_col_types[out_col_count] = col_type;
-    int w = (int)strlen(name);
-    if (col_type == T_INT) {
-      if (w < 5)
-        w = 5; // width for ints
-    } else {
-      if (w < col_len)
-        w = col_len;
+/* Mark every finished request done.  Called with g_aio_lock held. */
+static void ring_reap() {
+  unsigned head = *g_ring.cq_head;
+  unsigned tail = __atomic_load_n(g_ring.cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &g_ring.cqes[head & *g_ring.cq_mask];
+    aio_req *req = (aio_req *)(uintptr_t)cqe->user_data;
+    req->result = cqe->res;
+    /* A short transfer is finished here (a short read is usually EOF) */
+    if ((req->result > 0) && (req->result < req->len)) {
+      aio_req rest = *req;
+      rest.buf += req->result;
+      rest.offset += req->result;
+      rest.len -= req->result;
+      int more = aio_transfer(&rest);
+      req->result = (more < 0) ? more : req->result + more;
     }
-    out_col_widths[out_col_count] = w;
-    out_col_count++;
-  };
-
-  // Print common columns first (and add to out list)
-  for (int i = 0; i < num_common; i++) {
-    add_out_col(cols1[common_map1[i]].col_name, cols1[common_map1[i]].col_type,
-                cols1[common_map1[i]].col_len);
+    req->done = true;
+    g_ring.inflight--;
+    head++;
   }
+  __atomic_store_n(g_ring.cq_head, head, __ATOMIC_RELEASE);
+}
 
-  // Print remaining columns from table1
-  for (int i = 0; i < tpd1->num_columns; i++) {
-    bool is_common = false;
-    for (int c = 0; c < num_common; c++) {
-      if (common_map1[c] == i) {
-        is_common = true;
-        break;
-      }
-    }
-    if (!is_common) {
-      add_out_col(cols1[i].col_name, cols1[i].col_type, cols1[i].col_len);
-      first = false;
-    }
+/* Block until at least one request completes */
+static void ring_wait_one() {
+  syscall(__NR_io_uring_enter, g_ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+  ring_reap();
+}
+
+static void ring_submit(aio_req *req) {
+  while (g_ring.inflight >= g_ring.entries)
+    ring_wait_one();
+  unsigned tail = *g_ring.sq_tail;
+  unsigned index = tail & *g_ring.sq_mask;
+  struct io_uring_sqe *sqe = &g_ring.sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+  sqe->fd = req->fd;
+  sqe->off = req->offset;
+  sqe->addr = (uintptr_t)req->buf;
+  sqe->len = req->len;
+  sqe->user_data = (uintptr_t)req;
+  g_ring.sq_array[index] = index;
+  __atomic_store_n(g_ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+  g_ring.inflight++;
+  long submitted;
+  do {
+    submitted = syscall(__NR_io_uring_enter, g_ring.fd, 1, 0, 0, NULL, 0);
+  } while ((submitted < 0) && (errno == EINTR));
+  if (submitted != 1) {
+    /* The kernel took nothing; do it here */
+    __atomic_store_n(g_ring.sq_tail, tail, __ATOMIC_RELEASE);
+    g_ring.inflight--;
+    req->result = aio_transfer(req);
+    req->done = true;
   }
+}
+#endif
 
-  // Print remaining columns from table2
-  for (int i = 0; i < tpd2->num_columns; i++) {
-    bool is_common = false;
-    for (int c = 0; c < num_common; c++) {
-      if (common_map2[c] == i) {
-        is_common = true;
-        break;
+/* Pick the engine: DB_AIO if set, else io_uring when the kernel allows
+   it, else the thread pool.  Called with g_aio_lock held. */
+static void aio_init() {
+  const char *name = getenv("DB_AIO");
+  int want = AIO_URING;
+  if (name && (strcasecmp(name, "sync") == 0))
+    want = AIO_SYNC;
+  else if (name && (strcasecmp(name, "threads") == 0))
+    want = AIO_THREADS;
+
+  g_aio_engine = AIO_SYNC;
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+  if ((want == AIO_URING) && ring_setup()) {
+    g_aio_engine = AIO_URING;
+    return;
+  }
+#endif
+  if (want != AIO_SYNC) {
+    for (int i = 0; i < AIO_POOL_THREADS; i++) {
+      pthread_t tid;
+      if (pthread_create(&tid, NULL, aio_worker, NULL) == 0) {
+        pthread_detach(tid);
+        g_aio_engine = AIO_THREADS;
       }
     }
-    if (!is_common) {
-      add_out_col(cols2[i].col_name, cols2[i].col_type, cols2[i].col_len);
-      first = false;
-    }
   }
+}
 
-  /* Print header row with computed widths */
-  for (int i = 0; i < out_col_count; ++i) {
-    printf("%-*s", out_col_widths[i], out_col_names[i]);
-    if (i + 1 < out_col_count)
-      printf(" ");
+/* Start a request; aio_wait() collects it */
+static void aio_submit(aio_req *req) {
+  req->done = false;
+  req->next = NULL;
+  if (req->write)
+    STAT_ADD(aio_writes, 1);
+  else
+    STAT_ADD(aio_reads, 1);
+  pthread_mutex_lock(&g_aio_lock);
+  if (g_aio_engine < 0)
+    aio_init();
+  if (g_aio_engine == AIO_THREADS) {
+    if (g_aio_tail)
+      g_aio_tail->next = req;
+    else
+      g_aio_head = req;
+    g_aio_tail = req;
+    pthread_cond_signal(&g_aio_work);
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+  } else if (g_aio_engine == AIO_URING) {
+    ring_submit(req);
+#endif
+  } else {
+    req->result = aio_transfer(req);
+    req->done = true;
   }
-  printf("\n");
+  pthread_mutex_unlock(&g_aio_lock);
+}
 
-  /* Print separator line */
-  for (int i = 0; i < out_col_count; ++i) {
-    for (int j = 0; j < out_col_widths[i]; ++j)
-      putchar('-');
-    if (i + 1 < out_col_count)
-      putchar(' ');
-  }
-  printf("\n");
+/* True while a request is still in flight */
+static bool aio_busy(aio_req *req) {
+  pthread_mutex_lock(&g_aio_lock);
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+  if ((g_aio_engine == AIO_URING) && !req->done)
+    ring_reap();
+#endif
+  bool busy = !req->done;
+  pthread_mutex_unlock(&g_aio_lock);
+  return busy;
+}
 
-  /* Store generated widths and counts in static globals for use by
-   * print_joined_row */
-  /* We'll copy into static arrays accessible by print_joined_row */
-  /* Copy into file-scoped join_out_* arrays so print_joined_row can use them */
-  join_out_count = out_col_count;
-  for (int i = 0; i < out_col_count; ++i) {
-    join_out_widths[i] = out_col_widths[i];
-    join_out_types[i] = out_col_types[i];
-    strncpy(join_out_names[i], out_col_names[i], sizeof(join_out_names[0]) - 1);
-    join_out_names[i][sizeof(join_out_names[0]) - 1] = '\0';
+/* Wait for a request; returns its result */
+static int aio_wait(aio_req *req) {
+  pthread_mutex_lock(&g_aio_lock);
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+  if ((g_aio_engine == AIO_URING) && !req->done)
+    ring_reap();
+#endif
+  if (!req->done)
+    STAT_ADD(aio_waits, 1);
+  while (!req->done) {
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+    if (g_aio_engine == AIO_URING) {
+      ring_wait_one();
+      continue;
+    }
+#endif
+    pthread_cond_wait(&g_aio_done, &g_aio_lock);
+  }
+  pthread_mutex_unlock(&g_aio_lock);
+  if (req->result > 0) {
+    if (req->write)
+      STAT_ADD(bytes_written, req->result);
+    else
+      STAT_ADD(bytes_read, req->result);
   }
+  return req->result;
 }
 
-/* Check if two rows match on all common columns */
-static bool rows_match_on_common_columns(unsigned char *row1,
-                                         unsigned char *row2, cd_entry *cols1,
-                                         cd_entry *cols2, int *common_map1,
-                                         int *common_map2, int num_common) {
-  for (int c = 0; c < num_common; c++) {
-    int idx1 = common_map1[c];
-    int idx2 = common_map2[c];
+/*************************************************************
+        Worker threads - shared by the parallel operators
+ *************************************************************/
 
-    unsigned char len1, len2;
-    unsigned char str_val1[256] = {0}, str_val2[256] = {0};
-    int int_val1 = 0, int_val2 = 0;
+/* Worker threads for parallel operators: DB_THREADS, else one per CPU */
+static int db_threads() {
+  static int threads = 0;
+  if (threads == 0) {
+    const char *value = getenv("DB_THREADS");
+    long n = value ? atol(value) : sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (n < 1) ? 1 : (n > MAX_THREADS) ? MAX_THREADS : (int)n;
+  }
+  return threads;
+}
 
-    extract_field_at_column(row1, cols1, idx1, str_val1, &int_val1, &len1);
-    extract_field_at_column(row2, cols2, idx2, str_val2, &int_val2, &len2);
+/* DB_PARALLEL_ROWS: the fewest rows worth splitting up, and the fewest
+   each worker thread is given.  The default follows the row cap. */
+static long parallel_rows() {
+  static long rows = -1;
+  if (rows < 0) {
+    const char *value = getenv("DB_PARALLEL_ROWS");
+    long share = g_max_rows / PARALLEL_ROWS_CAP_SHARE;
+    rows = value ? atol(value) : (share < PARALLEL_ROWS_DEFAULT) ? share : PARALLEL_ROWS_DEFAULT;
+    if (rows < 0)
+      rows = 0;
+  }
+  return rows;
+}
 
-    void *v1 =
-        (cols1[idx1].col_type == T_INT) ? (void *)&int_val1 : (void *)str_val1;
-    void *v2 =
-        (cols2[idx2].col_type == T_INT) ? (void *)&int_val2 : (void *)str_val2;
+/* Threads for work over rows: up to DB_THREADS, at least
+   DB_PARALLEL_ROWS rows each */
+static int parallel_threads(long rows) {
+  long per_thread = parallel_rows();
+  if ((per_thread == 0) || (rows / per_thread >= db_threads()))
+    return db_threads();
+  return (rows < per_thread) ? 1 : (int)(rows / per_thread);
+}
 
-    if (!are_fields_equal(&cols1[idx1], len1, v1, len2, v2)) {
-      return false;
-    }
+/* DB_MORSEL_ROWS: records in one morsel of morsel-driven work */
+static long morsel_rows() {
+  static long rows = 0;
+  if (rows == 0) {
+    const char *value = getenv("DB_MORSEL_ROWS");
+    rows = value ? atol(value) : MORSEL_ROWS_DEFAULT;
+    if (rows < 1)
+      rows = 1;
   }
+  return rows;
+}
 
-  return true;
+static sched_deque g_deques[MAX_THREADS];
+static int g_sched_workers = 0;  // pool threads started, plus the caller
+static long g_sched_queued = 0;  // tasks in all the deques
+static pthread_mutex_t g_sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_sched_wake = PTHREAD_COND_INITIALIZER;  // new task, or a group done
+static __thread int t_worker = 0;  // this thread's deque
+
+static inline void deque_lock(sched_deque *d) {
+  while (__sync_lock_test_and_set(&d->lock, 1))
+    while (__atomic_load_n(&d->lock, __ATOMIC_RELAXED))
+      ;
 }
 
-/**
- * Print a joined row with proper column ordering
- */
-static void print_joined_row(unsigned char *row1, unsigned char *row2,
-                             tpd_entry *tpd1, tpd_entry *tpd2, int *common_map1,
-                             int *common_map2, int num_common) {
-  cd_entry *cols1 = (cd_entry *)((char *)tpd1 + tpd1->cd_offset);
-  cd_entry *cols2 = (cd_entry *)((char *)tpd2 + tpd2->cd_offset);
-  int pos = 0;
+static inline void deque_unlock(sched_deque *d) { __sync_lock_release(&d->lock); }
+
+/* Push onto the bottom of the worker's deque; false when it is full */
+static bool deque_push(int worker, const sched_task *task) {
+  sched_deque *d = &g_deques[worker];
+  deque_lock(d);
+  bool room = (d->bottom - d->top < SCHED_DEQUE_SIZE);
+  if (room)
+    d->tasks[d->bottom++ % SCHED_DEQUE_SIZE] = *task;
+  deque_unlock(d);
+  if (room)
+    __sync_fetch_and_add(&g_sched_queued, 1);
+  return room;
+}
 
-  /* Print common columns (from table1) */
-  for (int c = 0; c < num_common; c++) {
-    int idx = common_map1[c];
-    unsigned char len;
-    unsigned char str_val[256] = {0};
-    int int_val = 0;
-    extract_field_at_column(row1, cols1, idx, str_val, &int_val, &len);
-
-    if (join_out_types[pos] == T_INT) {
-      if (len == 0)
-        printf("%-*s", join_out_widths[pos], "NULL");
-      else
-        printf("%*d", join_out_widths[pos], int_val);
-    } else {
-      if (len == 0)
-        printf("%-*s", join_out_widths[pos], "NULL");
-      else
-        printf("%-*.*s", join_out_widths[pos], (int)len, (char *)str_val);
+/* The owner takes its newest task, a thief the oldest */
+static bool deque_take(int worker, bool steal, sched_task *task) {
+  sched_deque *d = &g_deques[worker];
+  deque_lock(d);
+  bool found = (d->top < d->bottom);
+  if (found)
+    *task = steal ? d->tasks[d->top++ % SCHED_DEQUE_SIZE]
+                  : d->tasks[--d->bottom % SCHED_DEQUE_SIZE];
+  deque_unlock(d);
+  if (found)
+    __sync_fetch_and_sub(&g_sched_queued, 1);
+  return found;
+}
+
+/* A task for worker: its own newest, else the oldest of the next worker
+   that has any */
+static bool sched_next(int worker, sched_task *task) {
+  if (deque_take(worker, false, task))
+    return true;
+  for (int k = 1; k < g_sched_workers; k++)
+    if (deque_take((worker + k) % g_sched_workers, true, task)) {
+      STAT_ADD(tasks_stolen, 1);
+      return true;
     }
-    if (pos + 1 < join_out_count)
-      printf(" ");
-    pos++;
+  return false;
+}
+
+static void sched_execute(sched_task *task) {
+  task->fn(task->arg, task->index);
+  STAT_ADD(tasks_run, 1);
+  if (__sync_sub_and_fetch(&task->group->pending, 1) == 0) {
+    pthread_mutex_lock(&g_sched_lock);
+    pthread_cond_broadcast(&g_sched_wake);
+    pthread_mutex_unlock(&g_sched_lock);
   }
+}
 
-  /* Remaining columns from table1 */
-  for (int i = 0; i < tpd1->num_columns; i++) {
-    bool is_common = false;
-    for (int c = 0; c < num_common; c++) {
-      if (common_map1[c] == i) {
-        is_common = true;
-        break;
-      }
+static void *sched_worker(void *arg) {
+  t_worker = (int)(long)arg;
+  sched_task task;
+  while (true) {
+    if (sched_next(t_worker, &task)) {
+      sched_execute(&task);
+      continue;
     }
-    if (!is_common) {
-      unsigned char len;
-      unsigned char str_val[256] = {0};
-      int int_val = 0;
-      extract_field_at_column(row1, cols1, i, str_val, &int_val, &len);
+    pthread_mutex_lock(&g_sched_lock);
+    while (__atomic_load_n(&g_sched_queued, __ATOMIC_ACQUIRE) == 0)
+      pthread_cond_wait(&g_sched_wake, &g_sched_lock);
+    pthread_mutex_unlock(&g_sched_lock);
+  }
+  return NULL;
+}
 
-      if (join_out_types[pos] == T_INT) {
-        if (len == 0)
-          printf("%-*s", join_out_widths[pos], "NULL");
-        else
-          printf("%*d", join_out_widths[pos], int_val);
-      } else {
-        if (len == 0)
-          printf("%-*s", join_out_widths[pos], "NULL");
-        else
-          printf("%-*.*s", join_out_widths[pos], (int)len, (char *)str_val);
-      }
-      if (pos + 1 < join_out_count)
-        printf(" ");
-      pos++;
+/* Start the pool: DB_THREADS - 1 threads besides the caller, pinned to
+   CPUs 1, 2, ... under DB_PIN_THREADS=1.  A worker that cannot be
+   started leaves an empty deque, and its share of the work to the
+   others. */
+static void sched_start() {
+  if (g_sched_workers > 0)
+    return;
+  const char *pin = getenv("DB_PIN_THREADS");
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  g_sched_workers = db_threads();
+  for (int w = 1; w < g_sched_workers; w++) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, sched_worker, (void *)(long)w) != 0)
+      continue;
+    pthread_detach(tid);
+#ifdef __linux__
+    if (pin && (atoi(pin) == 1) && (cpus > 0)) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(w % cpus, &set);
+      pthread_setaffinity_np(tid, sizeof(set), &set);
     }
+#endif
   }
+}
 
-  /* Remaining columns from table2 */
-  for (int i = 0; i < tpd2->num_columns; i++) {
-    bool is_common = false;
-    for (int c = 0; c < num_common; c++) {
-      if (common_map2[c] == i) {
-        is_common = true;
-        break;
-      }
-    }
-    if (!is_common) {
-      unsigned char len;
-      unsigned char str_val[256] = {0};
-      int int_val = 0;
-      extract_field_at_column(row2, cols2, i, str_val, &int_val, &len);
+/* Queue fn(arg, index) in the group; run it here if the deque is full */
+static void task_group_spawn(task_group *g, void (*fn)(void *, int), void *arg, int index) {
+  sched_task task = {fn, arg, index, g};
+  __sync_fetch_and_add(&g->pending, 1);
+  if (!deque_push(t_worker, &task)) {
+    sched_execute(&task);
+    return;
+  }
+  pthread_mutex_lock(&g_sched_lock);
+  pthread_cond_broadcast(&g_sched_wake);
+  pthread_mutex_unlock(&g_sched_lock);
+}
 
-      if (join_out_types[pos] == T_INT) {
-        if (len == 0)
-          printf("%-*s", join_out_widths[pos], "NULL");
-        else
-          printf("%*d", join_out_widths[pos], int_val);
-      } else {
-        if (len == 0)
-          printf("%-*s", join_out_widths[pos], "NULL");
-        else
-          printf("%-*.*s", join_out_widths[pos], (int)len, (char *)str_val);
-      }
-      if (pos + 1 < join_out_count)
-        printf(" ");
-      pos++;
+/* Run queued tasks until every task of the group has finished */
+static void task_group_wait(task_group *g) {
+  sched_task task;
+  while (__atomic_load_n(&g->pending, __ATOMIC_ACQUIRE) > 0) {
+    if (sched_next(t_worker, &task)) {
+      sched_execute(&task);
+      continue;
     }
+    pthread_mutex_lock(&g_sched_lock);
+    while ((__atomic_load_n(&g->pending, __ATOMIC_ACQUIRE) > 0) &&
+           (__atomic_load_n(&g_sched_queued, __ATOMIC_ACQUIRE) == 0))
+      pthread_cond_wait(&g_sched_wake, &g_sched_lock);
+    pthread_mutex_unlock(&g_sched_lock);
   }
-
-  printf("\n");
 }
 
-int main(int argc, char **argv) {
-  int rc = 0;
-  token_list *tok_list = NULL, *tok_ptr = NULL, *tmp_tok_ptr = NULL;
+/* fn(arg, 0) .. fn(arg, num_tasks - 1) on the pool, then wait */
+static void parallel_run(int num_tasks, void (*fn)(void *, int), void *arg) {
+  task_group g = {0};
+  sched_start();
+  for (int t = 0; t < num_tasks; t++)
+    task_group_spawn(&g, fn, arg, t);
+  task_group_wait(&g);
+}
 
-  if ((argc != 2) || (strlen(argv[1]) == 0)) {
-    printf("Usage: db \"command statement\"\n");
-    return 1;
+static void morsel_task(void *arg, int index) {
+  (void)index;
+  morsel_run *mr = (morsel_run *)arg;
+  long m;
+  while ((m = __sync_fetch_and_add(&mr->next, 1)) * mr->morsel_rows < mr->num_rows) {
+    long first = m * mr->morsel_rows;
+    long end = (first + mr->morsel_rows < mr->num_rows) ? first + mr->morsel_rows
+                                                        : mr->num_rows;
+    mr->fn(mr->arg, first, end, t_worker);
+    STAT_ADD(morsels, 1);
   }
+}
 
-  rc = initialize_tpd_list();
+/* fn(arg, first, end, worker) over [0, num_rows) in morsels of
+   morsel_rows records, handed out to num_threads workers as each asks
+   for its next one */
+static void parallel_morsels(int num_threads, long num_rows, long morsel_rows,
+                             void (*fn)(void *, long, long, int), void *arg) {
+  morsel_run mr = {fn, arg, num_rows, morsel_rows, 0};
+  parallel_run(num_threads, morsel_task, &mr);
+}
 
-  if (rc) {
-    printf("\nError in initialize_tpd_list().\nrc = %d\n", rc);
-  } else {
-    rc = get_token(argv[1], &tok_list);
+/*************************************************************
+        Table storage - fixed and slotted record formats
+ *************************************************************/
 
-    /* Test code */
-    tok_ptr = tok_list;
-    while (tok_ptr != NULL) {
-      printf("%16s \t%d \t %d\n", tok_ptr->tok_string, tok_ptr->tok_class,
-             tok_ptr->tok_value);
-      tok_ptr = tok_ptr->next;
-    }
+/* Big enough for the largest encoded record plus page header and slot */
+static int slotted_page_size(int record_size) {
+  int need = record_size + (int)sizeof(slotted_page_header) + (int)sizeof(slot_entry);
+  return (need + DB_PAGE_SIZE - 1) / DB_PAGE_SIZE * DB_PAGE_SIZE;
+}
 
-    if (!rc) {
-      rc = do_semantic(tok_list);
-    }
+static inline slot_entry *page_slots(unsigned char *page) {
+  return (slot_entry *)(page + sizeof(slotted_page_header));
+}
 
-    if (rc) {
-      bool found_error = false;
-      tok_ptr = tok_list;
-      while (tok_ptr != NULL) {
-        if ((tok_ptr->tok_class == error) || (tok_ptr->tok_value == INVALID)) {
-          printf("\nError in the string: %s\n", tok_ptr->tok_string);
-          printf("rc=%d\n", rc);
-          found_error = true;
-          break;
-        }
-        tok_ptr = tok_ptr->next;
-      }
-      if (!found_error) {
-        printf("\nError: rc=%d\n", rc);
-      }
+static inline int page_free_space(unsigned char *page) {
+  slotted_page_header *ph = (slotted_page_header *)page;
+  return ph->data_start - (int)sizeof(slotted_page_header) -
+         ph->num_slots * (int)sizeof(slot_entry);
+}
+
+static void init_page(unsigned char *page, int page_size) {
+  memset(page, 0, page_size);
+  ((slotted_page_header *)page)->data_start = (uint16_t)page_size;
+}
+
+/* Fixed in-memory row -> slotted record.  INT and CHAR(n) keep their
+   fixed size, VARCHAR(n) only stores the bytes in use. */
+static int encode_record(const tab_handle *th, const unsigned char *row,
+                         unsigned char *rec) {
+  int in = 0, out = 0;
+  for (int i = 0; i < th->tpd->num_columns; i++) {
+    cd_entry *col = &th->cols[i];
+    unsigned char len = row[in++];
+    rec[out++] = len;
+    if (col->col_type == T_INT) {
+      memcpy(rec + out, row + in, 4);
+      in += 4;
+      out += 4;
+    } else if (col->col_type == T_VARCHAR) {
+      memcpy(rec + out, row + in, len);
+      in += col->col_len;
+      out += len;
+    } else {
+      memcpy(rec + out, row + in, col->col_len);
+      in += col->col_len;
+      out += col->col_len;
     }
+  }
+  return out;
+}
 
-    /* Whether the token list is valid or not, we need to free the memory */
-    tok_ptr = tok_list;
-    while (tok_ptr != NULL) {
-      tmp_tok_ptr = tok_ptr->next;
-      free(tok_ptr);
-      tok_ptr = tmp_tok_ptr;
+static void decode_record(const tab_handle *th, const unsigned char *rec,
+                          unsigned char *row) {
+  int in = 0, out = 0;
+  memset(row, 0, th->hdr.record_size);
+  for (int i = 0; i < th->tpd->num_columns; i++) {
+    cd_entry *col = &th->cols[i];
+    unsigned char len = rec[in++];
+    row[out++] = len;
+    if (col->col_type == T_INT) {
+      memcpy(row + out, rec + in, 4);
+      in += 4;
+      out += 4;
+    } else if (col->col_type == T_VARCHAR) {
+      memcpy(row + out, rec + in, len);
+      in += len;
+      out += col->col_len;
+    } else {
+      memcpy(row + out, rec + in, col->col_len);
+      in += col->col_len;
+      out += col->col_len;
     }
   }
+}
 
-  return rc;
+/* ---- asynchronous I/O on the table file ---- */
+
+/* Read-ahead block size, DB_READ_BLOCK (KB) clipped to the allowed range */
+static long read_block_size() {
+  static long block_size = 0;
+  if (block_size == 0) {
+    const char *kb = getenv("DB_READ_BLOCK");
+    block_size = kb ? atol(kb) << 10 : READ_BLOCK_DEFAULT;
+    if (block_size < READ_BLOCK_MIN)
+      block_size = READ_BLOCK_MIN;
+    else if (block_size > READ_BLOCK_MAX)
+      block_size = READ_BLOCK_MAX;
+    block_size -= block_size % DIRECT_IO_ALIGN;
+  }
+  return block_size;
 }
 
-/*************************************************************
-        This is a lexical analyzer for simple SQL statements
- *************************************************************/
-int get_token(char *command, token_list **tok_list) {
-  int rc = 0, i, j;
-  char *start, *cur, temp_string[MAX_TOK_LEN];
-  bool done = false;
-
-  start = cur = command;
-  while (!done) {
-    bool found_keyword = false;
-
-    /* This is the TOP Level for each token */
-    memset((void *)temp_string, '\0', MAX_TOK_LEN);
-    i = 0;
+/* Tell the kernel how the file is about to be read */
+static inline void tab_advise(tab_handle *th, long offset, long len, int advice) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+  posix_fadvise(th->fd, offset, len, advice);
+#endif
+}
 
-    /* Get rid of all the leading blanks */
-    while (*cur == ' ')
-      cur++;
+/* Freed read-ahead buffers, kept so that each table open does not map
+   and fault in fresh megabytes */
+static unsigned char *g_block_pool[2 * AIO_READ_AHEAD];
+static int g_block_pool_cap[2 * AIO_READ_AHEAD];
+static int g_block_pool_count = 0;
+
+/* A buffer of at least len bytes; *cap gets its size */
+static unsigned char *block_buf_get(int len, int *cap) {
+  unsigned char *buf = NULL;
+  pthread_mutex_lock(&g_aio_lock);
+  for (int i = 0; i < g_block_pool_count; i++) {
+    if (g_block_pool_cap[i] >= len) {
+      buf = g_block_pool[i];
+      *cap = g_block_pool_cap[i];
+      g_block_pool_count--;
+      g_block_pool[i] = g_block_pool[g_block_pool_count];
+      g_block_pool_cap[i] = g_block_pool_cap[g_block_pool_count];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_aio_lock);
+  if (!buf && (buf = (unsigned char *)db_malloc_aligned(len, -1)))
+    *cap = len;
+  return buf;
+}
 
-    if (cur && isalpha(*cur)) {
-      // find valid identifier
-      int t_class;
-      do {
-        temp_string[i++] = *cur++;
-      } while ((isalnum(*cur)) || (*cur == '_'));
+static void block_buf_put(unsigned char *buf, int cap) {
+  if (!buf)
+    return;
+  pthread_mutex_lock(&g_aio_lock);
+  if (g_block_pool_count < 2 * AIO_READ_AHEAD) {
+    g_block_pool[g_block_pool_count] = buf;
+    g_block_pool_cap[g_block_pool_count++] = cap;
+    buf = NULL;
+  }
+  pthread_mutex_unlock(&g_aio_lock);
+  free(buf);
+}
 
-      if (!(strchr(STRING_BREAK, *cur))) {
-        /* If the next char following the keyword or identifier
-           is not a blank, (, ), or a comma, then append this
-                 character to temp_string, and flag this as an error */
-        temp_string[i++] = *cur++;
-        add_to_list(tok_list, temp_string, error, INVALID);
-        rc = INVALID;
-        done = true;
-      } else {
+static inline aio_block *tab_block_slot(tab_handle *th, long base) {
+  return &th->blocks[(base / read_block_size()) % AIO_READ_AHEAD];
+}
 
-        // We have an identifier with at least 1 character
-        // Now check if this ident is a keyword
-        for (j = 0, found_keyword = false; j < TOTAL_KEYWORDS_PLUS_TYPE_NAMES;
-             j++) {
-          if ((strcasecmp(keyword_table[j], temp_string) == 0)) {
-            found_keyword = true;
-            break;
-          }
-        }
+static inline bool ranges_overlap(long a, int a_len, long b, int b_len) {
+  return (a < b + b_len) && (b < a + a_len);
+}
 
-        if (found_keyword) {
-          if (KEYWORD_OFFSET + j < K_CREATE)
-            t_class = type_name;
-          else if (KEYWORD_OFFSET + j >= F_SUM)
-            t_class = function_name;
-          else
-            t_class = keyword;
+static inline bool tab_direct(const tab_handle *th) {
+  return (th->direct_fd >= 0) && th->direct_ok;
+}
 
-          add_to_list(tok_list, temp_string, t_class, KEYWORD_OFFSET + j);
-        } else {
-          if (strlen(temp_string) <= MAX_IDENT_LEN)
-            add_to_list(tok_list, temp_string, identifier, IDENT);
-          else {
-            add_to_list(tok_list, temp_string, error, INVALID);
-            rc = INVALID;
-            done = true;
-          }
-        }
+/* Wait for a request; one that O_DIRECT refused is redone through the
+   page cache, and O_DIRECT is not tried again on this handle */
+static int tab_wait(tab_handle *th, aio_req *req) {
+  int n = aio_wait(req);
+  if ((n == -EINVAL) && (req->fd == th->direct_fd)) {
+    th->direct_ok = false;
+    req->fd = th->fd;
+    aio_submit(req);
+    n = aio_wait(req);
+  }
+  return n;
+}
 
-        if (!*cur) {
-          add_to_list(tok_list, "", terminator, EOC);
-          done = true;
-        }
-      }
-    } else if (isdigit(*cur)) {
-      // find valid number
-      do {
-        temp_string[i++] = *cur++;
-      } while (isdigit(*cur));
+/* Wait for a read-ahead block; returns how much of it is in the file */
+static int tab_block_ready(tab_handle *th, aio_block *b) {
+  if (b->valid < 0) {
+    int n = tab_wait(th, &b->req);
+    b->valid = (n > 0) ? n : 0;
+  }
+  return b->valid;
+}
 
-      if (!(strchr(NUMBER_BREAK, *cur))) {
-        /* If the next char following the keyword or identifier
-           is not a blank or a ), then append this
-                 character to temp_string, and flag this as an error */
-        temp_string[i++] = *cur++;
-        add_to_list(tok_list, temp_string, error, INVALID);
-        rc = INVALID;
-        done = true;
-      } else {
-        add_to_list(tok_list, temp_string, constant, INT_LITERAL);
+/* Wait for every queued write and release it */
+static int tab_drain_writes(tab_handle *th) {
+  int rc = 0;
+  for (int i = 0; i < th->num_writes; i++) {
+    aio_req *req = th->writes[i];
+    if (tab_wait(th, req) != req->len)
+      rc = FILE_WRITE_ERROR;
+    free(req->buf);
+    free(req);
+  }
+  th->num_writes = 0;
+  return rc;
+}
 
-        if (!*cur) {
-          add_to_list(tok_list, "", terminator, EOC);
-          done = true;
-        }
-      }
-    } else if ((*cur == '(') || (*cur == ')') || (*cur == ',') ||
-               (*cur == '*') || (*cur == '=') || (*cur == '<') ||
-               (*cur == '>')) {
-      /* Catch all the symbols here. Check for multi-char operators. */
-      int t_value;
-      
-      // Check for multi-character operators: <=, >=, <>
-      if (*cur == '<') {
-        temp_string[i++] = *cur++;
-        if (*cur == '=') {
-          temp_string[i++] = *cur++;
-          t_value = S_LESS_EQUAL;
-        } else if (*cur == '>') {
-          temp_string[i++] = *cur++;
-          t_value = S_NOT_EQUAL;
-        } else {
-          t_value = S_LESS;
-        }
-      } else if (*cur == '>') {
-        temp_string[i++] = *cur++;
-        if (*cur == '=') {
-          temp_string[i++] = *cur++;
-          t_value = S_GREATER_EQUAL;
-        } else {
-          t_value = S_GREATER;
-        }
-      } else {
-        // Single character operators
-        switch (*cur) {
-        case '(':
-          t_value = S_LEFT_PAREN;
-          break;
-        case ')':
-          t_value = S_RIGHT_PAREN;
-          break;
-        case ',':
-          t_value = S_COMMA;
-          break;
-        case '*':
-          t_value = S_STAR;
-          break;
-        case '=':
-          t_value = S_EQUAL;
-          break;
-        }
-        temp_string[i++] = *cur++;
-      }
+/* Queue the write-back run.  Writes to the same bytes may complete in any
+   order, so an overlapping queued write is waited for first. */
+static int tab_queue_run(tab_handle *th) {
+  int rc = 0;
+  if (th->run_len == 0)
+    return 0;
+  bool overlap = (th->num_writes == AIO_MAX_WRITES);
+  for (int i = 0; (i < th->num_writes) && !overlap; i++)
+    overlap = ranges_overlap(th->writes[i]->offset, th->writes[i]->len,
+                             th->run_offset, th->run_len);
+  if (overlap && (rc = tab_drain_writes(th)))
+    return rc;
 
-      add_to_list(tok_list, temp_string, symbol, t_value);
+  aio_req *req = (aio_req *)db_malloc(sizeof(aio_req), -1);
+  if (!req)
+    return MEMORY_ERROR;
+  /* Whole aligned pages can bypass the page cache too */
+  req->fd = th->fd;
+  if (tab_direct(th) && (th->run_offset % DIRECT_IO_ALIGN == 0) &&
+      (th->run_len % DIRECT_IO_ALIGN == 0)) {
+    req->fd = th->direct_fd;
+    STAT_ADD(direct_ios, 1);
+  }
+  req->write = true;
+  req->buf = th->run;
+  req->len = th->run_len;
+  req->offset = th->run_offset;
+  th->run = NULL;
+  th->run_len = 0;
+  aio_submit(req);
+  th->writes[th->num_writes++] = req;
+  return 0;
+}
 
-      if (!*cur) {
-        add_to_list(tok_list, "", terminator, EOC);
-        done = true;
-      }
-    } else if (*cur == '\'') {
-      /* Find STRING_LITERRAL */
-      int t_class;
-      cur++;
-      do {
-        temp_string[i++] = *cur++;
-      } while ((*cur) && (*cur != '\''));
+/* Queue the run and wait for every write */
+static int tab_sync_writes(tab_handle *th) {
+  int rc = tab_queue_run(th);
+  int drain_rc = tab_drain_writes(th);
+  return rc ? rc : drain_rc;
+}
 
-      temp_string[i] = '\0';
+/* Make the writes to [offset, offset + len) reach the file */
+static int tab_io_barrier(tab_handle *th, long offset, int len) {
+  int rc = 0;
+  if ((th->run_len > 0) && ranges_overlap(th->run_offset, th->run_len, offset, len) &&
+      (rc = tab_queue_run(th)))
+    return rc;
+  for (int i = 0; i < th->num_writes; i++)
+    if (ranges_overlap(th->writes[i]->offset, th->writes[i]->len, offset, len))
+      return tab_drain_writes(th);
+  return 0;
+}
 
-      if (!*cur) {
-        /* If we reach the end of line */
-        add_to_list(tok_list, temp_string, error, INVALID);
-        rc = INVALID;
-        done = true;
-      } else /* must be a ' */
-      {
-        add_to_list(tok_list, temp_string, constant, STRING_LITERAL);
-        cur++;
-        if (!*cur) {
-          add_to_list(tok_list, "", terminator, EOC);
-          done = true;
-        }
-      }
-    } else {
-      if (!*cur) {
-        add_to_list(tok_list, "", terminator, EOC);
-        done = true;
-      } else {
-        /* not a ident, number, or valid symbol */
-        temp_string[i++] = *cur++;
-        add_to_list(tok_list, temp_string, error, INVALID);
-        rc = INVALID;
-        done = true;
-      }
+/* Start reading the block at base into its slot */
+static int tab_block_fetch(tab_handle *th, long base) {
+  int rc = 0;
+  aio_block *b = tab_block_slot(th, base);
+  if (b->used) {
+    if (b->req.offset == base)
+      return 0;
+    tab_block_ready(th, b);  // the slot's old read must land before reuse
+  }
+  /* Small files get small buffers; a block is read only up to the end,
+     rounded up to whole sectors for O_DIRECT (the read comes back short) */
+  long block_size = read_block_size();
+  int len = (th->file_end - base < block_size) ? (int)(th->file_end - base)
+                                               : (int)block_size;
+  if (tab_direct(th))
+    len = (len + DIRECT_IO_ALIGN - 1) / DIRECT_IO_ALIGN * DIRECT_IO_ALIGN;
+  if (b->cap < len) {
+    block_buf_put(b->req.buf, b->cap);
+    b->cap = 0;
+    if (!(b->req.buf = block_buf_get(len, &b->cap))) {
+      b->used = false;
+      return MEMORY_ERROR;
     }
   }
+  if ((rc = tab_io_barrier(th, base, len)))
+    return rc;
+  b->used = true;
+  b->valid = -1;
+  b->req.fd = th->fd;
+  if (tab_direct(th)) {
+    b->req.fd = th->direct_fd;
+    STAT_ADD(direct_ios, 1);
+  }
+  b->req.write = false;
+  b->req.offset = base;
+  b->req.len = len;
+  aio_submit(&b->req);
+  return 0;
+}
 
-  return rc;
+/* Moving onto block base: adjust the read-ahead distance and top the
+   window up.  stalled says the scan had to wait for base itself. */
+static int tab_read_ahead(tab_handle *th, long base, bool stalled) {
+  int rc = 0;
+  long block_size = read_block_size();
+  if ((th->read_block >= 0) && (base != th->read_block + block_size)) {
+    if (th->read_ahead > 0)
+      tab_advise(th, 0, 0, POSIX_FADV_RANDOM);
+    th->read_ahead = 0;
+  } else if (th->read_ahead == 0) {
+    tab_advise(th, 0, 0, POSIX_FADV_SEQUENTIAL);
+    th->read_ahead = 1;
+  } else if (stalled) {
+    th->read_ahead = (th->read_ahead * 2 < AIO_READ_AHEAD - 1) ? th->read_ahead * 2
+                                                               : AIO_READ_AHEAD - 1;
+  } else if (th->read_ahead > 1) {
+    aio_block *far = tab_block_slot(th, base + th->read_ahead * block_size);
+    if (far->used && (far->req.offset == base + th->read_ahead * block_size) &&
+        !aio_busy(&far->req))
+      th->read_ahead--;
+  }
+  th->read_block = base;
+
+  long end = base + (th->read_ahead + 1) * block_size;
+  if (end > th->file_end)
+    end = th->file_end;
+  if ((g_aio_engine == AIO_SYNC) && (end > base + block_size)) {
+    /* Nothing would overlap a synchronous read; let the kernel do it */
+    tab_advise(th, base + block_size, end - base - block_size, POSIX_FADV_WILLNEED);
+    return 0;
+  }
+  for (long ahead = base + block_size; ahead < end; ahead += block_size)
+    if ((rc = tab_block_fetch(th, ahead)))
+      return rc;
+  return 0;
 }
 
-void add_to_list(token_list **tok_list, char *token_string, int token_class, int token_value) {
-  token_list *current = *tok_list;
-  token_list *new_token = NULL;
+/* Read len bytes at offset from the read-ahead blocks */
+static int tab_pread(tab_handle *th, void *buf, int len, long offset) {
+  int rc = 0;
+  unsigned char *out = (unsigned char *)buf;
+  bool refetched = false;
+  long block_size = read_block_size();
+  if (!th->blocks &&
+      !(th->blocks = (aio_block *)calloc(AIO_READ_AHEAD, sizeof(aio_block))))
+    return MEMORY_ERROR;
 
-  // printf("%16s \t%d \t %d\n",token_string, token_class, token_value);
+  while (len > 0) {
+    long base = offset - offset % block_size;
+    aio_block *b = tab_block_slot(th, base);
+    bool hit = b->used && (b->req.offset == base);
+    if (!hit && (rc = tab_block_fetch(th, base)))
+      return rc;
+    if ((base != th->read_block) &&
+        (rc = tab_read_ahead(th, base, hit && (b->valid < 0) && aio_busy(&b->req))))
+      return rc;
 
-  new_token = (token_list *)calloc(1, sizeof(token_list));
-  strcpy(new_token->tok_string, token_string);
-  new_token->tok_class = token_class;
-  new_token->tok_value = token_value;
-  new_token->next = NULL;
+    int at = (int)(offset - base);
+    int valid = tab_block_ready(th, b);
+    if (at >= valid) {
+      /* Past the end, unless the file grew since the block was read */
+      if ((offset >= th->file_end) || refetched)
+        return FILE_OPEN_ERROR;
+      b->used = false;
+      refetched = true;
+      continue;
+    }
+    int n = (len < valid - at) ? len : valid - at;
+    memcpy(out, b->req.buf + at, n);
+    out += n;
+    offset += n;
+    len -= n;
+  }
+  return 0;
+}
 
-  if (current == NULL)
-    *tok_list = new_token;
-  else {
-    while (current->next != NULL)
-      current = current->next;
+/* Write len bytes at offset.  Read-ahead blocks holding those bytes are
+   patched, and contiguous writes collect in the write-back run. */
+static int tab_pwrite(tab_handle *th, const void *buf, int len, long offset) {
+  int rc = 0;
+  const unsigned char *data = (const unsigned char *)buf;
+  for (int k = 0; th->blocks && (k < AIO_READ_AHEAD); k++) {
+    aio_block *b = &th->blocks[k];
+    long base = b->req.offset;
+    if (!b->used || !ranges_overlap(base, b->cap, offset, len))
+      continue;
+    long lo = (offset > base) ? offset : base;
+    long hi = (offset + len < base + b->cap) ? offset + len : base + b->cap;
+    int valid = tab_block_ready(th, b);
+    if (lo > base + valid)
+      continue;  // leaves a gap; refetched if read
+    memcpy(b->req.buf + (lo - base), data + (lo - offset), hi - lo);
+    if (hi - base > valid)
+      b->valid = (int)(hi - base);
+  }
+  if (offset + len > th->file_end)
+    th->file_end = offset + len;
+
+  if ((th->run_len > 0) && (offset >= th->run_offset) &&
+      (offset <= th->run_offset + th->run_len) &&
+      (offset + len <= th->run_offset + AIO_RUN_SIZE)) {
+    memcpy(th->run + (offset - th->run_offset), data, len);
+    if (offset + len - th->run_offset > th->run_len)
+      th->run_len = (int)(offset + len - th->run_offset);
+    return 0;
+  }
+  if ((rc = tab_queue_run(th)))
+    return rc;
+  th->run = (unsigned char *)db_malloc_aligned((len > AIO_RUN_SIZE) ? len : AIO_RUN_SIZE, -1);
+  if (!th->run)
+    return MEMORY_ERROR;
+  memcpy(th->run, data, len);
+  th->run_offset = offset;
+  th->run_len = len;
+  return 0;
+}
 
-    current->next = new_token;
+/* Cut the file to size once every queued write is down */
+static int tab_truncate(tab_handle *th, long size) {
+  int rc = tab_sync_writes(th);
+  if (!rc && ftruncate(th->fd, size) != 0)
+    rc = FILE_WRITE_ERROR;
+  th->file_end = size;
+  for (int k = 0; th->blocks && (k < AIO_READ_AHEAD); k++) {
+    aio_block *b = &th->blocks[k];
+    if (!b->used)
+      continue;
+    int valid = tab_block_ready(th, b);
+    if (b->req.offset >= size)
+      b->used = false;
+    else if (b->req.offset + valid > size)
+      b->valid = (int)(size - b->req.offset);
   }
-  return;
+  return rc;
 }
 
-int do_semantic(token_list *tok_list) {
-  int return_code = 0, current_command = INVALID_STATEMENT;
-  bool unique = false;
-  token_list *current_token = tok_list;
+/* Read one record of a fixed-format table, charging the I/O to a plan
+   node when analyzing */
+static int read_row(tab_handle *th, int row_index, unsigned char *row_buffer) {
+  const table_file_header *header = &th->hdr;
+  long pos = row_pos(header, row_index);
+  if (tab_pread(th, row_buffer, header->record_size, pos))
+    return FILE_OPEN_ERROR;
+  STAT_ADD(rows_scanned, 1);
+
+  if (th->plan_node >= 0) {
+    plan_node *p = &g_plan[th->plan_node];
+    /* A page counts as read each time the scan moves onto it */
+    long first_page = pos / DB_PAGE_SIZE;
+    long last_page = (pos + header->record_size - 1) / DB_PAGE_SIZE;
+    p->pages_read += last_page - first_page + (first_page != p->last_page);
+    p->last_page = last_page;
+    p->bytes_read += header->record_size;
+  }
+  return 0;
+}
 
-  if ((current_token->tok_value == K_CREATE) &&
-      ((current_token->next != NULL) && (current_token->next->tok_value == K_TABLE))) {
-    printf("CREATE TABLE statement\n");
-    current_command = CREATE_TABLE;
-    current_token = current_token->next->next;
-  } else if ((current_token->tok_value == K_DROP) &&
-             ((current_token->next != NULL) && (current_token->next->tok_value == K_TABLE))) {
-    printf("DROP TABLE statement\n");
-    current_command = DROP_TABLE;
-    current_token = current_token->next->next;
-  } else if ((current_token->tok_value == K_LIST) &&
-             ((current_token->next != NULL) && (current_token->next->tok_value == K_TABLE))) {
-    printf("LIST TABLE statement\n");
-    current_command = LIST_TABLE;
-    current_token = current_token->next->next;
-  } else if ((current_token->tok_value == K_LIST) &&
-             ((current_token->next != NULL) && (current_token->next->tok_value == K_SCHEMA))) {
-    printf("LIST SCHEMA statement\n");
-    current_command = LIST_SCHEMA;
-    current_token = current_token->next->next;
-  } else if ((current_token->tok_value == K_INSERT) && (current_token->next != NULL) &&
-             (current_token->next->tok_value == K_INTO)) {
-    printf("INSERT statement\n");
-    current_command = INSERT;      // uses your enum (104)
-    current_token = current_token->next->next; // point at <table_name>
-  } else if ((current_token->tok_value == K_DELETE) && (current_token->next != NULL) &&
-             (current_token->next->tok_value == K_FROM)) {
-    printf("DELETE statement\n");
-    current_command = DELETE;
-    current_token = current_token->next->next;
-  } else if ((current_token->tok_value == K_UPDATE) && (current_token->next != NULL)) {
-    printf("UPDATE statement\n");
-    current_command = UPDATE;
-    current_token = current_token->next;
-  } else if (current_token->tok_value == K_SELECT) {
-    printf("SELECT statement\n");
-    current_command = SELECT;
-    current_token = current_token->next;
+static inline long page_pos(const tab_handle *th, int page_no) {
+  return (long)th->hdr.record_offset + (long)page_no * th->page_size;
+}
+
+static inline bool tab_compressed(const tab_handle *th) {
+  return (th->hdr.file_header_flag & TAB_FLAG_COMPRESSED) != 0;
+}
+
+/* Read a whole page; *io_bytes is what actually came off the disk */
+static int page_read(tab_handle *th, int page_no, unsigned char *buf,
+                     int *io_bytes) {
+  *io_bytes = 0;
+  if (!tab_compressed(th)) {
+    if (tab_pread(th, buf, th->page_size, page_pos(th, page_no)))
+      return FILE_OPEN_ERROR;
+    *io_bytes = th->page_size;
+    return 0;
+  }
+
+  if ((page_no < th->pending_cap) && th->pending[page_no]) {
+    memcpy(buf, th->pending[page_no], th->page_size);
+    return 0;
+  }
+  page_frame_header fh;
+  long pos = th->frame_pos[page_no];
+  if (tab_pread(th, &fh, sizeof(fh), pos) ||
+      (fh.comp_len == 0) || (fh.comp_len > (uint32_t)th->page_size))
+    return FILE_OPEN_ERROR;
+  pos += sizeof(fh);
+  if (fh.comp_len == (uint32_t)th->page_size) {
+    if (tab_pread(th, buf, th->page_size, pos))
+      return FILE_OPEN_ERROR;
+  } else if (tab_pread(th, th->frame, fh.comp_len, pos) ||
+             (lz_decompress(th->frame, fh.comp_len, buf, th->page_size) !=
+              th->page_size)) {
+    return FILE_OPEN_ERROR;
+  }
+  *io_bytes = (int)(sizeof(fh) + fh.comp_len);
+  return 0;
+}
+
+/* Write a whole page.  Compressed pages are held until tab_sync_frames. */
+static int page_write(tab_handle *th, int page_no, const unsigned char *buf) {
+  if (!tab_compressed(th))
+    return tab_pwrite(th, buf, th->page_size, page_pos(th, page_no));
+
+  if (page_no >= th->pending_cap) {
+    int cap = (page_no + 1) * 2;
+    unsigned char **pending = (unsigned char **)db_realloc(
+        th->pending, cap * sizeof(unsigned char *), -1);
+    if (!pending)
+      return MEMORY_ERROR;
+    memset(pending + th->pending_cap, 0,
+           (cap - th->pending_cap) * sizeof(unsigned char *));
+    th->pending = pending;
+    th->pending_cap = cap;
+  }
+  if ((!th->pending[page_no]) &&
+      (!(th->pending[page_no] = (unsigned char *)db_malloc(th->page_size, -1))))
+    return MEMORY_ERROR;
+  memcpy(th->pending[page_no], buf, th->page_size);
+  th->frames_dirty = true;
+  return 0;
+}
+
+static int page_num_slots(tab_handle *th, int page_no, int *num_slots) {
+  int rc = 0, io_bytes = 0;
+  slotted_page_header ph;
+  if (page_no == th->page_no) {
+    ph = *(slotted_page_header *)th->page;
+  } else if (!tab_compressed(th)) {
+    if (tab_pread(th, &ph, sizeof(ph), page_pos(th, page_no)))
+      return FILE_OPEN_ERROR;
   } else {
-    printf("Invalid statement\n");
-    return_code = current_command;
+    unsigned char *page = (unsigned char *)db_malloc(th->page_size, -1);
+    if (!page)
+      return MEMORY_ERROR;
+    if (!(rc = page_read(th, page_no, page, &io_bytes)))
+      ph = *(slotted_page_header *)page;
+    free(page);
+    if (rc)
+      return rc;
   }
+  *num_slots = ph.num_slots;
+  return 0;
+}
 
-  if (current_command != INVALID_STATEMENT) {
-    switch (current_command) {
-    case CREATE_TABLE:
-      return_code = sem_create_table(current_token);
-      break;
-    case DROP_TABLE:
-      return_code = sem_drop_table(current_token);
-      break;
-    case LIST_TABLE:
-      return_code = sem_list_tables();
-      break;
-    case LIST_SCHEMA:
-      return_code = sem_list_schema(current_token);
-      break;
-    case INSERT:
-      return_code = sem_insert_into(current_token);
-      break;
-    case DELETE:
-      return_code = sem_delete(current_token);
-      break;
-    case UPDATE:
-      return_code = sem_update(current_token);
-      break;
-    case SELECT:
-      return_code = sem_select(current_token);
+/* Compress the pending pages to disk.  Frames vary in length, so every
+   page from the first pending one on is rewritten, then the file is
+   cut to the new end. */
+static int tab_sync_frames(tab_handle *th) {
+  int rc = 0, first = -1, io_bytes = 0;
+  if (!th->frames_dirty)
+    return 0;
+  for (int p = 0; (p < th->num_pages) && (p < th->pending_cap); p++) {
+    if (th->pending[p]) {
+      first = p;
       break;
-    default:; /* no action */
     }
   }
 
-  return return_code;
+  if (first >= 0) {
+    /* Pull the rest of the old tail into memory before overwriting it */
+    unsigned char *page = (unsigned char *)db_malloc(th->page_size, -1);
+    if (!page)
+      return MEMORY_ERROR;
+    for (int p = first + 1; (p < th->num_frames) && (p < th->num_pages) && !rc; p++) {
+      if ((p >= th->pending_cap) || !th->pending[p]) {
+        if (!(rc = page_read(th, p, page, &io_bytes)))
+          rc = page_write(th, p, page);
+      }
+    }
+    free(page);
+
+    long *frame_pos = (long *)db_realloc(th->frame_pos,
+                                         (th->num_pages + 1) * sizeof(long), -1);
+    if (!rc && !frame_pos)
+      rc = MEMORY_ERROR;
+    if (frame_pos)
+      th->frame_pos = frame_pos;
+
+    long pos = th->frame_pos[first];
+    for (int p = first; (p < th->num_pages) && !rc; p++) {
+      page_frame_header fh;
+      int len = lz_compress(th->pending[p], th->page_size, th->frame,
+                            th->page_size - 1);
+      const unsigned char *data = len ? th->frame : th->pending[p];
+      fh.comp_len = len ? len : th->page_size;
+      th->frame_pos[p] = pos;
+      if (!(rc = tab_pwrite(th, &fh, sizeof(fh), pos)))
+        rc = tab_pwrite(th, data, fh.comp_len, pos + sizeof(fh));
+      pos += sizeof(fh) + fh.comp_len;
+    }
+    if (!rc) {
+      th->frame_pos[th->num_pages] = pos;
+      th->num_frames = th->num_pages;
+      rc = tab_truncate(th, pos);
+    }
+  } else if (th->num_pages < th->num_frames) {
+    /* Only trailing pages went away */
+    th->num_frames = th->num_pages;
+    rc = tab_truncate(th, th->frame_pos[th->num_pages]);
+  }
+
+  for (int p = 0; p < th->pending_cap; p++) {
+    free(th->pending[p]);
+    th->pending[p] = NULL;
+  }
+  th->frames_dirty = false;
+  return rc;
 }
 
-int sem_create_table(token_list *t_list) {
-  int rc = 0;
-  token_list *cur;
-  tpd_entry tab_entry;
-  tpd_entry *new_entry = NULL;
-  bool column_done = false;
-  int cur_id = 0;
-  cd_entry col_entry[MAX_NUM_COL];
+/* Frame offsets of a compressed table, from the frame headers */
+static int tab_load_frames(tab_handle *th) {
+  int cap = 16;
+  long pos = th->hdr.record_offset;
+  th->num_pages = 0;
+  th->frame_pos = (long *)db_malloc(cap * sizeof(long), -1);
+  if (!th->frame_pos)
+    return MEMORY_ERROR;
+  while (pos < th->hdr.file_size) {
+    page_frame_header fh;
+    if (tab_pread(th, &fh, sizeof(fh), pos))
+      return FILE_OPEN_ERROR;
+    if (th->num_pages + 1 >= cap) {
+      long *frame_pos = (long *)db_realloc(th->frame_pos, (cap *= 2) * sizeof(long), -1);
+      if (!frame_pos)
+        return MEMORY_ERROR;
+      th->frame_pos = frame_pos;
+    }
+    th->frame_pos[th->num_pages++] = pos;
+    pos += sizeof(fh) + fh.comp_len;
+  }
+  th->frame_pos[th->num_pages] = pos;
+  th->num_frames = th->num_pages;
+  return 0;
+}
 
-  memset(&tab_entry, '\0', sizeof(tpd_entry));
-  cur = t_list;
-  if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
-      (cur->tok_class != type_name)) {
-    // Error
-    rc = INVALID_TABLE_NAME;
-    cur->tok_value = INVALID;
-  } else {
-    if ((new_entry = get_tpd_from_list(cur->tok_string)) != NULL) {
-      rc = DUPLICATE_TABLE_NAME;
-      cur->tok_value = INVALID;
-    } else {
-      strcpy(tab_entry.table_name, cur->tok_string);
-      cur = cur->next;
-      if (cur->tok_value != S_LEFT_PAREN) {
-        // Error
-        rc = INVALID_TABLE_DEFINITION;
-        cur->tok_value = INVALID;
-      } else {
-        memset(&col_entry, '\0', (MAX_NUM_COL * sizeof(cd_entry)));
+static int tab_flush_page(tab_handle *th) {
+  if ((th->page_no < 0) || (!th->page_dirty))
+    return 0;
+  int rc = page_write(th, th->page_no, th->page);
+  if (!rc)
+    th->page_dirty = false;
+  return rc;
+}
 
-        /* Now build a set of column entries */
-        cur = cur->next;
-        do {
-          if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
-              (cur->tok_class != type_name)) {
-            // Error
-            rc = INVALID_COLUMN_NAME;
-            cur->tok_value = INVALID;
-          } else {
-            int i;
-            for (i = 0; i < cur_id; i++) {
-              /* make column name case sensitive */
-              if (strcmp(col_entry[i].col_name, cur->tok_string) == 0) {
-                rc = DUPLICATE_COLUMN_NAME;
-                cur->tok_value = INVALID;
-                break;
-              }
-            }
+/* Bring a page into the cache; first_row is the row index of its slot 0 */
+static int tab_load_page(tab_handle *th, int page_no, int first_row) {
+  int rc = 0, io_bytes = 0;
+  if (page_no != th->page_no) {
+    if ((rc = tab_flush_page(th)))
+      return rc;
+    th->page_no = -1;
+    if ((rc = page_read(th, page_no, th->page, &io_bytes)))
+      return rc;
+    th->page_no = page_no;
+    if (th->plan_node >= 0) {
+      g_plan[th->plan_node].pages_read++;
+      g_plan[th->plan_node].bytes_read += io_bytes;
+    }
+  }
+  th->page_first_row = first_row;
+  return 0;
+}
 
-            if (!rc) {
-              strcpy(col_entry[cur_id].col_name, cur->tok_string);
-              col_entry[cur_id].col_id = cur_id;
-              col_entry[cur_id].not_null = false; /* set default */
+/* First row of every page, from the page headers */
+static int tab_build_page_dir(tab_handle *th) {
+  int rc = 0;
+  th->page_dir = (int *)db_malloc((th->num_pages + 1) * sizeof(int), -1);
+  if (!th->page_dir)
+    return MEMORY_ERROR;
+  int row = 0;
+  for (int p = 0; p < th->num_pages; p++) {
+    int num_slots = 0;
+    th->page_dir[p] = row;
+    if ((rc = page_num_slots(th, p, &num_slots)))
+      return rc;
+    row += num_slots;
+  }
+  th->page_dir[th->num_pages] = row;
+  return 0;
+}
 
-              cur = cur->next;
-              if (cur->tok_class != type_name) {
-                // Error
-                rc = INVALID_TYPE_NAME;
-                cur->tok_value = INVALID;
-              } else {
-                /* Set the column type here, int or char */
-                col_entry[cur_id].col_type = cur->tok_value;
-                cur = cur->next;
+/* Load the page holding row and return its slot number.  Sequential
+   access walks forward page by page; anything else uses the directory. */
+static int tab_seek_row(tab_handle *th, int row, int *slot) {
+  int rc = 0;
+  if (th->page_no >= 0) {
+    int num_slots = ((slotted_page_header *)th->page)->num_slots;
+    if (row >= th->page_first_row && row < th->page_first_row + num_slots) {
+      *slot = row - th->page_first_row;
+      return 0;
+    }
+    if ((th->page_dir == NULL) && (row >= th->page_first_row + num_slots)) {
+      int page_no = th->page_no, first_row = th->page_first_row + num_slots;
+      while (++page_no < th->num_pages) {
+        if ((rc = tab_load_page(th, page_no, first_row)))
+          return rc;
+        num_slots = ((slotted_page_header *)th->page)->num_slots;
+        if (row < first_row + num_slots) {
+          *slot = row - first_row;
+          return 0;
+        }
+        first_row += num_slots;
+      }
+      return FILE_OPEN_ERROR;
+    }
+  } else if ((row == 0) && (th->num_pages > 0)) {
+    if ((rc = tab_load_page(th, 0, 0)))
+      return rc;
+    if (((slotted_page_header *)th->page)->num_slots > 0) {
+      *slot = 0;
+      return 0;
+    }
+  }
 
-                if (col_entry[cur_id].col_type == T_INT) {
-                  if ((cur->tok_value != S_COMMA) &&
-                      (cur->tok_value != K_NOT) &&
-                      (cur->tok_value != S_RIGHT_PAREN)) {
-                    rc = INVALID_COLUMN_DEFINITION;
-                    cur->tok_value = INVALID;
-                  } else {
-                    col_entry[cur_id].col_len = sizeof(int);
+  if ((th->page_dir == NULL) && (rc = tab_build_page_dir(th)))
+    return rc;
+  int lo = 0, hi = th->num_pages - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (th->page_dir[mid] <= row)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  /* Skip over any empty pages in front of the row */
+  while ((lo + 1 < th->num_pages) && (th->page_dir[lo + 1] <= row))
+    lo++;
+  if ((row < 0) || (row >= th->page_dir[th->num_pages]))
+    return FILE_OPEN_ERROR;
+  if ((rc = tab_load_page(th, lo, th->page_dir[lo])))
+    return rc;
+  *slot = row - th->page_dir[lo];
+  return 0;
+}
 
-                    if ((cur->tok_value == K_NOT) &&
-                        (cur->next->tok_value != K_NULL)) {
-                      rc = INVALID_COLUMN_DEFINITION;
-                      cur->tok_value = INVALID;
-                    } else if ((cur->tok_value == K_NOT) &&
-                               (cur->next->tok_value == K_NULL)) {
-                      col_entry[cur_id].not_null = true;
-                      cur = cur->next->next;
-                    }
+static void tab_forget_pages(tab_handle *th) {
+  th->page_no = -1;
+  th->page_dirty = false;
+  free(th->page_dir);
+  th->page_dir = NULL;
+}
 
-                    if (!rc) {
-                      /* I must have either a comma or right paren */
-                      if ((cur->tok_value != S_RIGHT_PAREN) &&
-                          (cur->tok_value != S_COMMA)) {
-                        rc = INVALID_COLUMN_DEFINITION;
-                        cur->tok_value = INVALID;
-                      } else {
-                        if (cur->tok_value == S_RIGHT_PAREN) {
-                          column_done = true;
-                        }
-                        cur = cur->next;
-                      }
-                    }
-                  }
-                } // end of T_INT processing
-                else {
-                  // It must be char() or varchar()
-                  if (cur->tok_value != S_LEFT_PAREN) {
-                    rc = INVALID_COLUMN_DEFINITION;
-                    cur->tok_value = INVALID;
-                  } else {
-                    /* Enter char(n) processing */
-                    cur = cur->next;
+static void tab_free_buffers(tab_handle *th) {
+  for (int k = 0; th->blocks && (k < AIO_READ_AHEAD); k++) {
+    if (th->blocks[k].used)
+      tab_block_ready(th, &th->blocks[k]);
+    block_buf_put(th->blocks[k].req.buf, th->blocks[k].cap);
+  }
+  if (th->direct_fd >= 0)
+    close(th->direct_fd);
+  free(th->blocks);
+  free(th->run);
+  free(th->page);
+  free(th->scratch);
+  free(th->page_dir);
+  free(th->frame);
+  free(th->frame_pos);
+  for (int p = 0; p < th->pending_cap; p++)
+    free(th->pending[p]);
+  free(th->pending);
+}
 
-                    if (cur->tok_value != INT_LITERAL) {
-                      rc = INVALID_COLUMN_LENGTH;
-                      cur->tok_value = INVALID;
-                    } else {
-                      /* Got a valid integer - convert */
-                      col_entry[cur_id].col_len = atoi(cur->tok_string);
-                      cur = cur->next;
+/* DB_DIRECT=1 opens every table with O_DIRECT */
+static bool direct_io_default() {
+  static int direct = -1;
+  if (direct < 0) {
+    const char *value = getenv("DB_DIRECT");
+    direct = (value && (atoi(value) > 0)) ? 1 : 0;
+  }
+  return direct == 1;
+}
 
-                      if (cur->tok_value != S_RIGHT_PAREN) {
-                        rc = INVALID_COLUMN_DEFINITION;
-                        cur->tok_value = INVALID;
-                      } else {
-                        cur = cur->next;
+/* A second descriptor on the file for the O_DIRECT transfers.  Header
+   I/O and unaligned writes stay on the buffered one.  Where O_DIRECT is
+   not available the handle just keeps using the page cache. */
+static void tab_open_direct(tab_handle *th, const char *table_name) {
+#if defined(O_DIRECT)
+  char filename[MAX_IDENT_LEN + 5] = {0};
+  tab_file_name(filename, sizeof(filename), table_name);
+  th->direct_fd = open(filename, O_RDWR | O_DIRECT);
+  th->direct_ok = (th->direct_fd >= 0);
+#endif
+}
 
-                        if ((cur->tok_value != S_COMMA) &&
-                            (cur->tok_value != K_NOT) &&
-                            (cur->tok_value != S_RIGHT_PAREN)) {
-                          rc = INVALID_COLUMN_DEFINITION;
-                          cur->tok_value = INVALID;
-                        } else {
-                          if ((cur->tok_value == K_NOT) &&
+static int tab_open(const char *table_name, tab_handle *th) {
+  int rc = 0;
+  memset(th, 0, sizeof(*th));
+  th->plan_node = -1;
+  th->page_no = -1;
+  th->read_block = -1;
+  th->direct_fd = -1;
+
+  th->tpd = get_tpd_from_list((char *)table_name);
+  if (!th->tpd)
+    return TABLE_NOT_EXIST;
+  th->cols = (cd_entry *)((char *)th->tpd + th->tpd->cd_offset);
+
+  if ((rc = open_tab_rw(table_name, &th->fp, &th->hdr)))
+    return rc;
+  struct stat file_stat;
+  th->fd = fileno(th->fp);
+  th->file_end = (fstat(th->fd, &file_stat) == 0) ? (long)file_stat.st_size
+                                                  : (long)th->hdr.file_size;
+  if ((th->hdr.file_header_flag & TAB_FLAG_DIRECT) || direct_io_default())
+    tab_open_direct(th, table_name);
+
+  if (th->hdr.file_header_flag & TAB_FLAG_SLOTTED) {
+    th->page_size = slotted_page_size(th->hdr.record_size);
+    th->num_pages =
+        (th->hdr.file_size - th->hdr.record_offset) / th->page_size;
+    th->page = (unsigned char *)db_malloc(th->page_size, -1);
+    th->scratch = (unsigned char *)db_malloc(th->hdr.record_size, -1);
+    if (!th->page || !th->scratch)
+      rc = MEMORY_ERROR;
+    if (!rc && tab_compressed(th)) {
+      if (!(th->frame = (unsigned char *)db_malloc(th->page_size, -1)))
+        rc = MEMORY_ERROR;
+      else
+        rc = tab_load_frames(th);
+    }
+    if (rc) {
+      tab_free_buffers(th);
+      fclose(th->fp);
+      return rc;
+    }
+  }
+  return 0;
+}
+
+static int tab_write_header(tab_handle *th) {
+  int rc = 0;
+  /* Data before the header that counts it */
+  if ((rc = tab_sync_writes(th)))
+    return rc;
+  if (tab_compressed(th)) {
+    if ((rc = tab_sync_frames(th)))
+      return rc;
+    th->hdr.file_size = th->frame_pos[th->num_pages];
+  } else if (th->hdr.file_header_flag & TAB_FLAG_SLOTTED) {
+    th->hdr.file_size = page_pos(th, th->num_pages);
+  }
+  return write_header(th->fp, &th->hdr);
+}
+
+static int tab_close(tab_handle *th) {
+  int rc = tab_flush_page(th);
+  /* In-place updates of a compressed table still change its frames */
+  if (!rc && th->frames_dirty)
+    rc = tab_write_header(th);
+  int sync_rc = tab_sync_writes(th);
+  if (!rc)
+    rc = sync_rc;
+  tab_free_buffers(th);
+  fclose(th->fp);
+  th->fp = NULL;
+  return rc;
+}
+
+/* Read row into the fixed in-memory layout */
+static int tab_read(tab_handle *th, int row, unsigned char *row_buffer) {
+  int rc = 0, slot = 0;
+  if (!(th->hdr.file_header_flag & TAB_FLAG_SLOTTED))
+    return read_row(th, row, row_buffer);
+
+  if ((rc = tab_seek_row(th, row, &slot)))
+    return rc;
+  decode_record(th, th->page + page_slots(th->page)[slot].offset, row_buffer);
+  STAT_ADD(rows_scanned, 1);
+  return 0;
+}
+
+/* Start a new page of a slotted table and make it the cached page */
+static int tab_new_page(tab_handle *th) {
+  int rc = tab_flush_page(th);
+  if (rc)
+    return rc;
+  init_page(th->page, th->page_size);
+  th->page_no = th->num_pages++;
+  th->page_first_row = th->hdr.num_records;
+  th->page_dirty = true;
+  if (th->page_dir) {
+    th->page_dir = (int *)db_realloc(th->page_dir,
+                                     (th->num_pages + 1) * sizeof(int), -1);
+    th->page_dir[th->num_pages] = th->hdr.num_records;
+  }
+  return 0;
+}
+
+/* Place an encoded record in the cached page as a new last slot */
+static void page_add_record(tab_handle *th, const unsigned char *rec, int len) {
+  slotted_page_header *ph = (slotted_page_header *)th->page;
+  slot_entry *se = &page_slots(th->page)[ph->num_slots++];
+  ph->data_start -= len;
+  memcpy(th->page + ph->data_start, rec, len);
+  se->offset = ph->data_start;
+  se->length = se->capacity = (uint16_t)len;
+  th->page_dirty = true;
+}
+
+/* Append a row at the end of the table and update the header */
+static int tab_append(tab_handle *th, const unsigned char *row_buffer) {
+  int rc = 0;
+  if (!(th->hdr.file_header_flag & TAB_FLAG_SLOTTED)) {
+    if ((rc = tab_pwrite(th, row_buffer, th->hdr.record_size,
+                         row_pos(&th->hdr, th->hdr.num_records))))
+      return rc;
+  } else {
+    int len = encode_record(th, row_buffer, th->scratch);
+    if (th->num_pages > 0) {
+      /* The rows of the last page are the last rows of the table */
+      int last = th->num_pages - 1;
+      if (th->page_no != last) {
+        int num_slots = 0;
+        if ((rc = page_num_slots(th, last, &num_slots)))
+          return rc;
+        rc = tab_load_page(th, last, th->hdr.num_records - num_slots);
+      }
+    }
+    if ((!rc) && ((th->num_pages == 0) ||
+                  (page_free_space(th->page) < len + (int)sizeof(slot_entry))))
+      rc = tab_new_page(th);
+    if (rc)
+      return rc;
+    page_add_record(th, th->scratch, len);
+    if (th->page_dir)
+      th->page_dir[th->num_pages]++;
+    if ((rc = tab_flush_page(th)))
+      return rc;
+  }
+  STAT_ADD(records_written, 1);
+  th->hdr.num_records++;
+  return tab_write_header(th);
+}
+
+/* Write the kept rows of a slotted table back to back from page 0.  Output
+   never overtakes input: page p is fully cached before any of its rows are
+   placed, and packed output needs at most p + 1 pages by then. */
+static int tab_pack(tab_handle *th, const bool *keep_row) {
+  int rc = 0, out_rows = 0, out_pages = 0, in_row = 0;
+  int in_pages = th->num_pages;
+  unsigned char *out = (unsigned char *)db_malloc(th->page_size, -1);
+  if (!out)
+    return MEMORY_ERROR;
+  init_page(out, th->page_size);
+
+  if ((rc = tab_flush_page(th))) {
+    free(out);
+    return rc;
+  }
+  for (int p = 0; p < in_pages && !rc; p++) {
+    if ((rc = tab_load_page(th, p, in_row)))
+      break;
+    slotted_page_header *ph = (slotted_page_header *)th->page;
+    for (int s = 0; s < ph->num_slots; s++, in_row++) {
+      if (!keep_row[in_row])
+        continue;
+      slot_entry *se = &page_slots(th->page)[s];
+      if (page_free_space(out) < se->length + (int)sizeof(slot_entry)) {
+        if ((rc = page_write(th, out_pages++, out)))
+          break;
+        init_page(out, th->page_size);
+      }
+      slotted_page_header *oh = (slotted_page_header *)out;
+      slot_entry *oe = &page_slots(out)[oh->num_slots++];
+      oh->data_start -= se->length;
+      memcpy(out + oh->data_start, th->page + se->offset, se->length);
+      oe->offset = oh->data_start;
+      oe->length = oe->capacity = se->length;
+      out_rows++;
+      STAT_ADD(records_written, 1);
+    }
+  }
+  if ((!rc) && (((slotted_page_header *)out)->num_slots > 0))
+    rc = page_write(th, out_pages++, out);
+  free(out);
+  tab_forget_pages(th);
+
+  if (!rc) {
+    th->num_pages = out_pages;
+    th->hdr.num_records = out_rows;
+    rc = tab_write_header(th);
+    /* The file shrinks with the table */
+    if (!rc)
+      rc = tab_truncate(th, th->hdr.file_size);
+  }
+  return rc;
+}
+
+/* Keep only the rows flagged in keep_row (used by DELETE) */
+static int tab_compact(tab_handle *th, const bool *keep_row) {
+  int rc = 0, write_idx = 0;
+  if (th->hdr.file_header_flag & TAB_FLAG_SLOTTED)
+    return tab_pack(th, keep_row);
+
+  unsigned char *row_buffer = (unsigned char *)db_malloc(th->hdr.record_size, -1);
+  if (!row_buffer)
+    return MEMORY_ERROR;
+  for (int row_idx = 0; row_idx < th->hdr.num_records; row_idx++) {
+    if (keep_row[row_idx]) {
+      if ((rc = read_row(th, row_idx, row_buffer)))
+        break;
+      if ((rc = tab_pwrite(th, row_buffer, th->hdr.record_size,
+                           row_pos(&th->hdr, write_idx))))
+        break;
+      STAT_ADD(records_written, 1);
+      write_idx++;
+    }
+  }
+  free(row_buffer);
+
+  if (!rc) {
+    th->hdr.num_records = write_idx;
+    rc = tab_write_header(th);
+  }
+  return rc;
+}
+
+/* Squeeze out the slack left by shrunken records and drop the old copy of
+   skip_slot.  Returns the free space left in the page. */
+static int page_repack(tab_handle *th, int skip_slot) {
+  unsigned char *tmp = (unsigned char *)db_malloc(th->page_size, -1);
+  if (!tmp)
+    return 0;
+  slotted_page_header *ph = (slotted_page_header *)th->page;
+  slot_entry *slots = page_slots(th->page);
+  int end = th->page_size;
+  for (int s = 0; s < ph->num_slots; s++) {
+    int len = (s == skip_slot) ? 0 : slots[s].length;
+    end -= len;
+    memcpy(tmp + end, th->page + slots[s].offset, len);
+    slots[s].offset = (uint16_t)end;
+    slots[s].length = slots[s].capacity = (uint16_t)len;
+  }
+  memcpy(th->page + end, tmp + end, th->page_size - end);
+  free(tmp);
+  ph->data_start = (uint16_t)end;
+  th->page_dirty = true;
+  return page_free_space(th->page);
+}
+
+/* Replace the table's contents with num_rows records from rows */
+static int tab_replace_rows(tab_handle *th, const unsigned char *rows, int num_rows) {
+  int rc = 0;
+  tab_forget_pages(th);
+  th->num_pages = 0;
+  th->hdr.num_records = 0;
+  for (int i = 0; i < num_rows && !rc; i++)
+    rc = tab_append(th, rows + (size_t)i * th->hdr.record_size);
+  if (!rc)
+    rc = tab_write_header(th);
+  if (!rc)
+    rc = tab_truncate(th, (th->hdr.file_header_flag & TAB_FLAG_SLOTTED)
+                              ? th->hdr.file_size
+                              : row_pos(&th->hdr, th->hdr.num_records));
+  return rc;
+}
+
+/* Rewrite the whole table with row replaced, keeping row order.  Used when
+   a grown record no longer fits in its page. */
+static int tab_rebuild(tab_handle *th, int row, const unsigned char *row_buffer) {
+  int rc = 0, num_rows = th->hdr.num_records;
+  int record_size = th->hdr.record_size;
+  unsigned char *rows = (unsigned char *)db_malloc((size_t)num_rows * record_size, -1);
+  if (!rows)
+    return MEMORY_ERROR;
+  for (int i = 0; i < num_rows && !rc; i++)
+    rc = tab_read(th, i, rows + (size_t)i * record_size);
+  if (!rc) {
+    memcpy(rows + (size_t)row * record_size, row_buffer, record_size);
+    rc = tab_replace_rows(th, rows, num_rows);
+  }
+  free(rows);
+  return rc;
+}
+
+/* Rewrite row in place.  A slotted record is updated in place when the
+   new encoding fits its reserved space, moved within its page when the
+   page has room, and otherwise moved to the end of the table. */
+static int tab_write(tab_handle *th, int row, const unsigned char *row_buffer) {
+  int rc = 0, slot = 0;
+  if (!(th->hdr.file_header_flag & TAB_FLAG_SLOTTED)) {
+    if ((rc = tab_pwrite(th, row_buffer, th->hdr.record_size, row_pos(&th->hdr, row))))
+      return rc;
+    STAT_ADD(records_written, 1);
+    return 0;
+  }
+
+  if ((rc = tab_seek_row(th, row, &slot)))
+    return rc;
+  int len = encode_record(th, row_buffer, th->scratch);
+  slotted_page_header *ph = (slotted_page_header *)th->page;
+  slot_entry *se = &page_slots(th->page)[slot];
+
+  if (len <= se->capacity) {
+    memcpy(th->page + se->offset, th->scratch, len);
+    se->length = (uint16_t)len;
+  } else if (page_free_space(th->page) >= len) {
+    ph->data_start -= len;
+    memcpy(th->page + ph->data_start, th->scratch, len);
+    se->offset = ph->data_start;
+    se->length = se->capacity = (uint16_t)len;
+  } else if (page_repack(th, slot) >= len) {
+    ph->data_start -= len;
+    memcpy(th->page + ph->data_start, th->scratch, len);
+    se->offset = ph->data_start;
+    se->length = se->capacity = (uint16_t)len;
+  } else {
+    unsigned char *saved = (unsigned char *)db_malloc(th->hdr.record_size, -1);
+    if (!saved)
+      return MEMORY_ERROR;
+    memcpy(saved, row_buffer, th->hdr.record_size);
+    rc = tab_rebuild(th, row, saved);
+    free(saved);
+    return rc;
+  }
+  th->page_dirty = true;
+  STAT_ADD(records_written, 1);
+  return 0;
+}
+
+/*************************************************************
+        Parallel DML - DELETE and UPDATE over record ranges
+ *************************************************************/
+
+/* Offset of a column's length byte in the fixed row layout */
+static int dml_column_offset(const tpd_entry *tpd, int col_index) {
+  const cd_entry *columns = (const cd_entry *)((const char *)tpd + tpd->cd_offset);
+  int offset = 0;
+  for (int col = 0; col < col_index; col++)
+    offset += 1 + ((columns[col].col_type == T_INT) ? 4 : columns[col].col_len);
+  return offset;
+}
+
+/* The WHERE of a DELETE or UPDATE.  A NULL field never matches.  DELETE
+   compares strings over the stored characters only (with = and <> also
+   checking the length), UPDATE compares them as whole strings. */
+static bool dml_where_match(const dml_where *w, const unsigned char *row) {
+  if (!w->has_where)
+    return true;
+  const unsigned char *field = row + w->offset;
+  int len = field[0];
+  if (len == 0)
+    return false;
+  int cmp;
+  if (w->col_type == T_INT) {
+    if (w->value_type != INT_LITERAL)
+      return false;
+    int32_t row_int;
+    memcpy(&row_int, field + 1, 4);
+    cmp = (row_int > w->int_value) - (row_int < w->int_value);
+  } else {
+    if (w->value_type != STRING_LITERAL)
+      return false;
+    cmp = strncmp((const char *)field + 1, w->str_value, len);
+    if (w->prefix_compare) {
+      if ((w->operator_type == S_EQUAL) || (w->operator_type == S_NOT_EQUAL))
+        cmp = ((cmp == 0) && (len == (int)strlen(w->str_value))) ? 0 : 1;
+    } else if ((cmp == 0) && w->str_value[len]) {
+      cmp = -1;  // the field is a prefix of the literal
+    }
+  }
+  switch (w->operator_type) {
+  case S_EQUAL:
+    return cmp == 0;
+  case S_LESS:
+    return cmp < 0;
+  case S_GREATER:
+    return cmp > 0;
+  case S_LESS_EQUAL:
+    return cmp <= 0;
+  case S_GREATER_EQUAL:
+    return cmp >= 0;
+  case S_NOT_EQUAL:
+    return cmp != 0;
+  }
+  return false;
+}
+
+/* Store UPDATE's SET value in a row */
+static void dml_set_column(const dml_set *s, unsigned char *row) {
+  unsigned char *field = row + s->offset;
+  int width = (s->col_type == T_INT) ? 4 : s->col_len;
+  if (s->value_type == K_NULL) {
+    field[0] = 0;
+    memset(field + 1, 0, width);
+  } else if (s->col_type == T_INT) {
+    field[0] = 4;
+    memcpy(field + 1, &s->int_value, 4);
+  } else {
+    int len = strlen(s->str_value);
+    field[0] = len;
+    memcpy(field + 1, s->str_value, len);
+    if (len < width)
+      memset(field + 1 + len, 0, width - len);
+  }
+}
+
+/* Whole-range pread/pwrite on the table's descriptor */
+static int dml_io(int fd, unsigned char *buf, long len, long offset, bool write) {
+  aio_req req;
+  memset(&req, 0, sizeof(req));
+  req.fd = fd;
+  req.write = write;
+  req.buf = buf;
+  req.len = (int)len;
+  req.offset = offset;
+  if (aio_transfer(&req) != len)
+    return write ? FILE_WRITE_ERROR : FILE_OPEN_ERROR;
+  if (write)
+    STAT_ADD(bytes_written, len);
+  else
+    STAT_ADD(bytes_read, len);
+  return 0;
+}
+
+/* Records in one DML morsel: DB_MORSEL_ROWS, within DML_MORSEL_BYTES */
+static long dml_morsel_rows(int record_size) {
+  long rows = DML_MORSEL_BYTES / record_size;
+  if (rows > morsel_rows())
+    rows = morsel_rows();
+  return (rows < 1) ? 1 : rows;
+}
+
+/* DELETE, first half of a window: read one morsel of it into place in
+   the window buffer and pack the records that stay to its front */
+static void dml_delete_read_task(void *arg, long first, long end, int worker) {
+  parallel_dml *pd = (parallel_dml *)arg;
+  int rs = pd->hdr->record_size;
+  long m = first / pd->morsel_rows;
+  unsigned char *buf = pd->window + (size_t)first * rs;
+  pd->kept[m] = 0;
+  int rc = dml_io(pd->fd, buf, (end - first) * rs, row_pos(pd->hdr, pd->first_row + first),
+                  false);
+  if (rc) {
+    pd->rc[worker] = rc;
+    return;
+  }
+  STAT_ADD(rows_scanned, end - first);
+  STAT_ADD(dml_ranges, 1);
+  int kept = 0;
+  for (int i = 0; i < end - first; i++) {
+    unsigned char *row = buf + (size_t)i * rs;
+    if (dml_where_match(pd->where, row)) {
+      pd->matched[worker]++;
+      continue;
+    }
+    if (kept != i)
+      memcpy(buf + (size_t)kept * rs, row, rs);
+    kept++;
+  }
+  pd->kept[m] = kept;
+}
+
+/* DELETE, second half: write a morsel's packed records at their new
+   place.  The whole window has been read by now, and no record moves
+   past the end of the window, so the writes only land on records
+   already in the buffer. */
+static void dml_delete_write_task(void *arg, long first, long end, int worker) {
+  parallel_dml *pd = (parallel_dml *)arg;
+  long m = first / pd->morsel_rows;
+  int kept = pd->kept[m];
+  if ((kept == 0) || ((pd->dest[m] == pd->first_row + first) && (kept == end - first)))
+    return;  // nothing to write, or nothing moved
+  int rs = pd->hdr->record_size;
+  int rc = dml_io(pd->fd, pd->window + (size_t)first * rs, (long)kept * rs,
+                  row_pos(pd->hdr, pd->dest[m]), true);
+  if (rc)
+    pd->rc[worker] = rc;
+  else
+    STAT_ADD(records_written, kept);
+}
+
+/* UPDATE: rewrite the matching records of one morsel */
+static void dml_update_task(void *arg, long first, long end, int worker) {
+  parallel_dml *pd = (parallel_dml *)arg;
+  int rs = pd->hdr->record_size;
+  unsigned char *buf = pd->bufs[worker];
+  long len = (end - first) * rs;
+  int rc = dml_io(pd->fd, buf, len, row_pos(pd->hdr, first), false);
+  if (rc) {
+    pd->rc[worker] = rc;
+    return;
+  }
+  STAT_ADD(rows_scanned, end - first);
+  STAT_ADD(dml_ranges, 1);
+  int changed = 0;
+  for (int i = 0; i < end - first; i++) {
+    unsigned char *rec = buf + (size_t)i * rs;
+    if (dml_where_match(pd->where, rec)) {
+      dml_set_column(pd->set, rec);
+      changed++;
+    }
+  }
+  if (changed == 0)
+    return;
+  if ((rc = dml_io(pd->fd, buf, len, row_pos(pd->hdr, first), true)))
+    pd->rc[worker] = rc;
+  else
+    STAT_ADD(records_written, changed);
+  pd->matched[worker] += changed;
+}
+
+/* Hand the file over to worker threads: queued writes down, and no
+   read-ahead block left to go stale */
+static int tab_release_io(tab_handle *th) {
+  int rc = tab_sync_writes(th);
+  for (int k = 0; th->blocks && (k < AIO_READ_AHEAD); k++) {
+    aio_block *b = &th->blocks[k];
+    if (b->used)
+      tab_block_ready(th, b);
+    b->used = false;
+  }
+  th->read_block = -1;
+  return rc;
+}
+
+static int dml_first_rc(const parallel_dml *pd) {
+  for (int w = 0; w < MAX_THREADS; w++)
+    if (pd->rc[w])
+      return pd->rc[w];
+  return 0;
+}
+
+static int dml_matched(const parallel_dml *pd) {
+  int matched = 0;
+  for (int w = 0; w < MAX_THREADS; w++)
+    matched += pd->matched[w];
+  return matched;
+}
+
+/* DELETE the rows matching where with num_threads threads.  The kept
+   records close up in place and the header is written once. */
+static int tab_delete_parallel(tab_handle *th, const dml_where *where, int num_threads,
+                               int *deleted, int plan_node) {
+  int rc = 0;
+  parallel_dml pd;
+  memset(&pd, 0, sizeof(pd));
+  *deleted = 0;
+  if ((rc = tab_release_io(th)))
+    return rc;
+  int rs = th->hdr.record_size, n = th->hdr.num_records;
+  pd.morsel_rows = dml_morsel_rows(rs);
+  long window = DML_WINDOW_BYTES / rs / pd.morsel_rows * pd.morsel_rows;
+  if (window < pd.morsel_rows)
+    window = pd.morsel_rows;
+  long morsels = window / pd.morsel_rows;
+  pd.fd = th->fd;
+  pd.hdr = &th->hdr;
+  pd.where = where;
+  pd.window = (unsigned char *)db_malloc((size_t)window * rs, plan_node);
+  pd.kept = (int *)db_malloc(morsels * sizeof(int), plan_node);
+  pd.dest = (int *)db_malloc(morsels * sizeof(int), plan_node);
+  if (!pd.window || !pd.kept || !pd.dest)
+    rc = MEMORY_ERROR;
+
+  int out = 0;  // records kept so far
+  for (int first = 0; (first < n) && !rc; first += window) {
+    long rows = (n - first < window) ? n - first : window;
+    pd.first_row = first;
+    parallel_morsels(num_threads, rows, pd.morsel_rows, dml_delete_read_task, &pd);
+    if ((rc = dml_first_rc(&pd)))
+      break;
+    for (long m = 0; m * pd.morsel_rows < rows; m++) {
+      pd.dest[m] = out;
+      out += pd.kept[m];
+    }
+    parallel_morsels(num_threads, rows, pd.morsel_rows, dml_delete_write_task, &pd);
+    rc = dml_first_rc(&pd);
+  }
+  free(pd.window);
+  free(pd.kept);
+  free(pd.dest);
+
+  *deleted = dml_matched(&pd);
+  if (!rc && (*deleted > 0)) {
+    th->hdr.num_records = out;
+    rc = tab_write_header(th);
+  }
+  return rc;
+}
+
+/* UPDATE the rows matching where with num_threads threads, a morsel at
+   a time */
+static int tab_update_parallel(tab_handle *th, const dml_where *where, const dml_set *set,
+                               int num_threads, int *updated, int plan_node) {
+  int rc = 0;
+  parallel_dml pd;
+  memset(&pd, 0, sizeof(pd));
+  *updated = 0;
+  if ((rc = tab_release_io(th)))
+    return rc;
+  pd.morsel_rows = dml_morsel_rows(th->hdr.record_size);
+  pd.fd = th->fd;
+  pd.hdr = &th->hdr;
+  pd.where = where;
+  pd.set = set;
+  /* Any worker may pick up a morsel */
+  for (int w = 0; w < db_threads(); w++)
+    if (!(pd.bufs[w] = (unsigned char *)db_malloc((size_t)pd.morsel_rows * th->hdr.record_size,
+                                                  plan_node)))
+      rc = MEMORY_ERROR;
+  if (!rc) {
+    parallel_morsels(num_threads, th->hdr.num_records, pd.morsel_rows, dml_update_task, &pd);
+    rc = dml_first_rc(&pd);
+    *updated = dml_matched(&pd);
+  }
+  for (int w = 0; w < db_threads(); w++)
+    free(pd.bufs[w]);
+  return rc;
+}
+
+static int create_table_data_file(const tpd_entry *table_descriptor) {
+  char filename[MAX_IDENT_LEN + 5] = {0};
+  tab_file_name(filename, sizeof(filename), table_descriptor->table_name);
+
+  int record_size = compute_record_size_from_tpd(table_descriptor);
+
+  table_file_header header = {0};
+  header.record_size = record_size;
+  header.num_records = 0;
+  header.record_offset = sizeof(table_file_header);
+  /* Initially only write the header; do not pre-allocate space for MAX_ROWS */
+  header.file_size = header.record_offset;
+  header.file_header_flag = 0;
+  header.tpd_ptr = 0; // zero on disk
+
+  /* Tables with VARCHAR columns store records at their encoded length */
+  const cd_entry *column = (const cd_entry *)((const char *)table_descriptor + table_descriptor->cd_offset);
+  for (int col_index = 0; col_index < table_descriptor->num_columns; ++col_index)
+    if (column[col_index].col_type == T_VARCHAR)
+      header.file_header_flag |= TAB_FLAG_SLOTTED;
+  /* Compression works on pages, so compressed tables are always slotted */
+  if (table_descriptor->tpd_flags & TPD_FLAG_COMPRESSED)
+    header.file_header_flag |= TAB_FLAG_SLOTTED | TAB_FLAG_COMPRESSED;
+  /* O_DIRECT tables start their records on a sector boundary, so whole
+     pages can be written around the page cache */
+  if (table_descriptor->tpd_flags & TPD_FLAG_DIRECT) {
+    header.file_header_flag |= TAB_FLAG_DIRECT;
+    header.record_offset = DIRECT_IO_ALIGN;
+    header.file_size = header.record_offset;
+  }
+
+  /* Write only the header to create a small initial file. File will grow as
+   * records are inserted. */
+  FILE *file_handle = fopen(filename, "wb");
+  if (!file_handle)
+    return FILE_OPEN_ERROR;
+  STAT_ADD(header_writes, 1);
+  if (db_fwrite(&header, sizeof(header), 1, file_handle) != 1) {
+    fclose(file_handle);
+    return FILE_WRITE_ERROR;
+  }
+  fflush(file_handle);
+  int rc = 0;
+  if (ftruncate(fileno(file_handle), header.record_offset) != 0)
+    rc = FILE_WRITE_ERROR;
+  fclose(file_handle);
+  return rc;
+}
+
+static int drop_table_data_file(const char *table_name) {
+  char fname[MAX_IDENT_LEN + 5] = {0};
+  snprintf(fname, sizeof(fname), "%s.tab", table_name);
+  if ((remove(fname) != 0) && (errno != ENOENT))
+    return FILE_OPEN_ERROR;
+  /* A materialized view also has its definition file */
+  snprintf(fname, sizeof(fname), "%.*s.mv", MAX_IDENT_LEN, table_name);
+  if ((remove(fname) != 0) && (errno != ENOENT))
+    return FILE_OPEN_ERROR;
+  return 0;
+}
+
+/* Printable form of a comparison operator token */
+static const char *op_symbol(int operator_type) {
+  switch (operator_type) {
+  case S_EQUAL:
+    return "=";
+  case S_LESS:
+    return "<";
+  case S_GREATER:
+    return ">";
+  case S_LESS_EQUAL:
+    return "<=";
+  case S_GREATER_EQUAL:
+    return ">=";
+  case S_NOT_EQUAL:
+    return "<>";
+  case K_IS:
+    return "IS";
+  }
+  return "?";
+}
+
+/**
+ * Find common columns between two tables for NATURAL JOIN
+ */
+static int find_common_columns(tpd_entry *tpd1, tpd_entry *tpd2, int *col_map1,
+                               int *col_map2) {
+  cd_entry *cols1 = (cd_entry *)((char *)tpd1 + tpd1->cd_offset);
+  cd_entry *cols2 = (cd_entry *)((char *)tpd2 + tpd2->cd_offset);
+  int num_common = 0;
+
+  for (int i = 0; i < tpd1->num_columns; i++) {
+    for (int j = 0; j < tpd2->num_columns; j++) {
+      if (strcmp(cols1[i].col_name, cols2[j].col_name) == 0) {
+        col_map1[num_common] = i;
+        col_map2[num_common] = j;
+        num_common++;
+        break;
+      }
+    }
+  }
+
+  return num_common;
+}
+
+#ifndef DB_NO_MAIN
+int main(int argc, char **argv) {
+  int rc = 0;
+  const char *mode_name = getenv("DB_OUTPUT");
+  int arg = 1;
+
+  if ((argc == 4) && (strcmp(argv[1], "-o") == 0)) {
+    mode_name = argv[2];
+    arg = 3;
+  }
+  if ((argc != arg + 1) || (strlen(argv[arg]) == 0)) {
+    printf("Usage: db [-o table|csv|tsv|json|raw] \"command statement\"\n");
+    return 1;
+  }
+  if (mode_name && *mode_name && ((g_output_mode = parse_output_mode(mode_name)) < 0)) {
+    printf("Unknown output mode: %s\n", mode_name);
+    return 1;
+  }
+
+  /* The other formats are meant for pipes: stdout carries only the
+     result rows, and the statement echo and messages go to stderr */
+  if (g_output_mode != OUT_TABLE) {
+    fflush(stdout);
+    g_result_fp = fdopen(dup(fileno(stdout)), "w");
+    dup2(fileno(stderr), fileno(stdout));
+    g_trace_tokens = false;
+  }
+
+  /* DB_STATS=1 dumps the I/O and allocation counters when we exit */
+  if (getenv("DB_STATS") != NULL)
+    atexit(dump_stats_at_exit);
+
+  rc = initialize_tpd_list();
+
+  if (rc) {
+    printf("\nError in initialize_tpd_list().\nrc = %d\n", rc);
+  } else {
+    rc = db_execute(argv[arg]);
+  }
+
+  return rc;
+}
+#endif
+
+/* Run one statement through the lexer and the semantic routines.  The
+   catalog must already be loaded with initialize_tpd_list().  main() uses
+   this for the command line, and db_bench.cpp drives the engine through it
+   in-process. */
+int db_execute(char *command) {
+  int rc = 0;
+  token_list *tok_list = NULL, *tok_ptr = NULL, *tmp_tok_ptr = NULL;
+
+  rc = get_token(command, &tok_list);
+
+  /* Test code */
+  tok_ptr = g_trace_tokens ? tok_list : NULL;
+  while (tok_ptr != NULL) {
+    printf("%16s \t%d \t %d\n", tok_ptr->tok_string, tok_ptr->tok_class,
+           tok_ptr->tok_value);
+    tok_ptr = tok_ptr->next;
+  }
+
+  if (!rc) {
+    rc = do_semantic(tok_list);
+  }
+
+  if (rc) {
+    bool found_error = false;
+    tok_ptr = tok_list;
+    while (tok_ptr != NULL) {
+      if ((tok_ptr->tok_class == error) || (tok_ptr->tok_value == INVALID)) {
+        printf("\nError in the string: %s\n", tok_ptr->tok_string);
+        printf("rc=%d\n", rc);
+        found_error = true;
+        break;
+      }
+      tok_ptr = tok_ptr->next;
+    }
+    if (!found_error) {
+      printf("\nError: rc=%d\n", rc);
+    }
+  }
+
+  /* Whether the token list is valid or not, we need to free the memory */
+  tok_ptr = tok_list;
+  while (tok_ptr != NULL) {
+    tmp_tok_ptr = tok_ptr->next;
+    free(tok_ptr);
+    tok_ptr = tmp_tok_ptr;
+  }
+
+  return rc;
+}
+
+/*************************************************************
+        This is a lexical analyzer for simple SQL statements
+ *************************************************************/
+int get_token(char *command, token_list **tok_list) {
+  int rc = 0, i, j;
+  char *start, *cur, temp_string[MAX_TOK_LEN];
+  bool done = false;
+
+  start = cur = command;
+  while (!done) {
+    bool found_keyword = false;
+
+    /* This is the TOP Level for each token */
+    memset((void *)temp_string, '\0', MAX_TOK_LEN);
+    i = 0;
+
+    /* Get rid of all the leading blanks */
+    while (*cur == ' ')
+      cur++;
+
+    if (cur && isalpha(*cur)) {
+      // find valid identifier
+      int t_class;
+      do {
+        temp_string[i++] = *cur++;
+      } while ((isalnum(*cur)) || (*cur == '_'));
+
+      if (!(strchr(STRING_BREAK, *cur))) {
+        /* If the next char following the keyword or identifier
+           is not a blank, (, ), or a comma, then append this
+                 character to temp_string, and flag this as an error */
+        temp_string[i++] = *cur++;
+        add_to_list(tok_list, temp_string, error, INVALID);
+        rc = INVALID;
+        done = true;
+      } else {
+
+        // We have an identifier with at least 1 character
+        // Now check if this ident is a keyword
+        for (j = 0, found_keyword = false; j < TOTAL_KEYWORDS_PLUS_TYPE_NAMES;
+             j++) {
+          if ((strcasecmp(keyword_table[j], temp_string) == 0)) {
+            found_keyword = true;
+            break;
+          }
+        }
+
+        if (found_keyword) {
+          if (KEYWORD_OFFSET + j < K_CREATE)
+            t_class = type_name;
+          else if (KEYWORD_OFFSET + j >= F_SUM)
+            t_class = function_name;
+          else
+            t_class = keyword;
+
+          add_to_list(tok_list, temp_string, t_class, KEYWORD_OFFSET + j);
+        } else {
+          if (strlen(temp_string) <= MAX_IDENT_LEN)
+            add_to_list(tok_list, temp_string, identifier, IDENT);
+          else {
+            add_to_list(tok_list, temp_string, error, INVALID);
+            rc = INVALID;
+            done = true;
+          }
+        }
+
+        if (!*cur) {
+          add_to_list(tok_list, "", terminator, EOC);
+          done = true;
+        }
+      }
+    } else if (isdigit(*cur)) {
+      // find valid number
+      do {
+        temp_string[i++] = *cur++;
+      } while (isdigit(*cur));
+
+      if (!(strchr(NUMBER_BREAK, *cur))) {
+        /* If the next char following the keyword or identifier
+           is not a blank or a ), then append this
+                 character to temp_string, and flag this as an error */
+        temp_string[i++] = *cur++;
+        add_to_list(tok_list, temp_string, error, INVALID);
+        rc = INVALID;
+        done = true;
+      } else {
+        add_to_list(tok_list, temp_string, constant, INT_LITERAL);
+
+        if (!*cur) {
+          add_to_list(tok_list, "", terminator, EOC);
+          done = true;
+        }
+      }
+    } else if ((*cur == '(') || (*cur == ')') || (*cur == ',') ||
+               (*cur == '*') || (*cur == '=') || (*cur == '<') ||
+               (*cur == '>') || (*cur == '.')) {
+      /* Catch all the symbols here. Check for multi-char operators. */
+      int t_value;
+      
+      // Check for multi-character operators: <=, >=, <>
+      if (*cur == '<') {
+        temp_string[i++] = *cur++;
+        if (*cur == '=') {
+          temp_string[i++] = *cur++;
+          t_value = S_LESS_EQUAL;
+        } else if (*cur == '>') {
+          temp_string[i++] = *cur++;
+          t_value = S_NOT_EQUAL;
+        } else {
+          t_value = S_LESS;
+        }
+      } else if (*cur == '>') {
+        temp_string[i++] = *cur++;
+        if (*cur == '=') {
+          temp_string[i++] = *cur++;
+          t_value = S_GREATER_EQUAL;
+        } else {
+          t_value = S_GREATER;
+        }
+      } else {
+        // Single character operators
+        switch (*cur) {
+        case '(':
+          t_value = S_LEFT_PAREN;
+          break;
+        case ')':
+          t_value = S_RIGHT_PAREN;
+          break;
+        case ',':
+          t_value = S_COMMA;
+          break;
+        case '*':
+          t_value = S_STAR;
+          break;
+        case '=':
+          t_value = S_EQUAL;
+          break;
+        case '.':
+          t_value = S_DOT;
+          break;
+        }
+        temp_string[i++] = *cur++;
+      }
+
+      add_to_list(tok_list, temp_string, symbol, t_value);
+
+      if (!*cur) {
+        add_to_list(tok_list, "", terminator, EOC);
+        done = true;
+      }
+    } else if (*cur == '\'') {
+      /* Find STRING_LITERRAL */
+      int t_class;
+      cur++;
+      do {
+        temp_string[i++] = *cur++;
+      } while ((*cur) && (*cur != '\''));
+
+      temp_string[i] = '\0';
+
+      if (!*cur) {
+        /* If we reach the end of line */
+        add_to_list(tok_list, temp_string, error, INVALID);
+        rc = INVALID;
+        done = true;
+      } else /* must be a ' */
+      {
+        add_to_list(tok_list, temp_string, constant, STRING_LITERAL);
+        cur++;
+        if (!*cur) {
+          add_to_list(tok_list, "", terminator, EOC);
+          done = true;
+        }
+      }
+    } else {
+      if (!*cur) {
+        add_to_list(tok_list, "", terminator, EOC);
+        done = true;
+      } else {
+        /* not a ident, number, or valid symbol */
+        temp_string[i++] = *cur++;
+        add_to_list(tok_list, temp_string, error, INVALID);
+        rc = INVALID;
+        done = true;
+      }
+    }
+  }
+
+  return rc;
+}
+
+void add_to_list(token_list **tok_list, char *token_string, int token_class, int token_value) {
+  token_list *current = *tok_list;
+  token_list *new_token = NULL;
+
+  // printf("%16s \t%d \t %d\n",token_string, token_class, token_value);
+
+  new_token = (token_list *)calloc(1, sizeof(token_list));
+  strcpy(new_token->tok_string, token_string);
+  new_token->tok_class = token_class;
+  new_token->tok_value = token_value;
+  new_token->next = NULL;
+
+  if (current == NULL)
+    *tok_list = new_token;
+  else {
+    while (current->next != NULL)
+      current = current->next;
+
+    current->next = new_token;
+  }
+  return;
+}
+
+/*************************************************************
+        Result cache - SELECT output keyed on statement text
+ *************************************************************/
+
+/* FNV-1a */
+static uint32_t hash_bytes(const unsigned char *data, int len) {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < len; i++) {
+    h ^= data[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/* Output of the SELECT being cached, collected by rw_flush() */
+static bool g_qcache_capture = false;
+static bool g_qcache_storable = false;
+static char *g_qcache_buf = NULL;
+static int g_qcache_len = 0;
+static int g_qcache_cap = 0;
+
+/* Byte limit from DB_RESULT_CACHE (KB); 0 when the cache is off */
+static long qcache_limit() {
+  static long limit = -1;
+  if (limit < 0) {
+    const char *kb = getenv("DB_RESULT_CACHE");
+    limit = kb ? atol(kb) << 10 : 0;
+    if (limit < 0)
+      limit = 0;
+  }
+  return limit;
+}
+
+static void qcache_capture(const char *data, int len) {
+  /* One entry may take a quarter of the cache at most */
+  if (!g_qcache_storable || (g_qcache_len + len > qcache_limit() / 4)) {
+    g_qcache_storable = false;
+    return;
+  }
+  if (g_qcache_len + len > g_qcache_cap) {
+    int cap = (g_qcache_cap > 0) ? g_qcache_cap : 4096;
+    while (cap < g_qcache_len + len)
+      cap *= 2;
+    char *buf = (char *)db_realloc(g_qcache_buf, cap, -1);
+    if (!buf) {
+      g_qcache_storable = false;
+      return;
+    }
+    g_qcache_buf = buf;
+    g_qcache_cap = cap;
+  }
+  memcpy(g_qcache_buf + g_qcache_len, data, len);
+  g_qcache_len += len;
+}
+
+static inline int qcache_entry_size(const qcache_entry *e) {
+  return (int)sizeof(qcache_entry) + ((e->key_len + e->result_len + 7) & ~7);
+}
+
+static inline char *qcache_entry_key(qcache_entry *e) {
+  return (char *)(e + 1);
+}
+
+/* qcache.bin opened and locked, or -1 (missing, unless create) */
+static int qcache_open(bool create) {
+  int fd = open(QCACHE_FILE, create ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+  if ((fd >= 0) && (flock(fd, LOCK_EX) != 0)) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+static void qcache_close(int fd, qcache_view *v) {
+  for (int i = 0; i < v->num_entries; i++)
+    if (v->entry_pos[i] < 0)
+      free(v->entries[i]);
+  free(v->tables);
+  free(v->data);
+  close(fd);  // drops the lock
+}
+
+/* Read the whole file.  A missing, empty or damaged file is an empty cache. */
+static void qcache_read(int fd, qcache_view *v) {
+  struct stat file_stat;
+  memset(v, 0, sizeof(*v));
+  v->hdr.magic = QCACHE_MAGIC;
+  if ((fstat(fd, &file_stat) != 0) || (file_stat.st_size < (off_t)sizeof(qcache_file_header)))
+    return;
+  long size = (long)file_stat.st_size;
+  if (!(v->data = (unsigned char *)db_malloc(size, -1)))
+    return;
+  if (pread(fd, v->data, size, 0) != size)
+    size = 0;
+  STAT_ADD(bytes_read, size);
+
+  qcache_file_header hdr;
+  memcpy(&hdr, v->data, sizeof(hdr));
+  long pos = sizeof(hdr) + (long)hdr.num_tables * sizeof(qcache_version);
+  if ((size == 0) || (hdr.magic != QCACHE_MAGIC) || (hdr.num_tables < 0) ||
+      (hdr.num_entries < 0) || (hdr.num_entries > QCACHE_MAX_ENTRIES) || (pos > size))
+    return;
+  for (int i = 0; i < hdr.num_entries; i++) {
+    qcache_entry *e = (qcache_entry *)(v->data + pos);
+    if ((pos + (long)sizeof(qcache_entry) > size) || (e->key_len < 0) ||
+        (e->result_len < 0) || (e->num_deps < 0) || (e->num_deps > QCACHE_MAX_DEPS) ||
+        (pos + qcache_entry_size(e) > size))
+      return;
+    v->entries[i] = e;
+    v->entry_pos[i] = pos;
+    pos += qcache_entry_size(e);
+  }
+  size_t table_bytes = (size_t)hdr.num_tables * sizeof(qcache_version);
+  if (!(v->tables = (qcache_version *)db_malloc(table_bytes + 1, -1)))
+    return;
+  memcpy(v->tables, v->data + sizeof(hdr), table_bytes);
+  v->hdr = hdr;
+  v->num_tables = hdr.num_tables;
+  v->num_entries = hdr.num_entries;
+}
+
+/* Rewrite the file from the view */
+static void qcache_write(int fd, qcache_view *v) {
+  long size = sizeof(qcache_file_header) + (long)v->num_tables * sizeof(qcache_version);
+  for (int i = 0; i < v->num_entries; i++)
+    size += qcache_entry_size(v->entries[i]);
+  unsigned char *out = (unsigned char *)db_malloc(size, -1);
+  if (!out)
+    return;
+  v->hdr.magic = QCACHE_MAGIC;
+  v->hdr.num_tables = v->num_tables;
+  v->hdr.num_entries = v->num_entries;
+  long pos = sizeof(qcache_file_header);
+  memcpy(out, &v->hdr, pos);
+  memcpy(out + pos, v->tables, (size_t)v->num_tables * sizeof(qcache_version));
+  pos += (long)v->num_tables * sizeof(qcache_version);
+  for (int i = 0; i < v->num_entries; i++) {
+    memcpy(out + pos, v->entries[i], qcache_entry_size(v->entries[i]));
+    pos += qcache_entry_size(v->entries[i]);
+  }
+  if ((pwrite(fd, out, size, 0) == size) && (ftruncate(fd, size) == 0))
+    STAT_ADD(bytes_written, size);
+  free(out);
+}
+
+static qcache_version *qcache_find_table(qcache_view *v, const char *table_name) {
+  for (int i = 0; i < v->num_tables; i++)
+    if (strcasecmp(v->tables[i].table_name, table_name) == 0)
+      return &v->tables[i];
+  return NULL;
+}
+
+/* Version record of a table, added at version 0 if new */
+static qcache_version *qcache_table(qcache_view *v, const char *table_name) {
+  qcache_version *t = qcache_find_table(v, table_name);
+  if (t)
+    return t;
+  qcache_version *tables = (qcache_version *)db_realloc(
+      v->tables, (v->num_tables + 1) * sizeof(qcache_version), -1);
+  if (!tables)
+    return NULL;
+  v->tables = tables;
+  t = &tables[v->num_tables++];
+  memset(t, 0, sizeof(*t));
+  strncpy(t->table_name, table_name, MAX_IDENT_LEN);
+  return t;
+}
+
+/* An entry is live while every table it read is at the same version */
+static bool qcache_entry_live(qcache_view *v, const qcache_entry *e) {
+  for (int d = 0; d < e->num_deps; d++) {
+    qcache_version *t = qcache_find_table(v, e->deps[d].table_name);
+    if ((t ? t->version : 0) != e->deps[d].version)
+      return false;
+  }
+  return true;
+}
+
+static void qcache_remove(qcache_view *v, int i) {
+  if (v->entry_pos[i] < 0)
+    free(v->entries[i]);
+  v->num_entries--;
+  v->entries[i] = v->entries[v->num_entries];
+  v->entry_pos[i] = v->entry_pos[v->num_entries];
+}
+
+/* The key: output mode plus every token, identifiers and keywords folded
+   to lower case.  dep gets the tables the statement names. */
+static int qcache_key(token_list *cur, char *key, qcache_entry *dep) {
+  int len = snprintf(key, QCACHE_MAX_KEY, "%d|", g_output_mode);
+  dep->num_deps = 0;
+  for (; cur && (cur->tok_value != EOC); cur = cur->next) {
+    int n = (int)strlen(cur->tok_string);
+    if (len + n + 8 > QCACHE_MAX_KEY)
+      return -1;
+    len += snprintf(key + len, QCACHE_MAX_KEY - len, "%d:", cur->tok_value);
+    for (int i = 0; i < n; i++)
+      key[len++] = (cur->tok_class == constant) ? cur->tok_string[i]
+                                                : (char)tolower((unsigned char)cur->tok_string[i]);
+    key[len++] = ' ';
+
+    tpd_entry *tpd = (cur->tok_class == identifier) ? get_tpd_from_list(cur->tok_string) : NULL;
+    bool seen = (tpd == NULL);
+    for (int d = 0; (d < dep->num_deps) && !seen; d++)
+      seen = (strcasecmp(dep->deps[d].table_name, tpd->table_name) == 0);
+    if (!seen) {
+      if (dep->num_deps == QCACHE_MAX_DEPS)
+        return -1;
+      memset(&dep->deps[dep->num_deps], 0, sizeof(qcache_version));
+      memcpy(dep->deps[dep->num_deps++].table_name, tpd->table_name, sizeof(tpd->table_name));
+    }
+  }
+  return len;
+}
+
+/* SELECT through the cache: a hit copies the stored output and never
+   opens a .tab file; a miss runs the statement and stores what it wrote */
+static int qcache_select(token_list *t_list) {
+  int rc = 0;
+  char key[QCACHE_MAX_KEY];
+  qcache_entry probe;
+  memset(&probe, 0, sizeof(probe));
+  int key_len = qcache_key(t_list, key, &probe);
+  if (key_len < 0)
+    return sem_select(t_list);
+  uint32_t hash = hash_bytes((const unsigned char *)key, key_len);
+
+  /* Lookup; the versions read here are the ones a new entry depends on.
+     The file is created now, so a write that runs before the store finds
+     it and bumps the version this entry would otherwise claim. */
+  qcache_view v;
+  int fd = qcache_open(true);
+  if (fd >= 0) {
+    qcache_read(fd, &v);
+    for (int i = 0; i < v.num_entries; i++) {
+      qcache_entry *e = v.entries[i];
+      if ((e->hash != hash) || (e->key_len != key_len) ||
+          (memcmp(qcache_entry_key(e), key, key_len) != 0) || !qcache_entry_live(&v, e))
+        continue;
+      fwrite(qcache_entry_key(e) + key_len, 1, e->result_len, g_result_fp ? g_result_fp : stdout);
+      /* Stamp the entry and count the hit in place */
+      e->last_used = ++v.hdr.clock;
+      v.hdr.hits++;
+      pwrite(fd, &v.hdr, sizeof(v.hdr), 0);
+      pwrite(fd, &e->last_used, sizeof(e->last_used), v.entry_pos[i]);
+      STAT_ADD(qcache_hits, 1);
+      qcache_close(fd, &v);
+      return 0;
+    }
+    for (int d = 0; d < probe.num_deps; d++) {
+      qcache_version *t = qcache_find_table(&v, probe.deps[d].table_name);
+      probe.deps[d].version = t ? t->version : 0;
+    }
+    v.hdr.misses++;
+    pwrite(fd, &v.hdr, sizeof(v.hdr), 0);
+    qcache_close(fd, &v);
+  }
+  bool miss_counted = (fd >= 0);
+  STAT_ADD(qcache_misses, 1);
+
+  g_qcache_len = 0;
+  g_qcache_storable = true;
+  g_qcache_capture = true;
+  rc = sem_select(t_list);
+  g_qcache_capture = false;
+  if (rc || !g_qcache_storable || ((fd = qcache_open(true)) < 0))
+    return rc;
+
+  /* Store: drop dead entries and any older copy, evict LRU to make room */
+  qcache_read(fd, &v);
+  if (!miss_counted)
+    v.hdr.misses++;
+  long bytes = 0;
+  for (int i = v.num_entries - 1; i >= 0; i--) {
+    qcache_entry *e = v.entries[i];
+    if (!qcache_entry_live(&v, e) ||
+        ((e->key_len == key_len) && (memcmp(qcache_entry_key(e), key, key_len) == 0)))
+      qcache_remove(&v, i);
+  }
+  for (int i = 0; i < v.num_entries; i++)
+    bytes += qcache_entry_size(v.entries[i]);
+  probe.hash = hash;
+  probe.key_len = key_len;
+  probe.result_len = g_qcache_len;
+  probe.last_used = ++v.hdr.clock;
+  int size = qcache_entry_size(&probe);
+  if (size > qcache_limit()) {
+    qcache_write(fd, &v);
+    qcache_close(fd, &v);
+    return rc;
+  }
+  while ((v.num_entries > 0) &&
+         ((bytes + size > qcache_limit()) || (v.num_entries >= QCACHE_MAX_ENTRIES))) {
+    int lru = 0;
+    for (int i = 1; i < v.num_entries; i++)
+      if (v.entries[i]->last_used < v.entries[lru]->last_used)
+        lru = i;
+    bytes -= qcache_entry_size(v.entries[lru]);
+    qcache_remove(&v, lru);
+    STAT_ADD(qcache_evictions, 1);
+  }
+  qcache_entry *e = (qcache_entry *)db_malloc(size, -1);
+  if (e) {
+    memset(e, 0, size);
+    memcpy(e, &probe, sizeof(probe));
+    memcpy(qcache_entry_key(e), key, key_len);
+    memcpy(qcache_entry_key(e) + key_len, g_qcache_buf, g_qcache_len);
+    for (int d = 0; d < e->num_deps; d++)
+      qcache_table(&v, e->deps[d].table_name);
+    v.entries[v.num_entries] = e;
+    v.entry_pos[v.num_entries++] = -1;
+  }
+  qcache_write(fd, &v);
+  qcache_close(fd, &v);
+  return rc;
+}
+
+/* A write to a table: bump its version and drop the entries built on it.
+   Nothing to do when there is no cache file. */
+static void qcache_bump(const char *table_name) {
+  qcache_view v;
+  int fd = qcache_open(false);
+  if (fd < 0)
+    return;
+  qcache_read(fd, &v);
+  qcache_version *t = qcache_table(&v, table_name);
+  if (t)
+    t->version++;
+  for (int i = v.num_entries - 1; i >= 0; i--)
+    if (!qcache_entry_live(&v, v.entries[i]))
+      qcache_remove(&v, i);
+  qcache_write(fd, &v);
+  qcache_close(fd, &v);
+}
+
+/* Totals kept in the cache file, for SHOW STATS */
+static void print_qcache_totals(FILE *out) {
+  qcache_view v;
+  int fd = qcache_open(false);
+  if (fd < 0)
+    return;
+  qcache_read(fd, &v);
+  long bytes = 0;
+  for (int i = 0; i < v.num_entries; i++)
+    bytes += qcache_entry_size(v.entries[i]);
+  fprintf(out, "%-28s %15d\n", "qcache_entries", v.num_entries);
+  fprintf(out, "%-28s %15ld\n", "qcache_bytes", bytes);
+  fprintf(out, "%-28s %15lld\n", "qcache_total_hits", (long long)v.hdr.hits);
+  fprintf(out, "%-28s %15lld\n", "qcache_total_misses", (long long)v.hdr.misses);
+  qcache_close(fd, &v);
+}
+
+/*************************************************************
+        Materialized views - incremental maintenance
+ *************************************************************/
+
+/* The output of a view's SELECT: rw_flush appends it here instead of
+   writing it, and rw_header leaves the column names */
+static bool g_mv_capture = false;
+static unsigned char *g_mv_buf = NULL;
+static int g_mv_len = 0, g_mv_cap = 0;
+static bool g_mv_overflow = false;
+static int g_mv_num_cols = 0;
+static char g_mv_names[OUT_MAX_COLS][MAX_IDENT_LEN + 1];
+static int g_mv_widths[OUT_MAX_COLS];
+static bool g_mv_numeric[OUT_MAX_COLS];
+
+/* Rows the running INSERT, DELETE or UPDATE changed, +1 added and -1
+   removed, kept while some view is maintained from its table */
+static bool g_mv_delta_on = false;
+static bool g_mv_delta_lost = false;
+static char g_mv_delta_table[MAX_IDENT_LEN + 1];
+static int g_mv_delta_size = 0;
+static unsigned char *g_mv_delta_rows = NULL;
+static signed char *g_mv_delta_signs = NULL;
+static int g_mv_delta_num = 0, g_mv_delta_cap = 0;
+
+static void mv_capture(const char *data, int len) {
+  if (g_mv_len + len > g_mv_cap) {
+    int cap = g_mv_cap ? g_mv_cap : OUT_BUF_SIZE;
+    while (cap < g_mv_len + len)
+      cap *= 2;
+    unsigned char *buf = (unsigned char *)db_realloc(g_mv_buf, cap, -1);
+    if (!buf) {
+      g_mv_overflow = true;
+      return;
+    }
+    g_mv_buf = buf;
+    g_mv_cap = cap;
+  }
+  memcpy(g_mv_buf + g_mv_len, data, len);
+  g_mv_len += len;
+}
+
+static void mv_capture_columns(const result_writer *rw) {
+  g_mv_num_cols = rw->num_cols;
+  memcpy(g_mv_names, rw->names, sizeof(g_mv_names));
+  memcpy(g_mv_widths, rw->widths, sizeof(g_mv_widths));
+  memcpy(g_mv_numeric, rw->numeric, sizeof(g_mv_numeric));
+}
+
+static void mv_copy_name(char *dst, const char *src) {
+  snprintf(dst, MAX_IDENT_LEN + 1, "%.*s", MAX_IDENT_LEN, src);
+}
+
+static int mv_field_size(const cd_entry *col) {
+  return 1 + ((col->col_type == T_INT) ? 4 : col->col_len);
+}
+
+/* printf onto the end of out; false once it no longer fits */
+static bool mv_append(char *out, int cap, int *len, const char *fmt, ...) {
+  if (*len >= cap)
+    return false;
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(out + *len, cap - *len, fmt, args);
+  va_end(args);
+  *len += n;
+  return *len < cap;
+}
+
+/* Statement text of the tokens from first up to stop */
+static bool mv_text(token_list *first, token_list *stop, char *out, int cap) {
+  int len = 0;
+  out[0] = '\0';
+  for (token_list *cur = first; cur && (cur != stop) && (cur->tok_value != EOC);
+       cur = cur->next)
+    if (!mv_append(out, cap, &len,
+                   (cur->tok_value == STRING_LITERAL) ? "%s'%s'" : "%s%s",
+                   (len > 0) ? " " : "", cur->tok_string))
+      return false;
+  return true;
+}
+
+static bool mv_clause_end(const token_list *cur) {
+  return (cur->tok_value == EOC) || (cur->tok_value == K_GROUP) ||
+         (cur->tok_value == K_HAVING) || (cur->tok_value == K_ORDER) ||
+         (cur->tok_value == K_LIMIT) || (cur->tok_value == K_OFFSET);
+}
+
+/* Split a view's SELECT into what maintenance needs and decide how the
+   view is kept up to date.  The statement itself is checked by running
+   it. */
+static int mv_parse(token_list *select_tok, mv_def *def) {
+  token_list *cur = select_tok->next;
+  def->kind = MV_ROWS;
+  def->star = false;
+  def->num_items = def->num_tables = def->num_group = 0;
+  if (!mv_text(select_tok, NULL, def->sql, sizeof(def->sql)))
+    return INVALID_VIEW_DEFINITION;
+
+  while (cur->tok_value != K_FROM) {
+    if ((cur->tok_value == EOC) || (def->num_items == MAX_NUM_COL))
+      return INVALID_VIEW_DEFINITION;
+    mv_item *item = &def->items[def->num_items++];
+    memset(item, 0, sizeof(*item));
+    if (cur->tok_value == S_STAR) {
+      def->star = true;
+      strcpy(item->col, "*");
+    } else if (cur->tok_class == function_name) {
+      item->func = cur->tok_value;
+      cur = cur->next;
+      if ((cur->tok_value != S_LEFT_PAREN) ||
+          ((cur->next->tok_value != S_STAR) && (cur->next->tok_class != identifier)) ||
+          (cur->next->next->tok_value != S_RIGHT_PAREN))
+        return INVALID_VIEW_DEFINITION;
+      cur = cur->next;
+      mv_copy_name(item->col, cur->tok_string);
+      cur = cur->next;
+    } else if (cur->tok_class == identifier) {
+      mv_copy_name(item->col, cur->tok_string);
+    } else {
+      return INVALID_VIEW_DEFINITION;
+    }
+    cur = cur->next;
+    if (cur->tok_value == S_COMMA)
+      cur = cur->next;
+  }
+
+  /* The tables are the identifiers of the FROM clause, up to a JOIN's ON */
+  token_list *from = cur;
+  bool join_on = false;
+  for (cur = cur->next; (cur->tok_value != K_WHERE) && !mv_clause_end(cur);
+       cur = cur->next) {
+    if (cur->tok_value == K_ON)
+      join_on = true;
+    if ((cur->tok_class != identifier) || join_on)
+      continue;
+    if (def->num_tables == MV_MAX_TABLES)
+      return INVALID_VIEW_DEFINITION;
+    mv_copy_name(def->tables[def->num_tables++], cur->tok_string);
+  }
+  while (!mv_clause_end(cur))
+    cur = cur->next;
+  if (!mv_text(from, cur, def->from_sql, sizeof(def->from_sql)))
+    return INVALID_VIEW_DEFINITION;
+
+  if (cur->tok_value == K_GROUP) {
+    cur = cur->next;
+    if (cur->tok_value != K_BY)
+      return INVALID_VIEW_DEFINITION;
+    for (cur = cur->next; cur->tok_class == identifier; cur = cur->next->next) {
+      if (def->num_group == MAX_NUM_COL)
+        return INVALID_VIEW_DEFINITION;
+      mv_copy_name(def->group[def->num_group++], cur->tok_string);
+      if (cur->next->tok_value != S_COMMA) {
+        cur = cur->next;
+        break;
+      }
+    }
+  }
+
+  bool aggregate = (def->num_group > 0);
+  for (int i = 0; i < def->num_items; i++)
+    aggregate = aggregate || (def->items[i].func != 0);
+  if (aggregate)
+    def->kind = MV_AGG;
+  /* HAVING, ORDER BY and LIMIT do not follow from the changed rows, a
+     table named twice changes on both sides of the join, and ON names
+     its columns by table */
+  if ((cur->tok_value != EOC) || join_on)
+    def->kind = MV_REFRESH;
+  for (int t = 0; t < def->num_tables; t++)
+    for (int u = t + 1; u < def->num_tables; u++)
+      if (strcasecmp(def->tables[t], def->tables[u]) == 0)
+        def->kind = MV_REFRESH;
+  return 0;
+}
+
+static cd_entry *mv_base_column(const mv_def *def, const char *col_name) {
+  for (int t = 0; t < def->num_tables; t++) {
+    tpd_entry *tpd = get_tpd_from_list((char *)def->tables[t]);
+    if (!tpd)
+      continue;
+    cd_entry *cols = (cd_entry *)((char *)tpd + tpd->cd_offset);
+    for (int c = 0; c < tpd->num_columns; c++)
+      if (strcasecmp(cols[c].col_name, col_name) == 0)
+        return &cols[c];
+  }
+  return NULL;
+}
+
+static int mv_key_size(const mv_def *def) {
+  int size = 0;
+  for (int g = 0; g < def->num_group; g++) {
+    cd_entry *col = mv_base_column(def, def->group[g]);
+    size += col ? mv_field_size(col) : 0;
+  }
+  return size;
+}
+
+/* A group state: the GROUP BY fields, the group's row count, then a sum
+   and a non-NULL count per SELECT item */
+static int mv_group_size(const mv_def *def) {
+  return mv_key_size(def) + 8 + 16 * def->num_items;
+}
+
+/* The SELECT that gives the states of the groups: the GROUP BY columns,
+   SUM and COUNT of each aggregated column, and COUNT(*) */
+static int mv_state_sql(const mv_def *def, char *sql, int cap) {
+  int len = 0;
+  bool ok = mv_append(sql, cap, &len, "SELECT");
+  for (int g = 0; g < def->num_group; g++)
+    ok = ok && mv_append(sql, cap, &len, " %s,", def->group[g]);
+  for (int i = 0; i < def->num_items; i++) {
+    const mv_item *item = &def->items[i];
+    if ((item->func == 0) || (strcmp(item->col, "*") == 0))
+      continue;
+    if (item->func != F_COUNT)
+      ok = ok && mv_append(sql, cap, &len, " SUM(%s),", item->col);
+    ok = ok && mv_append(sql, cap, &len, " COUNT(%s),", item->col);
+  }
+  ok = ok && mv_append(sql, cap, &len, " COUNT(*) %s", def->from_sql);
+  for (int g = 0; g < def->num_group; g++)
+    ok = ok && mv_append(sql, cap, &len, "%s%s", (g == 0) ? " GROUP BY " : ", ",
+                         def->group[g]);
+  return ok ? 0 : INVALID_VIEW_DEFINITION;
+}
+
+/* Run a SELECT with its output captured.  redirect names the table whose
+   delta file stands in for it. */
+static int mv_run(const char *sql, const char *redirect) {
+  char command[MV_MAX_SQL * 2];
+  token_list *tok_list = NULL, *tmp_tok_ptr = NULL;
+  snprintf(command, sizeof(command), "%s", sql);
+  int rc = get_token(command, &tok_list);
+  if (!rc) {
+    int saved_mode = g_output_mode, saved_explain = g_explain;
+    g_output_mode = OUT_RAW;
+    g_explain = EXPLAIN_OFF;
+    g_tab_redirect = redirect;
+    g_mv_len = 0;
+    g_mv_num_cols = 0;
+    g_mv_overflow = false;
+    g_mv_capture = true;
+    rc = sem_select(tok_list->next);
+    g_mv_capture = false;
+    g_tab_redirect = NULL;
+    g_output_mode = saved_mode;
+    g_explain = saved_explain;
+    if (!rc && g_mv_overflow)
+      rc = MEMORY_ERROR;
+  }
+  while (tok_list) {
+    tmp_tok_ptr = tok_list->next;
+    free(tok_list);
+    tok_list = tmp_tok_ptr;
+  }
+  return rc;
+}
+
+/* The next captured row in the record layout of cols.  ints gets the
+   whole value of every INT column.  False after the last row. */
+static bool mv_next_row(int *pos, const cd_entry *cols, int num_cols,
+                        unsigned char *row, long long *ints) {
+  if (*pos >= g_mv_len)
+    return false;
+  int offset = 0;
+  for (int c = 0; c < num_cols; c++) {
+    int len = g_mv_buf[(*pos)++];
+    const unsigned char *data = g_mv_buf + *pos;
+    int size = mv_field_size(&cols[c]) - 1;
+    *pos += len;
+    memset(row + offset, 0, 1 + size);
+    if (ints)
+      ints[c] = 0;
+    if ((len > 0) && (cols[c].col_type == T_INT)) {
+      long long value = 0;
+      memcpy(&value, data, (len < 8) ? len : 8);
+      int32_t stored = (int32_t)value;
+      row[offset] = 4;
+      memcpy(row + offset + 1, &stored, 4);
+      if (ints)
+        ints[c] = value;
+    } else if (len > 0) {
+      row[offset] = (unsigned char)((len < size) ? len : size);
+      memcpy(row + offset + 1, data, row[offset]);
+    }
+    offset += 1 + size;
+  }
+  return true;
+}
+
+/* Every captured row in the layout of table tpd */
+static int mv_captured_rows(const tpd_entry *tpd, unsigned char **rows, int *num_rows) {
+  const cd_entry *cols = (const cd_entry *)((const char *)tpd + tpd->cd_offset);
+  int record_size = compute_record_size_from_tpd(tpd), cap = 0, pos = 0;
+  *rows = NULL;
+  *num_rows = 0;
+  for (;;) {
+    if (*num_rows == cap) {
+      cap = cap ? cap * 2 : 16;
+      unsigned char *grown =
+          (unsigned char *)db_realloc(*rows, (size_t)cap * record_size, -1);
+      if (!grown)
+        return MEMORY_ERROR;
+      *rows = grown;
+    }
+    unsigned char *row = *rows + (size_t)*num_rows * record_size;
+    memset(row, 0, record_size);
+    if (!mv_next_row(&pos, cols, tpd->num_columns, row, NULL))
+      return 0;
+    (*num_rows)++;
+  }
+}
+
+/* Fold the captured output of the state query into the group states,
+   subtracting it for sign -1 */
+static int mv_fold(const mv_def *def, unsigned char **groups, int *num_groups, int sign) {
+  cd_entry cols[MAX_NUM_COL * 3 + 1];
+  long long ints[MAX_NUM_COL * 3 + 1];
+  unsigned char row[MAX_NUM_COL * 260];
+  int num_cols = 0, pos = 0;
+  int key_size = mv_key_size(def), group_size = mv_group_size(def);
+
+  memset(cols, 0, sizeof(cols));
+  for (int g = 0; g < def->num_group; g++) {
+    cd_entry *col = mv_base_column(def, def->group[g]);
+    if (!col)
+      return INVALID_VIEW_DEFINITION;
+    cols[num_cols++] = *col;
+  }
+  int num_ints = 1;
+  for (int i = 0; i < def->num_items; i++)
+    if (def->items[i].func && strcmp(def->items[i].col, "*"))
+      num_ints += (def->items[i].func == F_COUNT) ? 1 : 2;
+  for (int i = 0; i < num_ints; i++) {
+    cols[num_cols].col_type = T_INT;
+    cols[num_cols++].col_len = 4;
+  }
+
+  while (mv_next_row(&pos, cols, num_cols, row, ints)) {
+    int g = 0;
+    while ((g < *num_groups) && memcmp(*groups + (size_t)g * group_size, row, key_size))
+      g++;
+    if (g == *num_groups) {
+      unsigned char *grown = (unsigned char *)db_realloc(
+          *groups, (size_t)(g + 1) * group_size, -1);
+      if (!grown)
+        return MEMORY_ERROR;
+      *groups = grown;
+      memset(*groups + (size_t)g * group_size, 0, group_size);
+      memcpy(*groups + (size_t)g * group_size, row, key_size);
+      (*num_groups)++;
+    }
+    unsigned char *state = *groups + (size_t)g * group_size + key_size;
+    int c = def->num_group;
+    long long value[2];
+    for (int i = 0; i < def->num_items; i++) {
+      if ((def->items[i].func == 0) || (strcmp(def->items[i].col, "*") == 0))
+        continue;
+      memcpy(value, state + 8 + 16 * i, sizeof(value));
+      if (def->items[i].func != F_COUNT)
+        value[0] += sign * ints[c++];
+      value[1] += sign * ints[c++];
+      memcpy(state + 8 + 16 * i, value, sizeof(value));
+    }
+    memcpy(value, state, 8);
+    value[0] += sign * ints[c];
+    memcpy(state, value, 8);
+  }
+
+  /* A group is gone with its last row; without GROUP BY the one group
+     always stays */
+  if (def->num_group > 0) {
+    int kept = 0;
+    for (int g = 0; g < *num_groups; g++) {
+      long long rows;
+      memcpy(&rows, *groups + (size_t)g * group_size + key_size, 8);
+      if (rows <= 0)
+        continue;
+      memmove(*groups + (size_t)kept * group_size, *groups + (size_t)g * group_size,
+              group_size);
+      kept++;
+    }
+    *num_groups = kept;
+  }
+  return 0;
+}
+
+/* The view's rows from the group states */
+static int mv_agg_rows(const mv_def *def, const tpd_entry *view, const unsigned char *groups,
+                       int num_groups, unsigned char **rows) {
+  const cd_entry *cols = (const cd_entry *)((const char *)view + view->cd_offset);
+  int record_size = compute_record_size_from_tpd(view);
+  int key_size = mv_key_size(def), group_size = mv_group_size(def);
+  *rows = (unsigned char *)db_malloc((size_t)(num_groups + 1) * record_size, -1);
+  if (!*rows)
+    return MEMORY_ERROR;
+  memset(*rows, 0, (size_t)(num_groups + 1) * record_size);
+
+  for (int g = 0; g < num_groups; g++) {
+    const unsigned char *key = groups + (size_t)g * group_size;
+    unsigned char *row = *rows + (size_t)g * record_size;
+    long long group_rows, state[2];
+    memcpy(&group_rows, key + key_size, 8);
+    int offset = 0;
+    for (int i = 0; i < def->num_items; i++) {
+      const mv_item *item = &def->items[i];
+      if (item->func == 0) {
+        int key_offset = 0;
+        for (int k = 0; k < def->num_group; k++) {
+          if (strcasecmp(def->group[k], item->col) == 0)
+            break;
+          key_offset += mv_field_size(mv_base_column(def, def->group[k]));
+        }
+        memcpy(row + offset, key + key_offset, mv_field_size(&cols[i]));
+      } else {
+        memcpy(state, key + key_size + 8 + 16 * i, sizeof(state));
+        long long value = state[1];
+        if (item->func == F_SUM)
+          value = state[0];
+        else if (item->func == F_AVG)
+          value = (state[1] > 0) ? state[0] / state[1] : 0;
+        else if (strcmp(item->col, "*") == 0)
+          value = group_rows;
+        int32_t stored = (int32_t)value;
+        row[offset] = 4;
+        memcpy(row + offset + 1, &stored, 4);
+      }
+      offset += mv_field_size(&cols[i]);
+    }
+  }
+  return 0;
+}
+
+static int mv_store_rows(const char *name, const unsigned char *rows, int num_rows) {
+  tab_handle th;
+  int rc = tab_open(name, &th);
+  if (rc)
+    return rc;
+  rc = tab_replace_rows(&th, rows, num_rows);
+  int close_rc = tab_close(&th);
+  return rc ? rc : close_rc;
+}
+
+static int mv_write_file(const mv_def *def, const unsigned char *groups, int num_groups) {
+  char fname[MAX_IDENT_LEN + 5] = {0};
+  snprintf(fname, sizeof(fname), "%s.mv", def->name);
+  mv_file_header hdr = {MV_MAGIC, (int32_t)strlen(def->sql), num_groups,
+                        mv_group_size(def)};
+  FILE *fp = fopen(fname, "wb");
+  if (!fp)
+    return FILE_OPEN_ERROR;
+  bool ok = (db_fwrite(&hdr, sizeof(hdr), 1, fp) == 1) &&
+            (db_fwrite(def->sql, hdr.sql_len, 1, fp) == 1) &&
+            ((num_groups == 0) ||
+             (db_fwrite(groups, hdr.group_size, num_groups, fp) == (size_t)num_groups));
+  if (fclose(fp) != 0)
+    ok = false;
+  return ok ? 0 : FILE_WRITE_ERROR;
+}
+
+/* A view's definition, and its group states when groups is given */
+static int mv_read_file(const char *name, mv_def *def, unsigned char **groups,
+                        int *num_groups) {
+  char fname[MAX_IDENT_LEN + 5] = {0};
+  char command[MV_MAX_SQL];
+  mv_file_header hdr;
+  token_list *tok_list = NULL, *tmp_tok_ptr = NULL;
+  int rc = 0;
+
+  snprintf(fname, sizeof(fname), "%s.mv", name);
+  FILE *fp = fopen(fname, "rb");
+  if (!fp)
+    return FILE_OPEN_ERROR;
+  if ((db_fread(&hdr, sizeof(hdr), 1, fp) != 1) || (hdr.magic != MV_MAGIC) ||
+      (hdr.sql_len <= 0) || (hdr.sql_len >= MV_MAX_SQL) ||
+      (db_fread(command, hdr.sql_len, 1, fp) != 1))
+    rc = DBFILE_CORRUPTION;
+  if (!rc && groups) {
+    *num_groups = hdr.num_groups;
+    *groups = (unsigned char *)db_malloc((size_t)(hdr.num_groups + 1) * hdr.group_size, -1);
+    if (!*groups)
+      rc = MEMORY_ERROR;
+    else if ((hdr.num_groups > 0) &&
+             (db_fread(*groups, hdr.group_size, hdr.num_groups, fp) != (size_t)hdr.num_groups))
+      rc = DBFILE_CORRUPTION;
+  }
+  fclose(fp);
+
+  if (!rc) {
+    command[hdr.sql_len] = '\0';
+    memset(def, 0, sizeof(*def));
+    mv_copy_name(def->name, name);
+    if (!(rc = get_token(command, &tok_list)))
+      rc = mv_parse(tok_list, def);
+    while (tok_list) {
+      tmp_tok_ptr = tok_list->next;
+      free(tok_list);
+      tok_list = tmp_tok_ptr;
+    }
+  }
+  if (!rc && (hdr.group_size != mv_group_size(def)))
+    rc = DBFILE_CORRUPTION;
+  if (rc && groups) {
+    free(*groups);
+    *groups = NULL;
+  }
+  return rc;
+}
+
+/* Recompute a view from its base tables.  reuse: the view's SELECT has
+   just run and its output is still captured. */
+static int mv_refresh(const mv_def *def, bool reuse) {
+  tpd_entry *view = get_tpd_from_list((char *)def->name);
+  unsigned char *groups = NULL, *rows = NULL;
+  int num_groups = 0, num_rows = 0, rc = 0;
+  if (!view)
+    return TABLE_NOT_EXIST;
+
+  if (def->kind == MV_AGG) {
+    char sql[MV_MAX_SQL * 2];
+    if (!(rc = mv_state_sql(def, sql, sizeof(sql))) && !(rc = mv_run(sql, NULL)) &&
+        !(rc = mv_fold(def, &groups, &num_groups, 1)))
+      rc = mv_agg_rows(def, view, groups, num_groups, &rows);
+    num_rows = num_groups;
+  } else if (reuse || !(rc = mv_run(def->sql, NULL))) {
+    rc = mv_captured_rows(view, &rows, &num_rows);
+  }
+  if (!rc)
+    rc = mv_store_rows(def->name, rows, num_rows);
+  if (!rc)
+    rc = mv_write_file(def, groups, num_groups);
+  free(groups);
+  free(rows);
+  if (!rc)
+    qcache_bump(def->name);
+  return rc;
+}
+
+/* Write the delta rows of one sign as the base table's delta file, run
+   the view's SELECT over them and fold the result into the view */
+static int mv_apply_delta(const mv_def *def, int sign, unsigned char **groups,
+                          int *num_groups) {
+  char sql[MV_MAX_SQL * 2], fname[MAX_IDENT_LEN + 5] = {0};
+  tpd_entry *base = get_tpd_from_list(g_mv_delta_table);
+  tab_handle th;
+  int rc = 0;
+
+  g_tab_redirect = g_mv_delta_table;
+  if (!(rc = create_table_data_file(base)) && !(rc = tab_open(g_mv_delta_table, &th))) {
+    for (int i = 0; (i < g_mv_delta_num) && !rc; i++)
+      if (g_mv_delta_signs[i] == sign)
+        rc = tab_append(&th, g_mv_delta_rows + (size_t)i * g_mv_delta_size);
+    int close_rc = tab_close(&th);
+    if (!rc)
+      rc = close_rc;
+  }
+  g_tab_redirect = NULL;
+
+  if (!rc && (def->kind == MV_AGG)) {
+    if (!(rc = mv_state_sql(def, sql, sizeof(sql))) && !(rc = mv_run(sql, g_mv_delta_table)))
+      rc = mv_fold(def, groups, num_groups, sign);
+  } else if (!rc && !(rc = mv_run(def->sql, g_mv_delta_table))) {
+    /* Rows in: appended.  Rows out: one equal view row apiece removed. */
+    tpd_entry *view = get_tpd_from_list((char *)def->name);
+    const cd_entry *cols = (const cd_entry *)((const char *)view + view->cd_offset);
+    unsigned char *rows = NULL, *row = NULL;
+    bool *keep_row = NULL;
+    int num_rows = 0;
+    if (!(rc = mv_captured_rows(view, &rows, &num_rows)) && (num_rows > 0) &&
+        !(rc = tab_open(def->name, &th))) {
+      if (sign > 0) {
+        for (int r = 0; (r < num_rows) && !rc; r++)
+          rc = tab_append(&th, rows + (size_t)r * th.hdr.record_size);
+      } else if (!(row = (unsigned char *)db_malloc(th.hdr.record_size, -1)) ||
+                 !(keep_row = (bool *)db_malloc(th.hdr.num_records + 1, -1))) {
+        rc = MEMORY_ERROR;
+      } else {
+        memset(keep_row, 1, th.hdr.num_records + 1);
+        for (int v = 0; (v < th.hdr.num_records) && !rc && (num_rows > 0); v++) {
+          if ((rc = tab_read(&th, v, row)))
+            break;
+          for (int r = 0; r < num_rows; r++) {
+            unsigned char *old = rows + (size_t)r * th.hdr.record_size;
+            bool equal = true;
+            for (int c = 0, offset = 0; (c < view->num_columns) && equal; c++) {
+              equal = (row[offset] == old[offset]) &&
+                      (memcmp(row + offset + 1, old + offset + 1, row[offset]) == 0);
+              offset += mv_field_size(&cols[c]);
+            }
+            if (equal) {
+              keep_row[v] = false;
+              memmove(old, rows + (size_t)(num_rows - 1) * th.hdr.record_size,
+                      th.hdr.record_size);
+              num_rows--;
+              break;
+            }
+          }
+        }
+        if (!rc)
+          rc = tab_compact(&th, keep_row);
+      }
+      int close_rc = tab_close(&th);
+      if (!rc)
+        rc = close_rc;
+    }
+    free(keep_row);
+    free(row);
+    free(rows);
+  }
+
+  snprintf(fname, sizeof(fname), "%s.mvd", g_mv_delta_table);
+  remove(fname);
+  return rc;
+}
+
+/* Bring one view up to date with the collected delta rows */
+static int mv_maintain(const char *name) {
+  mv_def def;
+  unsigned char *groups = NULL, *rows = NULL;
+  int num_groups = 0, rc = 0;
+  bool depends = false, removed = false, added = false;
+
+  if ((rc = mv_read_file(name, &def, &groups, &num_groups)))
+    return rc;
+  for (int t = 0; t < def.num_tables; t++)
+    depends = depends || (strcasecmp(def.tables[t], g_mv_delta_table) == 0);
+  for (int i = 0; i < g_mv_delta_num; i++) {
+    removed = removed || (g_mv_delta_signs[i] < 0);
+    added = added || (g_mv_delta_signs[i] > 0);
+  }
+  if (depends && (def.kind == MV_REFRESH)) {
+    printf("Materialized view %s is stale until REFRESH MATERIALIZED VIEW %s\n", name, name);
+  } else if (depends) {
+    if (removed)
+      rc = mv_apply_delta(&def, -1, &groups, &num_groups);
+    if (!rc && added)
+      rc = mv_apply_delta(&def, 1, &groups, &num_groups);
+    if (!rc && (def.kind == MV_AGG)) {
+      tpd_entry *view = get_tpd_from_list((char *)name);
+      if (!(rc = mv_agg_rows(&def, view, groups, num_groups, &rows)) &&
+          !(rc = mv_store_rows(name, rows, num_groups)))
+        rc = mv_write_file(&def, groups, num_groups);
+    }
+    if (!rc)
+      qcache_bump(name);
+  }
+  free(groups);
+  free(rows);
+  return rc;
+}
+
+static bool mv_is_view(const char *table_name) {
+  tpd_entry *tpd = get_tpd_from_list((char *)table_name);
+  return tpd && (tpd->tpd_flags & TPD_FLAG_VIEW);
+}
+
+/* The first view whose SELECT reads table_name, copied to view_name */
+static bool mv_reads_table(const char *table_name, char *view_name) {
+  tpd_entry *cur = &(g_tpd_list->tpd_start);
+  for (int t = 0; t < g_tpd_list->num_tables; t++) {
+    mv_def def;
+    if ((cur->tpd_flags & TPD_FLAG_VIEW) && (mv_read_file(cur->table_name, &def, NULL, NULL) == 0))
+      for (int i = 0; i < def.num_tables; i++)
+        if (strcasecmp(def.tables[i], table_name) == 0) {
+          mv_copy_name(view_name, cur->table_name);
+          return true;
+        }
+    cur = (tpd_entry *)((char *)cur + cur->tpd_size);
+  }
+  return false;
+}
+
+/* Start collecting the rows a write to table_name changes, when there
+   is any view to maintain */
+static void mv_delta_begin(const char *table_name) {
+  tpd_entry *tpd = get_tpd_from_list((char *)table_name);
+  tpd_entry *cur = &(g_tpd_list->tpd_start);
+  g_mv_delta_on = false;
+  g_mv_delta_lost = false;
+  g_mv_delta_num = 0;
+  for (int t = 0; tpd && (t < g_tpd_list->num_tables); t++) {
+    g_mv_delta_on = g_mv_delta_on || (cur->tpd_flags & TPD_FLAG_VIEW);
+    cur = (tpd_entry *)((char *)cur + cur->tpd_size);
+  }
+  if (g_mv_delta_on) {
+    mv_copy_name(g_mv_delta_table, tpd->table_name);
+    g_mv_delta_size = compute_record_size_from_tpd(tpd);
+  }
+}
+
+static void mv_delta_row(int sign, const unsigned char *row) {
+  if (!g_mv_delta_on)
+    return;
+  if (g_mv_delta_num == g_mv_delta_cap) {
+    int cap = g_mv_delta_cap ? g_mv_delta_cap * 2 : 16;
+    unsigned char *rows =
+        (unsigned char *)db_realloc(g_mv_delta_rows, (size_t)cap * g_mv_delta_size, -1);
+    if (rows)
+      g_mv_delta_rows = rows;
+    signed char *signs = (signed char *)db_realloc(g_mv_delta_signs, cap, -1);
+    if (signs)
+      g_mv_delta_signs = signs;
+    if (!rows || !signs) {
+      g_mv_delta_lost = true;
+      return;
+    }
+    g_mv_delta_cap = cap;
+  }
+  memcpy(g_mv_delta_rows + (size_t)g_mv_delta_num * g_mv_delta_size, row, g_mv_delta_size);
+  g_mv_delta_signs[g_mv_delta_num++] = (signed char)sign;
+}
+
+/* The write is done: fold its rows into every view built on the table.
+   A view that cannot be maintained is left for REFRESH. */
+static void mv_delta_end(int rc) {
+  if (!g_mv_delta_on)
+    return;
+  g_mv_delta_on = false;
+  if (rc || (g_mv_delta_num == 0))
+    return;
+
+  /* Maintenance leaves the catalog alone, so it can be walked throughout */
+  tpd_entry *cur = &(g_tpd_list->tpd_start);
+  for (int t = 0; t < g_tpd_list->num_tables; t++) {
+    if (cur->tpd_flags & TPD_FLAG_VIEW) {
+      int view_rc = g_mv_delta_lost ? MEMORY_ERROR : mv_maintain(cur->table_name);
+      if (view_rc)
+        printf("Warning: materialized view %s not maintained (rc=%d), "
+               "REFRESH MATERIALIZED VIEW %s\n", cur->table_name, view_rc,
+               cur->table_name);
+    }
+    cur = (tpd_entry *)((char *)cur + cur->tpd_size);
+  }
+  g_mv_delta_num = 0;
+}
+
+/* The view's columns: plain columns keep their base table type,
+   aggregates are INT and named after the function and column */
+static int mv_view_columns(const mv_def *def, cd_entry *cols) {
+  for (int i = 0; i < g_mv_num_cols; i++) {
+    cd_entry *col = &cols[i];
+    memset(col, 0, sizeof(*col));
+    col->col_id = i;
+    const mv_item *item = (!def->star && (i < def->num_items)) ? &def->items[i] : NULL;
+    if (item && item->func) {
+      const char *func = (item->func == F_SUM) ? "sum" : (item->func == F_AVG) ? "avg" : "count";
+      char name[MAX_IDENT_LEN * 2];
+      if (strcmp(item->col, "*") == 0)
+        snprintf(name, sizeof(name), "%s", func);
+      else
+        snprintf(name, sizeof(name), "%s_%s", func, item->col);
+      mv_copy_name(col->col_name, name);
+      col->col_type = T_INT;
+      col->col_len = sizeof(int);
+    } else {
+      cd_entry *base = mv_base_column(def, g_mv_names[i]);
+      mv_copy_name(col->col_name, g_mv_names[i]);
+      col->col_type = base ? base->col_type : g_mv_numeric[i] ? T_INT : T_CHAR;
+      col->col_len = base ? base->col_len : g_mv_numeric[i] ? sizeof(int) : g_mv_widths[i];
+    }
+    /* A repeated name gets _2, _3, ... */
+    char name[MAX_IDENT_LEN + 1];
+    strcpy(name, col->col_name);
+    for (int j = 0, k = 2; j < i; j++)
+      if (strcasecmp(cols[j].col_name, col->col_name) == 0) {
+        char suffix[8];
+        int n = snprintf(suffix, sizeof(suffix), "_%d", k++);
+        int len = strlen(name);
+        if (len + n > MAX_IDENT_LEN)
+          len = MAX_IDENT_LEN - n;
+        snprintf(col->col_name, MAX_IDENT_LEN + 1, "%.*s%s", len, name, suffix);
+        j = -1;
+      }
+  }
+  return g_mv_num_cols;
+}
+
+/* CREATE MATERIALIZED VIEW <name> AS SELECT ... */
+int sem_create_view(token_list *t_list) {
+  int rc = 0;
+  token_list *cur = t_list;
+  mv_def def;
+  cd_entry cols[OUT_MAX_COLS];
+
+  memset(&def, 0, sizeof(def));
+  if ((cur->tok_class != identifier) || (strlen(cur->tok_string) > MAX_IDENT_LEN)) {
+    rc = INVALID_TABLE_NAME;
+    cur->tok_value = INVALID;
+  } else if (get_tpd_from_list(cur->tok_string) != NULL) {
+    rc = DUPLICATE_TABLE_NAME;
+    cur->tok_value = INVALID;
+  } else if ((cur->next->tok_value != K_AS) || (cur->next->next->tok_value != K_SELECT)) {
+    rc = INVALID_VIEW_DEFINITION;
+    cur->next->tok_value = INVALID;
+  } else if ((rc = mv_parse(cur->next->next, &def))) {
+    cur->next->next->tok_value = INVALID;
+  }
+  if (rc)
+    return rc;
+  strcpy(def.name, cur->tok_string);
+  for (int t = 0; t < def.num_tables; t++)
+    if (mv_is_view(def.tables[t])) {
+      printf("Error: a materialized view cannot be built on view %s\n", def.tables[t]);
+      return INVALID_VIEW_DEFINITION;
+    }
+
+  /* Running the SELECT checks it and gives the view's columns */
+  if ((rc = mv_run(def.sql, NULL)))
+    return rc;
+  int num_cols = mv_view_columns(&def, cols);
+  if ((num_cols == 0) || (num_cols > MAX_NUM_COL))
+    return INVALID_VIEW_DEFINITION;
+
+  int size = sizeof(tpd_entry) + sizeof(cd_entry) * num_cols;
+  tpd_entry *new_entry = (tpd_entry *)calloc(1, size);
+  if (!new_entry)
+    return MEMORY_ERROR;
+  new_entry->tpd_size = size;
+  strcpy(new_entry->table_name, def.name);
+  new_entry->num_columns = num_cols;
+  new_entry->cd_offset = sizeof(tpd_entry);
+  new_entry->tpd_flags = TPD_FLAG_VIEW;
+  memcpy((char *)new_entry + sizeof(tpd_entry), cols, sizeof(cd_entry) * num_cols);
+  if (!(rc = add_tpd_to_list(new_entry)) && !(rc = create_table_data_file(new_entry)))
+    rc = initialize_tpd_list();
+  free(new_entry);
+
+  if (!rc)
+    rc = mv_refresh(&def, true);
+  if (!rc)
+    printf("Materialized view %s: %s\n", def.name,
+           (def.kind == MV_REFRESH) ? "REFRESH only" : "maintained incrementally");
+  return rc;
+}
+
+/* REFRESH MATERIALIZED VIEW <name> */
+int sem_refresh_view(token_list *t_list) {
+  mv_def def;
+  int rc = 0;
+  if (!mv_is_view(t_list->tok_string)) {
+    t_list->tok_value = INVALID;
+    return get_tpd_from_list(t_list->tok_string) ? INVALID_VIEW_DEFINITION : TABLE_NOT_EXIST;
+  }
+  if (t_list->next->tok_value != EOC) {
+    t_list->next->tok_value = INVALID;
+    return INVALID_VIEW_DEFINITION;
+  }
+  tpd_entry *view = get_tpd_from_list(t_list->tok_string);
+  if (!(rc = mv_read_file(view->table_name, &def, NULL, NULL)))
+    rc = mv_refresh(&def, false);
+  return rc;
+}
+
+/* MATERIALIZED VIEW after CREATE or REFRESH */
+static bool is_view_keyword(token_list *cur) {
+  return cur && (cur->tok_value == K_MATERIALIZED) && cur->next &&
+         (cur->next->tok_value == K_VIEW);
+}
+
+int do_semantic(token_list *tok_list) {
+  int return_code = 0, current_command = INVALID_STATEMENT;
+  bool unique = false;
+  bool plan_only = false;
+  token_list *current_token = tok_list;
+
+  /* EXPLAIN [ANALYZE] <statement> - the statement functions add their
+     operators to g_plan while g_explain is set */
+  g_explain = EXPLAIN_OFF;
+  g_plan_count = 0;
+  if ((current_token->tok_value == K_EXPLAIN) && (current_token->next != NULL)) {
+    current_token = current_token->next;
+    if (current_token->tok_value == K_ANALYZE) {
+      printf("EXPLAIN ANALYZE statement\n");
+      g_explain = EXPLAIN_ANALYZE;
+      current_token = current_token->next;
+    } else {
+      printf("EXPLAIN statement\n");
+      g_explain = EXPLAIN_PLAN;
+    }
+  }
+
+  if ((current_token->tok_value == K_CREATE) &&
+      ((current_token->next != NULL) && (current_token->next->tok_value == K_TABLE))) {
+    printf("CREATE TABLE statement\n");
+    current_command = CREATE_TABLE;
+    current_token = current_token->next->next;
+  } else if ((current_token->tok_value == K_DROP) &&
+             ((current_token->next != NULL) && (current_token->next->tok_value == K_TABLE))) {
+    printf("DROP TABLE statement\n");
+    current_command = DROP_TABLE;
+    current_token = current_token->next->next;
+  } else if ((current_token->tok_value == K_LIST) &&
+             ((current_token->next != NULL) && (current_token->next->tok_value == K_TABLE))) {
+    printf("LIST TABLE statement\n");
+    current_command = LIST_TABLE;
+    current_token = current_token->next->next;
+  } else if ((current_token->tok_value == K_LIST) &&
+             ((current_token->next != NULL) && (current_token->next->tok_value == K_SCHEMA))) {
+    printf("LIST SCHEMA statement\n");
+    current_command = LIST_SCHEMA;
+    current_token = current_token->next->next;
+  } else if ((current_token->tok_value == K_INSERT) && (current_token->next != NULL) &&
+             (current_token->next->tok_value == K_INTO)) {
+    printf("INSERT statement\n");
+    current_command = INSERT;      // uses your enum (104)
+    current_token = current_token->next->next; // point at <table_name>
+  } else if ((current_token->tok_value == K_DELETE) && (current_token->next != NULL) &&
+             (current_token->next->tok_value == K_FROM)) {
+    printf("DELETE statement\n");
+    current_command = DELETE;
+    current_token = current_token->next->next;
+  } else if ((current_token->tok_value == K_UPDATE) && (current_token->next != NULL)) {
+    printf("UPDATE statement\n");
+    current_command = UPDATE;
+    current_token = current_token->next;
+  } else if (current_token->tok_value == K_SELECT) {
+    printf("SELECT statement\n");
+    current_command = SELECT;
+    current_token = current_token->next;
+  } else if ((current_token->tok_value == K_SHOW) && (current_token->next != NULL) &&
+             (current_token->next->tok_value == K_STATS)) {
+    printf("SHOW STATS statement\n");
+    current_command = SHOW_STATS;
+    current_token = current_token->next->next;
+  } else if ((current_token->tok_value == K_CREATE) && is_view_keyword(current_token->next)) {
+    printf("CREATE MATERIALIZED VIEW statement\n");
+    current_command = CREATE_VIEW;
+    current_token = current_token->next->next->next;
+  } else if ((current_token->tok_value == K_REFRESH) && is_view_keyword(current_token->next)) {
+    printf("REFRESH MATERIALIZED VIEW statement\n");
+    current_command = REFRESH_VIEW;
+    current_token = current_token->next->next->next;
+  } else {
+    printf("Invalid statement\n");
+    return_code = current_command;
+  }
+
+  if (g_explain != EXPLAIN_OFF) {
+    /* DDL, LIST and SHOW statements have no operators worth explaining */
+    const char *utility = NULL;
+    if (current_command == CREATE_TABLE)
+      utility = "CREATE TABLE";
+    else if (current_command == DROP_TABLE)
+      utility = "DROP TABLE";
+    else if (current_command == LIST_TABLE)
+      utility = "LIST TABLE";
+    else if (current_command == LIST_SCHEMA)
+      utility = "LIST SCHEMA";
+    else if (current_command == SHOW_STATS)
+      utility = "SHOW STATS";
+    else if (current_command == CREATE_VIEW)
+      utility = "CREATE MATERIALIZED VIEW";
+    else if (current_command == REFRESH_VIEW)
+      utility = "REFRESH MATERIALIZED VIEW";
+    if (utility) {
+      plan_add("Utility", 0, "%s", utility);
+      plan_only = (g_explain == EXPLAIN_PLAN);
+    }
+  }
+
+  /* A view changes only through its base tables */
+  if (((current_command == INSERT) || (current_command == DELETE) ||
+       (current_command == UPDATE)) &&
+      mv_is_view(current_token->tok_string)) {
+    printf("Error: %s is a materialized view\n", current_token->tok_string);
+    current_token->tok_value = INVALID;
+    return_code = VIEW_READ_ONLY;
+    current_command = INVALID_STATEMENT;
+  }
+
+  long long started = now_ns();
+  if ((current_command != INVALID_STATEMENT) && (!plan_only)) {
+    if ((current_command == INSERT) || (current_command == DELETE) ||
+        (current_command == UPDATE))
+      mv_delta_begin(current_token->tok_string);
+    switch (current_command) {
+    case CREATE_TABLE:
+      return_code = sem_create_table(current_token);
+      break;
+    case DROP_TABLE:
+      return_code = sem_drop_table(current_token);
+      break;
+    case LIST_TABLE:
+      return_code = sem_list_tables();
+      break;
+    case LIST_SCHEMA:
+      return_code = sem_list_schema(current_token);
+      break;
+    case INSERT:
+      return_code = sem_insert_into(current_token);
+      break;
+    case DELETE:
+      return_code = sem_delete(current_token);
+      break;
+    case UPDATE:
+      return_code = sem_update(current_token);
+      break;
+    case SELECT:
+      if ((qcache_limit() > 0) && (g_explain == EXPLAIN_OFF))
+        return_code = qcache_select(current_token);
+      else
+        return_code = sem_select(current_token);
+      break;
+    case SHOW_STATS:
+      return_code = sem_show_stats(current_token);
+      break;
+    case CREATE_VIEW:
+      return_code = sem_create_view(current_token);
+      break;
+    case REFRESH_VIEW:
+      return_code = sem_refresh_view(current_token);
+      break;
+    default:; /* no action */
+    }
+    mv_delta_end(return_code);
+
+    /* Cached results of a table are stale after any write to it.  CREATE
+       counts too: the files of an earlier table of that name may have been
+       deleted without a DROP. */
+    if ((current_command == INSERT) || (current_command == DELETE) ||
+        (current_command == UPDATE) || (current_command == DROP_TABLE) ||
+        (current_command == CREATE_TABLE) || (current_command == CREATE_VIEW))
+      qcache_bump(current_token->tok_string);
+
+    STAT_ADD(stmt_count[current_command - CREATE_TABLE], 1);
+    STAT_ADD(stmt_time_ns[current_command - CREATE_TABLE], now_ns() - started);
+  }
+
+  if ((g_explain != EXPLAIN_OFF) && (!return_code)) {
+    print_plan();
+  }
+  g_explain = EXPLAIN_OFF;
+
+  return return_code;
+}
+
+int sem_create_table(token_list *t_list) {
+  int rc = 0;
+  token_list *cur;
+  tpd_entry tab_entry;
+  tpd_entry *new_entry = NULL;
+  bool column_done = false;
+  int cur_id = 0;
+  cd_entry col_entry[MAX_NUM_COL];
+
+  memset(&tab_entry, '\0', sizeof(tpd_entry));
+  cur = t_list;
+  if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+      (cur->tok_class != type_name)) {
+    // Error
+    rc = INVALID_TABLE_NAME;
+    cur->tok_value = INVALID;
+  } else {
+    if ((new_entry = get_tpd_from_list(cur->tok_string)) != NULL) {
+      rc = DUPLICATE_TABLE_NAME;
+      cur->tok_value = INVALID;
+    } else {
+      strcpy(tab_entry.table_name, cur->tok_string);
+      cur = cur->next;
+      if (cur->tok_value != S_LEFT_PAREN) {
+        // Error
+        rc = INVALID_TABLE_DEFINITION;
+        cur->tok_value = INVALID;
+      } else {
+        memset(&col_entry, '\0', (MAX_NUM_COL * sizeof(cd_entry)));
+
+        /* Now build a set of column entries */
+        cur = cur->next;
+        do {
+          if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+              (cur->tok_class != type_name)) {
+            // Error
+            rc = INVALID_COLUMN_NAME;
+            cur->tok_value = INVALID;
+          } else {
+            int i;
+            for (i = 0; i < cur_id; i++) {
+              /* make column name case sensitive */
+              if (strcmp(col_entry[i].col_name, cur->tok_string) == 0) {
+                rc = DUPLICATE_COLUMN_NAME;
+                cur->tok_value = INVALID;
+                break;
+              }
+            }
+
+            if (!rc) {
+              strcpy(col_entry[cur_id].col_name, cur->tok_string);
+              col_entry[cur_id].col_id = cur_id;
+              col_entry[cur_id].not_null = false; /* set default */
+
+              cur = cur->next;
+              if (cur->tok_class != type_name) {
+                // Error
+                rc = INVALID_TYPE_NAME;
+                cur->tok_value = INVALID;
+              } else {
+                /* Set the column type here, int or char */
+                col_entry[cur_id].col_type = cur->tok_value;
+                cur = cur->next;
+
+                if (col_entry[cur_id].col_type == T_INT) {
+                  if ((cur->tok_value != S_COMMA) &&
+                      (cur->tok_value != K_NOT) &&
+                      (cur->tok_value != S_RIGHT_PAREN)) {
+                    rc = INVALID_COLUMN_DEFINITION;
+                    cur->tok_value = INVALID;
+                  } else {
+                    col_entry[cur_id].col_len = sizeof(int);
+
+                    if ((cur->tok_value == K_NOT) &&
+                        (cur->next->tok_value != K_NULL)) {
+                      rc = INVALID_COLUMN_DEFINITION;
+                      cur->tok_value = INVALID;
+                    } else if ((cur->tok_value == K_NOT) &&
+                               (cur->next->tok_value == K_NULL)) {
+                      col_entry[cur_id].not_null = true;
+                      cur = cur->next->next;
+                    }
+
+                    if (!rc) {
+                      /* I must have either a comma or right paren */
+                      if ((cur->tok_value != S_RIGHT_PAREN) &&
+                          (cur->tok_value != S_COMMA)) {
+                        rc = INVALID_COLUMN_DEFINITION;
+                        cur->tok_value = INVALID;
+                      } else {
+                        if (cur->tok_value == S_RIGHT_PAREN) {
+                          column_done = true;
+                        }
+                        cur = cur->next;
+                      }
+                    }
+                  }
+                } // end of T_INT processing
+                else {
+                  // It must be char() or varchar()
+                  if (cur->tok_value != S_LEFT_PAREN) {
+                    rc = INVALID_COLUMN_DEFINITION;
+                    cur->tok_value = INVALID;
+                  } else {
+                    /* Enter char(n) processing */
+                    cur = cur->next;
+
+                    if (cur->tok_value != INT_LITERAL) {
+                      rc = INVALID_COLUMN_LENGTH;
+                      cur->tok_value = INVALID;
+                    } else {
+                      /* Got a valid integer - convert */
+                      col_entry[cur_id].col_len = atoi(cur->tok_string);
+                      cur = cur->next;
+
+                      if (cur->tok_value != S_RIGHT_PAREN) {
+                        rc = INVALID_COLUMN_DEFINITION;
+                        cur->tok_value = INVALID;
+                      } else {
+                        cur = cur->next;
+
+                        if ((cur->tok_value != S_COMMA) &&
+                            (cur->tok_value != K_NOT) &&
+                            (cur->tok_value != S_RIGHT_PAREN)) {
+                          rc = INVALID_COLUMN_DEFINITION;
+                          cur->tok_value = INVALID;
+                        } else {
+                          if ((cur->tok_value == K_NOT) &&
                               (cur->next->tok_value != K_NULL)) {
                             rc = INVALID_COLUMN_DEFINITION;
                             cur->tok_value = INVALID;
@@ -913,956 +4318,2635 @@ int sem_create_table(token_list *t_list) {
                             cur = cur->next->next;
                           }
 
-                          if (!rc) {
-                            /* I must have either a comma or right paren */
-                            if ((cur->tok_value != S_RIGHT_PAREN) &&
-                                (cur->tok_value != S_COMMA)) {
-                              rc = INVALID_COLUMN_DEFINITION;
-                              cur->tok_value = INVALID;
-                            } else {
-                              if (cur->tok_value == S_RIGHT_PAREN) {
-                                column_done = true;
-                              }
-                              cur = cur->next;
-                            }
-                          }
-                        }
-                      }
-                    } /* end char(n) processing */
-                  }
-                } /* end char processing */
-              }
-            } // duplicate column name
-          } // invalid column name
+                          if (!rc) {
+                            /* I must have either a comma or right paren */
+                            if ((cur->tok_value != S_RIGHT_PAREN) &&
+                                (cur->tok_value != S_COMMA)) {
+                              rc = INVALID_COLUMN_DEFINITION;
+                              cur->tok_value = INVALID;
+                            } else {
+                              if (cur->tok_value == S_RIGHT_PAREN) {
+                                column_done = true;
+                              }
+                              cur = cur->next;
+                            }
+                          }
+                        }
+                      }
+                    } /* end char(n) processing */
+                  }
+                } /* end char processing */
+              }
+            } // duplicate column name
+          } // invalid column name
+
+          /* If rc=0, then get ready for the next column */
+          if (!rc) {
+            cur_id++;
+          }
+
+        } while ((rc == 0) && (!column_done));
+
+        /* Optional table options after the column list */
+        while ((column_done) && (cur->tok_value != EOC)) {
+          if (cur->tok_value == K_COMPRESS)
+            tab_entry.tpd_flags |= TPD_FLAG_COMPRESSED;
+          else if (cur->tok_value == K_DIRECT)
+            tab_entry.tpd_flags |= TPD_FLAG_DIRECT;
+          else
+            break;
+          cur = cur->next;
+        }
+
+        if ((column_done) && (cur->tok_value != EOC)) {
+          rc = INVALID_TABLE_DEFINITION;
+          cur->tok_value = INVALID;
+        }
+
+        if (!rc) {
+          /* Now finished building tpd and add it to the tpd list */
+          tab_entry.num_columns = cur_id;
+          tab_entry.tpd_size =
+              sizeof(tpd_entry) + sizeof(cd_entry) * tab_entry.num_columns;
+          tab_entry.cd_offset = sizeof(tpd_entry);
+          new_entry = (tpd_entry *)calloc(1, tab_entry.tpd_size);
+
+          if (new_entry == NULL) {
+            rc = MEMORY_ERROR;
+          } else {
+            memcpy((void *)new_entry, (void *)&tab_entry, sizeof(tpd_entry));
+
+            memcpy((void *)((char *)new_entry + sizeof(tpd_entry)),
+                   (void *)col_entry, sizeof(cd_entry) * tab_entry.num_columns);
+
+            rc = add_tpd_to_list(new_entry);
+
+            if (!rc) {
+              /* Create <table>.tab using the descriptor we just built before */
+              int frc = create_table_data_file(new_entry);
+              if (frc)
+                rc = frc;
+            }
+
+            /* Refresh the in-memory catalog so that future lookups work */
+            if (!rc) {
+              int irc = initialize_tpd_list();
+              if (irc)
+                rc = irc;
+            }
+
+            free(new_entry);
+          }
+        }
+      }
+    }
+  }
+  return rc;
+}
+
+int sem_drop_table(token_list *t_list) {
+  int rc = 0;
+  token_list *cur;
+  tpd_entry *tab_entry = NULL;
+
+  cur = t_list;
+  if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+      (cur->tok_class != type_name)) {
+    // Error
+    rc = INVALID_TABLE_NAME;
+    cur->tok_value = INVALID;
+  } else {
+    if (cur->next->tok_value != EOC) {
+      rc = INVALID_STATEMENT;
+      cur->next->tok_value = INVALID;
+    } else {
+      char view_name[MAX_IDENT_LEN + 1];
+      if ((tab_entry = get_tpd_from_list(cur->tok_string)) == NULL) {
+        rc = TABLE_NOT_EXIST;
+        cur->tok_value = INVALID;
+      } else if (mv_reads_table(tab_entry->table_name, view_name)) {
+        /* The view could never be maintained or refreshed again */
+        printf("Error: materialized view %s reads from %s; drop the view first\n",
+               view_name, tab_entry->table_name);
+        rc = TABLE_HAS_VIEW;
+        cur->tok_value = INVALID;
+      } else {
+        /* Found a valid tpd, drop it from tpd list */
+        rc = drop_tpd_from_list(cur->tok_string);
+        if (!rc) {
+          int frc = drop_table_data_file(cur->tok_string);
+          if (frc)
+            rc = frc;
+        }
+
+        /* Refresh the in-memory catalog so that future lookups work */
+        if (!rc) {
+          int irc = initialize_tpd_list();
+          if (irc)
+            rc = irc;
+        }
+      }
+    }
+  }
+
+  return rc;
+}
+
+int sem_list_tables() {
+  int rc = 0;
+  int num_tables = g_tpd_list->num_tables;
+  tpd_entry *cur = &(g_tpd_list->tpd_start);
+
+  if (num_tables == 0) {
+    printf("\nThere are currently no tables defined\n");
+  } else {
+    printf("\nTable List\n");
+    printf("*****************\n");
+    while (num_tables-- > 0) {
+      printf("%s\n", cur->table_name);
+      if (num_tables > 0) {
+        cur = (tpd_entry *)((char *)cur + cur->tpd_size);
+      }
+    }
+    printf("****** End ******\n");
+  }
+
+  return rc;
+}
+
+int sem_list_schema(token_list *t_list) {
+  int rc = 0;
+  token_list *cur;
+  tpd_entry *tab_entry = NULL;
+  cd_entry *col_entry = NULL;
+  char tab_name[MAX_IDENT_LEN + 1];
+  char filename[MAX_IDENT_LEN + 1];
+  bool report = false;
+  FILE *fhandle = NULL;
+  int i = 0;
+
+  cur = t_list;
+
+  if (cur->tok_value != K_FOR) {
+    rc = INVALID_STATEMENT;
+    cur->tok_value = INVALID;
+  } else {
+    cur = cur->next;
+
+    if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+        (cur->tok_class != type_name)) {
+      // Error
+      rc = INVALID_TABLE_NAME;
+      cur->tok_value = INVALID;
+    } else {
+      memset(filename, '\0', MAX_IDENT_LEN + 1);
+      strcpy(tab_name, cur->tok_string);
+      cur = cur->next;
+
+      if (cur->tok_value != EOC) {
+        if (cur->tok_value == K_TO) {
+          cur = cur->next;
+
+          if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+              (cur->tok_class != type_name)) {
+            // Error
+            rc = INVALID_REPORT_FILE_NAME;
+            cur->tok_value = INVALID;
+          } else {
+            if (cur->next->tok_value != EOC) {
+              rc = INVALID_STATEMENT;
+              cur->next->tok_value = INVALID;
+            } else {
+              /* We have a valid file name */
+              strcpy(filename, cur->tok_string);
+              report = true;
+            }
+          }
+        } else {
+          /* Missing the TO keyword */
+          rc = INVALID_STATEMENT;
+          cur->tok_value = INVALID;
+        }
+      }
+
+      if (!rc) {
+        if ((tab_entry = get_tpd_from_list(tab_name)) == NULL) {
+          rc = TABLE_NOT_EXIST;
+          cur->tok_value = INVALID;
+        } else {
+          if (report) {
+            if ((fhandle = fopen(filename, "a+tc")) == NULL) {
+              rc = FILE_OPEN_ERROR;
+            }
+          }
+
+          if (!rc) {
+            /* Find correct tpd, need to parse column and index information */
+
+            /* First, write the tpd_entry information */
+            printf("Table PD size            (tpd_size)    = %d\n",
+                   tab_entry->tpd_size);
+            printf("Table Name               (table_name)  = %s\n",
+                   tab_entry->table_name);
+            printf("Number of Columns        (num_columns) = %d\n",
+                   tab_entry->num_columns);
+            printf("Column Descriptor Offset (cd_offset)   = %d\n",
+                   tab_entry->cd_offset);
+            printf("Table PD Flags           (tpd_flags)   = %d\n\n",
+                   tab_entry->tpd_flags);
+
+            if (report) {
+              fprintf(fhandle, "Table PD size            (tpd_size)    = %d\n",
+                      tab_entry->tpd_size);
+              fprintf(fhandle, "Table Name               (table_name)  = %s\n",
+                      tab_entry->table_name);
+              fprintf(fhandle, "Number of Columns        (num_columns) = %d\n",
+                      tab_entry->num_columns);
+              fprintf(fhandle, "Column Descriptor Offset (cd_offset)   = %d\n",
+                      tab_entry->cd_offset);
+              fprintf(fhandle,
+                      "Table PD Flags           (tpd_flags)   = %d\n\n",
+                      tab_entry->tpd_flags);
+            }
+
+            /* Next, write the cd_entry information */
+            for (i = 0, col_entry = (cd_entry *)((char *)tab_entry +
+                                                 tab_entry->cd_offset);
+                 i < tab_entry->num_columns; i++, col_entry++) {
+              printf("Column Name   (col_name) = %s\n", col_entry->col_name);
+              printf("Column Id     (col_id)   = %d\n", col_entry->col_id);
+              printf("Column Type   (col_type) = %d\n", col_entry->col_type);
+              printf("Column Length (col_len)  = %d\n", col_entry->col_len);
+              printf("Not Null flag (not_null) = %d\n\n", col_entry->not_null);
+
+              if (report) {
+                fprintf(fhandle, "Column Name   (col_name) = %s\n",
+                        col_entry->col_name);
+                fprintf(fhandle, "Column Id     (col_id)   = %d\n",
+                        col_entry->col_id);
+                fprintf(fhandle, "Column Type   (col_type) = %d\n",
+                        col_entry->col_type);
+                fprintf(fhandle, "Column Length (col_len)  = %d\n",
+                        col_entry->col_len);
+                fprintf(fhandle, "Not Null Flag (not_null) = %d\n\n",
+                        col_entry->not_null);
+              }
+            }
+
+            if (report) {
+              fflush(fhandle);
+              fclose(fhandle);
+            }
+          } // File open error
+        } // Table not exist
+      } // no semantic errors
+    } // Invalid table name
+  } // Invalid statement
+
+  return rc;
+}
+
+int sem_insert_into(token_list *t_list) {
+  int rc = 0;
+  token_list *current_token = t_list;
+
+  // table name
+  if ((current_token->tok_class != keyword) &&
+      (current_token->tok_class != identifier) &&
+      (current_token->tok_class != type_name)) {
+    rc = INVALID_TABLE_NAME;
+    current_token->tok_value = INVALID;
+    return rc;
+  }
+
+  char table_name[MAX_IDENT_LEN + 1] = {0};
+  strcpy(table_name, current_token->tok_string);
+
+  tpd_entry *table_descriptor = get_tpd_from_list(table_name);
+  if (!table_descriptor) {
+    rc = TABLE_NOT_EXIST;
+    current_token->tok_value = INVALID;
+    return rc;
+  }
+
+  int insert_node = plan_add("Insert", 0, "%s", table_name);
+  long long mark = plan_clock();
+
+  current_token = current_token->next;
+  if (current_token->tok_value != K_VALUES) {
+    rc = INVALID_STATEMENT;
+    current_token->tok_value = INVALID;
+    return rc;
+  }
+  current_token = current_token->next;
+  if (current_token->tok_value != S_LEFT_PAREN) {
+    rc = INVALID_STATEMENT;
+    current_token->tok_value = INVALID;
+    return rc;
+  }
+  current_token = current_token->next;
+
+  tab_handle table;
+  if ((rc = tab_open(table_name, &table)))
+    return rc;
+
+  if (table.hdr.num_records >= g_max_rows) {
+    tab_close(&table);
+    return MEMORY_ERROR;
+  } // project cap
+
+  // prepare one record buffer
+  int record_size = table.hdr.record_size;
+  unsigned char *row_buffer = (unsigned char *)db_malloc(record_size, insert_node);
+  if (!row_buffer) {
+    tab_close(&table);
+    return MEMORY_ERROR;
+  }
+  memset(row_buffer, 0, record_size);
+
+  cd_entry *current_column =
+      (cd_entry *)((char *)table_descriptor + table_descriptor->cd_offset);
+  int buffer_offset = 0;
+
+  for (int column_index = 0; column_index < table_descriptor->num_columns;
+       ++column_index, ++current_column) {
+    // expect a value: STRING_LITERAL | INT_LITERAL | K_NULL
+    if ((current_token->tok_value != STRING_LITERAL) &&
+        (current_token->tok_value != INT_LITERAL) &&
+        (current_token->tok_value != K_NULL)) {
+      rc = INVALID_INSERT_DEFINITION;
+      current_token->tok_value = INVALID;
+      break;
+    }
+
+    if (current_token->tok_value == K_NULL) {
+      if (current_column->not_null) {
+        rc = NOT_NULL_CONSTRAINT_VIOLATION;
+        current_token->tok_value = INVALID;
+        break;
+      }
+      row_buffer[buffer_offset++] = 0; // length=0
+      // skip payload area
+      buffer_offset +=
+          (current_column->col_type == T_INT) ? 4 : current_column->col_len;
+    } else if (current_column->col_type == T_INT) {
+      if (current_token->tok_value != INT_LITERAL) {
+        rc = TYPE_MISMATCH;
+        current_token->tok_value = INVALID;
+        break;
+      }
+      long parsed_value = strtol(current_token->tok_string, NULL, 10);
+      row_buffer[buffer_offset++] = 4; // length
+      int32_t int_value = (int32_t)parsed_value;
+      memcpy(row_buffer + buffer_offset, &int_value, 4);
+      buffer_offset += 4;
+    } else {
+      // CHAR/VARCHAR(n) stored as fixed n with length tag
+      if (current_token->tok_value != STRING_LITERAL) {
+        rc = TYPE_MISMATCH;
+        current_token->tok_value = INVALID;
+        break;
+      }
+      int string_length = (int)strlen(current_token->tok_string);
+      if (string_length <= 0 || string_length > current_column->col_len) {
+        rc = INVALID_COLUMN_LENGTH;
+        current_token->tok_value = INVALID;
+        break;
+      }
+      row_buffer[buffer_offset++] = (unsigned char)string_length;
+      memcpy(row_buffer + buffer_offset, current_token->tok_string,
+             string_length);
+      buffer_offset +=
+          current_column->col_len; // advance fixed area (rest stays zero)
+    }
+
+    current_token = current_token->next;
+
+    // comma or right paren
+    if (column_index < table_descriptor->num_columns - 1) {
+      if (current_token->tok_value != S_COMMA) {
+        rc = INVALID_INSERT_DEFINITION;
+        current_token->tok_value = INVALID;
+        break;
+      }
+      current_token = current_token->next;
+    } else {
+      if (current_token->tok_value != S_RIGHT_PAREN) {
+        rc = INVALID_INSERT_DEFINITION;
+        current_token->tok_value = INVALID;
+        break;
+      }
+      current_token = current_token->next;
+    }
+  }
+
+  if (!rc) {
+    if (current_token->tok_value != EOC) {
+      rc = INVALID_STATEMENT;
+      current_token->tok_value = INVALID;
+    }
+  }
+
+  if ((!rc) && (g_explain != EXPLAIN_PLAN)) {
+    if (!(rc = tab_append(&table, row_buffer))) {
+      plan_rows(insert_node, 1, 1);
+      mv_delta_row(1, row_buffer);
+    }
+  }
+  plan_charge(insert_node, &mark);
+
+  free(row_buffer);
+  tab_close(&table);
+  return rc;
+}
+
+int sem_delete(token_list *t_list) {
+  int rc = 0;
+  token_list *cur = t_list;
+
+  // Validate table name
+  if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+      (cur->tok_class != type_name)) {
+    rc = INVALID_TABLE_NAME;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  char table_name[MAX_IDENT_LEN + 1];
+  strcpy(table_name, cur->tok_string);
+
+  tpd_entry *tpd = get_tpd_from_list(table_name);
+  if (!tpd) {
+    rc = TABLE_NOT_EXIST;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  cur = cur->next;
+
+  // Check for WHERE clause
+  bool has_where = false;
+  char where_column[MAX_IDENT_LEN + 1] = {0};
+  int where_operator = 0;
+  char where_value_str[256] = {0};
+  int where_value_int = 0;
+  int where_value_type = 0;
+
+  if (cur->tok_value == K_WHERE) {
+    has_where = true;
+    cur = cur->next;
+
+    if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+        (cur->tok_class != type_name)) {
+      rc = COLUMN_NOT_EXIST;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    strcpy(where_column, cur->tok_string);
+    cur = cur->next;
+
+    if (cur->tok_value != S_EQUAL && cur->tok_value != S_LESS &&
+        cur->tok_value != S_GREATER && cur->tok_value != S_LESS_EQUAL &&
+        cur->tok_value != S_GREATER_EQUAL && cur->tok_value != S_NOT_EQUAL) {
+      rc = INVALID_STATEMENT;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    where_operator = cur->tok_value;
+    cur = cur->next;
+
+    if (cur->tok_value == STRING_LITERAL) {
+      where_value_type = STRING_LITERAL;
+      strcpy(where_value_str, cur->tok_string);
+    } else if (cur->tok_value == INT_LITERAL) {
+      where_value_type = INT_LITERAL;
+      where_value_int = atoi(cur->tok_string);
+    } else {
+      rc = INVALID_STATEMENT;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    cur = cur->next;
+  }
+
+  if (cur->tok_value != EOC) {
+    rc = INVALID_STATEMENT;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  // Find WHERE column index
+  int where_col_index = -1;
+  cd_entry *columns = (cd_entry *)((char *)tpd + tpd->cd_offset);
+  if (has_where) {
+    for (int i = 0; i < tpd->num_columns; i++) {
+      if (strcasecmp(columns[i].col_name, where_column) == 0) {
+        where_col_index = i;
+        break;
+      }
+    }
+    if (where_col_index == -1) {
+      rc = COLUMN_NOT_EXIST;
+      return rc;
+    }
+  }
+
+  int delete_node = plan_add("Delete", 0, "%s", table_name);
+  int filter_node = -1;
+  if (has_where) {
+    if (where_value_type == INT_LITERAL)
+      filter_node = plan_add("Filter", 1, "%s %s %d", where_column,
+                             op_symbol(where_operator), where_value_int);
+    else
+      filter_node = plan_add("Filter", 1, "%s %s '%s'", where_column,
+                             op_symbol(where_operator), where_value_str);
+  }
+  int scan_node = plan_add("SeqScan", has_where ? 2 : 1, "%s", table_name);
+  if (g_explain == EXPLAIN_PLAN)
+    return rc;
 
-          /* If rc=0, then get ready for the next column */
-          if (!rc) {
-            cur_id++;
-          }
+  // Open table file
+  tab_handle table;
+  if ((rc = tab_open(table_name, &table)))
+    return rc;
+  table.plan_node = scan_node;
 
-        } while ((rc == 0) && (!column_done));
+  dml_where where = {0};
+  where.has_where = has_where;
+  if (has_where) {
+    where.offset = dml_column_offset(tpd, where_col_index);
+    where.col_type = columns[where_col_index].col_type;
+    where.operator_type = where_operator;
+    where.value_type = where_value_type;
+    where.int_value = where_value_int;
+    where.str_value = where_value_str;
+    where.prefix_compare = true;
+  }
 
-        if ((column_done) && (cur->tok_value != EOC)) {
-          rc = INVALID_TABLE_DEFINITION;
-          cur->tok_value = INVALID;
-        }
+  int deleted_count = 0;
+  long long mark = plan_clock();
+
+  /* Large fixed-format tables are split across worker threads.  Slotted
+     pages do not split into record ranges, and materialized views collect
+     the deleted rows one by one, so those stay serial. */
+  int threads = parallel_threads(table.hdr.num_records);
+  if ((threads > 1) && !(table.hdr.file_header_flag & TAB_FLAG_SLOTTED) &&
+      !g_mv_delta_on) {
+    int num_records = table.hdr.num_records;
+    rc = tab_delete_parallel(&table, &where, threads, &deleted_count, delete_node);
+    plan_rows(scan_node, num_records, num_records);
+    plan_rows(filter_node, num_records, deleted_count);
+    if (delete_node >= 0) {
+      char *detail = g_plan[delete_node].detail;
+      int used = strlen(detail);
+      detail_append(detail, sizeof(g_plan[delete_node].detail), &used, " [%d threads]",
+                    threads);
+    }
+  } else {
+    unsigned char *row_buffer = (unsigned char *)db_malloc(table.hdr.record_size, delete_node);
+    bool *keep_row = (bool *)db_calloc(table.hdr.num_records, sizeof(bool), delete_node);
+    if (!row_buffer || !keep_row) {
+      free(row_buffer);
+      free(keep_row);
+      tab_close(&table);
+      return MEMORY_ERROR;
+    }
 
-        if (!rc) {
-          /* Now finished building tpd and add it to the tpd list */
-          tab_entry.num_columns = cur_id;
-          tab_entry.tpd_size =
-              sizeof(tpd_entry) + sizeof(cd_entry) * tab_entry.num_columns;
-          tab_entry.cd_offset = sizeof(tpd_entry);
-          new_entry = (tpd_entry *)calloc(1, tab_entry.tpd_size);
+    for (int row_idx = 0; row_idx < table.hdr.num_records; row_idx++) {
+      if ((rc = tab_read(&table, row_idx, row_buffer)))
+        break;
+      plan_charge(scan_node, &mark);
+      plan_rows(scan_node, 1, 1);
 
-          if (new_entry == NULL) {
-            rc = MEMORY_ERROR;
-          } else {
-            memcpy((void *)new_entry, (void *)&tab_entry, sizeof(tpd_entry));
+      bool delete_this_row = dml_where_match(&where, row_buffer);
+      plan_charge(filter_node, &mark);
+      plan_rows(filter_node, 1, delete_this_row);
 
-            memcpy((void *)((char *)new_entry + sizeof(tpd_entry)),
-                   (void *)col_entry, sizeof(cd_entry) * tab_entry.num_columns);
+      if (delete_this_row) {
+        deleted_count++;
+        mv_delta_row(-1, row_buffer);
+      } else {
+        keep_row[row_idx] = true;
+      }
+    }
 
-            rc = add_tpd_to_list(new_entry);
+    if (!rc && (deleted_count > 0)) {
+      table.plan_node = delete_node;
+      rc = tab_compact(&table, keep_row);
+    }
+    free(keep_row);
+    free(row_buffer);
+  }
+
+  if (!rc) {
+    if (deleted_count == 0)
+      printf("Warning: No rows deleted.\n");
+    else
+      printf("%d row(s) deleted.\n", deleted_count);
+  }
+  plan_rows(delete_node, deleted_count, deleted_count);
+  plan_charge(delete_node, &mark);
+
+  int close_rc = tab_close(&table);
+  return rc ? rc : close_rc;
+}
+
+int sem_update(token_list *t_list) {
+  int rc = 0;
+  token_list *cur = t_list;
+
+  if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+      (cur->tok_class != type_name)) {
+    rc = INVALID_TABLE_NAME;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  char table_name[MAX_IDENT_LEN + 1];
+  strcpy(table_name, cur->tok_string);
+
+  tpd_entry *tpd = get_tpd_from_list(table_name);
+  if (!tpd) {
+    rc = TABLE_NOT_EXIST;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  cur = cur->next;
+
+  if (cur->tok_value != K_SET) {
+    rc = INVALID_STATEMENT;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  cur = cur->next;
+
+  // Column to update
+  if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+      (cur->tok_class != type_name)) {
+    rc = INVALID_COLUMN_NAME;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  char set_col_name[MAX_IDENT_LEN + 1];
+  strcpy(set_col_name, cur->tok_string);
+
+  // Verify column exists
+  int set_col_idx = -1;
+  cd_entry *columns = (cd_entry *)((char *)tpd + tpd->cd_offset);
+  for (int i = 0; i < tpd->num_columns; i++) {
+    if (strcasecmp(columns[i].col_name, set_col_name) == 0) {
+      set_col_idx = i;
+      break;
+    }
+  }
+  if (set_col_idx == -1) {
+    rc = COLUMN_NOT_EXIST;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  cur = cur->next;
+  if (cur->tok_value != S_EQUAL) {
+    rc = INVALID_STATEMENT;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  cur = cur->next;
+
+  // Value to set
+  int set_val_type = 0;
+  int32_t set_val_int = 0;
+  char set_val_str[256] = {0};
+
+  if (cur->tok_value == INT_LITERAL) {
+    set_val_type = INT_LITERAL;
+    set_val_int = atoi(cur->tok_string);
+    if (columns[set_col_idx].col_type != T_INT) {
+      rc = TYPE_MISMATCH;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+  } else if (cur->tok_value == STRING_LITERAL) {
+    set_val_type = STRING_LITERAL;
+    strcpy(set_val_str, cur->tok_string);
+    if (columns[set_col_idx].col_type == T_INT) {
+      rc = TYPE_MISMATCH;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    if (strlen(set_val_str) > columns[set_col_idx].col_len) {
+      rc = INVALID_COLUMN_LENGTH;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+  } else if (cur->tok_value == K_NULL) {
+    // Handle NULL if allowed
+    if (columns[set_col_idx].not_null) {
+      rc = NOT_NULL_CONSTRAINT_VIOLATION;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    set_val_type = K_NULL;
+  } else {
+    rc = INVALID_UPDATE_DEFINITION;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  cur = cur->next;
+
+  // Check for WHERE
+  bool has_where = false;
+  char where_column[MAX_IDENT_LEN + 1] = {0};
+  int where_operator = 0;
+  char where_value_str[256] = {0};
+  int where_value_int = 0;
+  int where_value_type = 0;
+  int where_col_index = -1;
+
+  if (cur->tok_value == K_WHERE) {
+    has_where = true;
+    cur = cur->next;
+
+    if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+        (cur->tok_class != type_name)) {
+      rc = COLUMN_NOT_EXIST;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    strcpy(where_column, cur->tok_string);
+
+    // Find WHERE column index
+    for (int i = 0; i < tpd->num_columns; i++) {
+      if (strcasecmp(columns[i].col_name, where_column) == 0) {
+        where_col_index = i;
+        break;
+      }
+    }
+    if (where_col_index == -1) {
+      rc = COLUMN_NOT_EXIST;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+
+    cur = cur->next;
+    if (cur->tok_value != S_EQUAL && cur->tok_value != S_LESS &&
+        cur->tok_value != S_GREATER && cur->tok_value != S_LESS_EQUAL &&
+        cur->tok_value != S_GREATER_EQUAL && cur->tok_value != S_NOT_EQUAL) {
+      rc = INVALID_STATEMENT;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    where_operator = cur->tok_value;
+    cur = cur->next;
+
+    if (cur->tok_value == STRING_LITERAL) {
+      where_value_type = STRING_LITERAL;
+      strcpy(where_value_str, cur->tok_string);
+    } else if (cur->tok_value == INT_LITERAL) {
+      where_value_type = INT_LITERAL;
+      where_value_int = atoi(cur->tok_string);
+    } else {
+      rc = INVALID_STATEMENT;
+      cur->tok_value = INVALID;
+      return rc;
+    }
+    cur = cur->next;
+  }
+
+  if (cur->tok_value != EOC) {
+    rc = INVALID_STATEMENT;
+    cur->tok_value = INVALID;
+    return rc;
+  }
+
+  int update_node = plan_add("Update", 0, "%s SET %s", table_name,
+                             set_col_name);
+  int filter_node = -1;
+  if (has_where) {
+    if (where_value_type == INT_LITERAL)
+      filter_node = plan_add("Filter", 1, "%s %s %d", where_column,
+                             op_symbol(where_operator), where_value_int);
+    else
+      filter_node = plan_add("Filter", 1, "%s %s '%s'", where_column,
+                             op_symbol(where_operator), where_value_str);
+  }
+  int scan_node = plan_add("SeqScan", has_where ? 2 : 1, "%s", table_name);
+  if (g_explain == EXPLAIN_PLAN)
+    return rc;
+
+  // Open file and update
+  tab_handle table;
+  if ((rc = tab_open(table_name, &table)))
+    return rc;
+  table.plan_node = scan_node;
+
+  dml_where where = {0};
+  where.has_where = has_where;
+  if (has_where) {
+    where.offset = dml_column_offset(tpd, where_col_index);
+    where.col_type = columns[where_col_index].col_type;
+    where.operator_type = where_operator;
+    where.value_type = where_value_type;
+    where.int_value = where_value_int;
+    where.str_value = where_value_str;
+  }
+  dml_set set = {0};
+  set.offset = dml_column_offset(tpd, set_col_idx);
+  set.col_type = columns[set_col_idx].col_type;
+  set.col_len = columns[set_col_idx].col_len;
+  set.value_type = set_val_type;
+  set.int_value = set_val_int;
+  set.str_value = set_val_str;
+
+  int updated_count = 0;
+  long long mark = plan_clock();
+
+  /* Split across worker threads under the same conditions as DELETE */
+  int threads = parallel_threads(table.hdr.num_records);
+  if ((threads > 1) && !(table.hdr.file_header_flag & TAB_FLAG_SLOTTED) &&
+      !g_mv_delta_on) {
+    int num_records = table.hdr.num_records;
+    rc = tab_update_parallel(&table, &where, &set, threads, &updated_count, update_node);
+    plan_rows(scan_node, num_records, num_records);
+    plan_rows(filter_node, num_records, updated_count);
+    plan_rows(update_node, updated_count, updated_count);
+    plan_charge(update_node, &mark);
+    if (update_node >= 0) {
+      char *detail = g_plan[update_node].detail;
+      int used = strlen(detail);
+      detail_append(detail, sizeof(g_plan[update_node].detail), &used, " [%d threads]",
+                    threads);
+    }
+  } else {
+    unsigned char *row_buffer = (unsigned char *)db_malloc(table.hdr.record_size, update_node);
+    if (!row_buffer) {
+      tab_close(&table);
+      return MEMORY_ERROR;
+    }
 
-            if (!rc) {
-              /* Create <table>.tab using the descriptor we just built before */
-              int frc = create_table_data_file(new_entry);
-              if (frc)
-                rc = frc;
-            }
+    for (int row_idx = 0; row_idx < table.hdr.num_records; row_idx++) {
+      if ((rc = tab_read(&table, row_idx, row_buffer)))
+        break;
+      plan_charge(scan_node, &mark);
+      plan_rows(scan_node, 1, 1);
 
-            /* Refresh the in-memory catalog so that future lookups work */
-            if (!rc) {
-              int irc = initialize_tpd_list();
-              if (irc)
-                rc = irc;
-            }
+      bool update_row = dml_where_match(&where, row_buffer);
+      plan_charge(filter_node, &mark);
+      plan_rows(filter_node, 1, update_row);
 
-            free(new_entry);
-          }
-        }
+      if (update_row) {
+        mv_delta_row(-1, row_buffer);
+        dml_set_column(&set, row_buffer);
+        if ((rc = tab_write(&table, row_idx, row_buffer)))
+          break;
+        mv_delta_row(1, row_buffer);
+        updated_count++;
+        plan_rows(update_node, 1, 1);
+        plan_charge(update_node, &mark);
       }
     }
+    free(row_buffer);
   }
-  return rc;
-}
 
-int sem_drop_table(token_list *t_list) {
-  int rc = 0;
-  token_list *cur;
-  tpd_entry *tab_entry = NULL;
+  int close_rc = tab_close(&table);
+  if (!rc)
+    rc = close_rc;
 
-  cur = t_list;
-  if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
-      (cur->tok_class != type_name)) {
-    // Error
-    rc = INVALID_TABLE_NAME;
-    cur->tok_value = INVALID;
-  } else {
-    if (cur->next->tok_value != EOC) {
-      rc = INVALID_STATEMENT;
-      cur->next->tok_value = INVALID;
+  if (!rc) {
+    if (updated_count == 0) {
+      printf("Warning: No rows updated.\n");
     } else {
-      if ((tab_entry = get_tpd_from_list(cur->tok_string)) == NULL) {
-        rc = TABLE_NOT_EXIST;
-        cur->tok_value = INVALID;
-      } else {
-        /* Found a valid tpd, drop it from tpd list */
-        rc = drop_tpd_from_list(cur->tok_string);
-        if (!rc) {
-          int frc = drop_table_data_file(cur->tok_string);
-          if (frc)
-            rc = frc;
-        }
-      }
+      printf("%d row(s) updated.\n", updated_count);
     }
   }
 
   return rc;
 }
 
-int sem_list_tables() {
-  int rc = 0;
-  int num_tables = g_tpd_list->num_tables;
-  tpd_entry *cur = &(g_tpd_list->tpd_start);
+/*************************************************************
+        Result writer - buffered SELECT output
+ *************************************************************/
 
-  if (num_tables == 0) {
-    printf("\nThere are currently no tables defined\n");
-  } else {
-    printf("\nTable List\n");
-    printf("*****************\n");
-    while (num_tables-- > 0) {
-      printf("%s\n", cur->table_name);
-      if (num_tables > 0) {
-        cur = (tpd_entry *)((char *)cur + cur->tpd_size);
-      }
-    }
-    printf("****** End ******\n");
-  }
+static const char *output_mode_names[] = {"table", "csv", "tsv", "json", "raw"};
 
-  return rc;
+/* Output mode for a -o / DB_OUTPUT name, or -1 */
+int parse_output_mode(const char *name) {
+  for (int m = OUT_TABLE; m <= OUT_RAW; m++)
+    if (strcasecmp(name, output_mode_names[m]) == 0)
+      return m;
+  return -1;
 }
 
-int sem_list_schema(token_list *t_list) {
-  int rc = 0;
-  token_list *cur;
-  tpd_entry *tab_entry = NULL;
-  cd_entry *col_entry = NULL;
-  char tab_name[MAX_IDENT_LEN + 1];
-  char filename[MAX_IDENT_LEN + 1];
-  bool report = false;
-  FILE *fhandle = NULL;
-  int i = 0;
+/* Decimal digits of v into out (room for 21 bytes); returns the length */
+static int format_int(char *out, long long v) {
+  char digits[20];
+  unsigned long long u = (v < 0) ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+  int n = 0, len = 0;
+  do {
+    digits[n++] = (char)('0' + (u % 10));
+    u /= 10;
+  } while (u);
+  if (v < 0)
+    out[len++] = '-';
+  while (n > 0)
+    out[len++] = digits[--n];
+  return len;
+}
 
-  cur = t_list;
+static void rw_flush(result_writer *rw) {
+  if (rw->used > 0) {
+    if (g_mv_capture) {
+      mv_capture(rw->buf, rw->used);
+    } else {
+      fwrite(rw->buf, 1, rw->used, rw->fp);
+      if (g_qcache_capture)
+        qcache_capture(rw->buf, rw->used);
+    }
+    rw->used = 0;
+  }
+}
 
-  if (cur->tok_value != K_FOR) {
-    rc = INVALID_STATEMENT;
-    cur->tok_value = INVALID;
-  } else {
-    cur = cur->next;
+/* Room for n more bytes; returns where they go */
+static char *rw_reserve(result_writer *rw, int n) {
+  if (rw->used + n > OUT_BUF_SIZE)
+    rw_flush(rw);
+  return rw->buf + rw->used;
+}
 
-    if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
-        (cur->tok_class != type_name)) {
-      // Error
-      rc = INVALID_TABLE_NAME;
-      cur->tok_value = INVALID;
-    } else {
-      memset(filename, '\0', MAX_IDENT_LEN + 1);
-      strcpy(tab_name, cur->tok_string);
-      cur = cur->next;
+static void rw_put(result_writer *rw, const char *data, int len) {
+  memcpy(rw_reserve(rw, len), data, len);
+  rw->used += len;
+}
 
-      if (cur->tok_value != EOC) {
-        if (cur->tok_value == K_TO) {
-          cur = cur->next;
+static void rw_char(result_writer *rw, char c) {
+  *rw_reserve(rw, 1) = c;
+  rw->used++;
+}
 
-          if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
-              (cur->tok_class != type_name)) {
-            // Error
-            rc = INVALID_REPORT_FILE_NAME;
-            cur->tok_value = INVALID;
-          } else {
-            if (cur->next->tok_value != EOC) {
-              rc = INVALID_STATEMENT;
-              cur->next->tok_value = INVALID;
-            } else {
-              /* We have a valid file name */
-              strcpy(filename, cur->tok_string);
-              report = true;
-            }
-          }
-        } else {
-          /* Missing the TO keyword */
-          rc = INVALID_STATEMENT;
-          cur->tok_value = INVALID;
-        }
-      }
+static void rw_pad(result_writer *rw, int n) {
+  if (n > 0) {
+    memset(rw_reserve(rw, n), ' ', n);
+    rw->used += n;
+  }
+}
 
-      if (!rc) {
-        if ((tab_entry = get_tpd_from_list(tab_name)) == NULL) {
-          rc = TABLE_NOT_EXIST;
-          cur->tok_value = INVALID;
-        } else {
-          if (report) {
-            if ((fhandle = fopen(filename, "a+tc")) == NULL) {
-              rc = FILE_OPEN_ERROR;
-            }
-          }
+/* pad_last: the table format puts a space after the last column too */
+static void rw_begin(result_writer *rw, int mode, bool pad_last) {
+  rw->fp = g_result_fp ? g_result_fp : stdout;
+  rw->mode = mode;
+  rw->num_cols = 0;
+  rw->col = 0;
+  rw->pad_last = pad_last;
+  rw->used = 0;
+}
 
-          if (!rc) {
-            /* Find correct tpd, need to parse column and index information */
+static void rw_add_column(result_writer *rw, const char *name, int width,
+                          bool numeric) {
+  int c = rw->num_cols++;
+  strncpy(rw->names[c], name, MAX_IDENT_LEN);
+  rw->names[c][MAX_IDENT_LEN] = '\0';
+  rw->widths[c] = width;
+  rw->numeric[c] = numeric;
+}
 
-            /* First, write the tpd_entry information */
-            printf("Table PD size            (tpd_size)    = %d\n",
-                   tab_entry->tpd_size);
-            printf("Table Name               (table_name)  = %s\n",
-                   tab_entry->table_name);
-            printf("Number of Columns        (num_columns) = %d\n",
-                   tab_entry->num_columns);
-            printf("Column Descriptor Offset (cd_offset)   = %d\n",
-                   tab_entry->cd_offset);
-            printf("Table PD Flags           (tpd_flags)   = %d\n\n",
-                   tab_entry->tpd_flags);
+/* Between fields of the table format */
+static void rw_table_gap(result_writer *rw, int c) {
+  if ((c < rw->num_cols - 1) || rw->pad_last)
+    rw_char(rw, ' ');
+}
 
-            if (report) {
-              fprintf(fhandle, "Table PD size            (tpd_size)    = %d\n",
-                      tab_entry->tpd_size);
-              fprintf(fhandle, "Table Name               (table_name)  = %s\n",
-                      tab_entry->table_name);
-              fprintf(fhandle, "Number of Columns        (num_columns) = %d\n",
-                      tab_entry->num_columns);
-              fprintf(fhandle, "Column Descriptor Offset (cd_offset)   = %d\n",
-                      tab_entry->cd_offset);
-              fprintf(fhandle,
-                      "Table PD Flags           (tpd_flags)   = %d\n\n",
-                      tab_entry->tpd_flags);
-            }
+/* A string field, quoted or escaped as the format needs */
+static void rw_text_value(result_writer *rw, const char *text, int len) {
+  if (rw->mode == OUT_CSV) {
+    bool quote = false;
+    for (int i = 0; (i < len) && !quote; i++)
+      quote = (text[i] == ',') || (text[i] == '"') || (text[i] == '\n') ||
+              (text[i] == '\r');
+    if (!quote) {
+      rw_put(rw, text, len);
+      return;
+    }
+    rw_char(rw, '"');
+    for (int i = 0; i < len; i++) {
+      if (text[i] == '"')
+        rw_char(rw, '"');
+      rw_char(rw, text[i]);
+    }
+    rw_char(rw, '"');
+  } else if (rw->mode == OUT_TSV) {
+    for (int i = 0; i < len; i++) {
+      char c = text[i];
+      if ((c == '\t') || (c == '\n') || (c == '\\')) {
+        rw_char(rw, '\\');
+        c = (c == '\t') ? 't' : (c == '\n') ? 'n' : '\\';
+      }
+      rw_char(rw, c);
+    }
+  } else if (rw->mode == OUT_JSON) {
+    static const char hex[] = "0123456789abcdef";
+    rw_char(rw, '"');
+    for (int i = 0; i < len; i++) {
+      unsigned char c = (unsigned char)text[i];
+      if ((c == '"') || (c == '\\')) {
+        rw_char(rw, '\\');
+        rw_char(rw, (char)c);
+      } else if (c < 0x20) {
+        char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+        rw_put(rw, esc, 6);
+      } else {
+        rw_char(rw, (char)c);
+      }
+    }
+    rw_char(rw, '"');
+  } else {
+    rw_put(rw, text, len);
+  }
+}
 
-            /* Next, write the cd_entry information */
-            for (i = 0, col_entry = (cd_entry *)((char *)tab_entry +
-                                                 tab_entry->cd_offset);
-                 i < tab_entry->num_columns; i++, col_entry++) {
-              printf("Column Name   (col_name) = %s\n", col_entry->col_name);
-              printf("Column Id     (col_id)   = %d\n", col_entry->col_id);
-              printf("Column Type   (col_type) = %d\n", col_entry->col_type);
-              printf("Column Length (col_len)  = %d\n", col_entry->col_len);
-              printf("Not Null flag (not_null) = %d\n\n", col_entry->not_null);
+/* Column names: the padded header and dashes of the table format, or
+   the header line of CSV / TSV */
+static void rw_header(result_writer *rw) {
+  if (g_mv_capture)
+    mv_capture_columns(rw);
+  if (rw->mode == OUT_TABLE) {
+    for (int c = 0; c < rw->num_cols; c++) {
+      int len = strlen(rw->names[c]);
+      rw_put(rw, rw->names[c], len);
+      rw_pad(rw, rw->widths[c] - len);
+      rw_table_gap(rw, c);
+    }
+    rw_char(rw, '\n');
+    for (int c = 0; c < rw->num_cols; c++) {
+      memset(rw_reserve(rw, rw->widths[c]), '-', rw->widths[c]);
+      rw->used += rw->widths[c];
+      rw_table_gap(rw, c);
+    }
+    rw_char(rw, '\n');
+  } else if ((rw->mode == OUT_CSV) || (rw->mode == OUT_TSV)) {
+    for (int c = 0; c < rw->num_cols; c++) {
+      if (c > 0)
+        rw_char(rw, (rw->mode == OUT_CSV) ? ',' : '\t');
+      rw_text_value(rw, rw->names[c], strlen(rw->names[c]));
+    }
+    rw_char(rw, '\n');
+  }
+}
 
-              if (report) {
-                fprintf(fhandle, "Column Name   (col_name) = %s\n",
-                        col_entry->col_name);
-                fprintf(fhandle, "Column Id     (col_id)   = %d\n",
-                        col_entry->col_id);
-                fprintf(fhandle, "Column Type   (col_type) = %d\n",
-                        col_entry->col_type);
-                fprintf(fhandle, "Column Length (col_len)  = %d\n",
-                        col_entry->col_len);
-                fprintf(fhandle, "Not Null Flag (not_null) = %d\n\n",
-                        col_entry->not_null);
-              }
-            }
+/* Separator or key ahead of the next field of the row */
+static void rw_field_start(result_writer *rw) {
+  if (rw->mode == OUT_CSV) {
+    if (rw->col > 0)
+      rw_char(rw, ',');
+  } else if (rw->mode == OUT_TSV) {
+    if (rw->col > 0)
+      rw_char(rw, '\t');
+  } else if (rw->mode == OUT_JSON) {
+    rw_put(rw, (rw->col > 0) ? ", \"" : "{\"", (rw->col > 0) ? 3 : 2);
+    rw_put(rw, rw->names[rw->col], strlen(rw->names[rw->col]));
+    rw_put(rw, "\": ", 3);
+  }
+}
 
-            if (report) {
-              fflush(fhandle);
-              fclose(fhandle);
-            }
-          } // File open error
-        } // Table not exist
-      } // no semantic errors
-    } // Invalid table name
-  } // Invalid statement
+/* Gap after the field, and the row end after its last one */
+static void rw_field_end(result_writer *rw) {
+  if (rw->mode == OUT_TABLE)
+    rw_table_gap(rw, rw->col);
+  if (++rw->col < rw->num_cols)
+    return;
+  rw->col = 0;
+  if (rw->mode == OUT_JSON)
+    rw_char(rw, '}');
+  if (rw->mode != OUT_RAW)
+    rw_char(rw, '\n');
+}
 
-  return rc;
+static void rw_int(result_writer *rw, long long value) {
+  rw_field_start(rw);
+  if (rw->mode == OUT_RAW) {
+    rw_char(rw, (char)sizeof(value));
+    rw_put(rw, (const char *)&value, sizeof(value));
+  } else {
+    char digits[24];
+    int len = format_int(digits, value);
+    if (rw->mode == OUT_TABLE)
+      rw_pad(rw, rw->widths[rw->col] - len);
+    rw_put(rw, digits, len);
+  }
+  rw_field_end(rw);
 }
 
-int sem_insert_into(token_list *t_list) {
-  int rc = 0;
-  token_list *current_token = t_list;
+static void rw_text(result_writer *rw, const char *text, int len) {
+  rw_field_start(rw);
+  if (rw->mode == OUT_RAW)
+    rw_char(rw, (char)len);
+  rw_text_value(rw, text, len);
+  if (rw->mode == OUT_TABLE)
+    rw_pad(rw, rw->widths[rw->col] - len);
+  rw_field_end(rw);
+}
 
-  // table name
-  if ((current_token->tok_class != keyword) &&
-      (current_token->tok_class != identifier) &&
-      (current_token->tok_class != type_name)) {
-    rc = INVALID_TABLE_NAME;
-    current_token->tok_value = INVALID;
-    return rc;
+static void rw_null(result_writer *rw) {
+  rw_field_start(rw);
+  if (rw->mode == OUT_TABLE) {
+    rw_put(rw, "NULL", 4);
+    rw_pad(rw, rw->widths[rw->col] - 4);
+  } else if (rw->mode == OUT_JSON) {
+    rw_put(rw, "null", 4);
+  } else if (rw->mode == OUT_RAW) {
+    rw_char(rw, 0);
   }
+  rw_field_end(rw);
+}
 
-  char table_name[MAX_IDENT_LEN + 1] = {0};
-  strcpy(table_name, current_token->tok_string);
+/* A stored field image: the length byte, then the payload */
+static void rw_field(result_writer *rw, const unsigned char *field, bool is_int) {
+  if (field[0] == 0) {
+    rw_null(rw);
+  } else if (is_int) {
+    int value;
+    memcpy(&value, field + 1, 4);
+    rw_int(rw, value);
+  } else {
+    rw_text(rw, (const char *)(field + 1), field[0]);
+  }
+}
 
-  tpd_entry *table_descriptor = get_tpd_from_list(table_name);
-  if (!table_descriptor) {
-    rc = TABLE_NOT_EXIST;
-    current_token->tok_value = INVALID;
-    return rc;
+/* The record count of the table format, then out with the rest */
+static void rw_finish(result_writer *rw, int rows) {
+  if (rw->mode == OUT_TABLE) {
+    char digits[24];
+    rw_put(rw, "\n ", 2);
+    rw_put(rw, digits, format_int(digits, rows));
+    rw_put(rw, " record(s) selected.\n\n", 22);
   }
+  rw_flush(rw);
+}
 
-  current_token = current_token->next;
-  if (current_token->tok_value != K_VALUES) {
-    rc = INVALID_STATEMENT;
-    current_token->tok_value = INVALID;
-    return rc;
+/*************************************************************
+        GROUP BY - hash aggregation with spill to disk
+ *************************************************************/
+
+static const char *agg_func_name(int type) {
+  return (type == F_SUM) ? "SUM" : (type == F_AVG) ? "AVG" : "COUNT";
+}
+
+/* True when a three-way comparison result satisfies the operator */
+static bool cmp_satisfies(int operator_type, int cmp) {
+  switch (operator_type) {
+  case S_EQUAL:         return cmp == 0;
+  case S_LESS:          return cmp < 0;
+  case S_GREATER:       return cmp > 0;
+  case S_LESS_EQUAL:    return cmp <= 0;
+  case S_GREATER_EQUAL: return cmp >= 0;
+  case S_NOT_EQUAL:     return cmp != 0;
   }
-  current_token = current_token->next;
-  if (current_token->tok_value != S_LEFT_PAREN) {
-    rc = INVALID_STATEMENT;
-    current_token->tok_value = INVALID;
-    return rc;
+  return false;
+}
+
+/* Parse "FUNC(col)" or "COUNT(*)" starting at *cur */
+static int parse_aggregate(token_list **cur, aggregate_func *agg) {
+  token_list *t = *cur;
+  if (t->tok_class != function_name)
+    return INVALID_SELECT_DEFINITION;
+  agg->type = t->tok_value;
+  t = t->next;
+  if (t->tok_value != S_LEFT_PAREN)
+    return INVALID_SELECT_DEFINITION;
+  t = t->next;
+  if (t->tok_value == S_STAR) {
+    if (agg->type != F_COUNT)
+      return INVALID_SELECT_DEFINITION; // Only COUNT(*) is valid
+    strcpy(agg->col_name, "*");
+  } else if (t->tok_class == keyword || t->tok_class == identifier ||
+             t->tok_class == type_name) {
+    strcpy(agg->col_name, t->tok_string);
+  } else {
+    return INVALID_SELECT_DEFINITION;
   }
-  current_token = current_token->next;
+  t = t->next;
+  if (t->tok_value != S_RIGHT_PAREN)
+    return INVALID_SELECT_DEFINITION;
+  *cur = t->next;
+  return 0;
+}
 
-  FILE *table_file = NULL;
-  table_file_header file_header;
-  if ((rc = open_tab_rw(table_name, &table_file, &file_header)))
-    return rc;
+/* Entry layout: uint32 hash, uint32 in-use flag, key padded to 8 bytes,
+   then num_aggs agg_state */
+static inline int agg_key_space(int key_len) { return (key_len + 7) & ~7; }
+
+static inline unsigned char *agg_slot(const group_agg *ga, int i) {
+  return ga->slots + (size_t)i * ga->entry_size;
+}
+
+static inline agg_state *agg_states(const group_agg *ga, unsigned char *entry) {
+  return (agg_state *)(entry + 8 + agg_key_space(ga->key_len));
+}
 
-  if (file_header.num_records >= 100) {
-    fclose(table_file);
+static inline bool agg_used(const unsigned char *entry) {
+  uint32_t used;
+  memcpy(&used, entry + 4, 4);
+  return used != 0;
+}
+
+static long agg_budget() {
+  const char *env = getenv("DB_AGG_MEM");
+  long budget = env ? atol(env) : 0;
+  return (budget > 0) ? budget : AGG_MEM_BUDGET;
+}
+
+static int agg_init(group_agg *ga, int key_len, int num_aggs, int level) {
+  memset(ga, 0, sizeof(*ga));
+  ga->key_len = key_len;
+  ga->num_aggs = num_aggs;
+  ga->level = level;
+  ga->entry_size = 8 + agg_key_space(key_len) + num_aggs * (int)sizeof(agg_state);
+  ga->capacity = 16;
+  if (level >= AGG_MAX_LEVEL) {
+    ga->max_capacity = 1 << 30;
+  } else {
+    long budget = agg_budget();
+    ga->max_capacity = ga->capacity;
+    while ((long)ga->max_capacity * 2 * ga->entry_size <= budget)
+      ga->max_capacity *= 2;
+  }
+  ga->slots = (unsigned char *)db_malloc((size_t)ga->capacity * ga->entry_size, -1);
+  if (!ga->slots) {
+    ga->capacity = 0;
     return MEMORY_ERROR;
-  } // project cap
+  }
+  memset(ga->slots, 0, (size_t)ga->capacity * ga->entry_size);
+  return 0;
+}
 
-  // prepare one record buffer
-  int record_size = file_header.record_size;
-  unsigned char *row_buffer = (unsigned char *)calloc(1, record_size);
-  if (!row_buffer) {
-    fclose(table_file);
+/* The slot holding entry's group, or the free slot where it belongs */
+static unsigned char *agg_probe(const group_agg *ga, const unsigned char *entry) {
+  uint32_t h;
+  memcpy(&h, entry, 4);
+  int mask = ga->capacity - 1;
+  for (int i = h & mask;; i = (i + 1) & mask) {
+    unsigned char *slot = agg_slot(ga, i);
+    if (!agg_used(slot))
+      return slot;
+    if ((memcmp(slot, entry, 4) == 0) &&
+        (memcmp(slot + 8, entry + 8, ga->key_len) == 0))
+      return slot;
+  }
+}
+
+static int agg_grow(group_agg *ga) {
+  unsigned char *old_slots = ga->slots;
+  int old_capacity = ga->capacity;
+  ga->capacity *= 2;
+  ga->slots = (unsigned char *)db_malloc((size_t)ga->capacity * ga->entry_size, -1);
+  if (!ga->slots) {
+    ga->slots = old_slots;
+    ga->capacity = old_capacity;
     return MEMORY_ERROR;
   }
+  memset(ga->slots, 0, (size_t)ga->capacity * ga->entry_size);
+  for (int i = 0; i < old_capacity; i++) {
+    unsigned char *entry = old_slots + (size_t)i * ga->entry_size;
+    if (agg_used(entry))
+      memcpy(agg_probe(ga, entry), entry, ga->entry_size);
+  }
+  free(old_slots);
+  return 0;
+}
 
-  cd_entry *current_column =
-      (cd_entry *)((char *)table_descriptor + table_descriptor->cd_offset);
-  int buffer_offset = 0;
+/* Partitions use the high hash bits, the table index the low ones */
+static int agg_spill(group_agg *ga, const unsigned char *entry) {
+  uint32_t h;
+  memcpy(&h, entry, 4);
+  int p = (h >> (29 - 3 * ga->level)) & (AGG_PARTITIONS - 1);
+  if ((!ga->part[p]) && (!(ga->part[p] = tmpfile())))
+    return FILE_OPEN_ERROR;
+  if (db_fwrite(entry, ga->entry_size, 1, ga->part[p]) != 1)
+    return FILE_WRITE_ERROR;
+  ga->spilled++;
+  return 0;
+}
 
-  for (int column_index = 0; column_index < table_descriptor->num_columns;
-       ++column_index, ++current_column) {
-    // expect a value: STRING_LITERAL | INT_LITERAL | K_NULL
-    if ((current_token->tok_value != STRING_LITERAL) &&
-        (current_token->tok_value != INT_LITERAL) &&
-        (current_token->tok_value != K_NULL)) {
-      rc = INVALID_INSERT_DEFINITION;
-      current_token->tok_value = INVALID;
-      break;
+/* Fold one (partial) entry into its group */
+static int agg_add(group_agg *ga, const unsigned char *entry) {
+  int rc = 0;
+  unsigned char *slot = agg_probe(ga, entry);
+  if (agg_used(slot)) {
+    agg_state *to = agg_states(ga, slot);
+    const agg_state *from = agg_states(ga, (unsigned char *)entry);
+    for (int a = 0; a < ga->num_aggs; a++) {
+      to[a].sum += from[a].sum;
+      to[a].count += from[a].count;
     }
+    return 0;
+  }
+  if ((ga->count + 1) * 2 > ga->capacity) {
+    if (ga->capacity >= ga->max_capacity)
+      return agg_spill(ga, entry);
+    if ((rc = agg_grow(ga)))
+      return rc;
+    slot = agg_probe(ga, entry);
+  }
+  memcpy(slot, entry, ga->entry_size);
+  ga->count++;
+  return 0;
+}
 
-    if (current_token->tok_value == K_NULL) {
-      if (current_column->not_null) {
-        rc = NOT_NULL_CONSTRAINT_VIOLATION;
-        current_token->tok_value = INVALID;
-        break;
-      }
-      row_buffer[buffer_offset++] = 0; // length=0
-      // skip payload area
-      buffer_offset +=
-          (current_column->col_type == T_INT) ? 4 : current_column->col_len;
-    } else if (current_column->col_type == T_INT) {
-      if (current_token->tok_value != INT_LITERAL) {
-        rc = TYPE_MISMATCH;
-        current_token->tok_value = INVALID;
-        break;
-      }
-      long parsed_value = strtol(current_token->tok_string, NULL, 10);
-      row_buffer[buffer_offset++] = 4; // length
-      int32_t int_value = (int32_t)parsed_value;
-      memcpy(row_buffer + buffer_offset, &int_value, 4);
-      buffer_offset += 4;
-    } else {
-      // CHAR/VARCHAR(n) stored as fixed n with length tag
-      if (current_token->tok_value != STRING_LITERAL) {
-        rc = TYPE_MISMATCH;
-        current_token->tok_value = INVALID;
+/* Append every finished group to *out, then aggregate the partitions one
+   at a time (each may spill again, one level down).  Frees ga. */
+static int agg_finish(group_agg *ga, unsigned char **out, int *out_count,
+                      int *out_cap, long long *spilled) {
+  int rc = 0;
+  for (int i = 0; (i < ga->capacity) && !rc; i++) {
+    unsigned char *entry = agg_slot(ga, i);
+    if (!agg_used(entry))
+      continue;
+    if (*out_count >= *out_cap) {
+      int cap = (*out_cap == 0) ? 64 : *out_cap * 2;
+      unsigned char *grown = (unsigned char *)db_realloc(*out, (size_t)cap * ga->entry_size, -1);
+      if (!grown) {
+        rc = MEMORY_ERROR;
         break;
       }
-      int string_length = (int)strlen(current_token->tok_string);
-      if (string_length <= 0 || string_length > current_column->col_len) {
-        rc = INVALID_COLUMN_LENGTH;
-        current_token->tok_value = INVALID;
-        break;
+      *out = grown;
+      *out_cap = cap;
+    }
+    memcpy(*out + (size_t)(*out_count)++ * ga->entry_size, entry, ga->entry_size);
+  }
+  free(ga->slots);
+  ga->slots = NULL;
+  *spilled += ga->spilled;
+
+  for (int p = 0; p < AGG_PARTITIONS; p++) {
+    if (!ga->part[p])
+      continue;
+    if (!rc) {
+      group_agg sub;
+      unsigned char *entry = (unsigned char *)db_malloc(ga->entry_size, -1);
+      if (!entry || (rc = agg_init(&sub, ga->key_len, ga->num_aggs, ga->level + 1))) {
+        free(entry);
+        rc = rc ? rc : MEMORY_ERROR;
+      } else {
+        rewind(ga->part[p]);
+        while (!rc && (db_fread(entry, ga->entry_size, 1, ga->part[p]) == 1))
+          rc = agg_add(&sub, entry);
+        free(entry);
+        int frc = agg_finish(&sub, out, out_count, out_cap, spilled);
+        if (!rc)
+          rc = frc;
       }
-      row_buffer[buffer_offset++] = (unsigned char)string_length;
-      memcpy(row_buffer + buffer_offset, current_token->tok_string,
-             string_length);
-      buffer_offset +=
-          current_column->col_len; // advance fixed area (rest stays zero)
     }
+    fclose(ga->part[p]);
+    ga->part[p] = NULL;
+  }
+  return rc;
+}
 
-    current_token = current_token->next;
+static long long agg_value(int type, const agg_state *st) {
+  if (type == F_SUM)
+    return st->sum;
+  if (type == F_AVG)
+    return (st->count > 0) ? (st->sum / st->count) : 0;
+  return st->count;
+}
 
-    // comma or right paren
-    if (column_index < table_descriptor->num_columns - 1) {
-      if (current_token->tok_value != S_COMMA) {
-        rc = INVALID_INSERT_DEFINITION;
-        current_token->tok_value = INVALID;
-        break;
-      }
-      current_token = current_token->next;
+/* Length of the normalized ORDER BY key for these columns */
+static int sort_key_length(const sort_key_col *cols, int num_cols) {
+  int len = SORT_SEQ_BYTES;
+  for (int c = 0; c < num_cols; c++)
+    len += 1 + cols[c].len;
+  return len;
+}
+
+/* Encode a row's ORDER BY columns and arrival number into key.  row2 is
+   the joined table's row, NULL without a join. */
+static void sort_key_encode(unsigned char *key, const unsigned char *row,
+                            const unsigned char *row2, const sort_key_col *cols,
+                            int num_cols, long long seq) {
+  for (int c = 0; c < num_cols; c++) {
+    const sort_key_col *sc = &cols[c];
+    const unsigned char *field = (sc->side ? row2 : row) + sc->offset;
+    bool is_null = (field[0] == 0);
+    *key++ = (is_null != sc->nulls_first) ? 1 : 0;
+    if (is_null) {
+      memset(key, 0, sc->len);
+    } else if (sc->type == T_INT) {
+      int value;
+      memcpy(&value, field + 1, 4);
+      uint32_t bits = (uint32_t)value ^ 0x80000000u;
+      key[0] = bits >> 24;
+      key[1] = bits >> 16;
+      key[2] = bits >> 8;
+      key[3] = bits;
     } else {
-      if (current_token->tok_value != S_RIGHT_PAREN) {
-        rc = INVALID_INSERT_DEFINITION;
-        current_token->tok_value = INVALID;
-        break;
-      }
-      current_token = current_token->next;
+      memcpy(key, field + 1, field[0]);
+      memset(key + field[0], 0, sc->len - field[0]);
+    }
+    if (sc->desc && !is_null) {
+      for (int i = 0; i < sc->len; i++)
+        key[i] = ~key[i];
     }
+    key += sc->len;
   }
+  for (int i = SORT_SEQ_BYTES - 1; i >= 0; i--, seq >>= 8)
+    key[i] = (unsigned char)seq;
+}
 
-  if (!rc) {
-    if (current_token->tok_value != EOC) {
-      rc = INVALID_STATEMENT;
-      current_token->tok_value = INVALID;
+/* Stable LSD radix sort of n keys of key_len bytes stored back to back.
+   order[] receives the key numbers in sorted order.  Byte positions that
+   are the same in every key (padding, high bytes of the arrival number)
+   are skipped. */
+static int radix_sort_keys(const unsigned char *keys, int key_len, int n,
+                           int *order, int node) {
+  int *tmp = (int *)db_malloc(n * sizeof(int), node);
+  if (!tmp)
+    return MEMORY_ERROR;
+  int *cur = order, *next = tmp;
+  for (int i = 0; i < n; i++)
+    cur[i] = i;
+
+  for (int pos = key_len - 1; pos >= 0; pos--) {
+    int count[257] = {0};
+    for (int i = 0; i < n; i++)
+      count[keys[(size_t)i * key_len + pos] + 1]++;
+    if (count[keys[pos] + 1] == n)
+      continue;
+    for (int b = 0; b < 256; b++)
+      count[b + 1] += count[b];
+    for (int i = 0; i < n; i++)
+      next[count[keys[(size_t)cur[i] * key_len + pos]]++] = cur[i];
+    int *swap = cur;
+    cur = next;
+    next = swap;
+  }
+
+  if (cur != order)
+    memcpy(order, cur, n * sizeof(int));
+  free(tmp);
+  return 0;
+}
+
+/*************************************************************
+        Parallel ORDER BY - sorted runs and splitter merge
+ *************************************************************/
+
+static inline const unsigned char *sort_key_at(const parallel_sort *ps, int k) {
+  return ps->keys + (size_t)k * ps->key_len;
+}
+
+static void sort_run_range(const parallel_sort *ps, int r, int *first, int *last) {
+  *first = (int)((long)ps->n * r / ps->num_threads);
+  *last = (int)((long)ps->n * (r + 1) / ps->num_threads);
+}
+
+/* Phase 1: radix sort run r */
+static void sort_run_task(void *arg, int r) {
+  parallel_sort *ps = (parallel_sort *)arg;
+  int first, last;
+  sort_run_range(ps, r, &first, &last);
+  if (last == first)
+    return;
+  int *run = ps->runs + first;
+  ps->rc[r] = radix_sort_keys(sort_key_at(ps, first), ps->key_len, last - first, run, -1);
+  for (int i = 0; i < last - first; i++)
+    run[i] += first;
+  STAT_ADD(sort_runs, 1);
+}
+
+/* Phase 2: merge key range t of every run.  The keys before it, in all
+   runs, say where its output starts. */
+static void sort_merge_task(void *arg, int t) {
+  parallel_sort *ps = (parallel_sort *)arg;
+  int T = ps->num_threads, next[MAX_THREADS], end[MAX_THREADS], heap[MAX_THREADS];
+  int size = 0, first, last;
+  long out = 0;
+  auto before = [&](int a, int b) -> bool {
+    return memcmp(sort_key_at(ps, ps->runs[next[a]]), sort_key_at(ps, ps->runs[next[b]]),
+                  ps->key_len) < 0;
+  };
+  auto sift_down = [&](int i) {
+    while (true) {
+      int best = i, l = 2 * i + 1, r = 2 * i + 2;
+      if ((l < size) && before(heap[l], heap[best]))
+        best = l;
+      if ((r < size) && before(heap[r], heap[best]))
+        best = r;
+      if (best == i)
+        return;
+      int temp = heap[i];
+      heap[i] = heap[best];
+      heap[best] = temp;
+      i = best;
     }
+  };
+
+  for (int r = 0; r < T; r++) {
+    sort_run_range(ps, r, &first, &last);
+    next[r] = ps->bounds[r * (T + 1) + t];
+    end[r] = ps->bounds[r * (T + 1) + t + 1];
+    out += next[r] - first;
+    if (next[r] < end[r])
+      heap[size++] = r;
+  }
+  for (int i = size / 2 - 1; i >= 0; i--)
+    sift_down(i);
+  while (size > 0) {
+    int r = heap[0];
+    ps->order[out++] = ps->runs[next[r]++];
+    if (next[r] == end[r])
+      heap[0] = heap[--size];
+    sift_down(0);
   }
+}
+
+/* radix_sort_keys on num_threads threads: sorted runs, then T - 1
+   splitters from a sample of every run, then one merge per key range */
+static int parallel_sort_keys(const unsigned char *keys, int key_len, int n, int *order,
+                              int num_threads, int node) {
+  int rc = 0, T = num_threads, first, last;
+  parallel_sort ps;
+  ps.keys = keys;
+  ps.key_len = key_len;
+  ps.n = n;
+  ps.num_threads = T;
+  ps.order = order;
+  memset(ps.rc, 0, sizeof(ps.rc));
+  ps.runs = (int *)db_malloc((size_t)n * sizeof(int), node);
+  ps.bounds = (int *)db_malloc((size_t)T * (T + 1) * sizeof(int), node);
+  unsigned char *samples = (unsigned char *)db_malloc((size_t)T * T * key_len, node);
+  int *sample_order = (int *)db_malloc((size_t)T * T * sizeof(int), node);
+  if (!ps.runs || !ps.bounds || !samples || !sample_order)
+    rc = MEMORY_ERROR;
 
   if (!rc) {
-    long write_position = row_pos(&file_header, file_header.num_records);
-    fseek(table_file, write_position, SEEK_SET);
-    if (fwrite(row_buffer, record_size, 1, table_file) != 1)
-      rc = FILE_WRITE_ERROR;
-    else {
-      file_header.num_records += 1;
-      rc = write_header(table_file, &file_header);
+    parallel_run(T, sort_run_task, &ps);
+    for (int r = 0; r < T; r++)
+      rc = rc ? rc : ps.rc[r];
+  }
+
+  // Keys are unique (they end in the arrival number), so each splitter
+  // cuts every run at one place
+  int num_samples = 0;
+  for (int r = 0; (r < T) && !rc; r++) {
+    sort_run_range(&ps, r, &first, &last);
+    for (int s = 0; (s < T) && (last > first); s++)
+      memcpy(samples + (size_t)num_samples++ * key_len,
+             sort_key_at(&ps, ps.runs[first + (int)((long)(last - first) * s / T)]), key_len);
+  }
+  if (!rc)
+    rc = radix_sort_keys(samples, key_len, num_samples, sample_order, node);
+  for (int r = 0; (r < T) && !rc; r++) {
+    int *bounds = ps.bounds + r * (T + 1);
+    sort_run_range(&ps, r, &first, &last);
+    bounds[0] = first;
+    bounds[T] = last;
+    for (int t = 1; t < T; t++) {
+      const unsigned char *splitter =
+          samples + (size_t)sample_order[num_samples * t / T] * key_len;
+      int lo = bounds[t - 1], hi = last;
+      while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (memcmp(sort_key_at(&ps, ps.runs[mid]), splitter, key_len) < 0)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      bounds[t] = lo;
     }
   }
+  if (!rc)
+    parallel_run(T, sort_merge_task, &ps);
 
-  free(row_buffer);
-  fclose(table_file);
+  free(ps.runs);
+  free(ps.bounds);
+  free(samples);
+  free(sample_order);
   return rc;
 }
 
-int sem_delete(token_list *t_list) {
-  int rc = 0;
-  token_list *cur = t_list;
+/*************************************************************
+        Scan kernels - predicates and join keys bound per query
+ *************************************************************/
 
-  // Validate table name
-  if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
-      (cur->tok_class != type_name)) {
-    rc = INVALID_TABLE_NAME;
-    cur->tok_value = INVALID;
-    return rc;
+/* Offset of a column's length byte in the table's rows */
+static bool scan_locate(const tpd_entry *tpd, const char *col_name, int *offset,
+                        int *col_type) {
+  const cd_entry *cols = (const cd_entry *)((const char *)tpd + tpd->cd_offset);
+  *offset = 0;
+  for (int k = 0; k < tpd->num_columns; k++) {
+    if (strcasecmp(cols[k].col_name, col_name) == 0) {
+      *col_type = cols[k].col_type;
+      return true;
+    }
+    *offset += 1 + ((cols[k].col_type == T_INT) ? 4 : cols[k].col_len);
   }
+  return false;
+}
 
-  char table_name[MAX_IDENT_LEN + 1];
-  strcpy(table_name, cur->tok_string);
-
-  tpd_entry *tpd = get_tpd_from_list(table_name);
-  if (!tpd) {
-    rc = TABLE_NOT_EXIST;
-    cur->tok_value = INVALID;
-    return rc;
+/* Op is a constant in every instance, so this folds to one compare */
+template <int Op> static inline bool scan_cmp(int cmp) {
+  switch (Op) {
+  case S_EQUAL:
+    return cmp == 0;
+  case S_LESS:
+    return cmp < 0;
+  case S_GREATER:
+    return cmp > 0;
+  case S_LESS_EQUAL:
+    return cmp <= 0;
+  case S_GREATER_EQUAL:
+    return cmp >= 0;
+  default:
+    return cmp != 0;
   }
+}
 
-  cur = cur->next;
+/* NULL fails every comparison */
+template <int Op> static bool pred_int(const unsigned char *field, const scan_pred *pred) {
+  int32_t value;
+  memcpy(&value, field + 1, 4);
+  return (field[0] != 0) &
+         scan_cmp<Op>((value > pred->int_value) - (value < pred->int_value));
+}
 
-  // Check for WHERE clause
-  bool has_where = false;
-  char where_column[MAX_IDENT_LEN + 1] = {0};
-  int where_operator = 0;
-  char where_value_str[256] = {0};
-  int where_value_int = 0;
-  int where_value_type = 0;
+/* Same order as strcmp() on the stored characters */
+template <int Op> static bool pred_str(const unsigned char *field, const scan_pred *pred) {
+  int len = field[0];
+  int cmp = memcmp(field + 1, pred->str_value, (len < pred->str_len) ? len : pred->str_len);
+  if (cmp == 0)
+    cmp = len - pred->str_len;
+  return (len != 0) && scan_cmp<Op>(cmp);
+}
 
-  if (cur->tok_value == K_WHERE) {
-    has_where = true;
-    cur = cur->next;
+static bool pred_is_null(const unsigned char *field, const scan_pred *) {
+  return field[0] == 0;
+}
 
-    if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
-        (cur->tok_class != type_name)) {
-      rc = COLUMN_NOT_EXIST;
-      cur->tok_value = INVALID;
-      return rc;
-    }
-    strcpy(where_column, cur->tok_string);
-    cur = cur->next;
+static bool pred_not_null(const unsigned char *field, const scan_pred *) {
+  return field[0] != 0;
+}
 
-    if (cur->tok_value != S_EQUAL && cur->tok_value != S_LESS &&
-        cur->tok_value != S_GREATER && cur->tok_value != S_LESS_EQUAL &&
-        cur->tok_value != S_GREATER_EQUAL && cur->tok_value != S_NOT_EQUAL) {
-      rc = INVALID_STATEMENT;
-      cur->tok_value = INVALID;
-      return rc;
-    }
-    where_operator = cur->tok_value;
-    cur = cur->next;
+/* Unknown column, or a literal of the other type */
+static bool pred_false(const unsigned char *, const scan_pred *) { return false; }
+
+static scan_pred_fn scan_pred_kernel(int col_type, int operator_type, int value_type) {
+  if (operator_type == K_IS)
+    return (value_type == K_NULL) ? pred_is_null : pred_not_null;
+  bool is_int = (col_type == T_INT);
+  if (is_int != (value_type == INT_LITERAL))
+    return pred_false;
+  switch (operator_type) {
+  case S_EQUAL:
+    return is_int ? pred_int<S_EQUAL> : pred_str<S_EQUAL>;
+  case S_LESS:
+    return is_int ? pred_int<S_LESS> : pred_str<S_LESS>;
+  case S_GREATER:
+    return is_int ? pred_int<S_GREATER> : pred_str<S_GREATER>;
+  case S_LESS_EQUAL:
+    return is_int ? pred_int<S_LESS_EQUAL> : pred_str<S_LESS_EQUAL>;
+  case S_GREATER_EQUAL:
+    return is_int ? pred_int<S_GREATER_EQUAL> : pred_str<S_GREATER_EQUAL>;
+  case S_NOT_EQUAL:
+    return is_int ? pred_int<S_NOT_EQUAL> : pred_str<S_NOT_EQUAL>;
+  }
+  return pred_false;
+}
 
-    if (cur->tok_value == STRING_LITERAL) {
-      where_value_type = STRING_LITERAL;
-      strcpy(where_value_str, cur->tok_string);
-    } else if (cur->tok_value == INT_LITERAL) {
-      where_value_type = INT_LITERAL;
-      where_value_int = atoi(cur->tok_string);
-    } else {
-      rc = INVALID_STATEMENT;
-      cur->tok_value = INVALID;
-      return rc;
+/* Bind the WHERE conditions.  A column is looked up in the first table,
+   then in the joined one (tpd2 NULL without a join). */
+static void scan_filter_compile(scan_filter *filter, const query_condition *conds,
+                                int num_conds, const tpd_entry *tpd1,
+                                const tpd_entry *tpd2) {
+  bool all_and = true, all_or = true;
+  filter->num_preds = (num_conds < MAX_SCAN_PREDS) ? num_conds : MAX_SCAN_PREDS;
+  for (int i = 0; i < filter->num_preds; i++) {
+    const query_condition *qc = &conds[i];
+    scan_pred *pred = &filter->preds[i];
+    int col_type = 0;
+    memset(pred, 0, sizeof(*pred));
+    pred->logical_operator = qc->logical_operator;
+    pred->int_value = qc->int_value;
+    pred->str_value = (qc->value_type == STRING_LITERAL) ? qc->str_value : "";
+    pred->str_len = strlen(pred->str_value);
+    if (scan_locate(tpd1, qc->col_name, &pred->offset, &col_type))
+      pred->fn = scan_pred_kernel(col_type, qc->operator_type, qc->value_type);
+    else if (tpd2 && scan_locate(tpd2, qc->col_name, &pred->offset, &col_type)) {
+      pred->side = 1;
+      pred->fn = scan_pred_kernel(col_type, qc->operator_type, qc->value_type);
+    } else
+      pred->fn = pred_false;
+    if (i < filter->num_preds - 1) {
+      all_and = all_and && (qc->logical_operator == K_AND);
+      all_or = all_or && (qc->logical_operator == K_OR);
     }
-    cur = cur->next;
   }
+  filter->shape = (filter->num_preds == 0) ? SCAN_ALL
+                  : (filter->num_preds == 1) ? SCAN_ONE
+                  : all_and ? SCAN_AND
+                  : all_or ? SCAN_OR
+                  : SCAN_CHAIN;
+}
 
-  if (cur->tok_value != EOC) {
-    rc = INVALID_STATEMENT;
-    cur->tok_value = INVALID;
-    return rc;
+/* row2 is the joined table's row, NULL without a join.  The shape is the
+   same on every row, so the switch always predicts. */
+static inline bool scan_filter_match(const scan_filter *filter, const unsigned char *row1,
+                                     const unsigned char *row2) {
+  const unsigned char *rows[2] = {row1, row2};
+  const scan_pred *p = filter->preds;
+  switch (filter->shape) {
+  case SCAN_ALL:
+    return true;
+  case SCAN_ONE:
+    return p->fn(rows[p->side] + p->offset, p);
+  case SCAN_AND:
+    for (int i = 0; i < filter->num_preds; i++)
+      if (!p[i].fn(rows[p[i].side] + p[i].offset, &p[i]))
+        return false;
+    return true;
+  case SCAN_OR:
+    for (int i = 0; i < filter->num_preds; i++)
+      if (p[i].fn(rows[p[i].side] + p[i].offset, &p[i]))
+        return true;
+    return false;
   }
+  bool result = p[0].fn(rows[p[0].side] + p[0].offset, &p[0]);
+  for (int i = 0; i + 1 < filter->num_preds; i++) {
+    bool next = p[i + 1].fn(rows[p[i + 1].side] + p[i + 1].offset, &p[i + 1]);
+    if (p[i].logical_operator == K_AND)
+      result = result && next;
+    else if (p[i].logical_operator == K_OR)
+      result = result || next;
+  }
+  return result;
+}
 
-  // Find WHERE column index
-  int where_col_index = -1;
-  cd_entry *columns = (cd_entry *)((char *)tpd + tpd->cd_offset);
-  if (has_where) {
-    for (int i = 0; i < tpd->num_columns; i++) {
-      if (strcasecmp(columns[i].col_name, where_column) == 0) {
-        where_col_index = i;
-        break;
-      }
+/* Lay out the projected row for the columns marked in keep[] */
+static void projection_compile(row_projection *proj, const tpd_entry *tpd,
+                               const bool *keep, int record_size) {
+  const cd_entry *cols = (const cd_entry *)((const char *)tpd + tpd->cd_offset);
+  bool all = true;
+  proj->num_runs = 0;
+  proj->row_size = 0;
+  for (int k = 0, off = 0; k < tpd->num_columns; k++) {
+    int width = 1 + ((cols[k].col_type == T_INT) ? 4 : cols[k].col_len);
+    if (!keep[k]) {
+      all = false;
+    } else if ((proj->num_runs > 0) &&
+               (proj->src[proj->num_runs - 1] + proj->len[proj->num_runs - 1] == off)) {
+      proj->len[proj->num_runs - 1] += width;
+      proj->row_size += width;
+    } else {
+      proj->src[proj->num_runs] = off;
+      proj->dst[proj->num_runs] = proj->row_size;
+      proj->len[proj->num_runs++] = width;
+      proj->row_size += width;
     }
-    if (where_col_index == -1) {
-      rc = COLUMN_NOT_EXIST;
-      return rc;
+    off += width;
+  }
+  if (all) {
+    proj->num_runs = 0;
+    proj->row_size = record_size;
+  }
+}
+
+/* Where a field of the table row sits in the projected row */
+static int projection_offset(const row_projection *proj, int offset) {
+  for (int r = 0; r < proj->num_runs; r++)
+    if ((offset >= proj->src[r]) && (offset < proj->src[r] + proj->len[r]))
+      return proj->dst[r] + offset - proj->src[r];
+  return offset;
+}
+
+/* The row to keep: row itself, or its projection built in out */
+static inline unsigned char *projection_apply(const row_projection *proj, unsigned char *row,
+                                              unsigned char *out) {
+  if (proj->num_runs == 0)
+    return row;
+  for (int r = 0; r < proj->num_runs; r++)
+    memcpy(out + proj->dst[r], row + proj->src[r], proj->len[r]);
+  return out;
+}
+
+static void join_keys_compile(join_keys *keys, const tpd_entry *tpd1, const tpd_entry *tpd2,
+                              const int *common1, const int *common2, int num_common) {
+  const cd_entry *cols1 = (const cd_entry *)((const char *)tpd1 + tpd1->cd_offset);
+  const cd_entry *cols2 = (const cd_entry *)((const char *)tpd2 + tpd2->cd_offset);
+  int col_type = 0;
+  bool all_int = true;
+  keys->num_keys = num_common;
+  for (int c = 0; c < num_common; c++) {
+    scan_locate(tpd1, cols1[common1[c]].col_name, &keys->offset1[c], &col_type);
+    scan_locate(tpd2, cols2[common2[c]].col_name, &keys->offset2[c], &col_type);
+    keys->is_int[c] = (cols1[common1[c]].col_type == T_INT);
+    all_int = all_int && keys->is_int[c];
+  }
+  keys->shape = (num_common == 0) ? JOIN_CROSS
+                : !all_int ? JOIN_MIXED
+                : (num_common == 1) ? JOIN_INT1
+                : JOIN_INT;
+}
+
+/* One side of JOIN ... ON: [table.]column.  A name both tables have is
+   taken from the table on its side of the operator (prefer), which also
+   makes a self-join's t.a < t.b compare the two copies. */
+static int join_on_column(token_list **cur, tpd_entry *const *tpd, const char *const *tables,
+                          int prefer, int *side, cd_entry **col) {
+  token_list *t = *cur;
+  const char *qualifier = NULL;
+  if (t->next->tok_value == S_DOT) {
+    qualifier = t->tok_string;
+    t = t->next->next;
+  }
+  if (t->tok_class != identifier)
+    return INVALID_COLUMN_NAME;
+  for (int k = 0; k < 2; k++) {
+    int s = k ? 1 - prefer : prefer;
+    if (qualifier && strcasecmp(qualifier, tables[s]))
+      continue;
+    cd_entry *cols = (cd_entry *)((char *)tpd[s] + tpd[s]->cd_offset);
+    for (int c = 0; c < tpd[s]->num_columns; c++) {
+      if (strcasecmp(cols[c].col_name, t->tok_string) == 0) {
+        *side = s;
+        *col = &cols[c];
+        *cur = t->next;
+        return 0;
+      }
     }
   }
+  return INVALID_COLUMN_NAME;
+}
 
-  // Open table file
-  FILE *fptr = NULL;
-  table_file_header hdr;
-  if ((rc = open_tab_rw(table_name, &fptr, &hdr)))
+/* "ON [t1.]x op [t2.]y", one comparison between a column of each table.
+   keys gets the table1 column on the left, flipping the operator if it
+   was written the other way round; detail gets the text for EXPLAIN. */
+static int join_on_parse(token_list **cur, tpd_entry *tpd1, const char *table1,
+                         tpd_entry *tpd2, const char *table2, join_keys *keys,
+                         char *detail, int detail_len) {
+  tpd_entry *tpd[2] = {tpd1, tpd2};
+  const char *tables[2] = {table1, table2};
+  int side1, side2, rc;
+  cd_entry *col1, *col2;
+  if ((rc = join_on_column(cur, tpd, tables, 0, &side1, &col1)))
     return rc;
-
-  int record_size = hdr.record_size;
-  unsigned char *row_buffer = (unsigned char *)malloc(record_size);
-  if (!row_buffer) {
-    fclose(fptr);
-    return MEMORY_ERROR;
+  int op = (*cur)->tok_value;
+  if ((op < S_EQUAL) || (op > S_NOT_EQUAL))
+    return INVALID_STATEMENT;
+  *cur = (*cur)->next;
+  if ((rc = join_on_column(cur, tpd, tables, 1, &side2, &col2)))
+    return rc;
+  if (side1 == side2) {
+    printf("Error: JOIN ... ON must compare a column of each table\n");
+    return INVALID_STATEMENT;
   }
-
-  bool *keep_row = (bool *)calloc(hdr.num_records, sizeof(bool));
-  if (!keep_row) {
-    free(row_buffer);
-    fclose(fptr);
-    return MEMORY_ERROR;
+  if ((col1->col_type == T_INT) != (col2->col_type == T_INT))
+    return TYPE_MISMATCH;
+  if (side1 == 1) {
+    cd_entry *col = col1;
+    col1 = col2;
+    col2 = col;
+    op = (op == S_LESS)            ? S_GREATER
+         : (op == S_GREATER)       ? S_LESS
+         : (op == S_LESS_EQUAL)    ? S_GREATER_EQUAL
+         : (op == S_GREATER_EQUAL) ? S_LESS_EQUAL
+                                   : op;
   }
+  int col_type = 0;
+  keys->shape = JOIN_THETA;
+  keys->num_keys = 1;
+  keys->op = op;
+  keys->is_int[0] = (col1->col_type == T_INT);
+  scan_locate(tpd1, col1->col_name, &keys->offset1[0], &col_type);
+  scan_locate(tpd2, col2->col_name, &keys->offset2[0], &col_type);
+  snprintf(detail, detail_len, "on %s.%s %s %s.%s", table1, col1->col_name, op_symbol(op),
+           table2, col2->col_name);
+  return 0;
+}
 
-  int deleted_count = 0;
+/* NULL joins NULL, as the key comparison always has */
+static inline bool join_int_equal(const unsigned char *f1, const unsigned char *f2) {
+  int32_t v1, v2;
+  memcpy(&v1, f1 + 1, 4);
+  memcpy(&v2, f2 + 1, 4);
+  return (f1[0] == f2[0]) & ((f1[0] == 0) | (v1 == v2));
+}
 
-  for (int row_idx = 0; row_idx < hdr.num_records; row_idx++) {
-    fseek(fptr, row_pos(&hdr, row_idx), SEEK_SET);
-    if (fread(row_buffer, record_size, 1, fptr) != 1) {
-      rc = FILE_OPEN_ERROR;
-      break;
-    }
+static inline bool join_str_equal(const unsigned char *f1, const unsigned char *f2) {
+  return (f1[0] == f2[0]) && (memcmp(f1 + 1, f2 + 1, f1[0]) == 0);
+}
 
-    bool delete_this_row = !has_where;
-
-    if (has_where) {
-      int offset = 0;
-      for (int col = 0; col < tpd->num_columns; col++) {
-        unsigned char len = row_buffer[offset++];
-        if (col == where_col_index) {
-          bool match = false;
-          if (columns[col].col_type == T_INT) {
-            if (len != 0 && where_value_type == INT_LITERAL) {
-              int32_t row_int;
-              memcpy(&row_int, row_buffer + offset, 4);
-              if (where_operator == S_EQUAL)
-                match = (row_int == where_value_int);
-              else if (where_operator == S_LESS)
-                match = (row_int < where_value_int);
-              else if (where_operator == S_GREATER)
-                match = (row_int > where_value_int);
-              else if (where_operator == S_LESS_EQUAL)
-                match = (row_int <= where_value_int);
-              else if (where_operator == S_GREATER_EQUAL)
-                match = (row_int >= where_value_int);
-              else if (where_operator == S_NOT_EQUAL)
-                match = (row_int != where_value_int);
-            }
-            offset += 4;
-          } else {
-            if (len != 0 && where_value_type == STRING_LITERAL) {
-              int cmp =
-                  strncmp((char *)(row_buffer + offset), where_value_str, len);
-              if (where_operator == S_EQUAL)
-                match = (cmp == 0 && len == strlen(where_value_str));
-              else if (where_operator == S_LESS)
-                match = (cmp < 0);
-              else if (where_operator == S_GREATER)
-                match = (cmp > 0);
-              else if (where_operator == S_LESS_EQUAL)
-                match = (cmp <= 0);
-              else if (where_operator == S_GREATER_EQUAL)
-                match = (cmp >= 0);
-              else if (where_operator == S_NOT_EQUAL)
-                match = !(cmp == 0 && len == strlen(where_value_str));
-            }
-            offset += columns[col].col_len;
-          }
-          delete_this_row = match;
-          break;
-        } else {
-          if (columns[col].col_type == T_INT)
-            offset += 4;
-          else
-            offset += columns[col].col_len;
-        }
-      }
-    }
+/* JOIN ... ON comparison: NULL matches nothing, as in WHERE, and
+   strings order like pred_str */
+static bool join_theta_match(const join_keys *keys, const unsigned char *row1,
+                             const unsigned char *row2) {
+  const unsigned char *f1 = row1 + keys->offset1[0], *f2 = row2 + keys->offset2[0];
+  if ((f1[0] == 0) || (f2[0] == 0))
+    return false;
+  int cmp;
+  if (keys->is_int[0]) {
+    int32_t v1, v2;
+    memcpy(&v1, f1 + 1, 4);
+    memcpy(&v2, f2 + 1, 4);
+    cmp = (v1 > v2) - (v1 < v2);
+  } else {
+    cmp = memcmp(f1 + 1, f2 + 1, (f1[0] < f2[0]) ? f1[0] : f2[0]);
+    if (cmp == 0)
+      cmp = f1[0] - f2[0];
+  }
+  return cmp_satisfies(keys->op, cmp);
+}
 
-    if (delete_this_row) {
-      deleted_count++;
-    } else {
-      keep_row[row_idx] = true;
-    }
+static inline bool join_keys_match(const join_keys *keys, const unsigned char *row1,
+                                   const unsigned char *row2) {
+  switch (keys->shape) {
+  case JOIN_THETA:
+    return join_theta_match(keys, row1, row2);
+  case JOIN_CROSS:
+    return true;
+  case JOIN_INT1:
+    return join_int_equal(row1 + keys->offset1[0], row2 + keys->offset2[0]);
+  case JOIN_INT:
+    for (int c = 0; c < keys->num_keys; c++)
+      if (!join_int_equal(row1 + keys->offset1[c], row2 + keys->offset2[c]))
+        return false;
+    return true;
   }
+  for (int c = 0; c < keys->num_keys; c++) {
+    const unsigned char *f1 = row1 + keys->offset1[c], *f2 = row2 + keys->offset2[c];
+    if (!(keys->is_int[c] ? join_int_equal(f1, f2) : join_str_equal(f1, f2)))
+      return false;
+  }
+  return true;
+}
 
-  if (!rc) {
-    if (deleted_count == 0) {
-      printf("Warning: No rows deleted.\n");
-    } else {
-      int write_idx = 0;
-      for (int row_idx = 0; row_idx < hdr.num_records; row_idx++) {
-        if (keep_row[row_idx]) {
-          fseek(fptr, row_pos(&hdr, row_idx), SEEK_SET);
-          if (fread(row_buffer, record_size, 1, fptr) != 1) {
-            rc = FILE_OPEN_ERROR;
-            break;
-          }
-          fseek(fptr, row_pos(&hdr, write_idx), SEEK_SET);
-          if (fwrite(row_buffer, record_size, 1, fptr) != 1) {
-            rc = FILE_WRITE_ERROR;
-            break;
-          }
-          write_idx++;
-        }
-      }
+/* Table1 rows held per block of a block nested-loop join: DB_JOIN_BLOCK
+   (KB) worth, at least one and no more than the table has */
+static int join_block_rows(int record_size, int num_records) {
+  static long block_size = -1;
+  if (block_size < 0) {
+    const char *kb = getenv("DB_JOIN_BLOCK");
+    block_size = kb ? atol(kb) << 10 : JOIN_BLOCK_DEFAULT;
+    if (block_size < 0)
+      block_size = 0;
+  }
+  long rows = block_size / record_size;
+  return (rows < 1) ? 1 : (rows > num_records) ? (num_records > 0 ? num_records : 1) : (int)rows;
+}
 
-      if (!rc) {
-        hdr.num_records = hdr.num_records - deleted_count;
-        rc = write_header(fptr, &hdr);
-        printf("%d row(s) deleted.\n", deleted_count);
-      }
+/* DB_JOIN_BLOOM=0 turns the NATURAL JOIN Bloom filters off */
+static bool join_bloom_enabled() {
+  static int enabled = -1;
+  if (enabled < 0) {
+    const char *value = getenv("DB_JOIN_BLOOM");
+    enabled = (value && (atoi(value) == 0)) ? 0 : 1;
+  }
+  return enabled == 1;
+}
+
+/* FNV-1a over each key's length byte and value, then a final mix so the
+   high bits (block) and low bits (bit positions) are independent.  Equal
+   keys, NULLs included, hash alike. */
+static uint64_t join_key_hash(const join_keys *keys, const unsigned char *row, int side) {
+  uint64_t h = 14695981039346656037ull;
+  for (int c = 0; c < keys->num_keys; c++) {
+    const unsigned char *field = row + (side ? keys->offset2[c] : keys->offset1[c]);
+    for (int i = 0; i <= field[0]; i++) {
+      h ^= field[i];
+      h *= 1099511628211ull;
     }
   }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return h;
+}
 
-  free(keep_row);
-  free(row_buffer);
-  fclose(fptr);
-  return rc;
+static int join_bloom_init(join_bloom *bloom, int num_keys) {
+  uint32_t num_blocks = 1;
+  while ((uint64_t)num_blocks * BLOOM_BLOCK_BITS < (uint64_t)num_keys * BLOOM_BITS_PER_KEY)
+    num_blocks <<= 1;
+  bloom->mask = num_blocks - 1;
+  bloom->blocks = (uint64_t *)db_malloc_aligned((size_t)num_blocks * (BLOOM_BLOCK_BITS / 8), -1);
+  if (!bloom->blocks)
+    return MEMORY_ERROR;
+  memset(bloom->blocks, 0, (size_t)num_blocks * (BLOOM_BLOCK_BITS / 8));
+  return 0;
 }
 
-int sem_update(token_list *t_list) {
-  int rc = 0;
-  token_list *cur = t_list;
+static inline uint64_t *join_bloom_block(const join_bloom *bloom, uint64_t h) {
+  return bloom->blocks + (size_t)((h >> 40) & bloom->mask) * (BLOOM_BLOCK_BITS / 64);
+}
 
-  if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
-      (cur->tok_class != type_name)) {
-    rc = INVALID_TABLE_NAME;
-    cur->tok_value = INVALID;
-    return rc;
+static inline void join_bloom_add(join_bloom *bloom, uint64_t h) {
+  uint64_t *block = join_bloom_block(bloom, h);
+  for (int k = 0; k < 4; k++) {
+    unsigned bit = (h >> (9 * k)) & (BLOOM_BLOCK_BITS - 1);
+    block[bit >> 6] |= 1ull << (bit & 63);
   }
+}
 
-  char table_name[MAX_IDENT_LEN + 1];
-  strcpy(table_name, cur->tok_string);
+static inline bool join_bloom_test(const join_bloom *bloom, uint64_t h) {
+  const uint64_t *block = join_bloom_block(bloom, h);
+  uint64_t hit = 1;
+  for (int k = 0; k < 4; k++) {
+    unsigned bit = (h >> (9 * k)) & (BLOOM_BLOCK_BITS - 1);
+    hit &= block[bit >> 6] >> (bit & 63);
+  }
+  return hit & 1;
+}
 
-  tpd_entry *tpd = get_tpd_from_list(table_name);
-  if (!tpd) {
-    rc = TABLE_NOT_EXIST;
-    cur->tok_value = INVALID;
+/* Filter each side of a NATURAL JOIN by the other's keys.  The outer
+   table's keys pick the inner rows worth rescanning (inner_rows), and
+   the keys of those rows build inner_bloom, which the outer scan checks
+   before each rescan. */
+static int join_bloom_prepare(tab_handle *t1, tab_handle *t2, const join_keys *keys,
+                              unsigned char *buf1, unsigned char *buf2,
+                              join_bloom *inner_bloom, int **inner_rows, int *num_inner) {
+  join_bloom outer_bloom;
+  int rc = join_bloom_init(&outer_bloom, t1->hdr.num_records);
+  if (rc)
     return rc;
+  for (int i = 0; (i < t1->hdr.num_records) && !rc; i++)
+    if (!(rc = tab_read(t1, i, buf1)))
+      join_bloom_add(&outer_bloom, join_key_hash(keys, buf1, 0));
+
+  *num_inner = 0;
+  *inner_rows = (int *)db_malloc((size_t)(t2->hdr.num_records + 1) * sizeof(int), -1);
+  if (!rc && !*inner_rows)
+    rc = MEMORY_ERROR;
+  if (!rc)
+    rc = join_bloom_init(inner_bloom, t2->hdr.num_records);
+  for (int j = 0; (j < t2->hdr.num_records) && !rc; j++) {
+    if ((rc = tab_read(t2, j, buf2)))
+      break;
+    uint64_t h = join_key_hash(keys, buf2, 1);
+    STAT_ADD(bloom_probes, 1);
+    if (join_bloom_test(&outer_bloom, h)) {
+      STAT_ADD(bloom_passed, 1);
+      (*inner_rows)[(*num_inner)++] = j;
+      join_bloom_add(inner_bloom, h);
+    }
   }
+  free(outer_bloom.blocks);
+  return rc;
+}
 
-  cur = cur->next;
+/*************************************************************
+        Join chains - NATURAL JOIN over three or more tables
+ *************************************************************/
 
-  if (cur->tok_value != K_SET) {
-    rc = INVALID_STATEMENT;
-    cur->tok_value = INVALID;
-    return rc;
+/* The joined row: every column name once, in FROM order.  Built while
+   parsing, so WHERE and the select list are checked against it. */
+static int join_chain_schema(join_chain *chain) {
+  tpd_entry *schema = &chain->schema;
+  memset(schema, 0, sizeof(*schema));
+  strcpy(schema->table_name, chain->tables[0]);
+  schema->cd_offset = (int)((char *)chain->schema_cols - (char *)schema);
+  for (int t = 0; t < chain->num_tables; t++) {
+    tpd_entry *tpd = chain->tpd[t];
+    cd_entry *cols = (cd_entry *)((char *)tpd + tpd->cd_offset);
+    for (int k = 0; k < tpd->num_columns; k++) {
+      int c = 0;
+      while ((c < schema->num_columns) &&
+             (strcmp(chain->schema_cols[c].col_name, cols[k].col_name) != 0))
+        c++;
+      if (c == schema->num_columns) {
+        if (c == MAX_NUM_COL) {
+          printf("Error: the joined tables have more than %d columns\n", MAX_NUM_COL);
+          return INVALID_SELECT_DEFINITION;
+        }
+        chain->schema_cols[c] = cols[k];
+        chain->schema_cols[c].col_id = c;
+        schema->num_columns++;
+      } else if ((cols[k].col_type == T_INT) != (chain->schema_cols[c].col_type == T_INT)) {
+        printf("Error: Type mismatch - column %s is not the same type in every table\n",
+               cols[k].col_name);
+        return TYPE_MISMATCH;
+      } else if (cols[k].col_len > chain->schema_cols[c].col_len) {
+        chain->schema_cols[c].col_len = cols[k].col_len;
+      }
+      chain->col_map[t][k] = c;
+    }
   }
+  schema->tpd_size = schema->cd_offset + schema->num_columns * (int)sizeof(cd_entry);
+  chain->record_size = compute_record_size_from_tpd(schema);
+  return 0;
+}
 
-  cur = cur->next;
+static uint32_t join_chain_columns(const join_chain *chain, int t) {
+  uint32_t mask = 0;
+  for (int k = 0; k < chain->tpd[t]->num_columns; k++)
+    mask |= 1u << chain->col_map[t][k];
+  return mask;
+}
 
-  // Column to update
-  if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
-      (cur->tok_class != type_name)) {
-    rc = INVALID_COLUMN_NAME;
-    cur->tok_value = INVALID;
-    return rc;
+/* Columns step k joins on: those of its table that an earlier step
+   already brought in */
+static int join_chain_keys(const join_chain *chain, int k, int *common1, int *common2) {
+  uint32_t present = 0;
+  int num_common = 0, t = chain->order[k];
+  for (int s = 0; s < k; s++)
+    present |= join_chain_columns(chain, chain->order[s]);
+  for (int j = 0; j < chain->tpd[t]->num_columns; j++) {
+    if (present & (1u << chain->col_map[t][j])) {
+      common1[num_common] = chain->col_map[t][j];
+      common2[num_common++] = j;
+    }
   }
+  return num_common;
+}
 
-  char set_col_name[MAX_IDENT_LEN + 1];
-  strcpy(set_col_name, cur->tok_string);
+/* Read the cardinalities, push the WHERE clause down to the scans and
+   pick the join order.  The order is the left-deep plan found by dynamic
+   programming over subsets of the tables.  A step is estimated at
+   min(|L|, |R|) rows when the two sides share a column (as if it were a
+   key of the larger one) and |L| x |R| when they do not; the order whose
+   intermediate results add up to the fewest rows wins, the FROM order
+   on ties. */
+static int join_chain_plan(join_chain *chain, const query_condition *conds, int num_conds) {
+  int rc = 0, n = chain->num_tables;
+  for (int t = 0; t < n; t++) {
+    FILE *fp = NULL;
+    table_file_header hdr;
+    if ((rc = open_tab_rw(chain->tables[t], &fp, &hdr)))
+      return rc;
+    fclose(fp);
+    chain->num_records[t] = hdr.num_records;
+    chain->step_node[t] = chain->scan_node[t] = -1;
+  }
 
-  // Verify column exists
-  int set_col_idx = -1;
-  cd_entry *columns = (cd_entry *)((char *)tpd + tpd->cd_offset);
-  for (int i = 0; i < tpd->num_columns; i++) {
-    if (strcasecmp(columns[i].col_name, set_col_name) == 0) {
-      set_col_idx = i;
-      break;
+  /* ANDed conditions hold on every table with the column, since the join
+     makes its values equal; with an OR they wait for the joined row */
+  bool all_and = true;
+  for (int i = 0; i + 1 < num_conds; i++)
+    all_and = all_and && (conds[i].logical_operator == K_AND);
+  for (int t = 0; t < n; t++) {
+    query_condition pushed[MAX_SCAN_PREDS];
+    int src[MAX_SCAN_PREDS], num = 0;
+    for (int i = 0; all_and && (i < num_conds) && (num < MAX_SCAN_PREDS); i++) {
+      int offset = 0, col_type = 0, schema_type = 0;
+      if (scan_locate(chain->tpd[t], conds[i].col_name, &offset, &col_type) &&
+          scan_locate(&chain->schema, conds[i].col_name, &offset, &schema_type) &&
+          (col_type == schema_type)) {
+        src[num] = i;
+        pushed[num] = conds[i];
+        pushed[num++].logical_operator = K_AND;
+      }
     }
+    if (num > 0)
+      pushed[num - 1].logical_operator = 0;
+    scan_filter_compile(&chain->filter[t], pushed, num, chain->tpd[t], NULL);
+    for (int p = 0; p < num; p++)
+      if (conds[src[p]].value_type == STRING_LITERAL)
+        chain->filter[t].preds[p].str_value = conds[src[p]].str_value;
+    chain->num_pushed[t] = num;
   }
-  if (set_col_idx == -1) {
-    rc = COLUMN_NOT_EXIST;
-    cur->tok_value = INVALID;
-    return rc;
+
+  int full = (1 << n) - 1;
+  double cost[1 << MAX_JOIN_TABLES], card[1 << MAX_JOIN_TABLES];
+  uint32_t covers[1 << MAX_JOIN_TABLES], table_cols[MAX_JOIN_TABLES];
+  int last[1 << MAX_JOIN_TABLES];
+  for (int t = 0; t < n; t++)
+    table_cols[t] = join_chain_columns(chain, t);
+  for (int s = 1; s <= full; s++) {
+    covers[s] = 0;
+    cost[s] = -1;
+    for (int t = n - 1; t >= 0; t--) {
+      if (!(s & (1 << t)))
+        continue;
+      covers[s] |= table_cols[t];
+      int rest = s & ~(1 << t);
+      double r = chain->num_records[t], rows;
+      if (rest == 0) {
+        cost[s] = 0;
+        card[s] = r;
+        last[s] = t;
+        continue;
+      }
+      rows = (covers[rest] & table_cols[t]) ? ((card[rest] < r) ? card[rest] : r)
+                                            : card[rest] * r;
+      if ((cost[s] < 0) || (cost[rest] + rows < cost[s])) {
+        cost[s] = cost[rest] + rows;
+        card[s] = rows;
+        last[s] = t;
+      }
+    }
   }
+  for (int s = full, k = n - 1; k >= 0; k--) {
+    chain->order[k] = last[s];
+    chain->est_rows[k] = card[s];
+    s &= ~(1 << last[s]);
+  }
+  return 0;
+}
 
-  cur = cur->next;
-  if (cur->tok_value != S_EQUAL) {
-    rc = INVALID_STATEMENT;
-    cur->tok_value = INVALID;
-    return rc;
+/* EXPLAIN: a HashJoin per step, the last one on top, each over the scan
+   of the table it adds.  Returns the top node. */
+static int join_chain_explain(join_chain *chain, int depth) {
+  int n = chain->num_tables;
+  cd_entry *cols = chain->schema_cols;
+  for (int k = n - 1; k >= 1; k--) {
+    int common1[MAX_NUM_COL], common2[MAX_NUM_COL];
+    int num_common = join_chain_keys(chain, k, common1, common2);
+    char detail[64] = {0};
+    int used = 0;
+    detail_append(detail, sizeof(detail), &used, "%s", num_common ? "natural on " : "cross product");
+    for (int c = 0; c < num_common; c++)
+      detail_append(detail, sizeof(detail), &used, "%s%s", c ? ", " : "",
+                    cols[common1[c]].col_name);
+    chain->step_node[k] = plan_add("HashJoin", depth + n - 1 - k, "%s, est %.0f rows",
+                                   detail, chain->est_rows[k]);
   }
+  for (int k = 0; k < n; k++) {
+    int t = chain->order[k];
+    if (chain->num_pushed[t] > 0)
+      chain->scan_node[k] = plan_add("SeqScan", depth + n - ((k > 0) ? k : 1),
+                                     "%s (%d rows), %d condition%s pushed down",
+                                     chain->tables[t], chain->num_records[t],
+                                     chain->num_pushed[t], (chain->num_pushed[t] > 1) ? "s" : "");
+    else
+      chain->scan_node[k] = plan_add("SeqScan", depth + n - ((k > 0) ? k : 1), "%s (%d rows)",
+                                     chain->tables[t], chain->num_records[t]);
+  }
+  return chain->step_node[n - 1];
+}
 
-  cur = cur->next;
+/* Read the table of step k into memory, keeping the rows that pass the
+   conditions pushed down to it */
+static int join_chain_load(join_chain *chain, int k, unsigned char **rows, int *num_rows,
+                           int *record_size) {
+  int rc = 0, t = chain->order[k], node = chain->scan_node[k];
+  tab_handle th;
+  if ((rc = tab_open(chain->tables[t], &th)))
+    return rc;
+  th.plan_node = node;
+  *record_size = th.hdr.record_size;
+  *num_rows = 0;
+  *rows = (unsigned char *)db_malloc((size_t)(th.hdr.num_records + 1) * th.hdr.record_size, node);
+  if (!*rows)
+    rc = MEMORY_ERROR;
+  long long mark = plan_clock();
+  for (int i = 0; (i < th.hdr.num_records) && !rc; i++) {
+    unsigned char *row = *rows + (size_t)*num_rows * th.hdr.record_size;
+    if ((rc = tab_read(&th, i, row)))
+      break;
+    bool keep = scan_filter_match(&chain->filter[t], row, NULL);
+    plan_rows(node, 1, keep);
+    *num_rows += keep;
+  }
+  plan_charge(node, &mark);
+  int close_rc = tab_close(&th);
+  return rc ? rc : close_rc;
+}
 
-  // Value to set
-  int set_val_type = 0;
-  int32_t set_val_int = 0;
-  char set_val_str[256] = {0};
+/* Run the steps in order.  Each hashes its table's rows on the columns
+   shared with the rows joined so far and probes with every joined row.
+   The first step is a cross product with one empty row, which lays the
+   first table out in the joined format. */
+static int join_chain_run(join_chain *chain) {
+  int rc = 0, n = chain->num_tables, rs = chain->record_size;
+  int offset[MAX_NUM_COL];
+  for (int c = 0, off = 0; c < chain->schema.num_columns; c++) {
+    offset[c] = off;
+    off += mv_field_size(&chain->schema_cols[c]);
+  }
 
-  if (cur->tok_value == INT_LITERAL) {
-    set_val_type = INT_LITERAL;
-    set_val_int = atoi(cur->tok_string);
-    if (columns[set_col_idx].col_type != T_INT) {
-      rc = TYPE_MISMATCH;
-      cur->tok_value = INVALID;
-      return rc;
+  unsigned char *left = (unsigned char *)db_malloc(rs, -1);
+  int num_left = 1;
+  if (!left)
+    return MEMORY_ERROR;
+  memset(left, 0, rs);
+
+  for (int k = 0; (k < n) && !rc && (num_left > 0); k++) {
+    int t = chain->order[k], node = chain->step_node[k];
+    tpd_entry *tpd = chain->tpd[t];
+    cd_entry *cols = (cd_entry *)((char *)tpd + tpd->cd_offset);
+    unsigned char *right = NULL;
+    int num_right = 0, right_size = 0;
+    if ((rc = join_chain_load(chain, k, &right, &num_right, &right_size))) {
+      free(right);
+      break;
     }
-  } else if (cur->tok_value == STRING_LITERAL) {
-    set_val_type = STRING_LITERAL;
-    strcpy(set_val_str, cur->tok_string);
-    if (columns[set_col_idx].col_type == T_INT) {
-      rc = TYPE_MISMATCH;
-      cur->tok_value = INVALID;
-      return rc;
+    long long mark = plan_clock();
+
+    int common1[MAX_NUM_COL], common2[MAX_NUM_COL];
+    int num_common = (k > 0) ? join_chain_keys(chain, k, common1, common2) : 0;
+    join_keys keys;
+    join_keys_compile(&keys, &chain->schema, tpd, common1, common2, num_common);
+
+    /* The columns this table adds, and where they go */
+    int src[MAX_NUM_COL], dst[MAX_NUM_COL], width[MAX_NUM_COL], num_copy = 0;
+    for (int j = 0, off = 0; j < tpd->num_columns; j++) {
+      bool shared = false;
+      for (int c = 0; (c < num_common) && !shared; c++)
+        shared = (common2[c] == j);
+      if (!shared) {
+        src[num_copy] = off;
+        dst[num_copy] = offset[chain->col_map[t][j]];
+        width[num_copy++] = mv_field_size(&cols[j]);
+      }
+      off += mv_field_size(&cols[j]);
     }
-    if (strlen(set_val_str) > columns[set_col_idx].col_len) {
-      rc = INVALID_COLUMN_LENGTH;
-      cur->tok_value = INVALID;
-      return rc;
+
+    /* Bucket lists keep each table's rows in table order, so the result
+       comes out in the order of nested loops */
+    uint32_t num_buckets = 16;
+    while (num_buckets < 2u * (uint32_t)num_right)
+      num_buckets <<= 1;
+    int *head = (int *)db_malloc(num_buckets * sizeof(int), node);
+    int *next = (int *)db_malloc((size_t)(num_right + 1) * sizeof(int), node);
+    if (!head || !next)
+      rc = MEMORY_ERROR;
+    else
+      memset(head, 0xff, num_buckets * sizeof(int));
+    for (int j = num_right - 1; (j >= 0) && !rc; j--) {
+      uint32_t b = join_key_hash(&keys, right + (size_t)j * right_size, 1) & (num_buckets - 1);
+      next[j] = head[b];
+      head[b] = j;
     }
-  } else if (cur->tok_value == K_NULL) {
-    // Handle NULL if allowed
-    if (columns[set_col_idx].not_null) {
-      rc = NOT_NULL_CONSTRAINT_VIOLATION;
-      cur->tok_value = INVALID;
-      return rc;
+
+    unsigned char *out = NULL;
+    int num_out = 0, out_cap = 0;
+    for (int i = 0; (i < num_left) && !rc; i++) {
+      unsigned char *row = left + (size_t)i * rs;
+      uint32_t b = join_key_hash(&keys, row, 0) & (num_buckets - 1);
+      for (int j = head[b]; j >= 0; j = next[j]) {
+        unsigned char *partner = right + (size_t)j * right_size;
+        if (!join_keys_match(&keys, row, partner))
+          continue;
+        if (num_out == out_cap) {
+          int cap = out_cap ? out_cap * 2 : 128;
+          unsigned char *grown = (unsigned char *)db_realloc(out, (size_t)cap * rs, node);
+          if (!grown) {
+            rc = MEMORY_ERROR;
+            break;
+          }
+          out = grown;
+          out_cap = cap;
+        }
+        unsigned char *joined = out + (size_t)num_out++ * rs;
+        memcpy(joined, row, rs);
+        for (int c = 0; c < num_copy; c++)
+          memcpy(joined + dst[c], partner + src[c], width[c]);
+      }
     }
-    set_val_type = K_NULL;
-  } else {
-    rc = INVALID_UPDATE_DEFINITION;
-    cur->tok_value = INVALID;
-    return rc;
+    plan_rows(node, num_left, num_out);
+    plan_charge(node, &mark);
+
+    free(head);
+    free(next);
+    free(right);
+    free(left);
+    left = out;
+    num_left = num_out;
   }
 
-  cur = cur->next;
-
-  // Check for WHERE
-  bool has_where = false;
-  char where_column[MAX_IDENT_LEN + 1] = {0};
-  int where_operator = 0;
-  char where_value_str[256] = {0};
-  int where_value_int = 0;
-  int where_value_type = 0;
-  int where_col_index = -1;
-
-  if (cur->tok_value == K_WHERE) {
-    has_where = true;
-    cur = cur->next;
+  chain->rows = left;
+  chain->num_rows = rc ? 0 : num_left;
+  return rc;
+}
 
-    if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
-        (cur->tok_class != type_name)) {
-      rc = COLUMN_NOT_EXIST;
-      cur->tok_value = INVALID;
-      return rc;
-    }
-    strcpy(where_column, cur->tok_string);
+/*************************************************************
+        Parallel join - radix-partitioned NATURAL JOIN
+ *************************************************************/
 
-    // Find WHERE column index
-    for (int i = 0; i < tpd->num_columns; i++) {
-      if (strcasecmp(columns[i].col_name, where_column) == 0) {
-        where_col_index = i;
-        break;
-      }
-    }
-    if (where_col_index == -1) {
-      rc = COLUMN_NOT_EXIST;
-      cur->tok_value = INVALID;
-      return rc;
-    }
+/* Even on one thread the partitioned hash join beats rescanning table2
+   per row once the tables are this large */
+static bool join_parallel_wanted(int num_rows1, int num_rows2) {
+  return (long)num_rows1 + num_rows2 >= parallel_rows();
+}
 
-    cur = cur->next;
-    if (cur->tok_value != S_EQUAL && cur->tok_value != S_LESS &&
-        cur->tok_value != S_GREATER && cur->tok_value != S_LESS_EQUAL &&
-        cur->tok_value != S_GREATER_EQUAL && cur->tok_value != S_NOT_EQUAL) {
-      rc = INVALID_STATEMENT;
-      cur->tok_value = INVALID;
-      return rc;
-    }
-    where_operator = cur->tok_value;
-    cur = cur->next;
+/* DB_ADAPTIVE=0 keeps a nested-loop join a nested loop to the end */
+static bool join_adaptive_enabled() {
+  static int enabled = -1;
+  if (enabled < 0) {
+    const char *value = getenv("DB_ADAPTIVE");
+    enabled = (value && (atoi(value) == 0)) ? 0 : 1;
+  }
+  return enabled == 1;
+}
 
-    if (cur->tok_value == STRING_LITERAL) {
-      where_value_type = STRING_LITERAL;
-      strcpy(where_value_str, cur->tok_string);
-    } else if (cur->tok_value == INT_LITERAL) {
-      where_value_type = INT_LITERAL;
-      where_value_int = atoi(cur->tok_string);
-    } else {
-      rc = INVALID_STATEMENT;
-      cur->tok_value = INVALID;
-      return rc;
+/* Enough partitions to keep every thread busy and each partition of
+   table2 within JOIN_PARTITION_BYTES */
+static int join_radix_bits(int num_threads, long table2_bytes) {
+  int bits = 0;
+  while ((bits < MAX_RADIX_BITS) &&
+         (((1L << bits) < 4L * num_threads) || ((table2_bytes >> bits) > JOIN_PARTITION_BYTES)))
+    bits++;
+  return bits;
+}
+
+static inline int join_partition(const parallel_join *pj, uint64_t h) {
+  return (int)((h >> 32) & ((1u << pj->radix_bits) - 1));
+}
+
+/* Thread t's share of a table: rows [first, last) */
+static void join_thread_range(const parallel_join *pj, int side, int t, int *first, int *last) {
+  *first = (int)((long)pj->num_rows[side] * t / pj->num_threads);
+  *last = (int)((long)pj->num_rows[side] * (t + 1) / pj->num_threads);
+}
+
+/* Pass 1: how many rows of each table thread t sends to each partition */
+static void join_count_task(void *arg, int t) {
+  parallel_join *pj = (parallel_join *)arg;
+  int num_parts = 1 << pj->radix_bits, first, last;
+  for (int side = 0; side < 2; side++) {
+    int *counts = pj->counts[side] + (size_t)t * num_parts;
+    join_thread_range(pj, side, t, &first, &last);
+    for (int r = first; r < last; r++) {
+      const unsigned char *row = pj->rows[side] + (size_t)r * pj->record_size[side];
+      counts[join_partition(pj, join_key_hash(pj->keys, row, side))]++;
     }
-    cur = cur->next;
   }
+}
 
-  if (cur->tok_value != EOC) {
-    rc = INVALID_STATEMENT;
-    cur->tok_value = INVALID;
-    return rc;
+/* Pass 2: copy them to the positions pass 1 reserved (counts now holds
+   each thread's first slot per partition), keeping row order */
+static void join_scatter_task(void *arg, int t) {
+  parallel_join *pj = (parallel_join *)arg;
+  int num_parts = 1 << pj->radix_bits, first, last;
+  for (int side = 0; side < 2; side++) {
+    int *next = pj->counts[side] + (size_t)t * num_parts;
+    join_thread_range(pj, side, t, &first, &last);
+    for (int r = first; r < last; r++) {
+      const unsigned char *row = pj->rows[side] + (size_t)r * pj->record_size[side];
+      uint64_t h = join_key_hash(pj->keys, row, side);
+      join_part_entry *e = &pj->parts[side][next[join_partition(pj, h)]++];
+      e->hash = (uint32_t)h;
+      e->row = r;
+    }
   }
+}
 
-  // Open file and update
-  FILE *fptr = NULL;
-  table_file_header hdr;
-  if ((rc = open_tab_rw(table_name, &fptr, &hdr)))
-    return rc;
-
-  int record_size = hdr.record_size;
-  unsigned char *row_buffer = (unsigned char *)malloc(record_size);
-  if (!row_buffer) {
-    fclose(fptr);
-    return MEMORY_ERROR;
+static bool join_pairs_add(join_pairs *out, int row1, int row2) {
+  if (out->num_pairs == out->capacity) {
+    long capacity = out->capacity ? out->capacity * 2 : 1024;
+    int *pairs = (int *)db_realloc(out->pairs, (size_t)capacity * 2 * sizeof(int), -1);
+    if (!pairs)
+      return false;
+    out->pairs = pairs;
+    out->capacity = capacity;
   }
+  out->pairs[out->num_pairs * 2] = row1;
+  out->pairs[out->num_pairs * 2 + 1] = row2;
+  out->num_pairs++;
+  return true;
+}
 
-  int updated_count = 0;
-
-  for (int row_idx = 0; row_idx < hdr.num_records; row_idx++) {
-    long pos = row_pos(&hdr, row_idx);
-    fseek(fptr, pos, SEEK_SET);
-    if (fread(row_buffer, record_size, 1, fptr) != 1) {
-      rc = FILE_OPEN_ERROR;
-      break;
+/* Pass 3: claim partitions until none are left; hash the smaller side of
+   the partition, as it turns out to be, then probe with the other.
+   Chains are built from the last row back and the probe side is read in
+   order, so each row1 meets its partners in table2 order either way. */
+static void join_partition_task(void *arg, int t) {
+  parallel_join *pj = (parallel_join *)arg;
+  join_pairs *out = &pj->out[t];
+  int num_parts = 1 << pj->radix_bits;
+  int *head = NULL, *next = NULL, capacity = 0;
+  for (int p = __sync_fetch_and_add(&pj->next_part, 1); (p < num_parts) && !out->rc;
+       p = __sync_fetch_and_add(&pj->next_part, 1)) {
+    const join_part_entry *in[2];
+    int n[2];
+    for (int side = 0; side < 2; side++) {
+      in[side] = pj->parts[side] + pj->starts[side][p];
+      n[side] = pj->starts[side][p + 1] - pj->starts[side][p];
     }
-
-    bool update_row = !has_where;
-    if (has_where) {
-      int offset = 0;
-      for (int col = 0; col < tpd->num_columns; col++) {
-        unsigned char len = row_buffer[offset++];
-        if (col == where_col_index) {
-          bool match = false;
-          if (columns[col].col_type == T_INT) {
-            if (len != 0 && where_value_type == INT_LITERAL) {
-              int32_t row_int;
-              memcpy(&row_int, row_buffer + offset, 4);
-              if (where_operator == S_EQUAL)
-                match = (row_int == where_value_int);
-              else if (where_operator == S_LESS)
-                match = (row_int < where_value_int);
-              else if (where_operator == S_GREATER)
-                match = (row_int > where_value_int);
-              else if (where_operator == S_LESS_EQUAL)
-                match = (row_int <= where_value_int);
-              else if (where_operator == S_GREATER_EQUAL)
-                match = (row_int >= where_value_int);
-              else if (where_operator == S_NOT_EQUAL)
-                match = (row_int != where_value_int);
-            }
-            offset += 4;
-          } else {
-            // String comparison
-            if (len > 0 && where_value_type == STRING_LITERAL) {
-              char row_str[256] = {0};
-              memcpy(row_str, row_buffer + offset, len);
-              row_str[len] = '\0';
-              int cmp = strcmp(row_str, where_value_str);
-              if (where_operator == S_EQUAL)
-                match = (cmp == 0);
-              else if (where_operator == S_LESS)
-                match = (cmp < 0);
-              else if (where_operator == S_GREATER)
-                match = (cmp > 0);
-              else if (where_operator == S_LESS_EQUAL)
-                match = (cmp <= 0);
-              else if (where_operator == S_GREATER_EQUAL)
-                match = (cmp >= 0);
-              else if (where_operator == S_NOT_EQUAL)
-                match = (cmp != 0);
-            }
-            offset += columns[col].col_len;
-          }
-          update_row = match;
+    STAT_ADD(join_partitions, 1);
+    if ((n[0] == 0) || (n[1] == 0))
+      continue;
+    int build = (n[0] < n[1]) ? 0 : 1, probe = 1 - build;
+    if (build == 0) {
+      STAT_ADD(join_swaps, 1);
+      out->swapped++;
+    }
+    int num_buckets = 1;
+    while (num_buckets < n[build])
+      num_buckets <<= 1;
+    if (num_buckets > capacity) {
+      free(head);
+      free(next);
+      capacity = num_buckets;
+      head = (int *)db_malloc((size_t)capacity * sizeof(int), -1);
+      next = (int *)db_malloc((size_t)capacity * sizeof(int), -1);
+      if (!head || !next) {
+        out->rc = MEMORY_ERROR;
+        break;
+      }
+    }
+    for (int b = 0; b < num_buckets; b++)
+      head[b] = -1;
+    for (int k = n[build] - 1; k >= 0; k--) {
+      int b = in[build][k].hash & (num_buckets - 1);
+      next[k] = head[b];
+      head[b] = k;
+    }
+    for (int kp = 0; (kp < n[probe]) && !out->rc; kp++) {
+      const join_part_entry *ep = &in[probe][kp];
+      for (int k = head[ep->hash & (num_buckets - 1)]; k >= 0; k = next[k]) {
+        const join_part_entry *eb = &in[build][k];
+        int row1 = build ? ep->row : eb->row, row2 = build ? eb->row : ep->row;
+        const unsigned char *r1 = pj->rows[0] + (size_t)row1 * pj->record_size[0];
+        const unsigned char *r2 = pj->rows[1] + (size_t)row2 * pj->record_size[1];
+        if ((eb->hash != ep->hash) || !join_keys_match(pj->keys, r1, r2))
+          continue;
+        out->joined++;
+        if (scan_filter_match(pj->filter, r1, r2) && !join_pairs_add(out, row1, row2)) {
+          out->rc = MEMORY_ERROR;
           break;
-        } else {
-          if (columns[col].col_type == T_INT)
-            offset += 4;
-          else
-            offset += columns[col].col_len;
         }
       }
     }
+  }
+  free(head);
+  free(next);
+}
 
-    if (update_row) {
-      // Update the column in row_buffer
-      int offset = 0;
-      for (int col = 0; col < tpd->num_columns; col++) {
-        if (col == set_col_idx) {
-          // Update this column
-          if (set_val_type == K_NULL) {
-            row_buffer[offset++] = 0; // length 0
-            // Zero out payload
-            if (columns[col].col_type == T_INT) {
-              memset(row_buffer + offset, 0, 4);
-              offset += 4;
-            } else {
-              memset(row_buffer + offset, 0, columns[col].col_len);
-              offset += columns[col].col_len;
-            }
-          } else if (columns[col].col_type == T_INT) {
-            row_buffer[offset++] = 4;
-            memcpy(row_buffer + offset, &set_val_int, 4);
-            offset += 4;
-          } else {
-            int len = strlen(set_val_str);
-            row_buffer[offset++] = len;
-            memcpy(row_buffer + offset, set_val_str, len);
-            // Zero out remaining bytes if any
-            if (len < columns[col].col_len) {
-              memset(row_buffer + offset + len, 0, columns[col].col_len - len);
-            }
-            offset += columns[col].col_len;
-          }
-        } else {
-          // Skip
-          unsigned char len = row_buffer[offset++];
-          if (columns[col].col_type == T_INT)
-            offset += 4;
-          else
-            offset += columns[col].col_len;
-        }
-      }
+/* Join pj's loaded tables on its keys, keeping the pairs that pass the
+   WHERE filter.  *pairs gets them in nested-loop order: by table1 row,
+   then table2 row. */
+static int parallel_join_run(parallel_join *pj, int **pairs, long *num_pairs, long *joined) {
+  int rc = 0, T = pj->num_threads, num_parts = 1 << pj->radix_bits;
+  *pairs = NULL;
+  *num_pairs = *joined = 0;
+  pj->next_part = 0;
+  memset(pj->out, 0, sizeof(pj->out));
+  for (int side = 0; side < 2; side++) {
+    pj->counts[side] = (int *)calloc((size_t)T * num_parts, sizeof(int));
+    pj->parts[side] = (join_part_entry *)db_malloc(
+        (size_t)(pj->num_rows[side] + 1) * sizeof(join_part_entry), -1);
+    pj->starts[side] = (int *)db_malloc((size_t)(num_parts + 1) * sizeof(int), -1);
+    if (!pj->counts[side] || !pj->parts[side] || !pj->starts[side])
+      rc = MEMORY_ERROR;
+  }
 
-      // Write back
-      fseek(fptr, pos, SEEK_SET);
-      if (fwrite(row_buffer, record_size, 1, fptr) != 1) {
-        rc = FILE_WRITE_ERROR;
-        break;
+  if (!rc) {
+    parallel_run(T, join_count_task, pj);
+    // Partition by partition, thread by thread, so row order survives
+    for (int side = 0; side < 2; side++) {
+      int pos = 0;
+      for (int p = 0; p < num_parts; p++) {
+        pj->starts[side][p] = pos;
+        for (int t = 0; t < T; t++) {
+          int count = pj->counts[side][(size_t)t * num_parts + p];
+          pj->counts[side][(size_t)t * num_parts + p] = pos;
+          pos += count;
+        }
       }
-      updated_count++;
+      pj->starts[side][num_parts] = pos;
     }
+    parallel_run(T, join_scatter_task, pj);
+    parallel_run(T, join_partition_task, pj);
   }
 
-  free(row_buffer);
-  fclose(fptr);
-
+  // A table1 row's pairs all come from one partition, so counting them
+  // by row is enough to lay the buffers out in order
+  long total = 0;
+  pj->swapped = 0;
+  for (int t = 0; t < T; t++) {
+    rc = rc ? rc : pj->out[t].rc;
+    total += pj->out[t].num_pairs;
+    *joined += pj->out[t].joined;
+    pj->swapped += pj->out[t].swapped;
+  }
+  int *first = rc ? NULL : (int *)calloc((size_t)pj->num_rows[0] + 1, sizeof(int));
+  long *start = first ? (long *)db_malloc(((size_t)pj->num_rows[0] + 1) * sizeof(long), -1) : NULL;
+  *pairs = start ? (int *)db_malloc((size_t)(total + 1) * 2 * sizeof(int), -1) : NULL;
+  if (!rc && !*pairs)
+    rc = MEMORY_ERROR;
   if (!rc) {
-    if (updated_count == 0) {
-      printf("Warning: No rows updated.\n");
-    } else {
-      printf("%d row(s) updated.\n", updated_count);
+    for (int t = 0; t < T; t++)
+      for (long k = 0; k < pj->out[t].num_pairs; k++)
+        first[pj->out[t].pairs[k * 2]]++;
+    long pos = 0;
+    for (int r = 0; r < pj->num_rows[0]; r++) {
+      start[r] = pos;
+      pos += first[r];
+    }
+    for (int t = 0; t < T; t++) {
+      for (long k = 0; k < pj->out[t].num_pairs; k++) {
+        long slot = start[pj->out[t].pairs[k * 2]]++;
+        (*pairs)[slot * 2] = pj->out[t].pairs[k * 2];
+        (*pairs)[slot * 2 + 1] = pj->out[t].pairs[k * 2 + 1];
+      }
     }
+    *num_pairs = total;
   }
 
+  free(first);
+  free(start);
+  for (int t = 0; t < T; t++)
+    free(pj->out[t].pairs);
+  for (int side = 0; side < 2; side++) {
+    free(pj->counts[side]);
+    free(pj->parts[side]);
+    free(pj->starts[side]);
+  }
+  if (rc) {
+    free(*pairs);
+    *pairs = NULL;
+  }
   return rc;
 }
 
@@ -1882,75 +6966,34 @@ int sem_select(token_list *t_list) {
   if (cur->tok_value == S_STAR) {
     is_star = true;
     cur = cur->next;
-  } else if (cur->tok_class == function_name) {
-    // Parse one or more aggregate functions (e.g., SUM(x), AVG(y))
-    is_aggregate = true;
-    
+  } else {
+    // Parse the select list: column names and aggregate functions
+    // (e.g., SUM(x), AVG(y)).  Columns may only be mixed with aggregates
+    // under GROUP BY, which is checked once the whole query is parsed.
     do {
-      if (cur->tok_class != function_name) {
-        return INVALID_SELECT_DEFINITION;
-      }
-      
-      int func_type = cur->tok_value;
-      cur = cur->next;
-      
-      // Expect opening parenthesis
-      if (cur->tok_value != S_LEFT_PAREN) {
+      if (num_sel_cols == MAX_NUM_COL) {
         return INVALID_SELECT_DEFINITION;
       }
-      cur = cur->next;
-      
-      // Parse aggregate parameter (column name or *)
-      char param_name[MAX_IDENT_LEN + 1] = {0};
-      if (cur->tok_value == S_STAR) {
-        if (func_type != F_COUNT) {
-          return INVALID_SELECT_DEFINITION; // Only COUNT(*) is valid
+      if (cur->tok_class == function_name) {
+        if (num_agg_funcs == MAX_NUM_COL) {
+          return INVALID_SELECT_DEFINITION;
         }
-        strcpy(param_name, "*");
-        cur = cur->next;
+        if ((rc = parse_aggregate(&cur, &agg_funcs[num_agg_funcs]))) {
+          return rc;
+        }
+        is_aggregate = true;
+        strcpy(sel_cols[num_sel_cols].name, agg_funcs[num_agg_funcs].col_name);
+        sel_cols[num_sel_cols].agg_index = num_agg_funcs++;
       } else if (cur->tok_class == keyword || cur->tok_class == identifier ||
                  cur->tok_class == type_name) {
-        strcpy(param_name, cur->tok_string);
-        cur = cur->next;
-      } else {
-        return INVALID_SELECT_DEFINITION;
-      }
-      
-      // Expect closing parenthesis
-      if (cur->tok_value != S_RIGHT_PAREN) {
-        return INVALID_SELECT_DEFINITION;
-      }
-      cur = cur->next;
-      
-      // Store aggregate function
-      agg_funcs[num_agg_funcs].type = func_type;
-      strcpy(agg_funcs[num_agg_funcs].col_name, param_name);
-      num_agg_funcs++;
-      
-      // Check for comma indicating more aggregates
-      if (cur->tok_value == S_COMMA) {
+        strcpy(sel_cols[num_sel_cols].name, cur->tok_string);
+        sel_cols[num_sel_cols].agg_index = -1;
         cur = cur->next;
       } else {
-        break;
-      }
-    } while (cur->tok_class == function_name);
-    
-    // If we saw a comma but no function follows, it's an error
-    if (cur->tok_value == S_COMMA || 
-        (num_agg_funcs > 0 && cur[-1].tok_value == S_COMMA)) {
-      return INVALID_SELECT_DEFINITION;
-    }
-  } else {
-    // Parse list of column names
-    do {
-      if (cur->tok_class != keyword && cur->tok_class != identifier &&
-          cur->tok_class != type_name) {
         return INVALID_SELECT_DEFINITION;
       }
-      strcpy(sel_cols[num_sel_cols].name, cur->tok_string);
       num_sel_cols++;
-      cur = cur->next;
-      
+
       if (cur->tok_value == S_COMMA) {
         cur = cur->next;
       } else {
@@ -1978,38 +7021,42 @@ int sem_select(token_list *t_list) {
     return TABLE_NOT_EXIST;
   }
 
-  // Validate aggregate functions on appropriate column types
-  if (is_aggregate) {
-    cd_entry *cols = (cd_entry *)((char *)tpd1 + tpd1->cd_offset);
-    for (int i = 0; i < num_agg_funcs; i++) {
-      if (agg_funcs[i].type == F_SUM || agg_funcs[i].type == F_AVG) {
-        if (strcmp(agg_funcs[i].col_name, "*") != 0) {
-          // Find the column and check if it's INT type
-          bool found = false;
-          for (int k = 0; k < tpd1->num_columns; k++) {
-            if (strcasecmp(cols[k].col_name, agg_funcs[i].col_name) == 0) {
-              found = true;
-              if (cols[k].col_type != T_INT) {
-                printf("Error: SUM and AVG can only be used on integer columns\n");
-                return INVALID_SELECT_DEFINITION;
-              }
-              break;
-            }
-          }
-          if (!found) {
-            return COLUMN_NOT_EXIST;
-          }
-        }
-      }
-    }
-  }
-
-  // 3. Parse NATURAL JOIN (Optional)
-  bool has_join = false;
+  // 3. Parse NATURAL JOIN or JOIN ... ON (Optional).  A third table makes
+  // it a join chain, which is joined up front and then read like one table.
+  bool has_join = false, join_on = false;
   char table2[MAX_IDENT_LEN + 1] = {0};
   tpd_entry *tpd2 = NULL;
+  join_chain chain;
+  chain.num_tables = 0;
+  join_keys on_keys;
+  char on_detail[128] = {0};
+
+  if (cur->tok_value == K_JOIN) {
+    cur = cur->next;
+    if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+        (cur->tok_class != type_name)) {
+      return INVALID_TABLE_NAME;
+    }
+    strcpy(table2, cur->tok_string);
+    if (!(tpd2 = get_tpd_from_list(table2))) {
+      return TABLE_NOT_EXIST;
+    }
+    cur = cur->next;
+    if (cur->tok_value != K_ON) {
+      return INVALID_STATEMENT;
+    }
+    cur = cur->next;
+    if ((rc = join_on_parse(&cur, tpd1, table1, tpd2, table2, &on_keys, on_detail,
+                            sizeof(on_detail)))) {
+      return rc;
+    }
+    has_join = join_on = true;
+  }
 
-  if (cur->tok_value == K_NATURAL) {
+  while (cur->tok_value == K_NATURAL) {
+    if (join_on) {
+      return INVALID_STATEMENT;
+    }
     cur = cur->next;
     if (cur->tok_value != K_JOIN) {
       return INVALID_STATEMENT;
@@ -2019,14 +7066,71 @@ int sem_select(token_list *t_list) {
         (cur->tok_class != type_name)) {
       return INVALID_TABLE_NAME;
     }
-    strcpy(table2, cur->tok_string);
-    tpd2 = get_tpd_from_list(table2);
-    if (!tpd2) {
+    tpd_entry *tpd = get_tpd_from_list(cur->tok_string);
+    if (!tpd) {
       return TABLE_NOT_EXIST;
     }
-    has_join = true;
+    if (!has_join) {
+      strcpy(table2, cur->tok_string);
+      tpd2 = tpd;
+      has_join = true;
+    } else {
+      if (chain.num_tables == 0) {
+        strcpy(chain.tables[0], table1);
+        strcpy(chain.tables[1], table2);
+        chain.tpd[0] = tpd1;
+        chain.tpd[1] = tpd2;
+        chain.num_tables = 2;
+      }
+      if (chain.num_tables == MAX_JOIN_TABLES) {
+        printf("Error: at most %d tables can be joined\n", MAX_JOIN_TABLES);
+        return INVALID_STATEMENT;
+      }
+      strcpy(chain.tables[chain.num_tables], cur->tok_string);
+      chain.tpd[chain.num_tables++] = tpd;
+    }
     cur = cur->next;
   }
+  if (chain.num_tables > 0) {
+    if ((rc = join_chain_schema(&chain))) {
+      return rc;
+    }
+    tpd1 = &chain.schema;
+    tpd2 = NULL;
+    has_join = false;
+  }
+
+  // Validate aggregate functions on appropriate column types; a joined
+  // column may come from either table
+  if (is_aggregate) {
+    for (int i = 0; i < num_agg_funcs; i++) {
+      if (agg_funcs[i].type == F_SUM || agg_funcs[i].type == F_AVG) {
+        if (strcmp(agg_funcs[i].col_name, "*") != 0) {
+          // Find the column and check if it's INT type
+          bool found = false;
+          for (int t = 0; (t < 2) && !found; t++) {
+            tpd_entry *tpd = t ? (has_join ? tpd2 : NULL) : tpd1;
+            if (!tpd)
+              continue;
+            cd_entry *cols = (cd_entry *)((char *)tpd + tpd->cd_offset);
+            for (int k = 0; k < tpd->num_columns; k++) {
+              if (strcasecmp(cols[k].col_name, agg_funcs[i].col_name) == 0) {
+                found = true;
+                if (cols[k].col_type != T_INT) {
+                  printf("Error: SUM and AVG can only be used on integer columns\n");
+                  return INVALID_SELECT_DEFINITION;
+                }
+                break;
+              }
+            }
+          }
+          if (!found) {
+            return COLUMN_NOT_EXIST;
+          }
+        }
+      }
+    }
+  }
 
   // 4. Parse WHERE clause (optional)
   query_condition conditions[10];  // Support up to 10 conditions
@@ -2119,48 +7223,415 @@ int sem_select(token_list *t_list) {
         num_conditions++;
         cur = cur->next;
       } else {
-        conditions[num_conditions].logical_operator = 0;  // Last condition
-        num_conditions++;
+        conditions[num_conditions].logical_operator = 0;  // Last condition
+        num_conditions++;
+        break;
+      }
+    } while (true);
+  }
+
+  // 5. Parse GROUP BY / HAVING (Optional)
+  select_column group_cols[MAX_NUM_COL];
+  int num_group_cols = 0;
+  having_condition having[10];  // Support up to 10 conditions
+  int num_having = 0;
+
+  if (cur->tok_value == K_GROUP) {
+    cur = cur->next;
+    if (cur->tok_value != K_BY) {
+      return INVALID_STATEMENT;
+    }
+    cur = cur->next;
+    do {
+      if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+          (cur->tok_class != type_name)) {
+        return INVALID_COLUMN_NAME;
+      }
+      if (num_group_cols == MAX_NUM_COL) {
+        return INVALID_STATEMENT;
+      }
+      strcpy(group_cols[num_group_cols].name, cur->tok_string);
+      group_cols[num_group_cols].agg_index = -1;
+      num_group_cols++;
+      cur = cur->next;
+
+      if (cur->tok_value == S_COMMA) {
+        cur = cur->next;
+      } else {
+        break;
+      }
+    } while (true);
+
+    if (cur->tok_value == K_HAVING) {
+      cur = cur->next;
+      do {
+        if (num_having == 10) {
+          return INVALID_STATEMENT;
+        }
+        having_condition *hc = &having[num_having];
+        memset(hc, 0, sizeof(*hc));
+        hc->agg_index = -1;
+        hc->group_index = -1;
+
+        if (cur->tok_class == function_name) {
+          // Reuse a SELECT list aggregate, or compute one more
+          aggregate_func agg;
+          if ((rc = parse_aggregate(&cur, &agg))) {
+            return rc;
+          }
+          for (int a = 0; a < num_agg_funcs; a++) {
+            if ((agg_funcs[a].type == agg.type) &&
+                (strcasecmp(agg_funcs[a].col_name, agg.col_name) == 0)) {
+              hc->agg_index = a;
+              break;
+            }
+          }
+          if (hc->agg_index == -1) {
+            if (num_agg_funcs == MAX_NUM_COL) {
+              return INVALID_STATEMENT;
+            }
+            agg_funcs[num_agg_funcs] = agg;
+            hc->agg_index = num_agg_funcs++;
+          }
+        } else if ((cur->tok_class == keyword) || (cur->tok_class == identifier) ||
+                   (cur->tok_class == type_name)) {
+          for (int g = 0; g < num_group_cols; g++) {
+            if (strcasecmp(group_cols[g].name, cur->tok_string) == 0) {
+              hc->group_index = g;
+              break;
+            }
+          }
+          if (hc->group_index == -1) {
+            printf("Error: HAVING column %s is not in GROUP BY\n", cur->tok_string);
+            return INVALID_COLUMN_NAME;
+          }
+          cur = cur->next;
+        } else {
+          return INVALID_STATEMENT;
+        }
+
+        if (cur->tok_value == S_EQUAL || cur->tok_value == S_LESS ||
+            cur->tok_value == S_GREATER || cur->tok_value == S_LESS_EQUAL ||
+            cur->tok_value == S_GREATER_EQUAL || cur->tok_value == S_NOT_EQUAL) {
+          hc->operator_type = cur->tok_value;
+          cur = cur->next;
+        } else {
+          return INVALID_STATEMENT;
+        }
+
+        if (cur->tok_value == INT_LITERAL) {
+          hc->value_type = INT_LITERAL;
+          hc->int_value = atoi(cur->tok_string);
+        } else if ((cur->tok_value == STRING_LITERAL) && (hc->group_index >= 0)) {
+          hc->value_type = STRING_LITERAL;
+          strcpy(hc->str_value, cur->tok_string);
+        } else if (cur->tok_value == STRING_LITERAL) {
+          printf("Error: Type mismatch - cannot compare an aggregate with a string value\n");
+          return TYPE_MISMATCH;
+        } else {
+          return INVALID_STATEMENT;
+        }
+        cur = cur->next;
+
+        if (cur->tok_value == K_AND || cur->tok_value == K_OR) {
+          hc->logical_operator = cur->tok_value;
+          num_having++;
+          cur = cur->next;
+        } else {
+          hc->logical_operator = 0;  // Last condition
+          num_having++;
+          break;
+        }
+      } while (true);
+    }
+  }
+  bool has_group = (num_group_cols > 0);
+
+  // 6. Parse ORDER BY col [ASC | DESC] [NULLS FIRST | LAST], ... (Optional)
+  order_column order_cols[MAX_NUM_COL];
+  int num_order_cols = 0;
+
+  if (cur->tok_value == K_ORDER) {
+    cur = cur->next;
+    if (cur->tok_value != K_BY) {
+      return INVALID_STATEMENT;
+    }
+    cur = cur->next;
+    do {
+      if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
+          (cur->tok_class != type_name)) {
+        return INVALID_COLUMN_NAME;
+      }
+      if (num_order_cols == MAX_NUM_COL) {
+        return INVALID_STATEMENT;
+      }
+      order_column *oc = &order_cols[num_order_cols++];
+      strcpy(oc->name, cur->tok_string);
+      oc->desc = false;
+      cur = cur->next;
+      if (cur->tok_value == K_DESC) {
+        oc->desc = true;
+        cur = cur->next;
+      } else if (cur->tok_value == K_ASC) {
+        cur = cur->next;
+      }
+      oc->nulls_first = !oc->desc;
+      // FIRST and LAST are not reserved: hw3 has columns named first/last
+      if (cur->tok_value == K_NULLS) {
+        cur = cur->next;
+        if (strcasecmp(cur->tok_string, "first") == 0)
+          oc->nulls_first = true;
+        else if (strcasecmp(cur->tok_string, "last") == 0)
+          oc->nulls_first = false;
+        else
+          return INVALID_STATEMENT;
+        cur = cur->next;
+      }
+
+      if (cur->tok_value == S_COMMA) {
+        cur = cur->next;
+      } else {
         break;
       }
     } while (true);
   }
+  bool has_order = (num_order_cols > 0);
 
-  // 5. Parse ORDER BY (Optional)
-  bool has_order = false;
-  char order_col[MAX_IDENT_LEN + 1] = {0};
-  bool order_desc = false;
+  // 7. Parse LIMIT n [OFFSET m] (Optional)
+  bool has_limit = false;
+  int limit_count = 0, offset_count = 0;
 
-  if (cur->tok_value == K_ORDER) {
+  if (cur->tok_value == K_LIMIT) {
     cur = cur->next;
-    if (cur->tok_value != K_BY) {
+    if ((cur->tok_value != INT_LITERAL) || ((limit_count = atoi(cur->tok_string)) < 0)) {
       return INVALID_STATEMENT;
     }
     cur = cur->next;
-    if ((cur->tok_class != keyword) && (cur->tok_class != identifier) &&
-        (cur->tok_class != type_name)) {
-      return INVALID_COLUMN_NAME;
-    }
-    strcpy(order_col, cur->tok_string);
-    cur = cur->next;
-    if (cur->tok_value == K_DESC) {
-      order_desc = true;
+    if (cur->tok_value == K_OFFSET) {
+      cur = cur->next;
+      if ((cur->tok_value != INT_LITERAL) || ((offset_count = atoi(cur->tok_string)) < 0)) {
+        return INVALID_STATEMENT;
+      }
       cur = cur->next;
     }
-    has_order = true;
+    has_limit = true;
   }
 
   if (cur->tok_value != EOC) {
     return INVALID_STATEMENT;
   }
 
+  int order_group[MAX_NUM_COL];  // GROUP BY column named by each ORDER BY column
+
+  // Without GROUP BY, aggregates cover the whole table and cannot be
+  // mixed with plain columns.  With it, every plain column must be grouped.
+  if (has_group) {
+    if (is_star) {
+      return INVALID_SELECT_DEFINITION;
+    }
+    for (int i = 0; i < num_sel_cols; i++) {
+      if (sel_cols[i].agg_index >= 0)
+        continue;
+      bool grouped = false;
+      for (int g = 0; g < num_group_cols && !grouped; g++)
+        grouped = (strcasecmp(sel_cols[i].name, group_cols[g].name) == 0);
+      if (!grouped) {
+        printf("Error: column %s must appear in GROUP BY\n", sel_cols[i].name);
+        return INVALID_SELECT_DEFINITION;
+      }
+    }
+    for (int c = 0; c < num_order_cols; c++) {
+      order_group[c] = -1;
+      for (int g = 0; g < num_group_cols && order_group[c] == -1; g++)
+        if (strcasecmp(order_cols[c].name, group_cols[g].name) == 0)
+          order_group[c] = g;
+      if (order_group[c] == -1) {
+        printf("Error: ORDER BY column %s must appear in GROUP BY\n",
+               order_cols[c].name);
+        return INVALID_COLUMN_NAME;
+      }
+    }
+  } else if (is_aggregate) {
+    for (int i = 0; i < num_sel_cols; i++) {
+      if (sel_cols[i].agg_index < 0) {
+        return INVALID_SELECT_DEFINITION;
+      }
+    }
+    num_sel_cols = 0;
+  }
+
+  if ((chain.num_tables > 0) && (rc = join_chain_plan(&chain, conditions, num_conditions))) {
+    return rc;
+  }
+
+  // Build the plan for EXPLAIN: output <- sort <- filter <- [join <-] scans
+  int output_node = -1, sort_node = -1, filter_node = -1, join_node = -1;
+  int group_node = -1, limit_node = -1;
+  int scan1_node = -1, scan2_node = -1, chain_node = -1;
+  if (g_explain != EXPLAIN_OFF) {
+    char detail[64] = {0};
+    int depth = 0, used = 0;
+
+    if (has_limit)
+      limit_node = plan_add("Limit", depth++, "%d offset %d", limit_count,
+                            offset_count);
+
+    if (is_aggregate && !has_group) {
+      for (int a = 0; a < num_agg_funcs && used < (int)sizeof(detail); a++)
+        used += snprintf(detail + used, sizeof(detail) - used, "%s%s(%s)",
+                         a ? ", " : "",
+                         (agg_funcs[a].type == F_SUM)   ? "SUM"
+                         : (agg_funcs[a].type == F_AVG) ? "AVG"
+                                                        : "COUNT",
+                         agg_funcs[a].col_name);
+      output_node = plan_add("Aggregate", depth++, "%s", detail);
+    } else {
+      if (is_star)
+        strcpy(detail, "*");
+      for (int c = 0; c < num_sel_cols && used < (int)sizeof(detail); c++) {
+        if (sel_cols[c].agg_index >= 0)
+          used += snprintf(detail + used, sizeof(detail) - used, "%s%s(%s)",
+                           c ? ", " : "",
+                           agg_func_name(agg_funcs[sel_cols[c].agg_index].type),
+                           sel_cols[c].name);
+        else
+          used += snprintf(detail + used, sizeof(detail) - used, "%s%s",
+                           c ? ", " : "", sel_cols[c].name);
+      }
+      output_node = plan_add("Project", depth++, "%s", detail);
+    }
+
+    if (has_order) {
+      used = 0;
+      for (int c = 0; c < num_order_cols; c++) {
+        order_column *oc = &order_cols[c];
+        detail_append(detail, sizeof(detail), &used, "%s%s%s", c ? ", " : "",
+                      oc->name, oc->desc ? " DESC" : "");
+        if (oc->nulls_first == oc->desc)
+          detail_append(detail, sizeof(detail), &used, " NULLS %s",
+                        oc->nulls_first ? "FIRST" : "LAST");
+      }
+      if (has_limit && !has_group && !is_aggregate)
+        sort_node = plan_add("TopN", depth++, "%s, heap of %d", detail,
+                             limit_count + offset_count);
+      else
+        sort_node = plan_add("Sort", depth++, "%s", detail);
+    }
+
+    if (has_group) {
+      used = 0;
+      for (int g = 0; g < num_group_cols; g++)
+        detail_append(detail, sizeof(detail), &used, "%s%s", g ? ", " : "",
+                      group_cols[g].name);
+      for (int h = 0; h < num_having; h++) {
+        having_condition *hc = &having[h];
+        detail_append(detail, sizeof(detail), &used, "%s", h ? " " : " HAVING ");
+        if (hc->agg_index >= 0)
+          detail_append(detail, sizeof(detail), &used, "%s(%s)",
+                        agg_func_name(agg_funcs[hc->agg_index].type),
+                        agg_funcs[hc->agg_index].col_name);
+        else
+          detail_append(detail, sizeof(detail), &used, "%s",
+                        group_cols[hc->group_index].name);
+        if (hc->value_type == INT_LITERAL)
+          detail_append(detail, sizeof(detail), &used, " %s %d",
+                        op_symbol(hc->operator_type), hc->int_value);
+        else
+          detail_append(detail, sizeof(detail), &used, " %s '%s'",
+                        op_symbol(hc->operator_type), hc->str_value);
+        if (hc->logical_operator)
+          detail_append(detail, sizeof(detail), &used, " %s",
+                        (hc->logical_operator == K_AND) ? "AND" : "OR");
+      }
+      group_node = plan_add("HashAggregate", depth++, "%s", detail);
+    }
+
+    if (num_conditions > 0) {
+      used = 0;
+      for (int c = 0; c < num_conditions && used < (int)sizeof(detail); c++) {
+        query_condition *qc = &conditions[c];
+        if (qc->operator_type == K_IS)
+          used += snprintf(detail + used, sizeof(detail) - used, "%s IS %sNULL",
+                           qc->col_name, (qc->value_type == K_NOT) ? "NOT " : "");
+        else if (qc->value_type == INT_LITERAL)
+          used += snprintf(detail + used, sizeof(detail) - used, "%s %s %d",
+                           qc->col_name, op_symbol(qc->operator_type),
+                           qc->int_value);
+        else
+          used += snprintf(detail + used, sizeof(detail) - used, "%s %s '%s'",
+                           qc->col_name, op_symbol(qc->operator_type),
+                           qc->str_value);
+        if (qc->logical_operator && used < (int)sizeof(detail))
+          used += snprintf(detail + used, sizeof(detail) - used, " %s ",
+                           (qc->logical_operator == K_AND) ? "AND" : "OR");
+      }
+      filter_node = plan_add("Filter", depth++, "%s", detail);
+    }
+
+    int block_rows = 0;
+    bool parallel = false;
+    if (has_join) {
+      int map1[MAX_NUM_COL], map2[MAX_NUM_COL];
+      int n = join_on ? 0 : find_common_columns(tpd1, tpd2, map1, map2);
+      cd_entry *c1 = (cd_entry *)((char *)tpd1 + tpd1->cd_offset);
+      used = snprintf(detail, sizeof(detail), "%s",
+                      join_on ? on_detail : n ? "natural on " : "cross product");
+      for (int c = 0; c < n && used < (int)sizeof(detail); c++)
+        used += snprintf(detail + used, sizeof(detail) - used, "%s%s",
+                         c ? ", " : "", c1[map1[c]].col_name);
+      FILE *fp = NULL;
+      table_file_header hdr1, hdr2;
+      if ((rc = open_tab_rw(table1, &fp, &hdr1)))
+        return rc;
+      fclose(fp);
+      if ((rc = open_tab_rw(table2, &fp, &hdr2)))
+        return rc;
+      fclose(fp);
+      if (n == 0) {
+        block_rows = join_block_rows(hdr1.record_size, hdr1.num_records);
+        join_node = plan_add("BlockNestedLoopJoin", depth++, "%s", detail);
+      } else if ((parallel = join_parallel_wanted(hdr1.num_records, hdr2.num_records))) {
+        int threads = parallel_threads((long)hdr1.num_records + hdr2.num_records);
+        int bits = join_radix_bits(threads, (long)hdr2.num_records * hdr2.record_size);
+        join_node = plan_add("RadixHashJoin", depth++, "%s, %d thread%s, %d partitions",
+                             detail, threads, (threads == 1) ? "" : "s", 1 << bits);
+      } else {
+        join_node = plan_add("NestedLoopJoin", depth++, "%s", detail);
+      }
+    }
+
+    if (chain.num_tables > 0)
+      chain_node = join_chain_explain(&chain, depth);
+    else
+      scan1_node = plan_add("SeqScan", depth, "%s", table1);
+    if (has_join && block_rows)
+      scan2_node = plan_add("SeqScan", depth, "%s (once per block of %d rows)", table2,
+                            block_rows);
+    else if (has_join && parallel)
+      scan2_node = plan_add("SeqScan", depth, "%s", table2);
+    else if (has_join)
+      scan2_node = plan_add("SeqScan", depth, "%s (rescanned per outer row)",
+                            table2);
+
+    if (g_explain == EXPLAIN_PLAN)
+      return rc;
+  }
+  /* Node that owns the materialized result rows */
+  int result_node = (filter_node >= 0)  ? filter_node
+                    : (join_node >= 0)  ? join_node
+                    : (chain_node >= 0) ? chain_node
+                                        : scan1_node;
+
   // Execution
   // We need to load data, join if needed, filter, store, sort, aggregate/print.
 
   // Define a generic row structure for memory storage
   struct ResultRow {
-    unsigned char *data; // Contains all columns from t1 (and t2 if join)
+    unsigned char *data; // the row of table1; NULL for a join
     int size;
+    int rowid1, rowid2;  // a join's two rows, read again for output
+    long long seq;       // arrival order; breaks ORDER BY ties like a stable sort
+    unsigned char *key;  // normalized ORDER BY key, kept by the top-N heap and joins
   };
 
   // We will store pointers to dynamically allocated row data
@@ -2172,15 +7643,22 @@ int sem_select(token_list *t_list) {
   int result_count = 0;
   int result_capacity = 0;
 
-  auto add_result = [&](unsigned char *row_data, int size) {
+  auto add_result = [&](unsigned char *row_data, int size, int rowid1, int rowid2) {
     if (result_count >= result_capacity) {
       result_capacity = (result_capacity == 0) ? 128 : result_capacity * 2;
-      results = (struct ResultRow *)realloc(
-          results, result_capacity * sizeof(struct ResultRow));
+      results = (struct ResultRow *)db_realloc(
+          results, result_capacity * sizeof(struct ResultRow), result_node);
+    }
+    results[result_count].data = NULL;
+    if (row_data) {
+      results[result_count].data = (unsigned char *)db_malloc(size, result_node);
+      memcpy(results[result_count].data, row_data, size);
     }
-    results[result_count].data = (unsigned char *)malloc(size);
-    memcpy(results[result_count].data, row_data, size);
     results[result_count].size = size;
+    results[result_count].rowid1 = rowid1;
+    results[result_count].rowid2 = rowid2;
+    results[result_count].seq = result_count;
+    results[result_count].key = NULL;
     result_count++;
   };
 
@@ -2204,29 +7682,266 @@ int sem_select(token_list *t_list) {
   cd_entry *cols2 =
       has_join ? (cd_entry *)((char *)tpd2 + tpd2->cd_offset) : NULL;
 
+  // GROUP BY: where each key column and aggregate input sits in a row
+  struct GroupField {
+    char *name;
+    bool in_t1;
+    int offset;     // of the length byte within its table's row
+    int width;      // length byte + payload
+    int key_offset; // within the group key
+    int type;
+    int len;
+  };
+  GroupField group_fields[MAX_NUM_COL], agg_fields[MAX_NUM_COL];
+  int group_key_len = 0;
+
+  auto locate_field = [&](const char *name, GroupField *f) -> bool {
+    for (int pass = 0; pass < (has_join ? 2 : 1); pass++) {
+      tpd_entry *tpd = pass ? tpd2 : tpd1;
+      cd_entry *cols = pass ? cols2 : cols1;
+      int off = 0;
+      for (int k = 0; k < tpd->num_columns; k++) {
+        int width = 1 + ((cols[k].col_type == T_INT) ? 4 : cols[k].col_len);
+        if (strcasecmp(cols[k].col_name, name) == 0) {
+          f->name = cols[k].col_name;
+          f->in_t1 = (pass == 0);
+          f->offset = off;
+          f->width = width;
+          f->type = cols[k].col_type;
+          f->len = cols[k].col_len;
+          return true;
+        }
+        off += width;
+      }
+    }
+    return false;
+  };
+
+  if (has_group) {
+    for (int g = 0; g < num_group_cols; g++) {
+      if (!locate_field(group_cols[g].name, &group_fields[g])) {
+        return INVALID_COLUMN_NAME;
+      }
+      group_fields[g].key_offset = group_key_len;
+      group_key_len += group_fields[g].width;
+    }
+    for (int a = 0; a < num_agg_funcs; a++) {
+      agg_fields[a].offset = -1;  // COUNT(*)
+      if (strcmp(agg_funcs[a].col_name, "*") == 0)
+        continue;
+      if (!locate_field(agg_funcs[a].col_name, &agg_fields[a])) {
+        return INVALID_COLUMN_NAME;
+      }
+      if ((agg_funcs[a].type != F_COUNT) && (agg_fields[a].type != T_INT)) {
+        printf("Error: SUM and AVG can only be used on integer columns\n");
+        return INVALID_SELECT_DEFINITION;
+      }
+    }
+  }
+
+  GroupField order_fields[MAX_NUM_COL];
+  for (int c = 0; (c < num_order_cols) && !has_group; c++) {
+    if (!locate_field(order_cols[c].name, &order_fields[c])) {
+      return INVALID_COLUMN_NAME;
+    }
+  }
+
   // Open files
-  FILE *f1 = NULL, *f2 = NULL;
-  table_file_header h1, h2;
-  if ((rc = open_tab_rw(table1, &f1, &h1)))
-    return rc;
+  tab_handle t1, t2;
+  table_file_header h1, h2 = {0};
+  t2.fp = NULL;
+  if (chain.num_tables > 0) {
+    // The chain's result stands in for table1
+    if ((rc = join_chain_run(&chain))) {
+      free(chain.rows);
+      return rc;
+    }
+    t1.fp = NULL;
+    h1.record_size = chain.record_size;
+    h1.num_records = chain.num_rows;
+  } else {
+    if ((rc = tab_open(table1, &t1)))
+      return rc;
+    h1 = t1.hdr;
+    t1.plan_node = scan1_node;
+  }
   if (has_join) {
-    if ((rc = open_tab_rw(table2, &f2, &h2))) {
-      fclose(f1);
+    if ((rc = tab_open(table2, &t2))) {
+      tab_close(&t1);
       return rc;
     }
+    h2 = t2.hdr;
+    t2.plan_node = scan2_node;
   }
 
-  unsigned char *buf1 = (unsigned char *)malloc(h1.record_size);
+  unsigned char *buf1 = (unsigned char *)db_malloc(h1.record_size, -1);
   unsigned char *buf2 =
-      has_join ? (unsigned char *)malloc(h2.record_size) : NULL;
+      has_join ? (unsigned char *)db_malloc(h2.record_size, -1) : NULL;
+
+  // Projection pushdown: a single table's result rows keep only the
+  // columns printed, sorted on or aggregated (WHERE is checked on buf1)
+  row_projection proj;
+  bool keep[MAX_NUM_COL];
+  for (int k = 0; k < tpd1->num_columns; k++) {
+    keep[k] = is_star || has_join;
+    for (int i = 0; (i < num_sel_cols) && !keep[k]; i++)
+      keep[k] = (sel_cols[i].agg_index < 0) &&
+                (strcasecmp(sel_cols[i].name, cols1[k].col_name) == 0);
+    for (int c = 0; (c < num_order_cols) && !has_group && !keep[k]; c++)
+      keep[k] = (strcasecmp(order_cols[c].name, cols1[k].col_name) == 0);
+    for (int a = 0; (a < num_agg_funcs) && !keep[k]; a++)
+      keep[k] = (strcasecmp(agg_funcs[a].col_name, cols1[k].col_name) == 0);
+  }
+  projection_compile(&proj, tpd1, keep, h1.record_size);
+  unsigned char *proj_buf =
+      proj.num_runs ? (unsigned char *)db_malloc(proj.row_size, -1) : NULL;
+
+  // GROUP BY streams every qualifying row straight into the hash table
+  group_agg ga;
+  unsigned char *group_entry = NULL;  // the row as a one-row partial group
+  unsigned char *groups = NULL;       // finished groups, ga.entry_size each
+  int num_groups = 0, groups_capacity = 0;
+  long long spilled = 0;
+  if (has_group) {
+    rc = agg_init(&ga, group_key_len, num_agg_funcs, 0);
+    group_entry = (unsigned char *)db_malloc(ga.entry_size, group_node);
+    if (!group_entry)
+      rc = MEMORY_ERROR;
+    else
+      memset(group_entry, 0, ga.entry_size);
+  }
+
+  auto group_row = [&](unsigned char *row1, unsigned char *row2) -> int {
+    unsigned char *key = group_entry + 8;
+    for (int g = 0; g < num_group_cols; g++) {
+      GroupField *gf = &group_fields[g];
+      memcpy(key + gf->key_offset, (gf->in_t1 ? row1 : row2) + gf->offset, gf->width);
+    }
+    uint32_t h = hash_bytes(key, group_key_len), used = 1;
+    memcpy(group_entry, &h, 4);
+    memcpy(group_entry + 4, &used, 4);
+
+    agg_state *st = agg_states(&ga, group_entry);
+    for (int a = 0; a < num_agg_funcs; a++) {
+      st[a].sum = 0;
+      st[a].count = 0;
+      if (agg_fields[a].offset < 0) {
+        st[a].count = 1;
+        continue;
+      }
+      unsigned char *field = (agg_fields[a].in_t1 ? row1 : row2) + agg_fields[a].offset;
+      if (field[0] > 0) {
+        st[a].count = 1;
+        if (agg_fields[a].type == T_INT) {
+          int value;
+          memcpy(&value, field + 1, 4);
+          st[a].sum = value;
+        }
+      }
+    }
+    plan_rows(group_node, 1, 0);
+    return agg_add(&ga, group_entry);
+  };
+
+  // ORDER BY key columns, within a result row or a group entry
+  sort_key_col sort_cols[MAX_NUM_COL];
+  for (int c = 0; c < num_order_cols; c++) {
+    GroupField *of = has_group ? &group_fields[order_group[c]] : &order_fields[c];
+    sort_cols[c].side = (has_group || of->in_t1) ? 0 : 1;
+    sort_cols[c].offset = has_group  ? 8 + of->key_offset
+                          : has_join ? of->offset
+                                     : projection_offset(&proj, of->offset);
+    sort_cols[c].type = of->type;
+    sort_cols[c].len = (of->type == T_INT) ? 4 : of->len;
+    sort_cols[c].desc = order_cols[c].desc;
+    sort_cols[c].nulls_first = order_cols[c].nulls_first;
+  }
+  int sort_key_len = sort_key_length(sort_cols, num_order_cols);
+
+  // LIMIT: without ORDER BY the scan stops once OFFSET + LIMIT rows are
+  // kept; with it, a max-heap keeps the best OFFSET + LIMIT rows seen so
+  // far (worst at results[0]).  Aggregates need every row.
+  long long row_window = (long long)limit_count + offset_count;
+  bool limit_rows = has_limit && !is_aggregate && !has_group;
+  bool use_heap = limit_rows && has_order;
+  long long rows_accepted = 0;
+  unsigned char *candidate_key =
+      use_heap ? (unsigned char *)db_malloc(sort_key_len, sort_node) : NULL;
+  if (use_heap && !candidate_key)
+    rc = MEMORY_ERROR;
+
+  auto heap_worse = [&](int a, int b) -> bool {
+    return memcmp(results[a].key, results[b].key, sort_key_len) > 0;
+  };
+
+  auto heap_sift_down = [&](int i) {
+    while (true) {
+      int worst = i, l = 2 * i + 1, r = 2 * i + 2;
+      if ((l < result_count) && heap_worse(l, worst))
+        worst = l;
+      if ((r < result_count) && heap_worse(r, worst))
+        worst = r;
+      if (worst == i)
+        return;
+      struct ResultRow temp = results[i];
+      results[i] = results[worst];
+      results[worst] = temp;
+      i = worst;
+    }
+  };
+
+  /* Keep one qualifying row; returns true when the scan can stop.  A
+     join keeps only the numbers of its two rows (and its ORDER BY key),
+     so matches cost no row copies; output reads the rows back. */
+  auto emit_row = [&](unsigned char *row1, unsigned char *row2, int rowid1,
+                      int rowid2) -> bool {
+    long long seq = rows_accepted++;
+    unsigned char *row_data = row2 ? NULL : row1;
+    int size = proj.row_size;
+    if (!use_heap) {
+      add_result(row_data, size, rowid1, rowid2);
+      if (row2 && has_order) {
+        unsigned char *key = (unsigned char *)db_malloc(sort_key_len, sort_node);
+        sort_key_encode(key, row1, row2, sort_cols, num_order_cols, seq);
+        results[result_count - 1].key = key;
+      }
+      return limit_rows && (result_count >= row_window);
+    }
+    sort_key_encode(candidate_key, row1, row2, sort_cols, num_order_cols, seq);
+    if (result_count < row_window) {
+      add_result(row_data, size, rowid1, rowid2);
+      int i = result_count - 1;
+      results[i].seq = seq;
+      results[i].key = (unsigned char *)db_malloc(sort_key_len, sort_node);
+      memcpy(results[i].key, candidate_key, sort_key_len);
+      while ((i > 0) && heap_worse(i, (i - 1) / 2)) {
+        struct ResultRow temp = results[i];
+        results[i] = results[(i - 1) / 2];
+        results[(i - 1) / 2] = temp;
+        i = (i - 1) / 2;
+      }
+    } else if ((result_count > 0) &&
+               (memcmp(candidate_key, results[0].key, sort_key_len) < 0)) {
+      if (row_data)
+        memcpy(results[0].data, row_data, size);
+      results[0].rowid1 = rowid1;
+      results[0].rowid2 = rowid2;
+      memcpy(results[0].key, candidate_key, sort_key_len);
+      results[0].seq = seq;
+      heap_sift_down(0);
+    }
+    return false;
+  };
+  bool scan_done = limit_rows && (row_window == 0);
 
   // Identify common columns for join
   int common1[MAX_NUM_COL], common2[MAX_NUM_COL];
   int num_common = 0;
-  if (has_join) {
+  if (has_join && !join_on) {
     num_common = find_common_columns(tpd1, tpd2, common1, common2);
     if (num_common == 0) {
       printf("Warning: No common columns found for NATURAL JOIN\n");
+      g_qcache_storable = false;  // a hit would not repeat the warning
       // Proceed as cross product? Or empty? Standard natural join is empty if
       // no common cols? Actually usually it's cross product if no common cols,
       // but here let's assume empty or error? The prompt says "Natural Join",
@@ -2234,320 +7949,472 @@ int sem_select(token_list *t_list) {
       // a Cartesian product. Let's assume we proceed.
     }
   }
+  join_keys keys;
+  if (join_on)
+    keys = on_keys;
+  else if (has_join)
+    join_keys_compile(&keys, tpd1, tpd2, common1, common2, num_common);
+  scan_filter filter;
+  scan_filter_compile(&filter, conditions, num_conditions, tpd1,
+                      has_join ? tpd2 : NULL);
+
+  // NATURAL JOIN: Bloom filters drop the rows of either table that have
+  // no partner, so the nested loop neither rescans nor compares them
+  join_bloom inner_bloom = {NULL, 0};
+  int *inner_rows = NULL, num_inner = has_join ? h2.num_records : 0;
+  bool use_block = has_join && ((keys.shape == JOIN_CROSS) || (keys.shape == JOIN_THETA));
+  bool use_parallel = has_join && !use_block &&
+                      join_parallel_wanted(h1.num_records, h2.num_records);
+  bool use_bloom = has_join && !use_block && !use_parallel && join_bloom_enabled();
+  if (use_bloom)
+    rc = join_bloom_prepare(&t1, &t2, &keys, buf1, buf2, &inner_bloom, &inner_rows,
+                            &num_inner);
 
   // Loop and Filter
-  for (int i = 0; i < h1.num_records; i++) {
-    fseek(f1, row_pos(&h1, i), SEEK_SET);
-    fread(buf1, h1.record_size, 1, f1);
+  long long mark = plan_clock();
+
+  // A joined pair of rows: check the join condition and WHERE, then keep
+  // it.  True once the scan can stop.
+  // Does the pair in row1 and buf2 pass the join condition and WHERE?
+  auto pair_match = [&](unsigned char *row1) -> bool {
+    bool joined = join_keys_match(&keys, row1, buf2);
+    plan_charge(join_node, &mark);
+    plan_rows(join_node, 1, joined);
+    if (!joined)
+      return false;
+    // WHERE columns are looked up in table1 first, then table2
+    bool match = scan_filter_match(&filter, row1, buf2);
+    if (num_conditions > 0) {
+      plan_charge(filter_node, &mark);
+      plan_rows(filter_node, 1, match);
+    }
+    return match;
+  };
 
-    if (!has_join) {
-      // Single table
-      bool match = true;
-      if (num_conditions > 0) {
-        // Evaluate conditions
-        // We support AND/OR. We need to handle precedence or just linear.
-        // Let's assume linear left-to-right for simplicity or strict precedence
-        // if needed. Given the structure: cond1 [OP cond2], let's evaluate
-        // sequentially. Actually, we need to handle the logical operators.
-        // result = cond1; if (op1 == AND) result = result && cond2; else result
-        // = result || cond2;
-
-        bool current_res = false;
-        // Evaluate first condition
-        // Helper to eval one condition
-        auto eval = [&](int cond_idx, unsigned char *row,
-                        tpd_entry *tpd) -> bool {
-          query_condition *c = &conditions[cond_idx];
-          // Find column
-          int col_idx = -1;
-          cd_entry *cols = (cd_entry *)((char *)tpd + tpd->cd_offset);
-          for (int k = 0; k < tpd->num_columns; k++) {
-            if (strcasecmp(cols[k].col_name, c->col_name) == 0) {
-              col_idx = k;
+  // Group or keep a pair that passed.  True once the scan can stop.
+  auto keep_pair = [&](unsigned char *row1, int i, int j) -> bool {
+    if (has_group) {
+      rc = group_row(row1, buf2);
+      plan_charge(group_node, &mark);
+    } else {
+      scan_done = emit_row(row1, buf2, i, j);
+    }
+    plan_charge(result_node, &mark);
+    return rc || scan_done;
+  };
+
+  auto join_pair = [&](unsigned char *row1, int i, int j) -> bool {
+    return pair_match(row1) && keep_pair(row1, i, j);
+  };
+
+  // Block nested loop: a block of table1 rows stays in memory while
+  // table2 streams past it, so table2 is read once per block instead of
+  // once per row.  The pairs that pass are noted as table2 goes by and
+  // kept afterwards table1 row by table1 row, in nested-loop order; a
+  // table2 row is read again only when grouping or ORDER BY needs it.
+  if (use_block) {
+    int block_rows = join_block_rows(h1.record_size, h1.num_records);
+    unsigned char *block = (unsigned char *)db_malloc((size_t)block_rows * h1.record_size, -1);
+    int *row_end = (int *)db_malloc((size_t)(block_rows + 1) * sizeof(int), -1);
+    int *pairs = NULL, *inner = NULL;  // (b, j) as found; j by table1 row
+    long num_pairs = 0, capacity = 0;
+    bool need_row2 = has_group || has_order;
+    if (!block || !row_end)
+      rc = MEMORY_ERROR;
+    for (int first = 0; (first < h1.num_records) && !rc && !scan_done; first += block_rows) {
+      int n = (h1.num_records - first < block_rows) ? h1.num_records - first : block_rows;
+      for (int b = 0; (b < n) && !rc; b++) {
+        rc = tab_read(&t1, first + b, block + (size_t)b * h1.record_size);
+        plan_charge(scan1_node, &mark);
+        plan_rows(scan1_node, 1, 1);
+      }
+      STAT_ADD(join_blocks, 1);
+      num_pairs = 0;
+      for (int j = 0; (j < h2.num_records) && !rc; j++) {
+        if ((rc = tab_read(&t2, j, buf2)))
+          break;
+        STAT_ADD(join_inner_rows, 1);
+        plan_charge(scan2_node, &mark);
+        plan_rows(scan2_node, 1, 1);
+        for (int b = 0; (b < n) && !rc; b++) {
+          if (!pair_match(block + (size_t)b * h1.record_size))
+            continue;
+          if (num_pairs == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            int *grown = (int *)db_realloc(pairs, (size_t)capacity * 2 * sizeof(int), -1);
+            int *grown_inner = grown ? (int *)db_realloc(inner, (size_t)capacity * sizeof(int), -1)
+                                     : NULL;
+            if (grown)
+              pairs = grown;
+            if (grown_inner)
+              inner = grown_inner;
+            if (!grown || !grown_inner) {
+              rc = MEMORY_ERROR;
               break;
             }
           }
-          if (col_idx == -1)
-            return false; // Should be caught earlier but safety
-
-          int offset = 0;
-          for (int k = 0; k < col_idx; k++) {
-            if (cols[k].col_type == T_INT)
-              offset += 1 + 4;
-            else
-              offset += 1 + cols[k].col_len;
-          }
+          pairs[2 * num_pairs] = b;
+          pairs[2 * num_pairs + 1] = j;
+          num_pairs++;
+        }
+      }
 
-          unsigned char len = row[offset++];
+      // Counting sort by table1 row; j stays ascending within a row
+      memset(row_end, 0, (size_t)(n + 1) * sizeof(int));
+      for (long p = 0; p < num_pairs; p++)
+        row_end[pairs[2 * p] + 1]++;
+      for (int b = 0; b < n; b++)
+        row_end[b + 1] += row_end[b];
+      for (long p = 0; p < num_pairs; p++)
+        inner[row_end[pairs[2 * p]]++] = pairs[2 * p + 1];
+
+      // row_end[b] is now where table1 row b's pairs end
+      long p = 0;
+      for (int b = 0; (b < n) && !rc && !scan_done; b++) {
+        unsigned char *row1 = block + (size_t)b * h1.record_size;
+        for (; (p < row_end[b]) && !rc && !scan_done; p++) {
+          if (need_row2 && (rc = tab_read(&t2, inner[p], buf2)))
+            break;
+          keep_pair(row1, first + b, inner[p]);
+        }
+      }
+    }
+    free(pairs);
+    free(inner);
+    free(row_end);
+    free(block);
+  }
 
-          if (c->operator_type == K_IS) {
-            if (c->value_type == K_NULL)
-              return (len == 0);
-            if (c->value_type == K_NOT)
-              return (len != 0);
-          }
+  // Parallel NATURAL JOIN: table1 from row first1 on and all of table2
+  // are read into memory and joined by partition on DB_THREADS threads;
+  // the pairs that pass WHERE come back in nested-loop order and are
+  // kept here as the loop would
+  auto hash_join = [&](int first1) {
+    parallel_join pj;
+    int *pairs = NULL;
+    long num_pairs = 0, joined = 0;
+    int n1 = h1.num_records - first1;
+    unsigned char *rows[2];
+    rows[0] = (unsigned char *)db_malloc((size_t)n1 * h1.record_size + 1, -1);
+    rows[1] = (unsigned char *)db_malloc((size_t)h2.num_records * h2.record_size + 1, -1);
+    if (!rows[0] || !rows[1])
+      rc = MEMORY_ERROR;
+    for (int i = 0; (i < n1) && !rc; i++)
+      rc = tab_read(&t1, first1 + i, rows[0] + (size_t)i * h1.record_size);
+    plan_charge(scan1_node, &mark);
+    plan_rows(scan1_node, n1, n1);
+    for (int j = 0; (j < h2.num_records) && !rc; j++)
+      rc = tab_read(&t2, j, rows[1] + (size_t)j * h2.record_size);
+    plan_charge(scan2_node, &mark);
+    plan_rows(scan2_node, h2.num_records, h2.num_records);
 
-          if (len == 0)
-            return false; // NULL fails other comparisons
-
-          if (cols[col_idx].col_type == T_INT) {
-            int val;
-            memcpy(&val, row + offset, 4);
-            if (c->operator_type == S_EQUAL)
-              return val == c->int_value;
-            if (c->operator_type == S_LESS)
-              return val < c->int_value;
-            if (c->operator_type == S_GREATER)
-              return val > c->int_value;
-            if (c->operator_type == S_LESS_EQUAL)
-              return val <= c->int_value;
-            if (c->operator_type == S_GREATER_EQUAL)
-              return val >= c->int_value;
-            if (c->operator_type == S_NOT_EQUAL)
-              return val != c->int_value;
-          } else {
-            char val_str[256] = {0};
-            memcpy(val_str, row + offset, len);
-            int cmp = strcmp(val_str, c->str_value);
-            if (c->operator_type == S_EQUAL)
-              return cmp == 0;
-            if (c->operator_type == S_LESS)
-              return cmp < 0;
-            if (c->operator_type == S_GREATER)
-              return cmp > 0;
-            if (c->operator_type == S_LESS_EQUAL)
-              return cmp <= 0;
-            if (c->operator_type == S_GREATER_EQUAL)
-              return cmp >= 0;
-            if (c->operator_type == S_NOT_EQUAL)
-              return cmp != 0;
-          }
-          return false;
-        };
-
-        current_res = eval(0, buf1, tpd1);
-        for (int k = 0; k < num_conditions - 1; k++) {
-          bool next_res = eval(k + 1, buf1, tpd1);
-          if (conditions[k].logical_operator == K_AND)
-            current_res = current_res && next_res;
-          else if (conditions[k].logical_operator == K_OR)
-            current_res = current_res || next_res;
-        }
-        match = current_res;
+    if (!rc) {
+      pj.keys = &keys;
+      pj.filter = &filter;
+      pj.rows[0] = rows[0];
+      pj.rows[1] = rows[1];
+      pj.record_size[0] = h1.record_size;
+      pj.record_size[1] = h2.record_size;
+      pj.num_rows[0] = n1;
+      pj.num_rows[1] = h2.num_records;
+      pj.num_threads = parallel_threads((long)n1 + h2.num_records);
+      pj.radix_bits = join_radix_bits(pj.num_threads, (long)h2.num_records * h2.record_size);
+      rc = parallel_join_run(&pj, &pairs, &num_pairs, &joined);
+      plan_charge(join_node, &mark);
+      plan_rows(join_node, n1, joined);
+      if (num_conditions > 0)
+        plan_rows(filter_node, joined, num_pairs);
+      if ((pj.swapped > 0) && (join_node >= 0)) {
+        char *detail = g_plan[join_node].detail;
+        int used = strlen(detail);
+        detail_append(detail, sizeof(g_plan[join_node].detail), &used,
+                      " [%d partitions built on %s]", pj.swapped, table1);
+      }
+    }
+    for (long p = 0; (p < num_pairs) && !rc && !scan_done; p++) {
+      int i = pairs[p * 2], j = pairs[p * 2 + 1];
+      unsigned char *row1 = rows[0] + (size_t)i * h1.record_size;
+      unsigned char *row2 = rows[1] + (size_t)j * h2.record_size;
+      if (has_group) {
+        rc = group_row(row1, row2);
+        plan_charge(group_node, &mark);
+      } else {
+        scan_done = emit_row(row1, row2, first1 + i, j);
+      }
+    }
+    plan_charge(result_node, &mark);
+    free(pairs);
+    free(rows[0]);
+    free(rows[1]);
+  };
+  if (use_parallel)
+    hash_join(0);
+
+  // A nested-loop join measures the table2 rows it reads; once they
+  // outweigh reading both tables JOIN_ADAPT_FACTOR times over, the rest
+  // of table1 goes to the partitioned join
+  long inner_reads = 0;
+  long adapt_limit = (has_join && !use_block && !use_parallel && join_adaptive_enabled())
+                         ? JOIN_ADAPT_FACTOR * ((long)h1.num_records + h2.num_records)
+                         : -1;
+  for (int i = 0; (i < h1.num_records) && !rc && !scan_done && !use_block && !use_parallel;
+       i++) {
+    if (chain.num_tables > 0)
+      memcpy(buf1, chain.rows + (size_t)i * h1.record_size, h1.record_size);
+    else if ((rc = tab_read(&t1, i, buf1)))
+      break;
+    plan_charge(scan1_node, &mark);
+    plan_rows(scan1_node, 1, 1);
+
+    if (!has_join) {
+      // Single table
+      bool match = scan_filter_match(&filter, buf1, NULL);
+      if (num_conditions > 0) {
+        plan_charge(filter_node, &mark);
+        plan_rows(filter_node, 1, match);
       }
 
-      if (match) {
-        add_result(buf1, h1.record_size);
+      if (match && has_group) {
+        rc = group_row(buf1, NULL);
+        plan_charge(group_node, &mark);
+      } else if (match) {
+        scan_done = emit_row(projection_apply(&proj, buf1, proj_buf), NULL, i, -1);
       }
+      plan_charge(result_node, &mark);
     } else {
-      // Join
-      for (int j = 0; j < h2.num_records; j++) {
-        fseek(f2, row_pos(&h2, j), SEEK_SET);
-        fread(buf2, h2.record_size, 1, f2);
-
-        // Check join condition
-        if (rows_match_on_common_columns(buf1, buf2, cols1, cols2, common1,
-                                         common2, num_common)) {
-          // Construct combined row for condition checking and storage
-          // Combined row format: [Row1 Data] [Row2 Data]
-          // This is a bit hacky but works for storage.
-          // For condition checking, we need to know which table the column
-          // belongs to. The prompt says "column_name" in WHERE. If ambiguous,
-          // what happens? We'll search tpd1 first, then tpd2.
-
-          bool match = true;
-          if (num_conditions > 0) {
-            bool current_res = false;
-            auto eval_join = [&](int cond_idx) -> bool {
-              query_condition *c = &conditions[cond_idx];
-              // Try tpd1
-              int col_idx = -1;
-              bool in_t1 = true;
-              for (int k = 0; k < tpd1->num_columns; k++) {
-                if (strcasecmp(cols1[k].col_name, c->col_name) == 0) {
-                  col_idx = k;
-                  break;
-                }
-              }
-              if (col_idx == -1) {
-                in_t1 = false;
-                for (int k = 0; k < tpd2->num_columns; k++) {
-                  if (strcasecmp(cols2[k].col_name, c->col_name) == 0) {
-                    col_idx = k;
-                    break;
-                  }
-                }
-              }
-              if (col_idx == -1)
-                return false;
-
-              unsigned char *row = in_t1 ? buf1 : buf2;
-              cd_entry *cols = in_t1 ? cols1 : cols2;
-
-              int offset = 0;
-              for (int k = 0; k < col_idx; k++) {
-                if (cols[k].col_type == T_INT)
-                  offset += 1 + 4;
-                else
-                  offset += 1 + cols[k].col_len;
-              }
-              unsigned char len = row[offset++];
+      // Join, unless the filter knows no row of table2 has this key
+      bool has_partner = true;
+      if (use_bloom) {
+        STAT_ADD(bloom_probes, 1);
+        has_partner = join_bloom_test(&inner_bloom, join_key_hash(&keys, buf1, 0));
+        if (has_partner)
+          STAT_ADD(bloom_passed, 1);
+      }
+      for (int n = 0; has_partner && (n < num_inner); n++) {
+        int j = inner_rows ? inner_rows[n] : n;
+        if ((rc = tab_read(&t2, j, buf2)))
+          break;
+        inner_reads++;
+        plan_charge(scan2_node, &mark);
+        plan_rows(scan2_node, 1, 1);
+        if (join_pair(buf1, i, j))
+          break;
+      }
+      if (rc)
+        break;
+      if ((adapt_limit >= 0) && (inner_reads > adapt_limit) && !scan_done &&
+          (i + 1 < h1.num_records)) {
+        STAT_ADD(join_switches, 1);
+        if (join_node >= 0) {
+          char *detail = g_plan[join_node].detail;
+          int used = strlen(detail);
+          detail_append(detail, sizeof(g_plan[join_node].detail), &used,
+                        " [hash join from row %d after %ld rows of %s]", i + 1,
+                        inner_reads, table2);
+        }
+        hash_join(i + 1);
+        break;
+      }
+    }
+  }
 
-              if (c->operator_type == K_IS) {
-                if (c->value_type == K_NULL)
-                  return (len == 0);
-                if (c->value_type == K_NOT)
-                  return (len != 0);
-              }
-              if (len == 0)
-                return false;
-
-              if (cols[col_idx].col_type == T_INT) {
-                int val;
-                memcpy(&val, row + offset, 4);
-                if (c->operator_type == S_EQUAL)
-                  return val == c->int_value;
-                if (c->operator_type == S_LESS)
-                  return val < c->int_value;
-                if (c->operator_type == S_GREATER)
-                  return val > c->int_value;
-              } else {
-                char val_str[256] = {0};
-                memcpy(val_str, row + offset, len);
-                int cmp = strcmp(val_str, c->str_value);
-                if (c->operator_type == S_EQUAL)
-                  return cmp == 0;
-                if (c->operator_type == S_LESS)
-                  return cmp < 0;
-                if (c->operator_type == S_GREATER)
-                  return cmp > 0;
-              }
-              return false;
-            };
-
-            current_res = eval_join(0);
-            for (int k = 0; k < num_conditions - 1; k++) {
-              bool next_res = eval_join(k + 1);
-              if (conditions[k].logical_operator == K_AND)
-                current_res = current_res && next_res;
-              else if (conditions[k].logical_operator == K_OR)
-                current_res = current_res || next_res;
-            }
-            match = current_res;
+  // Finish GROUP BY: drain the hash table and any spilled partitions,
+  // then keep the groups that pass HAVING
+  if (has_group) {
+    int frc = agg_finish(&ga, &groups, &num_groups, &groups_capacity, &spilled);
+    if (!rc)
+      rc = frc;
+
+    auto having_match = [&](unsigned char *entry) -> bool {
+      agg_state *st = agg_states(&ga, entry);
+      bool result = false;
+      for (int h = 0; h < num_having; h++) {
+        having_condition *hc = &having[h];
+        bool m = false;
+        if (hc->agg_index >= 0) {
+          long long v = agg_value(agg_funcs[hc->agg_index].type, &st[hc->agg_index]);
+          m = cmp_satisfies(hc->operator_type, (v > hc->int_value) - (v < hc->int_value));
+        } else {
+          GroupField *gf = &group_fields[hc->group_index];
+          unsigned char *field = entry + 8 + gf->key_offset;
+          if ((field[0] == 0) || ((gf->type == T_INT) != (hc->value_type == INT_LITERAL))) {
+            m = false;
+          } else if (gf->type == T_INT) {
+            int v;
+            memcpy(&v, field + 1, 4);
+            m = cmp_satisfies(hc->operator_type, (v > hc->int_value) - (v < hc->int_value));
+          } else {
+            char val_str[256] = {0};
+            memcpy(val_str, field + 1, field[0]);
+            m = cmp_satisfies(hc->operator_type, strcmp(val_str, hc->str_value));
           }
+        }
+        if (h == 0)
+          result = m;
+        else if (having[h - 1].logical_operator == K_AND)
+          result = result && m;
+        else
+          result = result || m;
+      }
+      return result;
+    };
 
-          if (match) {
-            // Store combined
-            int size = h1.record_size + h2.record_size;
-            unsigned char *combined = (unsigned char *)malloc(size);
-            memcpy(combined, buf1, h1.record_size);
-            memcpy(combined + h1.record_size, buf2, h2.record_size);
-            add_result(combined, size);
-            free(combined);
-          }
+    if (num_having > 0) {
+      int kept = 0;
+      for (int i = 0; i < num_groups; i++) {
+        unsigned char *entry = groups + (size_t)i * ga.entry_size;
+        if (having_match(entry)) {
+          if (kept != i)
+            memcpy(groups + (size_t)kept * ga.entry_size, entry, ga.entry_size);
+          kept++;
         }
       }
+      num_groups = kept;
     }
+    plan_rows(group_node, 0, num_groups);
+    if ((spilled > 0) && (group_node >= 0)) {
+      char *detail = g_plan[group_node].detail;
+      int used = strlen(detail);
+      detail_append(detail, sizeof(g_plan[group_node].detail), &used,
+                    " [spilled %lld]", spilled);
+    }
+    plan_charge(group_node, &mark);
   }
 
   // Sort
-  if (has_order && result_count > 1) {
-    // We need to find the sort column type and offset
-    // Similar lookup logic
-    int sort_col_idx = -1;
-    bool in_t1 = true;
-    for (int k = 0; k < tpd1->num_columns; k++) {
-      if (strcasecmp(cols1[k].col_name, order_col) == 0) {
-        sort_col_idx = k;
-        break;
-      }
+  mark = plan_clock();
+  plan_rows(sort_node, has_group ? num_groups : use_heap ? rows_accepted : result_count,
+            has_group ? num_groups : result_count);
+  // Every key is encoded once, the keys are radix sorted, and the rows
+  // (or groups) are then put in key order
+  int sort_count = has_group ? num_groups : result_count;
+  if (has_order && !rc && (sort_count > 1)) {
+    unsigned char *keys =
+        (unsigned char *)db_malloc((size_t)sort_count * sort_key_len, sort_node);
+    int *order = (int *)db_malloc(sort_count * sizeof(int), sort_node);
+    if (!keys || !order)
+      rc = MEMORY_ERROR;
+    for (int r = 0; (r < sort_count) && !rc; r++) {
+      if (has_group)
+        sort_key_encode(keys + (size_t)r * sort_key_len,
+                        groups + (size_t)r * ga.entry_size, NULL, sort_cols,
+                        num_order_cols, r);
+      else if (results[r].key)
+        memcpy(keys + (size_t)r * sort_key_len, results[r].key, sort_key_len);
+      else
+        sort_key_encode(keys + (size_t)r * sort_key_len, results[r].data, NULL,
+                        sort_cols, num_order_cols, results[r].seq);
     }
-    if (has_join && sort_col_idx == -1) {
-      in_t1 = false;
-      for (int k = 0; k < tpd2->num_columns; k++) {
-        if (strcasecmp(cols2[k].col_name, order_col) == 0) {
-          sort_col_idx = k;
-          break;
-        }
+    int threads = parallel_threads(sort_count);
+    if (!rc && (threads > 1))
+      rc = parallel_sort_keys(keys, sort_key_len, sort_count, order, threads, sort_node);
+    else if (!rc)
+      rc = radix_sort_keys(keys, sort_key_len, sort_count, order, sort_node);
+    if ((threads > 1) && (sort_node >= 0)) {
+      char *detail = g_plan[sort_node].detail;
+      int used = strlen(detail);
+      detail_append(detail, sizeof(g_plan[sort_node].detail), &used, " [%d runs merged]",
+                    threads);
+    }
+
+    if (!rc && has_group) {
+      unsigned char *sorted =
+          (unsigned char *)db_malloc((size_t)num_groups * ga.entry_size, sort_node);
+      if (!sorted) {
+        rc = MEMORY_ERROR;
+      } else {
+        for (int r = 0; r < num_groups; r++)
+          memcpy(sorted + (size_t)r * ga.entry_size,
+                 groups + (size_t)order[r] * ga.entry_size, ga.entry_size);
+        free(groups);
+        groups = sorted;
+      }
+    } else if (!rc) {
+      struct ResultRow *sorted = (struct ResultRow *)db_malloc(
+          result_capacity * sizeof(struct ResultRow), sort_node);
+      if (!sorted) {
+        rc = MEMORY_ERROR;
+      } else {
+        for (int r = 0; r < result_count; r++)
+          sorted[r] = results[order[r]];
+        free(results);
+        results = sorted;
       }
     }
+    free(keys);
+    free(order);
+  }
 
-    if (sort_col_idx != -1) {
-      // We need a custom comparator that knows how to extract the value
-      // We can't pass captures to qsort, so we need a global or static, or use
-      // a C++ sort with lambda? db.cpp is .cpp, so we can use std::sort! But we
-      // need to include <algorithm> and <vector> maybe? The file uses
-      // malloc/free, so let's stick to qsort if possible, but std::sort is
-      // easier with lambdas. Let's assume we can use std::sort. But wait, I
-      // can't easily add includes at the top without viewing the file again.
-      // I'll use a simple bubble sort or selection sort since N is small (100).
-      // Bubble sort is fine for 100 items.
+  plan_charge(sort_node, &mark);
 
-      for (int i = 0; i < result_count - 1; i++) {
-        for (int j = 0; j < result_count - i - 1; j++) {
-          // Compare results[j] and results[j+1]
-          unsigned char *r1 = results[j].data;
-          unsigned char *r2 = results[j + 1].data;
+  // OFFSET / LIMIT window over the rows (or groups) to print
+  int total_rows = has_group ? num_groups : is_aggregate ? 1 : result_count;
+  int first_out = 0, last_out = total_rows;
+  if (has_limit) {
+    first_out = (offset_count < total_rows) ? offset_count : total_rows;
+    last_out = (total_rows - first_out > limit_count) ? first_out + limit_count
+                                                      : total_rows;
+  }
+  int rows_out = last_out - first_out;
+  plan_rows(limit_node, total_rows, rows_out);
 
-          // Extract val1
-          unsigned char *row1 = in_t1 ? r1 : (r1 + h1.record_size);
-          cd_entry *cols = in_t1 ? cols1 : cols2;
-          int off1 = 0;
-          for (int k = 0; k < sort_col_idx; k++) {
-            if (cols[k].col_type == T_INT)
-              off1 += 5;
-            else
-              off1 += 1 + cols[k].col_len;
-          }
-          unsigned char len1 = row1[off1++];
-
-          // Extract val2
-          unsigned char *row2 = in_t1 ? r2 : (r2 + h1.record_size);
-          int off2 = 0;
-          for (int k = 0; k < sort_col_idx; k++) {
-            if (cols[k].col_type == T_INT)
-              off2 += 5;
-            else
-              off2 += 1 + cols[k].col_len;
-          }
-          unsigned char len2 = row2[off2++];
-
-          int cmp = 0;
-          if (cols[sort_col_idx].col_type == T_INT) {
-            int v1 = 0, v2 = 0;
-            if (len1 > 0)
-              memcpy(&v1, row1 + off1, 4);
-            if (len2 > 0)
-              memcpy(&v2, row2 + off2, 4);
-            if (v1 < v2)
-              cmp = -1;
-            else if (v1 > v2)
-              cmp = 1;
-          } else {
-            char s1[256] = {0}, s2[256] = {0};
-            if (len1 > 0)
-              memcpy(s1, row1 + off1, len1);
-            if (len2 > 0)
-              memcpy(s2, row2 + off2, len2);
-            cmp = strcmp(s1, s2);
-          }
+  // Output results: either aggregate or row-by-row
+  plan_rows(output_node, has_group ? num_groups : result_count,
+            has_group ? num_groups : is_aggregate ? 1 : result_count);
+  STAT_ADD(rows_returned, rows_out);
+
+  // A join's rows are read back by number, from only the tables that
+  // have a column to show; an outer row is read once for all its matches
+  int fetched1 = -1, fetched2 = -1;
+  auto fetch_row = [&](const struct ResultRow *res, bool need1, bool need2) -> int {
+    int frc = 0;
+    if (need1 && (res->rowid1 != fetched1) && !(frc = tab_read(&t1, res->rowid1, buf1)))
+      fetched1 = res->rowid1;
+    if (!frc && need2 && (res->rowid2 != fetched2) &&
+        !(frc = tab_read(&t2, res->rowid2, buf2)))
+      fetched2 = res->rowid2;
+    return frc;
+  };
 
-          if (order_desc)
-            cmp = -cmp;
+  result_writer rw;
+  if (has_group) {
+    // One row per group, columns in SELECT list order
+    int item_group[MAX_NUM_COL];
+    rw_begin(&rw, g_output_mode, true);
+    for (int i = 0; i < num_sel_cols; i++) {
+      item_group[i] = -1;
+      if (sel_cols[i].agg_index >= 0) {
+        rw_add_column(&rw, agg_func_name(agg_funcs[sel_cols[i].agg_index].type),
+                      10, true);
+        continue;
+      }
+      for (int g = 0; g < num_group_cols && item_group[i] == -1; g++)
+        if (strcasecmp(sel_cols[i].name, group_cols[g].name) == 0)
+          item_group[i] = g;
+      GroupField *gf = &group_fields[item_group[i]];
+      int w = strlen(gf->name);
+      int min_width = (gf->type == T_INT) ? 5 : gf->len;
+      rw_add_column(&rw, gf->name, (w < min_width) ? min_width : w,
+                    gf->type == T_INT);
+    }
+    rw_header(&rw);
 
-          if (cmp > 0) {
-            // Swap
-            struct ResultRow temp = results[j];
-            results[j] = results[j + 1];
-            results[j + 1] = temp;
-          }
+    for (int r = first_out; (r < last_out) && !rc; r++) {
+      unsigned char *entry = groups + (size_t)r * ga.entry_size;
+      agg_state *st = agg_states(&ga, entry);
+      for (int i = 0; i < num_sel_cols; i++) {
+        if (sel_cols[i].agg_index >= 0) {
+          int a = sel_cols[i].agg_index;
+          rw_int(&rw, agg_value(agg_funcs[a].type, &st[a]));
+          continue;
         }
+        GroupField *gf = &group_fields[item_group[i]];
+        rw_field(&rw, entry + 8 + gf->key_offset, gf->type == T_INT);
       }
     }
-  }
+    rw_finish(&rw, rows_out);
 
-  // Output results: either aggregate or row-by-row
-  if (is_aggregate) {
+  } else if (is_aggregate) {
     // Structure to hold aggregate computation results
     struct AggregateResult {
       long long sum_value;
@@ -2594,8 +8461,18 @@ int sem_select(token_list *t_list) {
       }
     }
 
+    bool need1 = false, need2 = false;
+    for (int a = 0; a < num_agg_funcs; a++) {
+      if (agg_results[a].column_index >= 0) {
+        need1 = need1 || agg_results[a].is_in_table1;
+        need2 = need2 || !agg_results[a].is_in_table1;
+      }
+    }
+
     // Compute aggregates by processing each result row
-    for (int i = 0; i < result_count; i++) {
+    for (int i = 0; (i < result_count) && !rc; i++) {
+      if (has_join && (rc = fetch_row(&results[i], need1, need2)))
+        break;
       for (int a = 0; a < num_agg_funcs; a++) {
         // COUNT(*) just counts rows
         if (agg_funcs[a].type == F_COUNT && strcmp(agg_funcs[a].col_name, "*") == 0) {
@@ -2604,10 +8481,9 @@ int sem_select(token_list *t_list) {
         }
         
         // Locate data in the appropriate table
-        unsigned char *row_data = results[i].data;
-        if (!agg_results[a].is_in_table1) {
-          row_data += h1.record_size;  // Skip to table2 data
-        }
+        unsigned char *row_data = !has_join                    ? results[i].data
+                                  : agg_results[a].is_in_table1 ? buf1
+                                                                : buf2;
         cd_entry *cols = agg_results[a].is_in_table1 ? cols1 : cols2;
 
         // Calculate offset to the target column
@@ -2618,6 +8494,8 @@ int sem_select(token_list *t_list) {
           else
             offset += 1 + cols[k].col_len;
         }
+        if (!has_join)
+          offset = projection_offset(&proj, offset);
         unsigned char field_length = row_data[offset++];
 
         // Process non-NULL values
@@ -2634,39 +8512,27 @@ int sem_select(token_list *t_list) {
       }
     }
 
-    // Display aggregate results with proper formatting
-    // Header row (left-justified, 10 chars per column)
-    for (int a = 0; a < num_agg_funcs; a++) {
-      const char *header = (agg_funcs[a].type == F_SUM) ? "SUM" :
-                          (agg_funcs[a].type == F_AVG) ? "AVG" : "COUNT";
-      printf("%-10s", header);
-      if (a < num_agg_funcs - 1) printf(" ");
-    }
-    printf("\n");
-    
-    // Separator row
-    for (int a = 0; a < num_agg_funcs; a++) {
-      printf("----------");
-      if (a < num_agg_funcs - 1) printf(" ");
-    }
-    printf("\n");
-    
-    // Value row (right-justified, 10 chars per column)
-    for (int a = 0; a < num_agg_funcs; a++) {
+    // Display aggregate results: 10 chars per column, headers
+    // left-justified and values right-justified
+    rw_begin(&rw, g_output_mode, false);
+    for (int a = 0; a < num_agg_funcs; a++)
+      rw_add_column(&rw, agg_func_name(agg_funcs[a].type), 10, true);
+    rw_header(&rw);
+
+    for (int a = 0; (a < num_agg_funcs) && (rows_out > 0); a++) {
       if (agg_funcs[a].type == F_SUM) {
-        printf("%10lld", agg_results[a].sum_value);
+        rw_int(&rw, agg_results[a].sum_value);
       } else if (agg_funcs[a].type == F_AVG) {
         long long avg = (agg_results[a].row_count > 0) ? 
                         (agg_results[a].sum_value / agg_results[a].row_count) : 0;
-        printf("%10lld", avg);
+        rw_int(&rw, avg);
       } else {  // F_COUNT
         int count = (strcmp(agg_funcs[a].col_name, "*") == 0) ? 
                     result_count : agg_results[a].row_count;
-        printf("%10d", count);
+        rw_int(&rw, count);
       }
-      if (a < num_agg_funcs - 1) printf(" ");
     }
-    printf("\n");
+    rw_flush(&rw);
 
   } else {
     // Print Rows
@@ -2756,8 +8622,12 @@ int sem_select(token_list *t_list) {
       }
     }
 
+    // A single table's rows are projected
+    for (int j = 0; (j < num_out) && !has_join; j++)
+      out_cols[j].offset = projection_offset(&proj, out_cols[j].offset);
+
     // Print Header
-    int widths[MAX_NUM_COL * 2];
+    rw_begin(&rw, g_output_mode, true);
     for (int i = 0; i < num_out; i++) {
       int w = strlen(out_cols[i].name);
       if (out_cols[i].type == T_INT) {
@@ -2767,68 +8637,74 @@ int sem_select(token_list *t_list) {
         if (w < out_cols[i].len)
           w = out_cols[i].len;
       }
-      widths[i] = w;
-      printf("%-*s ", w, out_cols[i].name);
-    }
-    printf("\n");
-    for (int i = 0; i < num_out; i++) {
-      for (int k = 0; k < widths[i]; k++)
-        putchar('-');
-      putchar(' ');
+      rw_add_column(&rw, out_cols[i].name, w, out_cols[i].type == T_INT);
     }
-    printf("\n");
+    rw_header(&rw);
 
     // Print Data
-    for (int i = 0; i < result_count; i++) {
+    bool need1 = false, need2 = false;
+    for (int j = 0; j < num_out; j++) {
+      need1 = need1 || out_cols[j].in_t1;
+      need2 = need2 || !out_cols[j].in_t1;
+    }
+    for (int i = first_out; (i < last_out) && !rc; i++) {
+      if (has_join && (rc = fetch_row(&results[i], need1, need2)))
+        break;
       for (int j = 0; j < num_out; j++) {
-        unsigned char *row = results[i].data;
-        if (!out_cols[j].in_t1)
-          row += h1.record_size;
-
-        int off = out_cols[j].offset;
-        unsigned char len = row[off++];
-
-        if (out_cols[j].type == T_INT) {
-          if (len == 0)
-            printf("%-*s ", widths[j], "NULL");
-          else {
-            int val;
-            memcpy(&val, row + off, 4);
-            printf("%*d ", widths[j], val);
-          }
-        } else {
-          if (len == 0)
-            printf("%-*s ", widths[j], "NULL");
-          else {
-            printf("%-*.*s ", widths[j], (int)len, (char *)(row + off));
-          }
-        }
+        unsigned char *row = !has_join ? results[i].data : out_cols[j].in_t1 ? buf1 : buf2;
+        rw_field(&rw, row + out_cols[j].offset, out_cols[j].type == T_INT);
       }
-      printf("\n");
     }
-    printf("\n %d record(s) selected.\n\n", result_count);
+    rw_finish(&rw, rows_out);
   }
+  plan_charge(output_node, &mark);
 
   // Cleanup
-  for (int i = 0; i < result_count; i++)
+  for (int i = 0; i < result_count; i++) {
     free(results[i].data);
+    free(results[i].key);
+  }
   free(results);
+  free(candidate_key);
+  free(groups);
+  free(group_entry);
   free(buf1);
   if (buf2)
     free(buf2);
-  fclose(f1);
-  if (f2)
-    fclose(f2);
+  free(proj_buf);
+  free(inner_rows);
+  free(inner_bloom.blocks);
+  if (chain.num_tables > 0)
+    free(chain.rows);
+  else
+    tab_close(&t1);
+  if (t2.fp)
+    tab_close(&t2);
 
   return rc;
 }
 
+int sem_show_stats(token_list *t_list) {
+  if (t_list->tok_value != EOC) {
+    t_list->tok_value = INVALID;
+    return INVALID_STATEMENT;
+  }
+  printf("\n");
+  print_stats(stdout);
+  print_qcache_totals(stdout);
+  return 0;
+}
+
 int initialize_tpd_list() {
   int rc = 0;
   FILE *fhandle = NULL;
   //	struct _stat file_stat;
   struct stat file_stat;
 
+  /* Reloading replaces any catalog already in memory */
+  free(g_tpd_list);
+  g_tpd_list = NULL;
+
   /* Open for read */
   if ((fhandle = fopen("dbfile.bin", "rbc")) == NULL) {
     if ((fhandle = fopen("dbfile.bin", "wbc")) == NULL) {
@@ -2841,7 +8717,7 @@ int initialize_tpd_list() {
         rc = MEMORY_ERROR;
       } else {
         g_tpd_list->list_size = sizeof(tpd_list);
-        fwrite(g_tpd_list, sizeof(tpd_list), 1, fhandle);
+        db_fwrite(g_tpd_list, sizeof(tpd_list), 1, fhandle);
         fflush(fhandle);
         fclose(fhandle);
       }
@@ -2857,7 +8733,7 @@ int initialize_tpd_list() {
     if (!g_tpd_list) {
       rc = MEMORY_ERROR;
     } else {
-      fread(g_tpd_list, file_stat.st_size, 1, fhandle);
+      db_fread(g_tpd_list, file_stat.st_size, 1, fhandle);
       fflush(fhandle);
       fclose(fhandle);
 
@@ -2878,21 +8754,22 @@ int add_tpd_to_list(tpd_entry *tpd) {
   if ((fhandle = fopen("dbfile.bin", "wbc")) == NULL) {
     rc = FILE_OPEN_ERROR;
   } else {
+    STAT_ADD(catalog_rewrites, 1);
     old_size = g_tpd_list->list_size;
 
     if (g_tpd_list->num_tables == 0) {
       /* If this is an empty list, overlap the dummy header */
       g_tpd_list->num_tables++;
       g_tpd_list->list_size += (tpd->tpd_size - sizeof(tpd_entry));
-      fwrite(g_tpd_list, old_size - sizeof(tpd_entry), 1, fhandle);
+      db_fwrite(g_tpd_list, old_size - sizeof(tpd_entry), 1, fhandle);
     } else {
       /* There is at least 1, just append at the end */
       g_tpd_list->num_tables++;
       g_tpd_list->list_size += tpd->tpd_size;
-      fwrite(g_tpd_list, old_size, 1, fhandle);
+      db_fwrite(g_tpd_list, old_size, 1, fhandle);
     }
 
-    fwrite(tpd, tpd->tpd_size, 1, fhandle);
+    db_fwrite(tpd, tpd->tpd_size, 1, fhandle);
     fflush(fhandle);
     fclose(fhandle);
   }
@@ -2918,6 +8795,7 @@ int drop_tpd_from_list(char *tabname) {
         if ((fhandle = fopen("dbfile.bin", "wbc")) == NULL) {
           rc = FILE_OPEN_ERROR;
         } else {
+          STAT_ADD(catalog_rewrites, 1);
           old_size = g_tpd_list->list_size;
 
           if (count == 0) {
@@ -2928,17 +8806,17 @@ int drop_tpd_from_list(char *tabname) {
               /* This is the last table, null out dummy header */
               memset((void *)g_tpd_list, '\0', sizeof(tpd_list));
               g_tpd_list->list_size = sizeof(tpd_list);
-              fwrite(g_tpd_list, sizeof(tpd_list), 1, fhandle);
+              db_fwrite(g_tpd_list, sizeof(tpd_list), 1, fhandle);
             } else {
               /* First in list, but not the last one */
               g_tpd_list->list_size -= cur->tpd_size;
 
               /* First, write the 8 byte header */
-              fwrite(g_tpd_list, sizeof(tpd_list) - sizeof(tpd_entry), 1,
+              db_fwrite(g_tpd_list, sizeof(tpd_list) - sizeof(tpd_entry), 1,
                      fhandle);
 
               /* Now write everything starting after the cur entry */
-              fwrite((char *)cur + cur->tpd_size,
+              db_fwrite((char *)cur + cur->tpd_size,
                      old_size - cur->tpd_size -
                          (sizeof(tpd_list) - sizeof(tpd_entry)),
                      1, fhandle);
@@ -2949,7 +8827,7 @@ int drop_tpd_from_list(char *tabname) {
             g_tpd_list->list_size -= cur->tpd_size;
 
             /* First, write everything from beginning to cur */
-            fwrite(g_tpd_list, ((char *)cur - (char *)g_tpd_list), 1, fhandle);
+            db_fwrite(g_tpd_list, ((char *)cur - (char *)g_tpd_list), 1, fhandle);
 
             /* Check if cur is the last entry. Note that g_tdp_list->list_size
                has already subtracted the cur->tpd_size, therefore it will
@@ -2960,7 +8838,7 @@ int drop_tpd_from_list(char *tabname) {
               /* NOT the last entry, copy everything from the beginning of the
                  next entry which is (cur + cur->tpd_size) and the remaining
                  size */
-              fwrite((char *)cur + cur->tpd_size,
+              db_fwrite((char *)cur + cur->tpd_size,
                      old_size - cur->tpd_size -
                          ((char *)cur - (char *)g_tpd_list),
                      1, fhandle);
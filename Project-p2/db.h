@@ -3,12 +3,13 @@ db.h - This file contains all the structures, defines, and function
         prototype for the db.exe program.
 *********************************************************************/
 #include <stdint.h>
+#include <stdio.h>
 
 #define MAX_IDENT_LEN 16
 #define MAX_NUM_COL 16
 #define MAX_TOK_LEN 32
 #define KEYWORD_OFFSET 10
-#define STRING_BREAK " (),<>="
+#define STRING_BREAK " (),<>=."
 #define NUMBER_BREAK " ),"
 #define MAX_ROWS 100
 
@@ -21,6 +22,36 @@ typedef struct table_file_header_def {
   int64_t tpd_ptr;          // 8 bytes (MUST be 0 on disk)
 } table_file_header;
 
+/* table_file_header.file_header_flag bits */
+#define TAB_FLAG_SLOTTED 0x1    /* slotted pages; VARCHAR stored at its length */
+#define TAB_FLAG_COMPRESSED 0x2 /* slotted pages stored as compressed frames */
+#define TAB_FLAG_DIRECT 0x4     /* O_DIRECT access; records start DIRECT_IO_ALIGN in */
+
+/* O_DIRECT transfers need the buffer, file offset and length aligned to
+   the device's logical block size */
+#define DIRECT_IO_ALIGN 4096
+
+/* Slotted page layout (tables with VARCHAR columns).  The page header and
+   slot array grow up from the start of the page, record data grows down
+   from the end.  Pages follow the table_file_header back to back. */
+typedef struct slotted_page_header_def {
+  uint16_t num_slots;
+  uint16_t data_start; // offset of the lowest record byte in the page
+} slotted_page_header;
+
+typedef struct slot_entry_def {
+  uint16_t offset;   // record offset within the page
+  uint16_t length;   // encoded record length
+  uint16_t capacity; // bytes reserved at offset, for in-place updates
+} slot_entry;
+
+/* In a compressed table every page is stored as a frame: this header
+   followed by comp_len bytes.  comp_len == page size means the page did
+   not compress and is stored as is. */
+typedef struct page_frame_header_def {
+  uint32_t comp_len;
+} page_frame_header;
+
 /* Column descriptor sturcture = 20+4+4+4+4 = 36 bytes */
 typedef struct cd_entry_def {
   char col_name[MAX_IDENT_LEN + 4];
@@ -41,6 +72,11 @@ typedef struct tpd_entry_def {
   int tpd_flags;
 } tpd_entry;
 
+/* tpd_entry.tpd_flags bits */
+#define TPD_FLAG_COMPRESSED 0x1 /* CREATE TABLE ... COMPRESS */
+#define TPD_FLAG_DIRECT 0x2     /* CREATE TABLE ... DIRECT */
+#define TPD_FLAG_VIEW 0x4       /* CREATE MATERIALIZED VIEW, defined in <name>.mv */
+
 /* Table packed descriptor list = 4+4+4+36 = 48 bytes.  When no
    table is defined the tpd_list is 48 bytes.  When there is
          at least 1 table, then the tpd_entry (36 bytes) will be
@@ -52,6 +88,187 @@ typedef struct tpd_list_def {
   tpd_entry tpd_start;
 } tpd_list;
 
+/* Materialized views.  The rows are an ordinary table in the catalog;
+   <name>.mv holds the SELECT and, for an aggregate view, a state record
+   per group: the GROUP BY values, the group's row count, and a running
+   sum and non-NULL count for each aggregate.  INSERT, DELETE and UPDATE
+   on a base table run the view's SELECT over just the changed rows and
+   fold the result into the view. */
+#define MV_MAGIC 0x3130564d  // "MV01"
+#define MV_MAX_SQL 1024
+#define MV_MAX_TABLES 4
+
+typedef enum mv_kind_def {
+  MV_ROWS = 0,  // no aggregates: changed rows are added to or removed from the view
+  MV_AGG,       // SUM/COUNT/AVG with optional GROUP BY: group states are adjusted
+  MV_REFRESH    // anything else (HAVING, ORDER BY, LIMIT, self-join): REFRESH only
+} mv_kind;
+
+typedef struct mv_file_header_def {
+  int32_t magic;
+  int32_t sql_len;     // the SELECT text follows the header
+  int32_t num_groups;  // then the group states
+  int32_t group_size;
+} mv_file_header;
+
+typedef struct mv_item_def {
+  int func;                     // F_SUM, F_AVG or F_COUNT; 0 for a column
+  char col[MAX_IDENT_LEN + 1];  // "*" for COUNT(*)
+} mv_item;
+
+typedef struct mv_def_def {
+  char name[MAX_IDENT_LEN + 1];
+  char sql[MV_MAX_SQL];       // the view's SELECT
+  char from_sql[MV_MAX_SQL];  // its FROM and WHERE clauses
+  int kind;
+  bool star;
+  int num_items;
+  mv_item items[MAX_NUM_COL];
+  int num_tables;
+  char tables[MV_MAX_TABLES][MAX_IDENT_LEN + 1];
+  int num_group;
+  char group[MAX_NUM_COL][MAX_IDENT_LEN + 1];
+} mv_def;
+
+/* Asynchronous table I/O.  Requests go to an io_uring (driven through
+   raw syscalls) or, where that is unavailable, to a small pool of
+   pread/pwrite threads; DB_AIO=uring|threads|sync picks one.  A table
+   handle keeps read-ahead blocks of the file in flight ahead of a scan,
+   and collects contiguous data writes into a write-back run that is
+   queued as one request.  Queued writes are waited for before the
+   header is written, before the file is cut, before an overlapping
+   read or write, and on close. */
+#define AIO_QUEUE_DEPTH 64
+#define AIO_POOL_THREADS 4
+#define AIO_RUN_SIZE (64 << 10)  // write-back run
+#define AIO_READ_AHEAD 8          // read-ahead slots per table
+#define AIO_MAX_WRITES 16  // queued writes per table before they are drained
+
+typedef enum aio_engine_def {
+  AIO_SYNC = 0,  // pread/pwrite in the caller
+  AIO_THREADS,
+  AIO_URING
+} aio_engine;
+
+typedef struct aio_req_def {
+  int fd;
+  bool write;
+  unsigned char *buf;
+  int len;
+  long offset;
+  int result;                // bytes moved, or -errno
+  bool done;
+  struct aio_req_def *next;  // thread pool queue
+} aio_req;
+
+/* Read-ahead.  DB_READ_BLOCK=<KB> sets the block size.  A sequential scan
+   starts two blocks deep (the one it is in plus the next), doubles the
+   distance each time it catches up with a read still in flight, and
+   backs off by one when reads finish a whole window ahead of it.  A jump
+   drops read-ahead until the scan is sequential again.  Blocks are
+   direct mapped: the block at file offset off lives in slot
+   (off / block size) % AIO_READ_AHEAD. */
+#define READ_BLOCK_MIN (64 << 10)
+#define READ_BLOCK_DEFAULT (1 << 20)
+#define READ_BLOCK_MAX (4 << 20)
+
+typedef struct aio_block_def {
+  aio_req req;
+  bool used;    // req.offset holds a block, read or in flight
+  int valid;    // bytes of the block in the file, once read
+  int cap;      // size of req.buf
+} aio_block;
+
+/* Open table handle.  The executor always sees rows in the fixed
+   in-memory layout (length byte + fixed payload per column); the handle
+   maps them onto the table's on-disk format. */
+typedef struct tab_handle_def {
+  FILE *fp;
+  table_file_header hdr;
+  tpd_entry *tpd;
+  cd_entry *cols;
+  int plan_node;         // EXPLAIN node charged for the reads
+  /* slotted format only */
+  int page_size;
+  int num_pages;
+  unsigned char *page;   // page cache (one page)
+  int page_no;           // page held in the cache, -1 for none
+  int page_first_row;    // row index of the cached page's slot 0
+  bool page_dirty;
+  int *page_dir;         // first row of each page, built on demand
+  unsigned char *scratch; // one encoded record
+  /* compressed format only */
+  long *frame_pos;          // file offset of each frame, plus the end
+  int num_frames;           // frames currently on disk
+  unsigned char **pending;  // pages written but not yet compressed to disk
+  int pending_cap;
+  bool frames_dirty;
+  unsigned char *frame;     // one compressed frame
+  /* asynchronous I/O on fileno(fp) */
+  int fd;
+  int direct_fd;            // O_DIRECT descriptor, -1 when not in use
+  bool direct_ok;           // cleared if the file system refuses O_DIRECT
+  long file_end;            // bytes in the file, counting queued writes
+  aio_block *blocks;        // AIO_READ_AHEAD read-ahead blocks
+  long read_block;          // block of the last read, -1 for none
+  int read_ahead;           // blocks read ahead of read_block
+  unsigned char *run;       // write-back run, not yet queued
+  long run_offset;
+  int run_len;
+  aio_req *writes[AIO_MAX_WRITES];  // queued writes, buffers owned
+  int num_writes;
+} tab_handle;
+
+/* Result cache (qcache.bin).  DB_RESULT_CACHE=<KB> turns it on and caps
+   the bytes of cached entries.  An entry holds the SELECT output keyed on
+   the normalized statement text, and the version of every table the
+   statement names.  INSERT, UPDATE, DELETE and DROP TABLE bump the
+   table's version whenever the file exists, cache on or not, so an entry
+   for an older version never hits again.  File layout: the header, the
+   table versions, then the entries.  All access holds flock(). */
+#define QCACHE_FILE "qcache.bin"
+#define QCACHE_MAGIC 0x31484351  // "QCH1"
+#define QCACHE_MAX_ENTRIES 256
+#define QCACHE_MAX_DEPS 8        // tables one statement may name
+#define QCACHE_MAX_KEY 1024
+
+typedef struct qcache_file_header_def {
+  int32_t magic;
+  int32_t num_tables;   // qcache_version records that follow
+  int32_t num_entries;
+  int32_t pad;
+  int64_t clock;        // LRU clock, advanced by every hit and store
+  int64_t hits;         // over every process that used the file
+  int64_t misses;
+} qcache_file_header;
+
+typedef struct qcache_version_def {
+  char table_name[MAX_IDENT_LEN + 4];
+  int32_t pad;
+  int64_t version;
+} qcache_version;
+
+/* Followed by the key and the result, padded to 8 bytes */
+typedef struct qcache_entry_def {
+  int64_t last_used;    // clock value of the last hit
+  uint32_t hash;        // of the key
+  int32_t key_len;
+  int32_t result_len;
+  int32_t num_deps;
+  qcache_version deps[QCACHE_MAX_DEPS];  // versions the result was built from
+} qcache_entry;
+
+/* qcache.bin in memory: the entries point into data or at new entries */
+typedef struct qcache_view_def {
+  unsigned char *data;
+  qcache_file_header hdr;
+  qcache_version *tables;
+  int num_tables;
+  qcache_entry *entries[QCACHE_MAX_ENTRIES + 1];
+  long entry_pos[QCACHE_MAX_ENTRIES + 1];  // file offset, -1 for a new one
+  int num_entries;
+} qcache_view;
+
 /* This token_list definition is used for breaking the command
    string into separate tokens in function get_tokens().  For
          each token, a new token_list will be allocated and linked
@@ -72,6 +289,7 @@ typedef struct aggregate_func_def {
 /* Helper structure for SELECT statement column selection */
 typedef struct select_column_def {
   char name[MAX_IDENT_LEN + 1];
+  int agg_index;  // index into the aggregates for SUM(x) etc., else -1
 } select_column;
 
 /* Helper structure for WHERE clause conditions */
@@ -84,6 +302,376 @@ typedef struct query_condition_def {
   int logical_operator;  // K_AND, K_OR, or 0 for last condition
 } query_condition;
 
+/* Worker threads for the parallel operators: DB_THREADS of them at most
+   (default: one per online CPU), each given at least DB_PARALLEL_ROWS
+   rows.  Unset, DB_PARALLEL_ROWS is PARALLEL_ROWS_DEFAULT or a
+   PARALLEL_ROWS_CAP_SHARE of the row cap, whichever is smaller, so a
+   full table is split even under the MAX_ROWS limit. */
+#define MAX_THREADS 64
+#define PARALLEL_ROWS_DEFAULT 1024
+#define PARALLEL_ROWS_CAP_SHARE 4
+
+/* Task scheduler.  The calling thread is worker 0 and DB_THREADS - 1
+   pool threads, started on first use, are the others; DB_PIN_THREADS=1
+   pins each pool thread to a core.  Every worker owns a deque: it pushes
+   and pops its own tasks at the bottom, and a worker that runs out
+   steals the oldest task of another.  A task group counts its unfinished
+   tasks, and the thread waiting for it runs queued tasks meanwhile.
+   Morsel-driven work hands out fixed-size record ranges (DB_MORSEL_ROWS)
+   to whichever worker asks next, so ranges that filter out more rows do
+   not hold the others up. */
+#define SCHED_DEQUE_SIZE 256
+#define MORSEL_ROWS_DEFAULT 16384
+
+struct task_group_def;
+
+typedef struct sched_task_def {
+  void (*fn)(void *arg, int index);
+  void *arg;
+  int index;
+  struct task_group_def *group;
+} sched_task;
+
+typedef struct task_group_def {
+  int pending;  // tasks spawned and not yet finished
+} task_group;
+
+typedef struct sched_deque_def {
+  int lock;                // spin lock
+  long top, bottom;        // tasks[top % size] .. tasks[(bottom - 1) % size]
+  sched_task tasks[SCHED_DEQUE_SIZE];
+} sched_deque;
+
+typedef struct morsel_run_def {
+  void (*fn)(void *arg, long first, long end, int worker);
+  void *arg;
+  long num_rows;
+  long morsel_rows;
+  long next;    // next morsel to hand out
+} morsel_run;
+
+/* Parallel DELETE and UPDATE of a fixed-format table.  Morsels of
+   records go to the scheduler's workers, which read and write them with
+   pread/pwrite on the table's descriptor.  UPDATE rewrites matching
+   records in place.  DELETE works a window of records at a time: every
+   morsel of the window is read and its kept records packed, then each
+   morsel's kept records are written where those of the morsels before
+   it end.  The header is written once, at the end. */
+#define DML_WINDOW_BYTES (16 << 20)  // records a DELETE round reads
+#define DML_MORSEL_BYTES (1 << 20)   // records in one morsel, at most
+
+typedef struct dml_where_def {
+  bool has_where;
+  int offset;            // of the column's length byte
+  int col_type;
+  int operator_type;
+  int value_type;        // INT_LITERAL or STRING_LITERAL
+  int int_value;
+  const char *str_value;
+  bool prefix_compare;   // DELETE compares only the stored characters
+} dml_where;
+
+typedef struct dml_set_def {
+  int offset;            // of the column's length byte
+  int col_type;
+  int col_len;
+  int value_type;        // INT_LITERAL, STRING_LITERAL or K_NULL
+  int int_value;
+  const char *str_value;
+} dml_set;
+
+typedef struct parallel_dml_def {
+  int fd;
+  const table_file_header *hdr;
+  const dml_where *where;
+  const dml_set *set;        // NULL for DELETE
+  long morsel_rows;
+  int first_row;             // DELETE: the window
+  unsigned char *window;     // and its records
+  int *kept;                 // records kept of each morsel
+  int *dest;                 // and the row they move to
+  unsigned char *bufs[MAX_THREADS];  // UPDATE: one morsel per worker
+  int matched[MAX_THREADS];  // per worker
+  int rc[MAX_THREADS];
+} parallel_dml;
+
+/* Scan kernels.  A WHERE condition is bound once per query to the offset
+   of its field and to a comparison instantiated for the column type and
+   operator; how the predicates combine picks the loop that runs them.
+   NATURAL JOIN keys are bound the same way. */
+#define MAX_SCAN_PREDS 10
+
+struct scan_pred_def;
+typedef bool (*scan_pred_fn)(const unsigned char *field, const struct scan_pred_def *pred);
+
+typedef struct scan_pred_def {
+  scan_pred_fn fn;
+  int side;               // row holding the field: 0 first table, 1 joined table
+  int offset;             // of the field's length byte
+  int int_value;
+  int str_len;
+  const char *str_value;  // the query_condition's literal
+  int logical_operator;   // K_AND, K_OR, or 0 for the last predicate
+} scan_pred;
+
+typedef enum scan_shape_def {
+  SCAN_ALL = 0,  // no WHERE
+  SCAN_ONE,      // a single predicate
+  SCAN_AND,      // ANDs only: stops at the first miss
+  SCAN_OR,       // ORs only: stops at the first hit
+  SCAN_CHAIN     // mixed, folded left to right
+} scan_shape;
+
+typedef struct scan_filter_def {
+  int shape;
+  int num_preds;
+  scan_pred preds[MAX_SCAN_PREDS];
+} scan_filter;
+
+/* Projected result row of a single-table SELECT: just the columns the
+   query prints, sorts or aggregates, packed in table order.  Columns
+   that sit next to each other in both rows copy as one run.  No runs
+   means every column is kept and rows are stored whole. */
+typedef struct row_projection_def {
+  int num_runs;
+  int src[MAX_NUM_COL];  // run start in the table row
+  int dst[MAX_NUM_COL];  // and in the projected row
+  int len[MAX_NUM_COL];
+  int row_size;
+} row_projection;
+
+typedef enum join_shape_def {
+  JOIN_CROSS = 0,  // no common columns
+  JOIN_INT1,       // one INT key
+  JOIN_INT,        // INT keys only
+  JOIN_MIXED,      // some CHAR/VARCHAR key
+  JOIN_THETA       // JOIN ... ON a.x < b.y: one comparison, any operator
+} join_shape;
+
+/* Blocked Bloom filter over NATURAL JOIN keys: a key's hash picks one
+   cache-line block and sets four bits inside it */
+#define BLOOM_BLOCK_BITS 512
+#define BLOOM_BITS_PER_KEY 10
+
+typedef struct join_bloom_def {
+  uint64_t *blocks;  // BLOOM_BLOCK_BITS / 64 words per block
+  uint32_t mask;     // block count - 1
+} join_bloom;
+
+typedef struct join_keys_def {
+  int shape;
+  int num_keys;
+  int offset1[MAX_NUM_COL];  // length byte of each key in the first table's row
+  int offset2[MAX_NUM_COL];  // and in the joined table's
+  bool is_int[MAX_NUM_COL];
+  int op;                    // JOIN_THETA: how offset1[0] compares to offset2[0]
+} join_keys;
+
+/* Block nested-loop join, for joins with no equality to hash or filter
+   on: DB_JOIN_BLOCK=<KB> of table1 rows are held at a time and table2 is
+   read once per block */
+#define JOIN_BLOCK_DEFAULT (1 << 20)
+
+/* NATURAL JOIN of three or more tables.  The tables are joined in the
+   order join_chain_plan picks, but every intermediate row already has
+   the final layout (each column once, in FROM order), so a step only
+   fills in the new table's columns. */
+#define MAX_JOIN_TABLES 8
+
+typedef struct join_chain_def {
+  int num_tables;  // 0 for one table or a two-table join
+  char tables[MAX_JOIN_TABLES][MAX_IDENT_LEN + 1];
+  tpd_entry *tpd[MAX_JOIN_TABLES];
+  int col_map[MAX_JOIN_TABLES][MAX_NUM_COL];  // schema column of each table column
+  int num_records[MAX_JOIN_TABLES];           // from the table headers
+  scan_filter filter[MAX_JOIN_TABLES];        // WHERE conditions applied at the scan
+  int num_pushed[MAX_JOIN_TABLES];
+  int order[MAX_JOIN_TABLES];                 // tables in join order
+  double est_rows[MAX_JOIN_TABLES];           // estimated rows after each step
+  int step_node[MAX_JOIN_TABLES];             // EXPLAIN nodes, by step
+  int scan_node[MAX_JOIN_TABLES];
+  tpd_entry schema;                           // the joined row; its columns follow
+  cd_entry schema_cols[MAX_NUM_COL];
+  int record_size;
+  unsigned char *rows;                        // the join result, record_size each
+  int num_rows;
+} join_chain;
+
+/* Parallel NATURAL JOIN.  Both tables are radix-partitioned on the key
+   hash so one partition of table2 fits in cache; worker threads then
+   join whole partitions, each into its own buffer of row-number pairs,
+   and the buffers are merged back into nested-loop order.  Each
+   partition is hashed on whichever table has fewer rows in it.  Joins of
+   fewer than DB_PARALLEL_ROWS rows in all start as the Bloom-filtered
+   nested loop, and move the rest of table1 to the partitioned join once
+   the table2 rows the loop has read pass JOIN_ADAPT_FACTOR times the
+   rows of both tables (DB_ADAPTIVE=0 keeps the loop). */
+#define JOIN_PARTITION_BYTES (256 << 10)  // table2 bytes per partition
+#define MAX_RADIX_BITS 10
+#define JOIN_ADAPT_FACTOR 4
+
+typedef struct join_part_entry_def {
+  uint32_t hash;  // low half of join_key_hash; the high half picked the partition
+  int row;
+} join_part_entry;
+
+typedef struct join_pairs_def {
+  int *pairs;  // row of table1, row of table2, ...
+  long num_pairs, capacity;
+  long joined;  // pairs with equal keys, before WHERE
+  int swapped;  // partitions hashed on table1's rows, the smaller side
+  int rc;
+} join_pairs;
+
+typedef struct parallel_join_def {
+  const join_keys *keys;
+  const scan_filter *filter;
+  const unsigned char *rows[2];     // each table, loaded whole
+  int record_size[2];
+  int num_rows[2];
+  int num_threads;
+  int radix_bits;
+  int *counts[2];                   // rows per thread and partition
+  join_part_entry *parts[2];        // the rows, grouped by partition
+  int *starts[2];                   // partition p is [starts[p], starts[p + 1])
+  int next_part;                    // next partition to claim
+  join_pairs out[MAX_THREADS];
+  int swapped;                      // partitions hashed on table1's rows
+} parallel_join;
+
+/* Helper structure for HAVING conditions.  The left side is an aggregate
+   or one of the GROUP BY columns. */
+typedef struct having_condition_def {
+  int agg_index;         // aggregate compared, or -1
+  int group_index;       // GROUP BY column compared, or -1
+  int operator_type;     // S_EQUAL, S_LESS, ...
+  int value_type;        // INT_LITERAL or STRING_LITERAL
+  int int_value;
+  char str_value[256];
+  int logical_operator;  // K_AND, K_OR, or 0 for last condition
+} having_condition;
+
+/* Helper structure for ORDER BY columns */
+typedef struct order_column_def {
+  char name[MAX_IDENT_LEN + 1];
+  bool desc;
+  bool nulls_first;  // defaults to NULL sorting as the smallest value
+} order_column;
+
+/* ORDER BY sorts normalized keys.  Each column becomes a NULL byte and a
+   fixed-width image whose byte order is the sort order (INTs big-endian
+   with the sign bit flipped, strings zero-padded, DESC images inverted);
+   the row's arrival number follows, so keys are unique and one memcmp
+   orders two rows. */
+#define SORT_SEQ_BYTES 8
+
+typedef struct sort_key_col_def {
+  int side;          // 0 for the first table's row, 1 for the joined table's
+  int offset;        // of the field's length byte within the row
+  int type;
+  int len;           // image bytes in the key
+  bool desc;
+  bool nulls_first;
+} sort_key_col;
+
+/* Parallel ORDER BY: each thread radix sorts one run of the keys, then
+   splitter keys cut every run into one key range per thread, and each
+   thread merges its range of all the runs straight into place */
+typedef struct parallel_sort_def {
+  const unsigned char *keys;
+  int key_len;
+  int n;
+  int num_threads;
+  int *runs;    // key numbers; run r is [n * r / T, n * (r + 1) / T), sorted
+  int *bounds;  // run r's part of range t: [bounds[r * (T + 1) + t], ... + t + 1])
+  int *order;   // the merged key numbers
+  int rc[MAX_THREADS];
+} parallel_sort;
+
+/* Hash aggregation state for GROUP BY.  Every group is one fixed-size
+   entry in an open-addressing table: the hash, the group key (the field
+   images of the GROUP BY columns), then a sum and a count per aggregate.
+   Once the table reaches its memory budget, rows of groups that are not
+   already in it are written as partial entries to partition files, which
+   are aggregated one at a time afterwards. */
+#define AGG_PARTITIONS 8
+#define AGG_MAX_LEVEL 6           // deeper partitions ignore the budget
+#define AGG_MEM_BUDGET (4 << 20)  // default, DB_AGG_MEM overrides
+
+typedef struct agg_state_def {
+  long long sum;
+  long long count;
+} agg_state;
+
+typedef struct group_agg_def {
+  int key_len;
+  int num_aggs;
+  int entry_size;
+  int capacity;           // slots, a power of two
+  int max_capacity;       // most slots the budget allows
+  int count;              // groups in the table
+  unsigned char *slots;
+  int level;              // partitioning depth; picks the hash bits used
+  FILE *part[AGG_PARTITIONS];
+  long long spilled;      // entries written to partition files
+} group_agg;
+
+/* Helper structure for EXPLAIN / EXPLAIN ANALYZE.  Each operator of the
+   chosen plan is one node; depth gives the indentation in the printed
+   tree.  The counters are only filled in by EXPLAIN ANALYZE, and the
+   time is the operator's own (exclusive) time. */
+typedef struct plan_node_def {
+  char op_name[24];     // SeqScan, Filter, NestedLoopJoin, Sort, ...
+  char detail[128];     // table name, predicate, sort key, ...
+  int depth;
+  long long rows_in;
+  long long rows_out;
+  long long time_ns;
+  long long pages_read;
+  long long bytes_read;
+  long long allocs;
+  long last_page;       // page the operator last read from
+} plan_node;
+
+#define MAX_PLAN_NODES 16
+#define DB_PAGE_SIZE 4096
+
+/* EXPLAIN modes - see do_semantic() */
+typedef enum explain_mode_def {
+  EXPLAIN_OFF = 0,
+  EXPLAIN_PLAN,    // print the plan, do not execute
+  EXPLAIN_ANALYZE  // execute and print the plan with per-operator counters
+} explain_mode;
+
+/* SELECT result formats - db -o <mode> or DB_OUTPUT=<mode> */
+typedef enum output_mode_def {
+  OUT_TABLE = 0,   // aligned columns and a record count (the default)
+  OUT_CSV,         // header line, comma separated, RFC 4180 quoting
+  OUT_TSV,         // header line, tab separated, \t \n \\ escaped
+  OUT_JSON,        // one JSON object per row
+  OUT_RAW          // per field: the length byte and the stored payload
+} output_mode;
+
+/* Result writer for SELECT.  Fields are formatted straight into buf with
+   a hand-rolled integer conversion and padding, and the buffer goes out
+   with one fwrite whenever it fills.  NULL is an empty field in CSV and
+   TSV (an empty string is stored as NULL anyway). */
+#define OUT_BUF_SIZE (64 << 10)
+#define OUT_MAX_COLS (MAX_NUM_COL * 2)
+
+typedef struct result_writer_def {
+  FILE *fp;
+  int mode;
+  int num_cols;
+  int col;                        // next column of the current row
+  bool pad_last;                  // table: a space after the last column too
+  char names[OUT_MAX_COLS][MAX_IDENT_LEN + 1];
+  int widths[OUT_MAX_COLS];
+  bool numeric[OUT_MAX_COLS];     // right-justified, unquoted in JSON
+  int used;
+  char buf[OUT_BUF_SIZE];
+} result_writer;
+
 /* This enum defines the different classes of tokens for
          semantic processing. */
 typedef enum t_class {
@@ -129,10 +717,27 @@ typedef enum t_value {
   K_AND,             // 35
   K_OR,              // 36
   K_NATURAL,         // 37
-  K_JOIN,            // 38 - new keyword should be added below this line
-  F_SUM,             // 39
-  F_AVG,             // 40
-  F_COUNT,           // 41 - new function name should be added below this line
+  K_JOIN,            // 38
+  K_EXPLAIN,         // 39
+  K_ANALYZE,         // 40
+  K_SHOW,            // 41
+  K_STATS,           // 42
+  K_COMPRESS,        // 43
+  K_GROUP,           // 44
+  K_HAVING,          // 45
+  K_LIMIT,           // 46
+  K_OFFSET,          // 47
+  K_ASC,             // 48
+  K_NULLS,           // 49
+  K_DIRECT,          // 50
+  K_MATERIALIZED,    // 51
+  K_VIEW,            // 52
+  K_AS,              // 53
+  K_REFRESH,         // 54
+  K_ON,              // 55 - new keyword should be added below this line
+  F_SUM,             // 56
+  F_AVG,             // 57
+  F_COUNT,           // 58 - new function name should be added below this line
   S_LEFT_PAREN = 70, // 70
   S_RIGHT_PAREN,     // 71
   S_COMMA,           // 72
@@ -143,6 +748,7 @@ typedef enum t_value {
   S_LESS_EQUAL,      // 77
   S_GREATER_EQUAL,   // 78
   S_NOT_EQUAL,       // 79
+  S_DOT,             // 80
   IDENT = 85,        // 85
   INT_LITERAL = 90,  // 90
   STRING_LITERAL,    // 91
@@ -151,7 +757,7 @@ typedef enum t_value {
 } token_value;
 
 /* This constants must be updated when add new keywords */
-#define TOTAL_KEYWORDS_PLUS_TYPE_NAMES 32
+#define TOTAL_KEYWORDS_PLUS_TYPE_NAMES 49
 
 /* New keyword must be added in the same position/order as the enum
    definition above, otherwise the lookup will be wrong */
@@ -160,7 +766,9 @@ char *keyword_table[] = {
     "drop",   "list",    "schema", "for",    "to",     "insert", "into",
     "values", "delete",  "from",   "where",  "update", "set",    "select",
     "order",  "by",      "desc",   "is",     "and",    "or",     "natural",
-    "join",   "sum",     "avg",    "count"};
+    "join",   "explain", "analyze", "show",   "stats",  "compress", "group",
+    "having", "limit",   "offset", "asc",    "nulls",  "direct", "materialized",
+    "view",   "as",      "refresh", "on",    "sum",    "avg",    "count"};
 
 /* This enum defines a set of possible statements */
 typedef enum s_statement {
@@ -173,9 +781,52 @@ typedef enum s_statement {
   DELETE,                   // 105
   UPDATE,                   // 106
   SELECT,                   // 107
-  SELECT_STAR               // 108
+  SELECT_STAR,              // 108
+  SHOW_STATS,               // 109
+  CREATE_VIEW,              // 110
+  REFRESH_VIEW              // 111
 } semantic_statement;
 
+#define NUM_STATEMENT_TYPES (REFRESH_VIEW - CREATE_TABLE + 1)
+
+/* Hot-path instrumentation counters reported by SHOW STATS.  One block
+   per thread, summed when read. */
+typedef struct db_stats_def {
+  long long rows_scanned;     // records read from .tab files
+  long long rows_returned;    // rows produced by SELECT
+  long long records_written;  // records written to .tab files
+  long long fseek_calls;
+  long long fread_calls;
+  long long fwrite_calls;
+  long long bytes_read;
+  long long bytes_written;
+  long long header_writes;    // table_file_header rewrites
+  long long catalog_rewrites; // dbfile.bin rewrites
+  long long allocations;
+  long long aio_reads;        // asynchronous requests submitted
+  long long aio_writes;
+  long long aio_waits;        // times a request was not done when needed
+  long long direct_ios;       // requests that went through O_DIRECT
+  long long qcache_hits;      // SELECTs answered from the result cache
+  long long qcache_misses;
+  long long qcache_evictions;
+  long long bloom_probes;     // join rows checked against a Bloom filter
+  long long bloom_passed;     // and not dropped by it
+  long long join_blocks;      // table1 blocks of a block nested-loop join
+  long long join_inner_rows;  // table2 rows read for them
+  long long join_partitions;  // partitions joined by parallel NATURAL JOINs
+  long long sort_runs;        // runs sorted by parallel ORDER BYs
+  long long dml_ranges;       // morsels of parallel DELETEs and UPDATEs
+  long long tasks_run;        // scheduler tasks finished
+  long long tasks_stolen;     // taken from another worker's deque
+  long long morsels;          // record ranges of morsel-driven work
+  long long join_switches;    // nested-loop joins moved to the partitioned join
+  long long join_swaps;       // join partitions hashed on table1's rows
+  long long stmt_count[NUM_STATEMENT_TYPES];   // per sem_* function
+  long long stmt_time_ns[NUM_STATEMENT_TYPES];
+  struct db_stats_def *next;
+} db_stats;
+
 /* This enum has a list of all the errors that should be detected
    by the program.  Can append to this if necessary. */
 typedef enum error_return_codes {
@@ -193,6 +844,9 @@ typedef enum error_return_codes {
   INVALID_REPORT_FILE_NAME,  // -388
   INVALID_UPDATE_DEFINITION, // -387
   INVALID_SELECT_DEFINITION, // -386
+  INVALID_VIEW_DEFINITION,   // -385
+  VIEW_READ_ONLY,            // -384
+  TABLE_HAS_VIEW,            // -383
   /* Must add all the possible errors from I/U/D + SELECT here */
   FILE_OPEN_ERROR = -299,        // -299
   DBFILE_CORRUPTION,             // -298
@@ -207,6 +861,8 @@ typedef enum error_return_codes {
 /* Set of function prototypes */
 int get_token(char *command, token_list **tok_list);
 void add_to_list(token_list **tok_list, char *tmp, int t_class, int t_value);
+int db_execute(char *command);
+int parse_output_mode(const char *name);
 int do_semantic(token_list *tok_list);
 int sem_create_table(token_list *t_list);
 int sem_drop_table(token_list *t_list);
@@ -219,6 +875,9 @@ int sem_select_natural_join(tpd_entry *tpd1, tpd_entry *tpd2, const char *tab1,
 int sem_delete(token_list *t_list);
 int sem_update(token_list *t_list);
 int sem_select(token_list *t_list);
+int sem_show_stats(token_list *t_list);
+int sem_create_view(token_list *t_list);
+int sem_refresh_view(token_list *t_list);
 
 /*
         Keep a global list of tpd - in real life, this will be stored
@@ -0,0 +1,357 @@
+/************************************************************
+        db_bench - in-process benchmark harness for db.cpp
+
+        Builds the engine into the same program (db.cpp is
+        compiled here with DB_NO_MAIN) and drives it through
+        db_execute(), so no process is spawned per statement.
+
+        gcc -O2 -o db_bench db_bench.cpp -lstdc++
+        ./db_bench --rows 1000 --ops 200 --out bench.json
+ ************************************************************/
+
+#define DB_NO_MAIN
+#include "db.cpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Benchmark configuration, set from the command line */
+typedef struct bench_config_def {
+  int rows;        // rows loaded into bench_a (bench_b gets half)
+  int ops;         // timed operations per workload
+  int int_cols;    // extra INT payload columns
+  int char_cols;   // extra CHAR/VARCHAR payload columns
+  int char_len;    // declared length of the CHAR/VARCHAR columns
+  bool varchar;    // VARCHAR instead of CHAR payload columns
+  bool compress;   // CREATE TABLE ... COMPRESS
+  int selectivity; // percent of rows matched by range predicates
+  unsigned int seed;
+  const char *dir; // scratch directory for dbfile.bin and .tab files
+  const char *out; // JSON output file, stdout when NULL
+} bench_config;
+
+/* Latencies of one workload */
+typedef struct bench_result_def {
+  const char *name;
+  int ops;
+  int errors;
+  long long total_ns;
+  long long *latency_ns;
+} bench_result;
+
+#define MAX_WORKLOADS 16
+
+static unsigned int g_rand_state = 1;
+
+static unsigned int bench_rand() {
+  /* xorshift32 - reproducible across platforms for a given --seed */
+  g_rand_state ^= g_rand_state << 13;
+  g_rand_state ^= g_rand_state >> 17;
+  g_rand_state ^= g_rand_state << 5;
+  return g_rand_state;
+}
+
+static int compare_latency(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile_us(long long *sorted, int count, double pct) {
+  if (count == 0)
+    return 0.0;
+  int idx = (int)(pct * (count - 1) + 0.5);
+  return sorted[idx] / 1000.0;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: db_bench [--rows N] [--ops N] [--int-cols N] [--char-cols N]\n"
+          "                [--char-len N] [--varchar] [--compress] [--selectivity PCT]\n"
+          "                [--seed N] [--dir PATH] [--out FILE]\n");
+}
+
+static int parse_args(int argc, char **argv, bench_config *cfg) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "--varchar") == 0) {
+      cfg->varchar = true;
+      continue;
+    }
+    if (strcmp(arg, "--compress") == 0) {
+      cfg->compress = true;
+      continue;
+    }
+    if (val == NULL) {
+      usage();
+      return -1;
+    }
+    if (strcmp(arg, "--rows") == 0)
+      cfg->rows = atoi(val);
+    else if (strcmp(arg, "--ops") == 0)
+      cfg->ops = atoi(val);
+    else if (strcmp(arg, "--int-cols") == 0)
+      cfg->int_cols = atoi(val);
+    else if (strcmp(arg, "--char-cols") == 0)
+      cfg->char_cols = atoi(val);
+    else if (strcmp(arg, "--char-len") == 0)
+      cfg->char_len = atoi(val);
+    else if (strcmp(arg, "--selectivity") == 0)
+      cfg->selectivity = atoi(val);
+    else if (strcmp(arg, "--seed") == 0)
+      cfg->seed = (unsigned int)strtoul(val, NULL, 10);
+    else if (strcmp(arg, "--dir") == 0)
+      cfg->dir = val;
+    else if (strcmp(arg, "--out") == 0)
+      cfg->out = val;
+    else {
+      usage();
+      return -1;
+    }
+    i++;
+  }
+
+  /* k, v and g are always there, so keep the payload inside MAX_NUM_COL */
+  if ((cfg->rows <= 0) || (cfg->ops <= 0) || (cfg->int_cols < 0) ||
+      (cfg->char_cols < 0) || (cfg->int_cols + cfg->char_cols > MAX_NUM_COL - 3) ||
+      (cfg->char_len <= 0) || (cfg->char_len > 255) || (cfg->selectivity < 0) ||
+      (cfg->selectivity > 100)) {
+    usage();
+    return -1;
+  }
+  if (cfg->seed == 0)
+    cfg->seed = 1;
+  return 0;
+}
+
+/* Run one statement and record its latency */
+static void bench_exec(bench_result *res, const char *fmt, ...) {
+  char stmt[1024];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(stmt, sizeof(stmt), fmt, args);
+  va_end(args);
+
+  long long start = now_ns();
+  int rc = db_execute(stmt);
+  long long elapsed = now_ns() - start;
+
+  res->latency_ns[res->ops++] = elapsed;
+  res->total_ns += elapsed;
+  if (rc)
+    res->errors++;
+}
+
+static bench_result *new_result(bench_result *results, int *count,
+                                const char *name, int capacity) {
+  bench_result *res = &results[(*count)++];
+  memset(res, 0, sizeof(*res));
+  res->name = name;
+  res->latency_ns = (long long *)calloc(capacity, sizeof(long long));
+  return res;
+}
+
+/* Build "c0 char(16), c1 char(16), ..." style payload column definitions */
+static void payload_columns(const bench_config *cfg, char *buf, int size) {
+  int used = 0;
+  for (int i = 0; i < cfg->int_cols; i++)
+    used += snprintf(buf + used, size - used, ", i%d int", i);
+  for (int i = 0; i < cfg->char_cols; i++)
+    used += snprintf(buf + used, size - used, ", c%d %s(%d)", i,
+                     cfg->varchar ? "varchar" : "char", cfg->char_len);
+}
+
+/* Build the matching payload values for row k */
+static void payload_values(const bench_config *cfg, int k, char *buf, int size) {
+  int used = 0;
+  for (int i = 0; i < cfg->int_cols; i++)
+    used += snprintf(buf + used, size - used, ", %d", (int)(bench_rand() % 100000));
+  for (int i = 0; i < cfg->char_cols; i++) {
+    /* Variable length strings so VARCHAR and CHAR differ in footprint */
+    char str[256];
+    int len = 1 + (int)(bench_rand() % cfg->char_len);
+    for (int c = 0; c < len; c++)
+      str[c] = 'a' + (char)((k + c + i) % 26);
+    str[len] = '\0';
+    used += snprintf(buf + used, size - used, ", '%s'", str);
+  }
+}
+
+static void write_json(FILE *out, const bench_config *cfg,
+                       bench_result *results, int count) {
+  fprintf(out, "{\"benchmark\": \"db_bench\", \"config\": {\"rows\": %d, "
+               "\"ops\": %d, \"int_cols\": %d, \"char_cols\": %d, "
+               "\"char_len\": %d, \"varchar\": %s, \"compress\": %s, \"selectivity\": %d, "
+               "\"seed\": %u},\n \"results\": [\n",
+          cfg->rows, cfg->ops, cfg->int_cols, cfg->char_cols, cfg->char_len,
+          cfg->varchar ? "true" : "false", cfg->compress ? "true" : "false",
+          cfg->selectivity, cfg->seed);
+
+  for (int w = 0; w < count; w++) {
+    bench_result *res = &results[w];
+    qsort(res->latency_ns, res->ops, sizeof(long long), compare_latency);
+    double total_sec = res->total_ns / 1e9;
+    fprintf(out,
+            "  {\"workload\": \"%s\", \"ops\": %d, \"errors\": %d, "
+            "\"total_sec\": %.6f, \"ops_per_sec\": %.1f, \"p50_us\": %.1f, "
+            "\"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}%s\n",
+            res->name, res->ops, res->errors, total_sec,
+            (total_sec > 0) ? res->ops / total_sec : 0.0,
+            percentile_us(res->latency_ns, res->ops, 0.50),
+            percentile_us(res->latency_ns, res->ops, 0.99),
+            percentile_us(res->latency_ns, res->ops, 0.999),
+            percentile_us(res->latency_ns, res->ops, 1.0),
+            (w + 1 < count) ? "," : "");
+  }
+  /* Engine-wide counters over the whole run, for I/O amplification */
+  db_stats total;
+  db_stats_total(&total);
+  fprintf(out,
+          " ],\n \"engine\": {\"rows_scanned\": %lld, \"rows_returned\": %lld, "
+          "\"records_written\": %lld, \"fseek_calls\": %lld, "
+          "\"fread_calls\": %lld, \"fwrite_calls\": %lld, "
+          "\"bytes_read\": %lld, \"bytes_written\": %lld, "
+          "\"header_writes\": %lld, \"catalog_rewrites\": %lld, "
+          "\"allocations\": %lld}}\n",
+          total.rows_scanned, total.rows_returned, total.records_written,
+          total.fseek_calls, total.fread_calls, total.fwrite_calls,
+          total.bytes_read, total.bytes_written, total.header_writes,
+          total.catalog_rewrites, total.allocations);
+}
+
+int main(int argc, char **argv) {
+  bench_config cfg = {1000, 200, 1, 1, 16, false, false, 10, 42, "bench_data", NULL};
+  bench_result results[MAX_WORKLOADS];
+  int num_results = 0;
+  char cols[512], vals[2048];
+
+  if (parse_args(argc, argv, &cfg))
+    return 1;
+  g_rand_state = cfg.seed;
+
+  /* Open the report before moving into the scratch directory */
+  FILE *out = stdout;
+  if (cfg.out && (out = fopen(cfg.out, "w")) == NULL) {
+    fprintf(stderr, "db_bench: cannot open %s\n", cfg.out);
+    return 1;
+  }
+
+  /* Work in a scratch directory so an existing dbfile.bin is untouched */
+  mkdir(cfg.dir, 0755);
+  if (chdir(cfg.dir) != 0) {
+    fprintf(stderr, "db_bench: cannot use directory %s\n", cfg.dir);
+    return 1;
+  }
+  remove("dbfile.bin");
+  remove("bench_a.tab");
+  remove("bench_b.tab");
+
+  /* The engine reports through stdout; keep it for the JSON only */
+  fflush(stdout);
+  int json_fd = dup(fileno(stdout));
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, fileno(stdout));
+  close(null_fd);
+
+  g_trace_tokens = false;
+  g_max_rows = cfg.rows + cfg.ops;
+  if (initialize_tpd_list()) {
+    fprintf(stderr, "db_bench: cannot initialize dbfile.bin\n");
+    return 1;
+  }
+
+  /* Schema: k is a unique key, v is uniform in [0, 1000) for range
+     predicates, g has 10 distinct values for grouping */
+  payload_columns(&cfg, cols, sizeof(cols));
+  bench_result setup = {0};
+  long long setup_latency[2];
+  setup.latency_ns = setup_latency;
+  const char *opts = cfg.compress ? " COMPRESS" : "";
+  bench_exec(&setup, "CREATE TABLE bench_a (k int, v int, g int%s)%s", cols, opts);
+  bench_exec(&setup, "CREATE TABLE bench_b (k int, w int)%s", opts);
+  if (setup.errors) {
+    fprintf(stderr, "db_bench: cannot create the benchmark tables\n");
+    return 1;
+  }
+
+  int range_limit = cfg.selectivity * 10;
+
+  bench_result *res = new_result(results, &num_results, "insert", cfg.rows);
+  for (int k = 0; k < cfg.rows; k++) {
+    payload_values(&cfg, k, vals, sizeof(vals));
+    bench_exec(res, "INSERT INTO bench_a VALUES (%d, %d, %d%s)", k,
+               (int)(bench_rand() % 1000), k % 10, vals);
+  }
+
+  /* bench_b matches every other key of bench_a; load it untimed */
+  bench_result load = {0};
+  load.latency_ns = (long long *)calloc(cfg.rows, sizeof(long long));
+  for (int k = 0; k < cfg.rows; k += 2)
+    bench_exec(&load, "INSERT INTO bench_b VALUES (%d, %d)", k, k * 3);
+  free(load.latency_ns);
+
+  res = new_result(results, &num_results, "point_lookup", cfg.ops);
+  for (int i = 0; i < cfg.ops; i++)
+    bench_exec(res, "SELECT * FROM bench_a WHERE k = %d",
+               (int)(bench_rand() % cfg.rows));
+
+  res = new_result(results, &num_results, "range_scan", cfg.ops);
+  for (int i = 0; i < cfg.ops; i++)
+    bench_exec(res, "SELECT k, v FROM bench_a WHERE v < %d", range_limit);
+
+  res = new_result(results, &num_results, "update", cfg.ops);
+  for (int i = 0; i < cfg.ops; i++)
+    bench_exec(res, "UPDATE bench_a SET v = %d WHERE k = %d",
+               (int)(bench_rand() % 1000), (int)(bench_rand() % cfg.rows));
+
+  /* Joins and sorts are far more expensive per statement */
+  int heavy_ops = (cfg.ops >= 10) ? cfg.ops / 10 : 1;
+
+  res = new_result(results, &num_results, "natural_join", heavy_ops);
+  for (int i = 0; i < heavy_ops; i++)
+    bench_exec(res, "SELECT k, v, w FROM bench_a NATURAL JOIN bench_b "
+                    "WHERE v < %d", range_limit);
+
+  res = new_result(results, &num_results, "order_by", heavy_ops);
+  for (int i = 0; i < heavy_ops; i++)
+    bench_exec(res, "SELECT k, v FROM bench_a WHERE v < %d ORDER BY v DESC",
+               range_limit);
+
+  res = new_result(results, &num_results, "order_by_multi", heavy_ops);
+  for (int i = 0; i < heavy_ops; i++)
+    bench_exec(res, "SELECT k, v, g FROM bench_a WHERE v < %d "
+                    "ORDER BY g, v DESC, k", range_limit);
+
+  res = new_result(results, &num_results, "top_n", heavy_ops);
+  for (int i = 0; i < heavy_ops; i++)
+    bench_exec(res, "SELECT k, v FROM bench_a ORDER BY v DESC LIMIT 10");
+
+  res = new_result(results, &num_results, "aggregate", cfg.ops);
+  for (int i = 0; i < cfg.ops; i++)
+    bench_exec(res, "SELECT SUM(v), AVG(v), COUNT(*) FROM bench_a WHERE v < %d",
+               range_limit);
+
+  res = new_result(results, &num_results, "group_by", cfg.ops);
+  for (int i = 0; i < cfg.ops; i++)
+    bench_exec(res, "SELECT g, COUNT(*), SUM(v) FROM bench_a WHERE v < %d "
+                    "GROUP BY g", range_limit);
+
+  res = new_result(results, &num_results, "delete", cfg.ops);
+  for (int i = 0; i < cfg.ops; i++)
+    bench_exec(res, "DELETE FROM bench_a WHERE k = %d",
+               (int)(bench_rand() % cfg.rows));
+
+  /* Restore stdout and report */
+  fflush(stdout);
+  dup2(json_fd, fileno(stdout));
+  close(json_fd);
+
+  write_json(out, &cfg, results, num_results);
+  if (out != stdout)
+    fclose(out);
+
+  for (int w = 0; w < num_results; w++)
+    free(results[w].latency_ns);
+  return 0;
+}